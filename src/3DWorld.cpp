@@ -48,6 +48,7 @@ int const START_MODE       = WMODE_GROUND; // 0 = standard mesh, 1 = planet/univ
 
 
 char const *const defaults_file  = "defaults.txt";
+char const *const sim_bench_file = "defaults_sim_bench.txt"; // headless city simulation benchmark
 char const *const dstate_file    = "state.txt";
 char const *const dmesh_file     = "mesh.txt";
 char const *const dcoll_obj_file = "coll_objs/coll_objs.txt";
@@ -74,7 +75,11 @@ bool enable_model3d_custom_mipmaps(1), flatten_tt_mesh_under_models(0), show_map
 bool enable_dpart_shadows(0), enable_tt_model_reflect(1), enable_tt_model_indir(0), auto_calc_tt_model_zvals(0), use_model_lod_blocks(0), enable_translocator(0), enable_grass_fire(0);
 bool disable_model_textures(0), start_in_inf_terrain(0), allow_shader_invariants(1), config_unlimited_weapons(0), disable_tt_water_reflect(0), allow_model3d_quads(1);
 bool enable_timing_profiler(0), fast_transparent_spheres(0), force_ref_cmap_update(0), use_instanced_pine_trees(0), enable_postproc_recolor(0), draw_building_interiors(0);
-bool toggle_room_light(0), merge_model_objects(0), display_frame_time(0), reverse_3ds_vert_winding_order(1), disable_dlights(0);
+bool toggle_room_light(0), merge_model_objects(0), display_frame_time(0), reverse_3ds_vert_winding_order(1), disable_dlights(0), refit_dynamic_cobj_tree(1);
+bool cobj_tree_sah_build(0), rt_task_stealing(1), compress_lighting_files(0), use_model3d_cache(0), parallel_obj_reader(1), benchmark_obj_reader(0);
+bool benchmark_cpu_noise(0), async_tile_gen(1), deterministic_erosion(0), benchmark_erosion(0), benchmark_watershed(0), benchmark_voxel_brush(0);
+bool sparse_voxel_models(0), parallel_model_tex_load(1), mipmap_gamma_correct(0), use_texture_cache(0);
+bool texture_cache_warm_only(0), benchmark_leaf_wind(0);
 int xoff(0), yoff(0), xoff2(0), yoff2(0), rand_gen_index(0), mesh_rgen_index(0), camera_change(1), camera_in_air(0), auto_time_adv(0);
 int animate(1), animate2(1), draw_model(0), init_x(STARTING_INIT_X), fire_key(0), do_run(0), init_num_balls(-1), change_wmode_frame(0);
 int game_mode(0), map_mode(0), load_hmv(0), load_coll_objs(1), read_landscape(0), screen_reset(0), mesh_seed(0), rgen_seed(1);
@@ -92,9 +97,9 @@ int enable_fsource(0), run_forward(0), advanced(0), dynamic_mesh_scroll(0);
 int read_snow_file(0), write_snow_file(0), mesh_detail_tex(NOISE_TEX);
 int read_light_files[NUM_LIGHTING_TYPES] = {0}, write_light_files[NUM_LIGHTING_TYPES] = {0};
 unsigned num_snowflakes(0), create_voxel_landscape(0), hmap_filter_width(0), num_dynam_parts(100), snow_coverage_resolution(2), num_birds_per_tile(2), num_fish_per_tile(15);
-unsigned erosion_iters(0), erosion_iters_tt(0), video_framerate(60), num_video_threads(0), skybox_tid(0);
+unsigned erosion_iters(0), erosion_iters_tt(0), erosion_tile_size(0), voxel_quant_bits(0), hmap_tile_cache_mb(256), video_framerate(60), num_video_threads(0), skybox_tid(0), cobj_tree_bench_max_objs(0);
 float NEAR_CLIP(DEF_NEAR_CLIP), FAR_CLIP(DEF_FAR_CLIP), system_max_orbit(1.0), sky_occlude_scale(0.0), tree_slope_thresh(5.0), mouse_sensitivity(1.0), tt_grass_scale_factor(1.0);
-float water_plane_z(0.0), base_gravity(1.0), crater_depth(1.0), crater_radius(1.0), disabled_mesh_z(FAR_CLIP), vegetation(1.0), atmosphere(1.0), biome_x_offset(0.0);
+float water_plane_z(0.0), base_gravity(1.0), crater_depth(1.0), crater_radius(1.0), disabled_mesh_z(FAR_CLIP), vegetation(1.0), atmosphere(1.0), biome_x_offset(0.0), mipmap_alpha_coverage(0.0);
 float mesh_file_scale(1.0), mesh_file_tz(0.0), speed_mult(1.0), mesh_z_cutoff(-FAR_CLIP), relh_adj_tex(0.0), dodgeball_metalness(1.0), ray_step_size_mult(1.0);
 float water_h_off(0.0), water_h_off_rel(0.0), perspective_fovy(0.0), perspective_nclip(0.0), read_mesh_zmm(0.0), indir_light_exp(1.0), cloud_height_offset(0.0);
 float snow_depth(0.0), snow_random(0.0), cobj_z_bias(DEF_Z_BIAS), init_temperature(DEF_TEMPERATURE), indir_vert_offset(0.25), sm_tree_density(1.0), fog_dist_scale(1.0);
@@ -106,7 +111,7 @@ float model_hemi_lighting_scale(0.5), pine_tree_radius_scale(1.0);
 float light_int_scale[NUM_LIGHTING_TYPES] = {1.0, 1.0, 1.0, 1.0, 1.0}, first_ray_weight[NUM_LIGHTING_TYPES] = {1.0, 1.0, 1.0, 1.0, 1.0};
 double camera_zh(0.0);
 point mesh_origin(all_zeros), camera_pos(all_zeros), cube_map_center(all_zeros);
-string user_text, cobjs_out_fn, sphere_materials_fn, hmap_out_fn, skybox_cube_map_name, coll_damage_name;
+string user_text, cobjs_out_fn, sphere_materials_fn, hmap_out_fn, hmap_tile_fn, skybox_cube_map_name, coll_damage_name, texture_cache_dir("texture_cache");
 colorRGB ambient_lighting_scale(1,1,1), mesh_color_scale(1,1,1);
 colorRGBA bkg_color, flower_color(ALPHA0);
 set<unsigned char> keys, keyset;
@@ -126,7 +131,7 @@ extern bool clear_landscape_vbo, use_dense_voxels, tree_4th_branches, model_calc
 extern int camera_flight, DISABLE_WATER, DISABLE_SCENERY, camera_invincible, onscreen_display, mesh_freq_filter, show_waypoints, last_inventory_frame;
 extern int tree_coll_level, GLACIATE, UNLIMITED_WEAPONS, destroy_thresh, MAX_RUN_DIST, mesh_gen_mode, mesh_gen_shape, map_drag_x, map_drag_y;
 extern unsigned NPTS, NRAYS, LOCAL_RAYS, GLOBAL_RAYS, DYNAMIC_RAYS, NUM_THREADS, MAX_RAY_BOUNCES, grass_density, max_unique_trees, shadow_map_sz;
-extern unsigned scene_smap_vbo_invalid, spheres_mode, max_cube_map_tex_sz, DL_GRID_BS;
+extern unsigned scene_smap_vbo_invalid, spheres_mode, max_cube_map_tex_sz, DL_GRID_BS, tile_cache_max_mb;
 extern float fticks, team_damage, self_damage, player_damage, smiley_damage, smiley_speed, tree_deadness, tree_dead_prob, lm_dz_adj, nleaves_scale, flower_density, universe_ambient_scale;
 extern float mesh_scale, tree_scale, mesh_height_scale, smiley_acc, hmv_scale, last_temp, grass_length, grass_width, branch_radius_scale, tree_height_scale, planet_update_rate;
 extern float MESH_START_MAG, MESH_START_FREQ, MESH_MAG_MULT, MESH_FREQ_MULT, def_tex_aniso;
@@ -135,7 +140,7 @@ extern point hmv_pos, camera_last_pos;
 extern colorRGBA sunlight_color;
 extern int coll_id[];
 extern float tree_lod_scales[4];
-extern string read_hmap_modmap_fn, write_hmap_modmap_fn, read_voxel_brush_fn, write_voxel_brush_fn, font_texture_atlas_fn;
+extern string read_hmap_modmap_fn, write_hmap_modmap_fn, tile_cache_dir, read_voxel_brush_fn, write_voxel_brush_fn, font_texture_atlas_fn;
 extern vector<bbox> team_starts;
 extern player_state *sstates;
 extern pt_line_drawer obj_pld;
@@ -1621,6 +1626,24 @@ int load_config(string const &config_file) {
 	kwmb.add("use_dense_voxels", use_dense_voxels);
 	kwmb.add("use_voxel_cobjs", use_voxel_cobjs);
 	kwmb.add("mt_cobj_tree_build", mt_cobj_tree_build);
+	kwmb.add("refit_dynamic_cobj_tree", refit_dynamic_cobj_tree);
+	kwmb.add("cobj_tree_sah_build", cobj_tree_sah_build);
+	kwmb.add("rt_task_stealing", rt_task_stealing);
+	kwmb.add("compress_lighting_files", compress_lighting_files);
+	kwmb.add("use_model3d_cache", use_model3d_cache);
+	kwmb.add("parallel_obj_reader", parallel_obj_reader);
+	kwmb.add("benchmark_obj_reader", benchmark_obj_reader);
+	kwmb.add("benchmark_cpu_noise", benchmark_cpu_noise);
+	kwmb.add("async_tile_gen", async_tile_gen);
+	kwmb.add("deterministic_erosion", deterministic_erosion);
+	kwmb.add("benchmark_erosion", benchmark_erosion);
+	kwmb.add("benchmark_watershed", benchmark_watershed);
+	kwmb.add("benchmark_voxel_brush", benchmark_voxel_brush);
+	kwmb.add("benchmark_leaf_wind", benchmark_leaf_wind);
+	kwmb.add("sparse_voxel_models", sparse_voxel_models);
+	kwmb.add("parallel_model_tex_load", parallel_model_tex_load);
+	kwmb.add("mipmap_gamma_correct", mipmap_gamma_correct);
+	kwmb.add("use_texture_cache", use_texture_cache);
 	kwmb.add("global_lighting_update", global_lighting_update);
 	kwmb.add("lighting_update_offline", lighting_update_offline);
 	kwmb.add("two_sided_lighting", two_sided_lighting);
@@ -1731,6 +1754,10 @@ int load_config(string const &config_file) {
 	kwmu.add("hmap_filter_width", hmap_filter_width);
 	kwmu.add("erosion_iters", erosion_iters);
 	kwmu.add("erosion_iters_tt", erosion_iters_tt);
+	kwmu.add("erosion_tile_size", erosion_tile_size);
+	kwmu.add("voxel_quant_bits", voxel_quant_bits);
+	kwmu.add("heightmap_tile_cache_mb", hmap_tile_cache_mb);
+	kwmu.add("tile_cache_max_mb", tile_cache_max_mb);
 	kwmu.add("num_dynam_parts", num_dynam_parts);
 	kwmu.add("num_birds_per_tile", num_birds_per_tile);
 	kwmu.add("num_fish_per_tile", num_fish_per_tile);
@@ -1739,6 +1766,7 @@ int load_config(string const &config_file) {
 	kwmu.add("dlight_grid_bitshift", DL_GRID_BS);
 	kwmu.add("video_framerate", video_framerate);
 	kwmu.add("num_video_threads", num_video_threads);
+	kwmu.add("cobj_tree_bench_max_objs", cobj_tree_bench_max_objs);
 
 	kw_to_val_map_t<float> kwmf(error);
 	kwmf.add("gravity", base_gravity);
@@ -1746,6 +1774,7 @@ int load_config(string const &config_file) {
 	kwmf.add("mesh_scale", mesh_scale);
 	kwmf.add("mesh_z_cutoff", mesh_z_cutoff);
 	kwmf.add("disabled_mesh_z", disabled_mesh_z);
+	kwmf.add("mipmap_alpha_coverage", mipmap_alpha_coverage);
 	kwmf.add("relh_adj_tex", relh_adj_tex);
 	kwmf.add("set_czmax", czmax);
 	kwmf.add("camera_radius", CAMERA_RADIUS);
@@ -1837,11 +1866,14 @@ int load_config(string const &config_file) {
 	kwms.add("coll_damage_name",   coll_damage_name);
 	kwms.add("read_hmap_modmap_filename",  read_hmap_modmap_fn);
 	kwms.add("write_hmap_modmap_filename", write_hmap_modmap_fn);
+	kwms.add("tile_cache_dir", tile_cache_dir);
 	kwms.add("read_voxel_brush_filename",  read_voxel_brush_fn);
 	kwms.add("write_voxel_brush_filename", write_voxel_brush_fn);
 	kwms.add("font_texture_atlas_fn", font_texture_atlas_fn);
 	kwms.add("sphere_materials_fn", sphere_materials_fn);
 	kwms.add("write_heightmap_png", hmap_out_fn);
+	kwms.add("heightmap_tile_file", hmap_tile_fn);
+	kwms.add("texture_cache_dir", texture_cache_dir);
 	kwms.add("skybox_cube_map", skybox_cube_map_name);
 
 	while (read_str(fp, strc)) { // slow but should be OK: these ones require special handling
@@ -2109,6 +2141,7 @@ int load_config(string const &config_file) {
 		if (error) {cout << "Parse error in config file." << endl; break;}
 	} // while read
 	if (universe_only && disable_universe) {cout << "Error: universe_only and disable_universe are mutually exclusive" << endl; error = 1;}
+	if (voxel_quant_bits != 0 && voxel_quant_bits != 8 && voxel_quant_bits != 16) {cout << "Error: voxel_quant_bits must be 0, 8, or 16" << endl; error = 1;}
 	checked_fclose(fp);
 	temperature    = init_temperature;
 	num_dodgeballs = max(num_dodgeballs, 1); // have to have at least 1
@@ -2187,7 +2220,9 @@ void init_debug_callback() {
 int main(int argc, char** argv) {
 
 	cout << "Starting 3DWorld" << endl;
-	if (argc == 2) {read_ueventlist(argv[1]);}
+	bool const sim_bench(argc == 2 && string(argv[1]) == "-sim_bench"); // headless city simulation benchmark
+	bool const warm_tex_cache((argc == 2 || argc == 3) && string(argv[1]) == "-warm_tex_cache"); // headless texture cache generation: [config file]
+	if (argc == 2 && !sim_bench && !warm_tex_cache) {read_ueventlist(argv[1]);}
 	int rs(1);
 	if      (srand_param == 1) {rs = GET_TIME_MS();}
 	else if (srand_param != 0) {rs = srand_param;}
@@ -2195,8 +2230,10 @@ int main(int argc, char** argv) {
 	create_sin_table();
 	set_scene_constants();
 	load_texture_names(); // needs to be before config file load
-	load_top_level_config(defaults_file);
+	load_top_level_config(sim_bench ? sim_bench_file : ((warm_tex_cache && argc == 3) ? argv[2] : defaults_file));
 	gen_gauss_rand_arr(); // after reading seed from config file
+	if (sim_bench) {return (run_city_sim_benchmark() ? 0 : 1);} // no window or GL context
+	if (warm_tex_cache) {return (warm_texture_cache() ? 0 : 1);} // no window or GL context
 	cout << "Loading."; cout.flush();
 	
  	// Initialize GLUT
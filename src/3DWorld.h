@@ -1005,7 +1005,11 @@ public:
 	void copy_alpha_from_texture(texture_t const &at, bool alpha_in_red_comp);
 	void merge_in_alpha_channel(texture_t const &at);
 	void build_mipmaps();
+	void build_custom_mipmaps();
+	bool use_alpha_coverage() const;
+	float get_base_alpha_coverage() const;
 	void create_custom_mipmaps();
+	void scale_data(unsigned char const *src, int w, int h, unsigned char *dest, int new_w, int new_h) const;
 	unsigned char const *get_mipmap_data(unsigned level) const;
 	void set_to_color(colorRGBA const &c);
 	void maybe_assign_normal_map_tid(int nm_tid) {if (nm_tid >= 0 && bump_tid < 0) {bump_tid = nm_tid;}}
@@ -1023,6 +1027,9 @@ public:
 	void load_tiff(int index, bool allow_diff_width_height, bool allow_two_byte_grayscale);
 	void load_dds(int index);
 	void load_ppm(int index, bool allow_diff_width_height);
+	uint64_t get_cache_hash(unsigned stage, texture_t const *alpha_tex=nullptr, bool is_bump=0) const;
+	bool read_from_cache(uint64_t hash);
+	bool write_to_cache(uint64_t hash) const;
 	void auto_insert_alpha_channel(int index);
 	void fill_transparent_with_avg_color();
 	void do_invert_y();
@@ -8,6 +8,11 @@
 #include "gl_ext_arb.h"
 #include "shaders.h"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#define USE_SSE_MIPMAPS
+#include <immintrin.h>
+#endif
+
 
 float const TEXTURE_SMOOTH        = 0.01;
 float const SPHERE_SECTION        = 0.75;
@@ -199,11 +204,11 @@ float def_tex_aniso(2.0);
 unsigned char *landscape0 = NULL;
 
 
-extern bool mesh_difuse_tex_comp, water_is_lava, invert_bump_maps;
+extern bool mesh_difuse_tex_comp, water_is_lava, invert_bump_maps, mipmap_gamma_correct;
 extern unsigned smoke_tid, dl_tid, elem_tid, gb_tid, reflection_tid, room_mirror_ref_tid, depth_tid, empty_smap_tid, frame_buffer_RGB_tid, skybox_tid, skybox_cube_tid, univ_reflection_tid;
 extern int world_mode, read_landscape, default_ground_tex, xoff2, yoff2, DISABLE_WATER;
 extern int scrolling, dx_scroll, dy_scroll, display_mode, iticks, universe_only, window_width, window_height;
-extern float zmax, zmin, glaciate_exp, relh_adj_tex, vegetation, fticks;
+extern float zmax, zmin, glaciate_exp, relh_adj_tex, vegetation, fticks, mipmap_alpha_coverage;
 extern char *mesh_diffuse_tex_fn;
 
 
@@ -258,21 +263,29 @@ void set_landscape_texture_from_file() {
 }
 
 
-void load_textures() {
+void load_texture_files() { // CPU only, so this can also be used to warm the texture cache without a GL context
 
-	timer_t timer("Texture Load");
-	cout << "loading textures"; cout.flush();
 	if (using_custom_landscape_texture()) {set_landscape_texture_from_file();} // must be done first
 	load_texture_names();
 
 #pragma omp parallel for schedule(dynamic)
 	for (int i = 0; i < (int)textures.size(); ++i) {
 		//cout << "."; cout.flush();
-		if (!is_tex_disabled(i)) {textures[i].load(i, 0, 0, 1);} // ignore word alignment here, since resizing isn't thread safe
-	}
-	for (int i = 0; i < (int)textures.size(); ++i) {
-		if (!is_tex_disabled(i)) {textures[i].fix_word_alignment();}
+		if (is_tex_disabled(i)) continue;
+		texture_t &t(textures[i]);
+		uint64_t const cache_hash(t.get_cache_hash(0)); // zero if not enabled or not cacheable
+		if (cache_hash != 0 && t.read_from_cache(cache_hash)) continue;
+		t.load(i, 0, 0, 1);
+		t.fix_word_alignment(); // resizing is thread safe since it doesn't use GL
+		if (cache_hash != 0) {t.write_to_cache(cache_hash);}
 	}
+}
+
+void load_textures() {
+
+	timer_t timer("Texture Load");
+	cout << "loading textures"; cout.flush();
+	load_texture_files();
 	cout << " done" << endl;
 	textures[BULLET_D_TEX].merge_in_alpha_channel(textures[BULLET_A_TEX]);
 	gen_smoke_texture();
@@ -615,6 +628,202 @@ void texture_t::merge_in_alpha_channel(texture_t const &at) {
 }
 
 
+// GL-free replacement for gluScaleImage() on tightly packed data: each output texel is the area weighted average of the input texels it covers
+template<typename T> void scale_image_box_filter(T const *src, int w, int h, T *dest, int new_w, int new_h, int ncomp) {
+
+	assert(ncomp >= 1 && ncomp <= 4);
+	float const sx(float(w)/new_w), sy(float(h)/new_h);
+
+	for (int y = 0; y < new_h; ++y) {
+		float const y1(y*sy), y2((y+1)*sy);
+		int const yb((int)y1), ye(min(h, (int)ceil(y2)));
+
+		for (int x = 0; x < new_w; ++x) {
+			float const x1(x*sx), x2((x+1)*sx);
+			int const xb((int)x1), xe(min(w, (int)ceil(x2)));
+			float sum[4] = {0.0}, wsum(0.0);
+
+			for (int yy = yb; yy < ye; ++yy) {
+				float const wy(min(y2, yy+1.0f) - max(y1, float(yy)));
+
+				for (int xx = xb; xx < xe; ++xx) {
+					float const wt(wy*(min(x2, xx+1.0f) - max(x1, float(xx))));
+					T const *const s(src + ncomp*(yy*w + xx));
+					for (int c = 0; c < ncomp; ++c) {sum[c] += wt*s[c];}
+					wsum += wt;
+				}
+			}
+			assert(wsum > 0.0);
+			for (int c = 0; c < ncomp; ++c) {dest[ncomp*(y*new_w + x) + c] = T(sum[c]/wsum + 0.5f);}
+		} // for x
+	} // for y
+}
+
+void texture_t::scale_data(unsigned char const *src, int w, int h, unsigned char *dest, int new_w, int new_h) const { // thread safe
+
+	if (is_16_bit_gray) {scale_image_box_filter((unsigned short const *)src, w, h, (unsigned short *)dest, new_w, new_h, 1);}
+	else {scale_image_box_filter(src, w, h, dest, new_w, new_h, ncolors);}
+}
+
+
+// ************ mipmap generation ************
+
+// one 2x2 downsampling step from a w1 x h1 level to a w2 x h2 level, where w2 = max(w1/2, 1) and h2 = max(h1/2, 1)
+struct mipmap_level_t {
+	unsigned char const *src;
+	unsigned char *dest;
+	unsigned w1, h1, w2, h2, ncomp; // ncomp is per pixel, in units of 8 or 16 bits
+	bool is_16_bit;
+
+	mipmap_level_t(unsigned char const *src_, unsigned char *dest_, unsigned w, unsigned h, unsigned ncomp_, bool is_16_bit_) :
+		src(src_), dest(dest_), w1(max(w, 1U)), h1(max(h, 1U)), w2(max(w>>1, 1U)), h2(max(h>>1, 1U)), ncomp(ncomp_), is_16_bit(is_16_bit_) {}
+	unsigned xinc() const {return ((w2 < w1) ? ncomp : 0);} // offset to the second source pixel in X, in components
+	unsigned yinc() const {return ((h2 < h1) ? ncomp*w1 : 0);} // offset to the second source row, in components
+	bool is_full_2x2() const {return (w2 < w1 && h2 < h1);}
+	bool parallel() const {return (w2*h2 >= 65536);} // only worth using multiple threads for large levels
+};
+
+struct srgb_lut_t { // for gamma correct filtering of 8-bit sRGB color components
+	float to_linear[256];
+	unsigned char to_srgb[4096];
+
+	srgb_lut_t() {
+		for (unsigned i = 0; i < 256; ++i) {
+			float const c(i/255.0f);
+			to_linear[i] = ((c <= 0.04045f) ? c/12.92f : pow((c + 0.055f)/1.055f, 2.4f));
+		}
+		for (unsigned i = 0; i < 4096; ++i) {
+			float const l(i/4095.0f), s((l <= 0.0031308f) ? 12.92f*l : (1.055f*pow(l, 1.0f/2.4f) - 0.055f));
+			to_srgb[i] = (unsigned char)min(255.0f, (255.0f*s + 0.5f));
+		}
+	}
+	unsigned char from_linear(float l) const {return to_srgb[max(0, min(4095, int(4095.0f*l + 0.5f)))];}
+};
+srgb_lut_t const &get_srgb_lut() {static srgb_lut_t const lut; return lut;} // thread safe init
+
+template<typename T> void downsample_row_box(mipmap_level_t const &L, unsigned y, unsigned x_start) { // scalar, rounded 2x2 average
+
+	T const *const s((T const *)L.src);
+	T *const d((T *)L.dest);
+	unsigned const nc(L.ncomp), xinc(L.xinc()), yinc(L.yinc());
+
+	for (unsigned x = x_start; x < L.w2; ++x) {
+		unsigned const ix1(nc*(y*L.w2 + x)), ix2(nc*((y<<1)*L.w1 + (x<<1)));
+		for (unsigned c = 0; c < nc; ++c) {d[ix1+c] = T(((unsigned)s[ix2+c] + s[ix2+xinc+c] + s[ix2+yinc+c] + s[ix2+yinc+xinc+c] + 2) >> 2);}
+	}
+}
+
+void downsample_row_box_gamma(mipmap_level_t const &L, unsigned y) { // 8-bit RGB or RGBA; alpha is filtered linearly
+
+	srgb_lut_t const &lut(get_srgb_lut());
+	unsigned const nc(L.ncomp), xinc(L.xinc()), yinc(L.yinc());
+
+	for (unsigned x = 0; x < L.w2; ++x) {
+		unsigned const ix1(nc*(y*L.w2 + x)), ix2(nc*((y<<1)*L.w1 + (x<<1)));
+		unsigned char const *const s(L.src);
+		UNROLL_3X(L.dest[ix1+i_] = lut.from_linear(0.25f*(lut.to_linear[s[ix2+i_]] + lut.to_linear[s[ix2+xinc+i_]] + lut.to_linear[s[ix2+yinc+i_]] + lut.to_linear[s[ix2+yinc+xinc+i_]]));)
+		if (nc == 4) {L.dest[ix1+3] = (unsigned char)(((unsigned)s[ix2+3] + s[ix2+xinc+3] + s[ix2+yinc+3] + s[ix2+yinc+xinc+3] + 2) >> 2);}
+	}
+}
+
+#ifdef USE_SSE_MIPMAPS
+// SSE2 2x2 box filter kernels for full 2x2 downsampling; each returns the first output pixel in the row that wasn't processed
+unsigned downsample_row_sse_8bit(mipmap_level_t const &L, unsigned y) {
+
+	unsigned char const *const r0(L.src + L.ncomp*(2*y)*L.w1), *const r1(r0 + L.ncomp*L.w1);
+	unsigned char *const d(L.dest + L.ncomp*y*L.w2);
+	__m128i const zero(_mm_setzero_si128()), two(_mm_set1_epi16(2));
+	unsigned x(0);
+
+	if (L.ncomp == 4) { // RGBA: 4 source pixels => 2 output pixels
+		for (; x+2 <= L.w2; x += 2) {
+			__m128i const a(_mm_loadu_si128((__m128i const *)(r0 + 8*x))), b(_mm_loadu_si128((__m128i const *)(r1 + 8*x)));
+			__m128i const lo(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero))); // column sums of source pixels 0 and 1
+			__m128i const hi(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero))); // column sums of source pixels 2 and 3
+			__m128i const sum(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi))); // {p0+p1, p2+p3}
+			__m128i const avg(_mm_srli_epi16(_mm_add_epi16(sum, two), 2));
+			_mm_storel_epi64((__m128i *)(d + 4*x), _mm_packus_epi16(avg, avg));
+		}
+	}
+	else if (L.ncomp == 1) { // grayscale: 16 source pixels => 8 output pixels
+		__m128i const mask(_mm_set1_epi16(0x00FF));
+
+		for (; x+8 <= L.w2; x += 8) {
+			__m128i const a(_mm_loadu_si128((__m128i const *)(r0 + 2*x))), b(_mm_loadu_si128((__m128i const *)(r1 + 2*x)));
+			__m128i const sum(_mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, mask), _mm_srli_epi16(a, 8)), _mm_add_epi16(_mm_and_si128(b, mask), _mm_srli_epi16(b, 8))));
+			__m128i const avg(_mm_srli_epi16(_mm_add_epi16(sum, two), 2));
+			_mm_storel_epi64((__m128i *)(d + x), _mm_packus_epi16(avg, avg));
+		}
+	}
+	return x;
+}
+
+unsigned downsample_row_sse_16bit(mipmap_level_t const &L, unsigned y) { // 16-bit grayscale: 8 source pixels => 4 output pixels
+
+	assert(L.ncomp == 1);
+	unsigned short const *const r0((unsigned short const *)L.src + (2*y)*L.w1), *const r1(r0 + L.w1);
+	unsigned short *const d((unsigned short *)L.dest + y*L.w2);
+	__m128i const mask(_mm_set1_epi32(0xFFFF)), two(_mm_set1_epi32(2)), bias32(_mm_set1_epi32(32768)), bias16(_mm_set1_epi16(-32768));
+	unsigned x(0);
+
+	for (; x+4 <= L.w2; x += 4) {
+		__m128i const a(_mm_loadu_si128((__m128i const *)(r0 + 2*x))), b(_mm_loadu_si128((__m128i const *)(r1 + 2*x)));
+		__m128i const sum(_mm_add_epi32(_mm_add_epi32(_mm_and_si128(a, mask), _mm_srli_epi32(a, 16)), _mm_add_epi32(_mm_and_si128(b, mask), _mm_srli_epi32(b, 16))));
+		__m128i const avg(_mm_sub_epi32(_mm_srli_epi32(_mm_add_epi32(sum, two), 2), bias32)); // biased into signed 16-bit range for packing
+		__m128i const packed(_mm_xor_si128(_mm_packs_epi32(avg, avg), bias16)); // SSE2 has no unsigned 32 => 16 bit pack
+		_mm_storel_epi64((__m128i *)(d + x), packed);
+	}
+	return x;
+}
+#endif
+
+// 2x2 box filter for 1-4 component 8-bit or 1 component 16-bit data; optionally gamma correct for 8-bit color; large levels are split across threads
+void downsample_mipmap_level(mipmap_level_t const &L, bool gamma_correct) {
+
+	assert(L.ncomp >= 1 && L.ncomp <= 4);
+	assert(!L.is_16_bit || L.ncomp == 1);
+	gamma_correct &= (!L.is_16_bit && L.ncomp >= 3);
+
+#pragma omp parallel for schedule(static) if (L.parallel())
+	for (int y = 0; y < (int)L.h2; ++y) {
+		if (gamma_correct) {downsample_row_box_gamma(L, y); continue;}
+		unsigned x_start(0);
+#ifdef USE_SSE_MIPMAPS
+		if (L.is_full_2x2()) {x_start = (L.is_16_bit ? downsample_row_sse_16bit(L, y) : downsample_row_sse_8bit(L, y));}
+#endif
+		if (L.is_16_bit) {downsample_row_box<unsigned short>(L, y, x_start);} else {downsample_row_box<unsigned char>(L, y, x_start);} // remainder
+	}
+}
+
+unsigned get_alpha_coverage(unsigned char const *data, unsigned npixels, float alpha_scale, unsigned thresh) { // number of RGBA pixels with scaled alpha above thresh
+
+	unsigned count(0);
+	for (unsigned i = 0; i < npixels; ++i) {count += (alpha_scale*data[4*i+3] > thresh);}
+	return count;
+}
+
+// scale the alpha values of an RGBA mipmap level so that the fraction passing an alpha test of thresh matches that of the base level,
+// which keeps alpha tested foliage and fences from thinning out in the distance
+void preserve_alpha_coverage(unsigned char *data, unsigned npixels, float target_coverage, unsigned thresh) {
+
+	float lo(0.0), hi(4.0); // range of alpha scales to search
+
+	for (unsigned iter = 0; iter < 10; ++iter) { // binary search
+		float const mid(0.5f*(lo + hi));
+		if (get_alpha_coverage(data, npixels, mid, thresh) < target_coverage*npixels) {lo = mid;} else {hi = mid;}
+	}
+	float const alpha_scale(0.5f*(lo + hi));
+	for (unsigned i = 0; i < npixels; ++i) {data[4*i+3] = (unsigned char)min(255.0f, (alpha_scale*data[4*i+3] + 0.5f));}
+}
+
+bool texture_t::use_alpha_coverage() const {return (mipmap_alpha_coverage > 0.0 && ncolors == 4 && !is_16_bit_gray);}
+unsigned get_alpha_coverage_thresh() {return unsigned(255.0f*mipmap_alpha_coverage);}
+
+float texture_t::get_base_alpha_coverage() const {
+	return (use_alpha_coverage() ? get_alpha_coverage(data, num_pixels(), 1.0, get_alpha_coverage_thresh())/float(num_pixels()) : 0.0f);
+}
+
+
 void texture_t::build_mipmaps() {
 
 	if (use_mipmaps != 2) return; // not enabled
@@ -628,14 +837,16 @@ void texture_t::build_mipmaps() {
 		data_size += ncolors*tsz*tsz;
 	}
 	mm_data = new unsigned char[data_size];
-	GLenum const format(calc_format());
+	bool const gamma_correct(mipmap_gamma_correct && !normal_map);
+	float const coverage(get_base_alpha_coverage());
 
 	for (unsigned level = 0; level < mm_offsets.size(); ++level) {
 		unsigned const tsz(width >> level);
 		assert(tsz > 1);
-		int const ret(gluScaleImage(format, tsz,   tsz,   get_data_format(), get_mipmap_data(level),
-			                                tsz/2, tsz/2, get_data_format(), (mm_data + mm_offsets[level])));
-		if (ret) cout << "GLU error during mipmap image scale: " << gluErrorString(ret) << "." << endl;
+		unsigned char *const dest(mm_data + mm_offsets[level]);
+		if (tsz & 1) {scale_data(get_mipmap_data(level), tsz, tsz, dest, tsz/2, tsz/2); continue;} // not a power of 2
+		downsample_mipmap_level(mipmap_level_t(get_mipmap_data(level), dest, tsz, tsz, (is_16_bit_gray ? 1 : ncolors), is_16_bit_gray), gamma_correct);
+		if (use_alpha_coverage()) {preserve_alpha_coverage(dest, (tsz/2)*(tsz/2), coverage, get_alpha_coverage_thresh());}
 	}
 }
 
@@ -835,16 +1046,13 @@ void texture_t::add_alpha_channel() {
 }
 
 
-void texture_t::resize(int new_w, int new_h) { // Note: not thread safe
+void texture_t::resize(int new_w, int new_h) { // thread safe, as long as the texture hasn't been sent to the GPU
 
 	if (new_w == width && new_h == height) return; // already correct size
 	assert(is_allocated());
 	assert(width > 0 && height > 0 && new_w > 0 && new_h > 0);
 	unsigned char *new_data(new unsigned char[new_w*new_h*ncolors]);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // required to handle calls from from fix_word_alignment()
-	int const ret(gluScaleImage(calc_format(), width, height, get_data_format(), data, new_w, new_h, get_data_format(), new_data));
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-	if (ret) {cout << "GLU error during image scale: " << gluErrorString(ret) << "." << endl;}
+	scale_data(data, width, height, new_data, new_w, new_h);
 	free_data(); // only if size increases?
 	data   = new_data;
 	width  = new_w;
@@ -918,64 +1126,90 @@ void texture_t::make_normal_map() {
 }
 
 
-void texture_t::create_custom_mipmaps() {
+// computes custom mipmaps into mm_data on the CPU so that they can be prepared in parallel, before create_custom_mipmaps() uploads them
+void texture_t::build_custom_mipmaps() {
 
+	if (use_mipmaps != 3 && use_mipmaps != 4) return; // not enabled
+	if (!mm_offsets.empty()) {assert(mm_data); return;} // already built
+	assert(mm_data == NULL);
 	assert(is_allocated());
-	GLenum const format(calc_format());
-	unsigned const tsize(num_bytes());
-	vector<unsigned char> idata, odata;
-	idata.resize(tsize);
-	memcpy(&idata.front(), data, tsize);
+	unsigned data_size(0);
+
+	for (unsigned w = width, h = height; w > 1 || h > 1; w >>= 1, h >>= 1) {
+		mm_offsets.push_back(data_size);
+		data_size += ncolors*max(w>>1, 1U)*max(h>>1, 1U);
+	}
+	mm_data = new unsigned char[data_size];
 	color_wrapper cw; cw.set_c4(color);
+	bool const gamma_correct(mipmap_gamma_correct && !normal_map);
+	float const coverage(get_base_alpha_coverage());
+	srgb_lut_t const &lut(get_srgb_lut());
 
-	for (unsigned w = width, h = height, level = 1; w > 1 || h > 1; w >>= 1, h >>= 1, ++level) {
-		unsigned const w1(max(w,    1U)), h1(max(h,    1U));
-		unsigned const w2(max(w>>1, 1U)), h2(max(h>>1, 1U));
-		unsigned const xinc((w2 < w1) ? ncolors : 0), yinc((h2 < h1) ? ncolors*w1 : 0);
-		odata.resize(ncolors*w2*h2);
+	for (unsigned w = width, h = height, level = 0; w > 1 || h > 1; w >>= 1, h >>= 1, ++level) {
+		mipmap_level_t const L(get_mipmap_data(level), (mm_data + mm_offsets[level]), w, h, ncolors, 0);
+
+		if (ncolors != 4) { // no alpha, so this is a plain box filter
+			downsample_mipmap_level(L, gamma_correct);
+			continue;
+		}
+		unsigned const w1(L.w1), w2(L.w2), xinc(L.xinc()), yinc(L.yinc());
+		unsigned char const *const idata(L.src);
+		unsigned char *const odata(L.dest);
 
-		for (unsigned y = 0; y < h2; ++y) {
+#pragma omp parallel for schedule(static) if (L.parallel())
+		for (int y = 0; y < (int)L.h2; ++y) { // custom alpha mipmaps
 			for (unsigned x = 0; x < w2; ++x) {
 				unsigned const ix1(ncolors*(y*w2+x)), ix2(ncolors*((y<<1)*w1+(x<<1)));
+				unsigned const a1(idata[ix2+3]), a2(idata[ix2+xinc+3]), a3(idata[ix2+yinc+3]), a4(idata[ix2+yinc+xinc+3]);
+				unsigned const a_sum(a1 + a2 + a3 + a4);
 
-				if (ncolors == 1) {
-					odata[ix1] = (unsigned char)(((unsigned)idata[ix2] + idata[ix2+xinc] + idata[ix2+yinc] + idata[ix2+yinc+xinc]) >> 2);
-				}
-				else if (ncolors == 3) {
-					UNROLL_3X(odata[ix1+i_] = (unsigned char)(((unsigned)idata[ix2+i_] + idata[ix2+xinc+i_] + idata[ix2+yinc+i_] + idata[ix2+yinc+xinc+i_]) >> 2);)
-				}
-				else { // custom alpha mipmaps
-					assert(ncolors == 4);
-					unsigned const a1(idata[ix2+3]), a2(idata[ix2+xinc+3]), a3(idata[ix2+yinc+3]), a4(idata[ix2+yinc+xinc+3]);
-					unsigned const a_sum(a1 + a2 + a3 + a4);
+				if (gamma_correct) { // same as below, but with colors converted to linear space for filtering
+					float const *const tl(lut.to_linear);
 
 					if (a_sum == 0) { // fully transparent
 						if (use_mipmaps == 4) {UNROLL_3X(odata[ix1+i_] = cw.c[i_];)} // use average texture color
-						else { // color is average of all 4 values
-							UNROLL_3X(odata[ix1+i_] = (unsigned char)(((unsigned)idata[ix2+i_] + idata[ix2+xinc+i_] + idata[ix2+yinc+i_] + idata[ix2+yinc+xinc+i_]) / 4);)
-						}
-						odata[ix1+3] = 0;
+						else {UNROLL_3X(odata[ix1+i_] = lut.from_linear(0.25f*(tl[idata[ix2+i_]] + tl[idata[ix2+xinc+i_]] + tl[idata[ix2+yinc+i_]] + tl[idata[ix2+yinc+xinc+i_]]));)}
+					}
+					else {
+						float const a_cw((use_mipmaps == 4) ? (1020 - a_sum) : 0), norm(1.0f/(a_sum + a_cw));
+						UNROLL_3X(odata[ix1+i_] = lut.from_linear(norm*(a1*tl[idata[ix2+i_]] + a2*tl[idata[ix2+xinc+i_]] + a3*tl[idata[ix2+yinc+i_]] + a4*tl[idata[ix2+yinc+xinc+i_]] + a_cw*tl[cw.c[i_]]));)
 					}
-					else { // pre-multiplied and normalized colors
-						if (use_mipmaps == 4) {
-							unsigned const a_cw(1020 - a_sum); // use average texture color for transparent pixels
-							UNROLL_3X(odata[ix1+i_] = (unsigned char)((a1*idata[ix2+i_] + a2*idata[ix2+xinc+i_] + a3*idata[ix2+yinc+i_] + a4*idata[ix2+yinc+xinc+i_] + a_cw*cw.c[i_]) / 1020);)
-						}
-						else {
-							UNROLL_3X(odata[ix1+i_] = (unsigned char)((a1*idata[ix2+i_] + a2*idata[ix2+xinc+i_] + a3*idata[ix2+yinc+i_] + a4*idata[ix2+yinc+xinc+i_]) / a_sum);)
-						}
-						odata[ix1+3] = min(255U, min(max(max(a1, a2), max(a3, a4)), unsigned(mipmap_alpha_weight*a_sum)));
+				}
+				else if (a_sum == 0) { // fully transparent
+					if (use_mipmaps == 4) {UNROLL_3X(odata[ix1+i_] = cw.c[i_];)} // use average texture color
+					else { // color is average of all 4 values
+						UNROLL_3X(odata[ix1+i_] = (unsigned char)(((unsigned)idata[ix2+i_] + idata[ix2+xinc+i_] + idata[ix2+yinc+i_] + idata[ix2+yinc+xinc+i_]) / 4);)
+					}
+				}
+				else { // pre-multiplied and normalized colors
+					if (use_mipmaps == 4) {
+						unsigned const a_cw(1020 - a_sum); // use average texture color for transparent pixels
+						UNROLL_3X(odata[ix1+i_] = (unsigned char)((a1*idata[ix2+i_] + a2*idata[ix2+xinc+i_] + a3*idata[ix2+yinc+i_] + a4*idata[ix2+yinc+xinc+i_] + a_cw*cw.c[i_]) / 1020);)
+					}
+					else {
+						UNROLL_3X(odata[ix1+i_] = (unsigned char)((a1*idata[ix2+i_] + a2*idata[ix2+xinc+i_] + a3*idata[ix2+yinc+i_] + a4*idata[ix2+yinc+xinc+i_]) / a_sum);)
 					}
 				}
+				odata[ix1+3] = ((a_sum == 0) ? 0 : min(255U, min(max(max(a1, a2), max(a3, a4)), unsigned(mipmap_alpha_weight*a_sum))));
 			} // for x
 		} // for y
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // needed for mipmap levels where width*ncolors is not aligned
-		glTexImage2D(GL_TEXTURE_2D, level, calc_internal_format(), w2, h2, 0, format, get_data_format(), &odata.front());
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-		idata.swap(odata);
+		if (use_alpha_coverage()) {preserve_alpha_coverage(odata, L.w2*L.h2, coverage, get_alpha_coverage_thresh());}
 	} // for w
 }
 
+void texture_t::create_custom_mipmaps() {
+
+	build_custom_mipmaps(); // if not already built
+	GLenum const format(calc_format());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // needed for mipmap levels where width*ncolors is not aligned
+
+	for (unsigned w = width, h = height, level = 1; w > 1 || h > 1; w >>= 1, h >>= 1, ++level) {
+		glTexImage2D(GL_TEXTURE_2D, level, calc_internal_format(), max(w>>1, 1U), max(h>>1, 1U), 0, format, get_data_format(), get_mipmap_data(level));
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	free_mm_data(); // no longer needed, and will be rebuilt if the texture is uploaded again
+}
+
 
 void texture_t::load_from_gl() { // also set tid?
 
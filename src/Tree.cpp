@@ -12,6 +12,12 @@
 #include "sinf.h"
 #include "cobj_bsp_tree.h"
 #include "draw_utils.h"
+#include <chrono>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define USE_SSE_LEAF_BEND
+#include <immintrin.h>
+#endif
 
 float const BURN_RADIUS      = 0.2;
 float const BURN_DAMAGE      = 80.0;
@@ -62,7 +68,7 @@ tree_cont_t *cur_tile_trees(nullptr);
 tree_placer_t tree_placer;
 
 
-extern bool has_snow, no_sun_lpos_update, has_dl_sources, gen_tree_roots, tt_lightning_enabled, tree_indir_lighting, begin_motion, enable_grass_fire;
+extern bool has_snow, no_sun_lpos_update, has_dl_sources, gen_tree_roots, tt_lightning_enabled, tree_indir_lighting, begin_motion, enable_grass_fire, benchmark_leaf_wind;
 extern int num_trees, do_zoom, display_mode, animate2, iticks, draw_model, frame_counter;
 extern int xoff2, yoff2, rand_gen_index, game_mode, leaf_color_changed, scrolling, dx_scroll, dy_scroll, window_width, window_height;
 extern unsigned smoke_tid;
@@ -341,10 +347,42 @@ void tree_cont_t::draw_branches_and_leaves(shader_t &s, tree_lod_render_t &lod_r
 		}
 		tree_data_t::post_leaf_draw();
 
-		if (!tt_shadow_mode) {
-			int const num_to_update(to_update_leaves.size());
-	#pragma omp parallel for num_threads(max(1, min(4, num_to_update))) schedule(static) if (num_to_update > 1)
-			for (int i = 0; i < num_to_update; ++i) {to_update_leaves[i]->update_leaf_orients_wind();}
+		if (!tt_shadow_mode) {update_leaf_orients_wind();}
+	}
+}
+
+
+// batched leaf wind animation for the trees whose leaves were drawn this frame; trees are processed in parallel
+void tree_cont_t::update_leaf_orients_wind() {
+
+	if (to_update_leaves.empty()) return;
+	auto const start_time(std::chrono::high_resolution_clock::now());
+	// trees that share tree data would all compute the same leaf orients (leaf positions are relative to the tree and there's no healing),
+	// so only update one of them; this also avoids two threads writing the same leaf data
+	sort(to_update_leaves.begin(), to_update_leaves.end(), [](tree const *a, tree const *b) {return (a->get_tdata_ptr() < b->get_tdata_ptr());});
+	unsigned num_unique(0);
+
+	for (auto i = to_update_leaves.begin(); i != to_update_leaves.end(); ++i) {
+		if (num_unique > 0 && (*i)->get_tdata_ptr() == to_update_leaves[num_unique-1]->get_tdata_ptr()) {(*i)->set_leaf_orients_valid(); continue;} // updated below
+		to_update_leaves[num_unique++] = *i;
+	}
+	to_update_leaves.resize(num_unique);
+	int const num_to_update(to_update_leaves.size()), num_threads(max(1, min(omp_get_max_threads_3dw(), num_to_update)));
+	leaf_wind_scratch.resize(max((unsigned)leaf_wind_scratch.size(), (unsigned)num_threads));
+
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic) if (num_to_update > 1)
+	for (int i = 0; i < num_to_update; ++i) {to_update_leaves[i]->update_leaf_orients_wind(leaf_wind_scratch[omp_get_thread_num_3dw()]);}
+
+	if (benchmark_leaf_wind) { // print the average over every 100 updates of this container
+		leaf_wind_stats_t &ls(leaf_wind_stats);
+		ls.time_ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+		ls.num_trees += num_to_update;
+		for (int i = 0; i < num_to_update; ++i) {ls.num_leaves += to_update_leaves[i]->get_num_leaves();}
+
+		if (++ls.num_calls == 100) {
+			cout << "Leaf wind update: " << ls.num_trees/ls.num_calls << " trees, " << ls.num_leaves/ls.num_calls << " leaves, " << ls.time_ms/ls.num_calls << " ms, "
+				 << ls.num_leaves/max(ls.time_ms, 0.001) << " leaves/ms with " << num_threads << " threads" << endl;
+			ls = leaf_wind_stats_t();
 		}
 	}
 }
@@ -1195,6 +1233,78 @@ void tree_data_t::bend_leaf(unsigned i, float angle) { // Note: slow
 }
 
 
+// SoA version of bend_leaf() for a batch of leaves with increasing indices; sin and cos are evaluated with polynomials rather than
+// the sin table so that four leaves can be processed at once with SSE
+void tree_data_t::bend_leaves(unsigned const *ixs, float const *angles, unsigned num) {
+
+	if (num == 0) return;
+	unsigned const BLOCK_SZ = 64; // must be a multiple of 4
+	float dx[BLOCK_SZ], dy[BLOCK_SZ], dz[BLOCK_SZ], nx[BLOCK_SZ], ny[BLOCK_SZ], nz[BLOCK_SZ], ex[BLOCK_SZ], ey[BLOCK_SZ], ez[BLOCK_SZ], ang[BLOCK_SZ];
+
+	for (unsigned b = 0; b < num; b += BLOCK_SZ) {
+		unsigned const n(min(BLOCK_SZ, num - b));
+
+		for (unsigned i = 0; i < n; ++i) { // gather into SoA form: d = base to tip (pts[1] - pts[0]), e = pts[3] - pts[0]
+			assert(ixs[b+i] < leaves.size());
+			tree_leaf const &l(leaves[ixs[b+i]]);
+			dx[i] = l.pts[1].x - l.pts[0].x; dy[i] = l.pts[1].y - l.pts[0].y; dz[i] = l.pts[1].z - l.pts[0].z;
+			ex[i] = l.pts[3].x - l.pts[0].x; ey[i] = l.pts[3].y - l.pts[0].y; ez[i] = l.pts[3].z - l.pts[0].z;
+			nx[i] = l.norm.x; ny[i] = l.norm.y; nz[i] = l.norm.z;
+			ang[i] = angles[b+i];
+		}
+		unsigned i(0);
+#ifdef USE_SSE_LEAF_BEND
+		for (; i+4 <= n; i += 4) { // on output, d = delta to add to pts[1] and pts[2], e = new normal
+			__m128 const a(_mm_loadu_ps(ang+i)), a2(_mm_mul_ps(a, a)), one(_mm_set1_ps(1.0f));
+			// Taylor series; angles are in [-PI/2, PI/2], where the error is < 5E-6
+			__m128 s(_mm_set1_ps(1.0f/362880.0f)), c(_mm_set1_ps(-1.0f/3628800.0f));
+			s = _mm_add_ps(_mm_mul_ps(s, a2), _mm_set1_ps(-1.0f/5040.0f));
+			s = _mm_add_ps(_mm_mul_ps(s, a2), _mm_set1_ps( 1.0f/120.0f));
+			s = _mm_add_ps(_mm_mul_ps(s, a2), _mm_set1_ps(-1.0f/6.0f));
+			s = _mm_mul_ps(a, _mm_add_ps(_mm_mul_ps(s, a2), one));
+			c = _mm_add_ps(_mm_mul_ps(c, a2), _mm_set1_ps( 1.0f/40320.0f));
+			c = _mm_add_ps(_mm_mul_ps(c, a2), _mm_set1_ps(-1.0f/720.0f));
+			c = _mm_add_ps(_mm_mul_ps(c, a2), _mm_set1_ps( 1.0f/24.0f));
+			c = _mm_add_ps(_mm_mul_ps(c, a2), _mm_set1_ps(-0.5f));
+			c = _mm_add_ps(_mm_mul_ps(c, a2), one);
+			__m128 const vdx(_mm_loadu_ps(dx+i)), vdy(_mm_loadu_ps(dy+i)), vdz(_mm_loadu_ps(dz+i));
+			__m128 const mag(_mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vdx, vdx), _mm_mul_ps(vdy, vdy)), _mm_mul_ps(vdz, vdz)))), ms(_mm_mul_ps(mag, s));
+			__m128 const wx(_mm_add_ps(_mm_mul_ps(vdx, c), _mm_mul_ps(_mm_loadu_ps(nx+i), ms))); // new_dir
+			__m128 const wy(_mm_add_ps(_mm_mul_ps(vdy, c), _mm_mul_ps(_mm_loadu_ps(ny+i), ms)));
+			__m128 const wz(_mm_add_ps(_mm_mul_ps(vdz, c), _mm_mul_ps(_mm_loadu_ps(nz+i), ms)));
+			__m128 const vex(_mm_loadu_ps(ex+i)), vey(_mm_loadu_ps(ey+i)), vez(_mm_loadu_ps(ez+i));
+			__m128 const cx(_mm_sub_ps(_mm_mul_ps(wy, vez), _mm_mul_ps(wz, vey))); // cross_product(new_dir, e)
+			__m128 const cy(_mm_sub_ps(_mm_mul_ps(wz, vex), _mm_mul_ps(wx, vez)));
+			__m128 const cz(_mm_sub_ps(_mm_mul_ps(wx, vey), _mm_mul_ps(wy, vex)));
+			__m128 const cmag(_mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cy, cy)), _mm_mul_ps(cz, cz))));
+			// same as get_norm(): leave the vector unnormalized if its length is below TOLERANCE
+			__m128 const inv(_mm_or_ps(_mm_and_ps(_mm_cmpge_ps(cmag, _mm_set1_ps(TOLERANCE)), _mm_div_ps(one, cmag)), _mm_andnot_ps(_mm_cmpge_ps(cmag, _mm_set1_ps(TOLERANCE)), one)));
+			_mm_storeu_ps(dx+i, _mm_sub_ps(wx, vdx)); _mm_storeu_ps(dy+i, _mm_sub_ps(wy, vdy)); _mm_storeu_ps(dz+i, _mm_sub_ps(wz, vdz));
+			_mm_storeu_ps(ex+i, _mm_mul_ps(cx, inv)); _mm_storeu_ps(ey+i, _mm_mul_ps(cy, inv)); _mm_storeu_ps(ez+i, _mm_mul_ps(cz, inv));
+		}
+#endif
+		for (; i < n; ++i) { // scalar remainder, or all leaves if SSE is not available
+			vector3d const orig_dir(dx[i], dy[i], dz[i]), new_dir(orig_dir*cosf(ang[i]) + vector3d(nx[i], ny[i], nz[i])*(orig_dir.mag()*sinf(ang[i])));
+			vector3d const normal(cross_product(new_dir, vector3d(ex[i], ey[i], ez[i])).get_norm());
+			dx[i] = new_dir.x - orig_dir.x; dy[i] = new_dir.y - orig_dir.y; dz[i] = new_dir.z - orig_dir.z;
+			ex[i] = normal.x; ey[i] = normal.y; ez[i] = normal.z;
+		}
+		for (unsigned i = 0; i < n; ++i) { // scatter into leaf vertex data
+			unsigned const ix(ixs[b+i] << 2);
+			tree_leaf const &l(leaves[ixs[b+i]]);
+			vector3d const delta(dx[i], dy[i], dz[i]);
+			leaf_data[ix+1].v = l.pts[1] + delta;
+			leaf_data[ix+2].v = l.pts[2] + delta;
+			norm_comp nc; nc.set_norm_no_clamp(vector3d(ex[i], ey[i], ez[i])); // already normalized, no need to clamp
+			UNROLL_4X(leaf_data[i_+ix].set_norm(nc);)
+		}
+	} // for b
+	mark_leaf_changed(ixs[0]);
+	mark_leaf_changed(ixs[num-1]);
+	reset_leaves = 1;
+}
+
+
 bool tree_data_t::check_if_needs_updated() {
 
 	bool const do_update(last_update_frame < frame_counter);
@@ -1203,7 +1313,7 @@ bool tree_data_t::check_if_needs_updated() {
 }
 
 
-void tree::update_leaf_orients_wind() { // leaves move in wind (somewhat slow)
+void tree::update_leaf_orients_wind(leaf_wind_scratch_t &scratch) { // leaves move in wind
 
 	tree_data_t &td(tdata());
 	vector<tree_leaf> const &leaves(td.get_leaves());
@@ -1211,33 +1321,43 @@ void tree::update_leaf_orients_wind() { // leaves move in wind (somewhat slow)
 	rgen.set_state(frame_counter, leaves.size());
 	bool const priv_data(td_is_private());
 	bool const heal_pass(priv_data && LEAF_HEAL_RATE > 0 && world_mode == WMODE_GROUND && (rgen.rand()&7) == 0); // only update healed color every 8 frames
-	int last_xpos(0), last_ypos(0);
-	vector3d local_wind(zero_vector);
+	unsigned cell_ix(0); // index of the last used cell
+	scratch.cells.clear();
+	scratch.ixs.clear();
+	scratch.angles.clear();
 
-	for (unsigned i = 0; i < leaves.size(); ++i) { // process leaf wind and collisions
+	for (unsigned i = 0; i < leaves.size(); ++i) { // process leaf wind
 		point p0(leaves[i].pts[0]);
 		if (priv_data) {p0 += tree_center;}
 		int const xpos(get_xpos(p0.x)), ypos(get_ypos(p0.y));
 			
-		// Note: should check for similar z-value, but z is usually similar within the leaves of a single tree
-		if (i == 0 || xpos != last_xpos || ypos != last_ypos) {
-			local_wind = get_local_wind(xpos, ypos, p0.z, !priv_data); // slow
-			last_xpos  = xpos;
-			last_ypos  = ypos;
+		if (scratch.cells.empty() || scratch.cells[cell_ix].x != xpos || scratch.cells[cell_ix].y != ypos) { // leaf is in a different cell than the previous leaf
+			for (cell_ix = 0; cell_ix < scratch.cells.size(); ++cell_ix) { // leaves aren't sorted, so search the previously visited cells
+				if (scratch.cells[cell_ix].x == xpos && scratch.cells[cell_ix].y == ypos) break;
+			}
+			// Note: should check for similar z-value, but z is usually similar within the leaves of a single tree; uses the z-value of the first leaf in each cell
+			if (cell_ix == scratch.cells.size()) {scratch.cells.emplace_back(xpos, ypos, get_local_wind(xpos, ypos, p0.z, !priv_data));} // slow
 		}
+		vector3d const &local_wind(scratch.cells[cell_ix].wind);
+
 		if (local_wind != zero_vector) {
-			float const angle(PI_TWO*max(-1.0f, min(1.0f, dot_product(local_wind, leaves[i].norm)))); // not physically correct, but it looks good
-			td.bend_leaf(i, angle);
+			scratch.ixs.push_back(i);
+			scratch.angles.push_back(PI_TWO*max(-1.0f, min(1.0f, dot_product(local_wind, leaves[i].norm)))); // not physically correct, but it looks good
 		}
-		if (heal_pass && (rgen.rand()&63) == 0) { // leaf heals every 64 frames
+	} // for i
+	td.bend_leaves(scratch.ixs.data(), scratch.angles.data(), scratch.ixs.size());
+
+	if (heal_pass) {
+		for (unsigned i = 0; i < leaves.size(); ++i) { // process leaf healing
+			if ((rgen.rand()&63) != 0) continue; // leaf heals every 64 frames
 			short &lcolor(td.get_leaves()[i].lcolor); // non-const, can't use <leaves>
 
 			if (lcolor > 0 && lcolor < 1000) { // partially damaged
 				lcolor = min(1000, (lcolor + int(LEAF_HEAL_RATE*fticks)));
 				copy_color(i);
 			}
-		}
-	} // for i
+		} // for i
+	}
 	leaf_orients_valid = 1;
 }
 
@@ -10,6 +10,7 @@
 #include "openal_wrap.h"
 #ifdef _OPENMP
 #include <omp.h>
+#include <mutex>
 #endif
 
 
@@ -63,8 +64,30 @@ void add_player_ship_engine_light();
 
 #ifdef _OPENMP
 int omp_get_thread_num_3dw() {return omp_get_thread_num();} // where does this belong?
+int omp_get_max_threads_3dw() {return omp_get_max_threads();}
+
+// allow parallel loops inside the 3-thread draw/update region; calls must be paired with omp_restore_nested_3dw() so that nesting
+// isn't left enabled for the rest of the process; reference counted since cars and peds may each enable it from different threads
+std::mutex omp_nested_mutex;
+unsigned omp_nested_refs(0);
+int omp_prev_max_active_levels(1);
+
+void omp_enable_nested_3dw() {
+	std::lock_guard<std::mutex> lock(omp_nested_mutex);
+	if (omp_nested_refs++ > 0) return; // already enabled
+	omp_prev_max_active_levels = omp_get_max_active_levels();
+	if (omp_prev_max_active_levels < 2) {omp_set_max_active_levels(2);}
+}
+void omp_restore_nested_3dw() {
+	std::lock_guard<std::mutex> lock(omp_nested_mutex);
+	assert(omp_nested_refs > 0);
+	if (--omp_nested_refs == 0) {omp_set_max_active_levels(omp_prev_max_active_levels);}
+}
 #else
 int omp_get_thread_num_3dw() {return 0;}
+int omp_get_max_threads_3dw() {return 1;}
+void omp_enable_nested_3dw() {}
+void omp_restore_nested_3dw() {}
 #endif
 
 void init_universe_display() {
@@ -8,6 +8,12 @@
 #include "openal_wrap.h"
 #include "shaders.h"
 #include "gl_ext_arb.h"
+#include <climits> // for UINT_MAX
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define USE_SSE_RIPPLES
+#include <immintrin.h>
+#endif
 
 
 float    const RIPPLE_DAMP1        = 0.95;
@@ -91,7 +97,20 @@ vector<water_spring> water_springs;
 vector<water_section> wsections;
 spillover spill;
 
-extern bool using_lightmap, has_snow, fast_water_reflect, enable_clip_plane_z, begin_motion;
+// boundary edges of each valley that water can spill across, in the order they're checked by update_valleys_and_draw_spillover();
+// edges of valley v are spill_edges[spill_edge_start[v]..spill_edge_start[v+1]); must be recomputed when wminside or valleys change
+struct spill_edge_t {
+	short i, j;
+	unsigned char k; // index into spill_ijd
+	spill_edge_t(short i_, short j_, unsigned char k_) : i(i_), j(j_), k(k_) {}
+};
+vector<spill_edge_t> spill_edges;
+vector<unsigned> spill_edge_start;
+bool spill_edges_valid(0);
+
+int const spill_ijd[4][4] = {{0,1,0,1}, {0,-1,0,0}, {1,0,1,0}, {-1,0,0,0}}; // {di, dj} of the adjacent cell, {di, dj} of the cell whose height limits the spill
+
+extern bool using_lightmap, has_snow, fast_water_reflect, enable_clip_plane_z, begin_motion, benchmark_watershed;
 extern int display_mode, frame_counter, game_mode, TIMESCALE2, I_TIMESCALE2, world_mode, rand_gen_index, animate, animate2, blood_spilled;
 extern int landscape_changed, xoff2, yoff2, scrolling, dx_scroll, dy_scroll, INIT_DISABLE_WATER;
 extern float temperature, zmax, zmin, zbottom, ztop, light_factor, water_plane_z, fticks, mesh_scale, water_h_off_rel, clip_plane_z;
@@ -108,7 +127,8 @@ void compute_ripples();
 void update_valleys_and_draw_spillover();
 void update_water_volumes();
 void draw_spillover(vector<vert_norm_color> &verts, int i, int j, int si, int sj, int index, int vol_over, float blood_mix, float mud_mix);
-int  calc_rest_pos(vector<int> &path_x, vector<int> &path_y, vector<char> &rp_set, int &x, int &y);
+void calc_drainage_roots(vector<unsigned> const &next, int nx, int ny, vector<unsigned> &root, vector<unsigned char> &found);
+void benchmark_watershed_sizes();
 void calc_water_flow();
 void init_water_springs(int nws);
 void process_water_springs();
@@ -692,6 +712,107 @@ inline void update_water_edges(int i, int j) {
 }
 
 
+unsigned const RIPPLE_ACTIVE_BIT = 0x1000; // above all inside8 bits
+
+// neighbor offsets {dy, dx}, weights, and the inside8 bit set in the neighbor's send_mask when it sends ripples to the center cell
+int const ripple_nbor_dy[8] = {0, 0, -1, 1, -1, -1, 1, 1};
+int const ripple_nbor_dx[8] = {-1, 1, 0, 0, -1, 1, -1, 1};
+float const ripple_nbor_w[8] = {1.0, 1.0, 1.0, 1.0, SQRTOFTWOINV, SQRTOFTWOINV, SQRTOFTWOINV, SQRTOFTWOINV};
+unsigned const ripple_nbor_bit[8] = {0x08, 0x02, 0x10, 0x04, 0x80, 0x40, 0x100, 0x20};
+
+
+inline bool is_ripple_cell_active(int i, int j) {
+	return (wminside[i][j] && water_matrix[i][j] >= z_min_matrix[i][j] /*&& get_water_enabled(j, i)*/);
+}
+
+// recompute the bounds of cells that can contain water, expanded by one cell to include those that receive ripples from water cells
+void update_ripple_region() {
+
+	vector<int> row_x1(MESH_Y_SIZE, MESH_X_SIZE), row_x2(MESH_Y_SIZE, -1);
+
+#pragma omp parallel for schedule(static,16)
+	for (int i = 0; i < MESH_Y_SIZE; ++i) {
+		for (int j = 0; j < MESH_X_SIZE; ++j) {
+			if (wminside[i][j]) {row_x1[i] = min(row_x1[i], j); row_x2[i] = j;}
+		}
+	}
+	ripples.invalidate_region();
+	ripples.x1 = MESH_X_SIZE;
+
+	for (int i = 0; i < MESH_Y_SIZE; ++i) {
+		if (row_x2[i] < 0) continue; // no water in this row
+		if (ripples.y2 < 0) {ripples.y1 = i;}
+		ripples.y2 = i;
+		ripples.x1 = min(ripples.x1, row_x1[i]);
+		ripples.x2 = max(ripples.x2, row_x2[i]);
+	}
+	if (!ripples.region_valid()) {ripples.invalidate_region(); return;}
+	ripples.x1 = max(ripples.x1-1, 0); ripples.x2 = min(ripples.x2+1, MESH_X_SIZE-1);
+	ripples.y1 = max(ripples.y1-1, 0); ripples.y2 = min(ripples.y2+1, MESH_Y_SIZE-1);
+}
+
+// new acc = fix(fix(acc)*atten - sum of outgoing deltas) for active cells, plus the sum of incoming deltas from active neighbors that send to this cell;
+// scalar version for cells on the mesh border and cells left over from the SIMD loop; returns true if the cell is rippling
+inline bool calc_ripple_acc(int i, int j, float rm_atten) {
+
+	unsigned const ix(ripples.get_ix(i, j));
+	float const rmij(ripples.rval[ix]);
+	float dsum(0.0), recv(0.0);
+
+	for (unsigned n = 0; n < 8; ++n) {
+		int const y(i + ripple_nbor_dy[n]), x(j + ripple_nbor_dx[n]);
+		if (x < 0 || y < 0 || x >= MESH_X_SIZE || y >= MESH_Y_SIZE) continue;
+		unsigned const nix(ripples.get_ix(y, x));
+		float const dz((rmij - ripples.rval[nix])*ripple_nbor_w[n]);
+		dsum += dz;
+		if (ripples.send_mask[nix] & ripple_nbor_bit[n]) {recv -= dz;}
+	}
+	float &acc(ripples.acc[ix]);
+	bool rippling(0);
+
+	if (ripples.send_mask[ix] & RIPPLE_ACTIVE_BIT) {
+		fix_fp_mag(acc);
+		acc *= rm_atten;
+		rippling = (fabs(acc) > 1.0E-6);
+		acc -= dsum;
+		fix_fp_mag(acc);
+	}
+	acc += recv;
+	return rippling;
+}
+
+#ifdef USE_SSE_RIPPLES
+// branch-free SSE version of calc_ripple_acc() for four cells starting at {i, j}, which must be interior to the mesh
+inline bool calc_ripple_acc_x4(int i, int j, __m128 const &atten) {
+
+	unsigned const ix(ripples.get_ix(i, j));
+	__m128 const rmij(_mm_loadu_ps(&ripples.rval[ix])), tol(_mm_set1_ps(TOLERANCE)), sign_bit(_mm_set1_ps(-0.0f));
+	__m128 dsum(_mm_setzero_ps()), recv(_mm_setzero_ps());
+
+	for (unsigned n = 0; n < 8; ++n) {
+		unsigned const nix(ix + ripple_nbor_dy[n]*MESH_X_SIZE + ripple_nbor_dx[n]);
+		__m128 const dz(_mm_mul_ps(_mm_sub_ps(rmij, _mm_loadu_ps(&ripples.rval[nix])), _mm_set1_ps(ripple_nbor_w[n])));
+		__m128i const bit(_mm_set1_epi32(ripple_nbor_bit[n]));
+		__m128i const nmask(_mm_loadu_si128((__m128i const *)&ripples.send_mask[nix]));
+		dsum = _mm_add_ps(dsum, dz);
+		recv = _mm_sub_ps(recv, _mm_and_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(nmask, bit), bit)), dz));
+	}
+	__m128i const active_bit(_mm_set1_epi32(RIPPLE_ACTIVE_BIT));
+	__m128i const mask(_mm_loadu_si128((__m128i const *)&ripples.send_mask[ix]));
+	__m128 const active(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(mask, active_bit), active_bit)));
+	__m128 const acc(_mm_loadu_ps(&ripples.acc[ix]));
+	__m128 const acc_fixed(_mm_and_ps(acc, _mm_cmpge_ps(_mm_andnot_ps(sign_bit, acc), tol))); // fix_fp_mag()
+	__m128 const acc_atten(_mm_mul_ps(acc_fixed, atten));
+	__m128 acc_active(_mm_sub_ps(acc_atten, dsum));
+	acc_active = _mm_and_ps(acc_active, _mm_cmpge_ps(_mm_andnot_ps(sign_bit, acc_active), tol)); // fix_fp_mag()
+	__m128 const acc_new(_mm_or_ps(_mm_and_ps(active, acc_active), _mm_andnot_ps(active, acc)));
+	_mm_storeu_ps(&ripples.acc[ix], _mm_add_ps(acc_new, recv));
+	__m128 const rippling(_mm_and_ps(active, _mm_cmpgt_ps(_mm_andnot_ps(sign_bit, acc_atten), _mm_set1_ps(1.0E-6f))));
+	return (_mm_movemask_ps(rippling) != 0);
+}
+#endif // USE_SSE_RIPPLES
+
+
 void compute_ripples() {
 
 	if (DISABLE_WATER) return;
@@ -702,118 +823,84 @@ void compute_ripples() {
 	if (temperature > W_FREEZE_POINT && (start_ripple || first_water_run)) {
 		float const tstep(max(fticks, 0.25f)); // ensure some min amount of damping to prevent unstable ripples when the framerate is very high
 		float const rm_atten(pow(RIPPLE_MAT_ATTEN, tstep)), rdamp1(pow(RIPPLE_DAMP1, tstep)), rdamp2(RIPPLE_DAMP2*tstep);
+		bool const new_region(update_iter || !ripples.region_valid());
+		if (new_region) {update_ripple_region();} // periodically pick up wminside changes
 		start_ripple = 0;
 
-		for (int i = 0; i < MESH_Y_SIZE; ++i) {
-			for (int j = 0; j < MESH_X_SIZE; ++j) {
-				if (!wminside[i][j] || water_matrix[i][j] < z_min_matrix[i][j] /*|| !get_water_enabled(j, i)*/) continue;
-				short const i8(watershed_matrix[i][j].inside8);
-				fix_fp_mag(ripples[i][j].rval);
-				float const rmij(ripples[i][j].rval);
-				float &acc(ripples[i][j].acc);
-				fix_fp_mag(acc);
-				acc *= rm_atten;
-				if (!start_ripple && fabs(acc) > 1.0E-6) start_ripple = 1;
-
-				// 00 0- -0 0+ +0 -- +- ++ -+  22  11
-				// 01 02 04 08 10 20 40 80 100 200 400
-				if (point_interior_to_mesh(j, i)) { // fast mode
-					float const d0( rmij - ripples[i  ][j-1].rval);
-					if (i8 & 0x02)  ripples[i  ][j-1].acc += d0;
-					float const d2( rmij - ripples[i  ][j+1].rval);
-					if (i8 & 0x08)  ripples[i  ][j+1].acc += d2;
-					float const d4((rmij - ripples[i-1][j-1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x20)  ripples[i-1][j-1].acc += d4;
-					float const d1( rmij - ripples[i-1][j  ].rval);
-					if (i8 & 0x04)  ripples[i-1][j  ].acc += d1;
-					float const d7((rmij - ripples[i-1][j+1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x100) ripples[i-1][j+1].acc += d7;
-					float const d5((rmij - ripples[i+1][j-1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x40)  ripples[i+1][j-1].acc += d5;
-					float const d3( rmij - ripples[i+1][j  ].rval);
-					if (i8 & 0x10)  ripples[i+1][j  ].acc += d3;
-					float const d6((rmij - ripples[i+1][j+1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x80)  ripples[i+1][j+1].acc += d6;
-					acc -= d0 + d1 + d2 + d3 + d4 + d5 + d6 + d7;
-					fix_fp_mag(acc);
-					continue;
+		if (ripples.region_valid()) {
+			// only cells in the region can be active; recompute all send masks when the region changes so that cells outside of it are zero
+			int const mx1(new_region ? 0 : ripples.x1), my1(new_region ? 0 : ripples.y1);
+			int const mx2(new_region ? MESH_X_SIZE-1 : ripples.x2), my2(new_region ? MESH_Y_SIZE-1 : ripples.y2);
+
+#pragma omp parallel for schedule(static,16)
+			for (int i = my1; i <= my2; ++i) {
+				for (int j = mx1; j <= mx2; ++j) {
+					unsigned const ix(ripples.get_ix(i, j));
+					bool const active(is_ripple_cell_active(i, j));
+					ripples.send_mask[ix] = (active ? (watershed_matrix[i][j].inside8 | RIPPLE_ACTIVE_BIT) : 0);
+					if (active) {fix_fp_mag(ripples.rval[ix]);}
 				}
-				if (j > 0) {
-					float const dz(rmij - ripples[i][j-1].rval);
-					if (i8 & 0x02) ripples[i][j-1].acc += dz;
-					acc -= dz;
-
-					if (i > 0) {
-						float const dz((rmij - ripples[i-1][j-1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x20) ripples[i-1][j-1].acc += dz;
-						acc -= dz;
-					}
-					if (i < MESH_Y_SIZE-1) {
-						float const dz((rmij - ripples[i+1][j-1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x40) ripples[i+1][j-1].acc += dz;
-						acc -= dz;
-					}
-				}
-				if (i > 0) {
-					float const dz(rmij - ripples[i-1][j].rval);
-					if (i8 & 0x04) ripples[i-1][j].acc += dz;
-					acc -= dz;
-				}
-				if (j < MESH_X_SIZE-1) {
-					float const dz(rmij - ripples[i][j+1].rval);
-					if (i8 & 0x08) ripples[i][j+1].acc += dz;
-					acc -= dz;
-
-					if (i < MESH_Y_SIZE-1) {
-						float const dz((rmij - ripples[i+1][j+1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x80) ripples[i+1][j+1].acc += dz;
-						acc -= dz;
-					}
-					if (i > 0) {
-						float const dz((rmij - ripples[i-1][j+1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x100) ripples[i-1][j+1].acc += dz;
-						acc -= dz;
-					}
-				}
-				if (i < MESH_Y_SIZE-1) {
-					float const dz(rmij - ripples[i+1][j].rval);
-					if (i8 & 0x10) ripples[i+1][j].acc += dz;
-					acc -= dz;
+			}
+			// each cell gathers ripples from its neighbors and only writes its own acc, so rows can be processed in parallel
+			int const x1(ripples.x1), x2(ripples.x2), y1(ripples.y1), y2(ripples.y2);
+			int rippling(0);
+#ifdef USE_SSE_RIPPLES
+			int const ix1(max(x1, 1)), ix2(min(x2, MESH_X_SIZE-2)); // interior range
+			__m128 const atten(_mm_set1_ps(rm_atten));
+#endif
+
+#pragma omp parallel for schedule(static,16) reduction(|:rippling)
+			for (int i = y1; i <= y2; ++i) {
+				if (i == 0 || i == MESH_Y_SIZE-1) { // mesh border row
+					for (int j = x1; j <= x2; ++j) {rippling |= calc_ripple_acc(i, j, rm_atten);}
+					continue;
 				}
-				fix_fp_mag(acc);
-			} // for j
-		} // for i
+				int j(x1);
+#ifdef USE_SSE_RIPPLES
+				for (; j < ix1; ++j) {rippling |= calc_ripple_acc(i, j, rm_atten);}
+				for (; j+3 <= ix2; j += 4) {rippling |= calc_ripple_acc_x4(i, j, atten);}
+#endif
+				for (; j <= x2; ++j) {rippling |= calc_ripple_acc(i, j, rm_atten);} // remaining cells, or all cells for the scalar version
+			}
+			start_ripple = (rippling != 0);
+		}
 		if (DEBUG_RIPPLE_TIME) dtime1 += GET_DELTA_TIME;
-		
-		for (int i = 0; i < MESH_Y_SIZE; ++i) {
-			for (int j = 0; j < MESH_X_SIZE; ++j) {
+		// cells outside of the region have no water and are only updated every UPDATE_STEP
+		int const ux1(update_iter ? 0 : ripples.x1), uy1(update_iter ? 0 : ripples.y1);
+		int const ux2(update_iter ? MESH_X_SIZE-1 : ripples.x2), uy2(update_iter ? MESH_Y_SIZE-1 : ripples.y2);
+
+#pragma omp parallel for schedule(static,16)
+		for (int i = uy1; i <= uy2; ++i) {
+			for (int j = ux1; j <= ux2; ++j) {
+				unsigned const ix(ripples.get_ix(i, j));
+				float &rval(ripples.rval[ix]);
 				float ripple_zval(0.0);
 
 				if (wminside[i][j]) {
-					float const zval(rdamp1*(ripples[i][j].rval + rdamp2*ripples[i][j].acc)); // ripple wave height
+					float const zval(rdamp1*(rval + rdamp2*ripples.acc[ix])); // ripple wave height
 					ripple_zval = ((fabs(zval) < TOLERANCE) ? 0.0 : zval); // prevent small floating point numbers
 				}
 				if (wminside[i][j] == 1) { // dynamic water
 					int const wsi(watershed_matrix[i][j].wsi);
 					assert(size_t(wsi) < valleys.size());
 
-					if (water_matrix[i][j] < z_min_matrix[i][j] && fabs(ripples[i][j].rval) < 1.0E-4 && fabs(ripples[i][j].acc) < 1.0E-4) { // under ground - no ripple
+					if (water_matrix[i][j] < z_min_matrix[i][j] && fabs(rval) < 1.0E-4 && fabs(ripples.acc[ix]) < 1.0E-4) { // under ground - no ripple
 						if (update_iter) water_matrix[i][j] = valleys[wsi].zval;
 						continue;
 					}
 					float const depth(valleys[wsi].depth);
 
 					if (depth < 0) {
-						ripples[i][j].rval *= rm_atten;
+						rval *= rm_atten;
 						if (update_iter) water_matrix[i][j] = valleys[wsi].zval;
 						continue;
 					}
 					float const zval(max(min(ripple_zval, depth), -depth)); // max ripple height equals water depth
-					ripples[i][j].rval = rm_atten*zval;
+					rval = rm_atten*zval;
 					water_matrix[i][j] = valleys[wsi].zval + zval;
 				}
 				else if (wminside[i][j] == 2) { // fixed water
-					ripples[i][j].rval = rm_atten*ripple_zval;
+					rval = rm_atten*ripple_zval;
 					water_matrix[i][j] = water_plane_z + min(MAX_RIPPLE_HEIGHT, ripple_zval);
 					water_matrix[i][j] = max(water_matrix[i][j], zbottom);
 				}
@@ -822,7 +909,7 @@ void compute_ripples() {
 						update_water_edges(i, j);
 					}
 					else {
-						ripples[i][j].rval = 0.0; // not sure if this is correct, or if there is something else that should be done here
+						rval = 0.0; // not sure if this is correct, or if there is something else that should be done here
 					}
 				}
 			} // for j
@@ -830,7 +917,7 @@ void compute_ripples() {
 		if (DEBUG_RIPPLE_TIME) dtime2 += GET_DELTA_TIME;
 	}
 	else { // no ripple
-		matrix_clear_2d(ripples);
+		ripples.clear();
 
 		// must clear ripples at least once at the beginning
 		if (NO_ICE_RIPPLES || counter == 0 || temperature > W_FREEZE_POINT) {
@@ -917,7 +1004,7 @@ void add_splash(point const &pos, int xpos, int ypos, float energy, float radius
 
 	for (int i = y1; i <= y2; i++) {
 		for (int j = x1; j <= x2; j++) {
-			if (((i - ypos)*(i - ypos) + (j - xpos)*(j - ypos)) <= radsq && wminside[i][j]) {ripples[i][j].rval += splash_size;}
+			if (((i - ypos)*(i - ypos) + (j - xpos)*(j - ypos)) <= radsq && wminside[i][j]) {ripples.get_rval(i, j) += splash_size;}
 		}
 	}
 	start_ripple = 1;
@@ -952,10 +1039,10 @@ void add_waves() { // add waves due to wind
 			float const wval(wind_amplitude*min(2.5f, sqrt(lwmag))*val*min(depth, 0.1f));
 			
 			if (wminside[y][x] == 2) { // outside water (oceans)
-				ripples[y][x].rval += wval + wave_amplitude*fticks_clamped*sin(wave_freq*wave_time + depth_scale*depth);
+				ripples.get_rval(y, x) += wval + wave_amplitude*fticks_clamped*sin(wave_freq*wave_time + depth_scale*depth);
 			}
-			else if (fabs(ripples[y][x].rval) < 0.1*wval) { // don't add wind if already rippling to prevent instability
-				ripples[y][x].rval += wval;
+			else if (fabs(ripples.get_rval(y, x)) < 0.1*wval) { // don't add wind if already rippling to prevent instability
+				ripples.get_rval(y, x) += wval;
 			}
 			start_ripple = 1;
 		}
@@ -1002,6 +1089,36 @@ void sync_water_height(int wsi, int skip_ix, float zval, float z_over, vector<un
 }
 
 
+void calc_spill_edges() {
+
+	spill_edges.clear();
+	spill_edge_start.assign(valleys.size()+1, 0);
+
+	for (int pass = 0; pass < 2; ++pass) { // count edges per valley, then fill them in scan order
+		if (pass == 1) {
+			for (unsigned v = 0; v < valleys.size(); ++v) {spill_edge_start[v+1] += spill_edge_start[v];} // prefix sum
+			spill_edges.resize(spill_edge_start.back(), spill_edge_t(0, 0, 0));
+		}
+		vector<unsigned> pos(spill_edge_start.begin(), spill_edge_start.end()-1);
+
+		for (int i = 1; i < MESH_Y_SIZE-1; ++i) {
+			for (int j = 1; j < MESH_X_SIZE-1; ++j) {
+				if (wminside[i][j] != 1) continue;
+				int const wsi(watershed_matrix[i][j].wsi);
+				assert(size_t(wsi) < valleys.size());
+
+				for (unsigned k = 0; k < 4; ++k) {
+					int const ii(i+spill_ijd[k][0]), jj(j+spill_ijd[k][1]);
+					if (wminside[ii][jj] == 1 && watershed_matrix[ii][jj].wsi == wsi) continue; // same pool, can't spill
+					if (pass == 0) {++spill_edge_start[wsi+1];} else {spill_edges[pos[wsi]++] = spill_edge_t(i, j, k);}
+				}
+			}
+		}
+	} // for pass
+	spill_edges_valid = 1;
+}
+
+
 void update_valleys_and_draw_spillover() {
 
 	for (unsigned i = 0; i < valleys.size(); ++i) {
@@ -1074,19 +1191,17 @@ void update_valleys_and_draw_spillover() {
 		v.depth       = v.zval - mesh_height[v.y][v.x];
 	} // for i
 
-	// check for spillover offscreen or into another pool
-	int const ijd[4][4] = {{0,1,0,1}, {0,-1,0,0}, {1,0,1,0}, {-1,0,0,0}};
+	// check for spillover offscreen or into another pool; only edges on the border of each pool need to be checked
+	if (!spill_edges_valid || spill_edge_start.size() != valleys.size()+1) {calc_spill_edges();}
 
-	for (int i = 1; i < MESH_Y_SIZE-1; ++i) {
-		for (int j = 1; j < MESH_X_SIZE-1; ++j) {
-			if (wminside[i][j] != 1) continue;
-			int const wsi(watershed_matrix[i][j].wsi);
-			float const zval(valleys[wsi].zval);
-			if (zval < z_min_matrix[i][j]) continue;
+	for (unsigned wsi = 0; wsi < valleys.size(); ++wsi) {
+		float const zval(valleys[wsi].zval);
 
-			for (unsigned k = 0; k < 4; ++k) {
-				check_spillover(i+ijd[k][0], j+ijd[k][1], i+ijd[k][2], j+ijd[k][3], i, j, zval, wsi);
-			}
+		for (unsigned e = spill_edge_start[wsi]; e < spill_edge_start[wsi+1]; ++e) {
+			spill_edge_t const &se(spill_edges[e]);
+			int const i(se.i), j(se.j), k(se.k);
+			if (zval < z_min_matrix[i][j]) continue;
+			check_spillover(i+spill_ijd[k][0], j+spill_ijd[k][1], i+spill_ijd[k][2], j+spill_ijd[k][3], i, j, zval, wsi);
 		}
 	}
 	vector<vert_norm_color> verts;
@@ -1319,6 +1434,8 @@ void calc_watershed() {
 				watershed_matrix[i][j].inside8 = 0x1FF; // all outside water
 			}
 		}
+		ripples.invalidate_region();
+		spill_edges_valid = 0;
 		max_water_height = def_water_level;
 		min_water_height = def_water_level;
 		return;
@@ -1337,8 +1454,17 @@ void calc_watershed() {
 	}
 	max_water_height = def_water_level;
 	min_water_height = def_water_level;
-	vector<char> rp_set(XY_MULT_SIZE, 0);
-	vector<int> path_x(XY_SUM_SIZE), path_y(XY_SUM_SIZE);
+	if (benchmark_watershed) {benchmark_watershed_sizes();}
+	RESET_TIME;
+	vector<unsigned> next(XY_MULT_SIZE), root;
+	vector<unsigned char> found;
+
+	for (int i = 0; i < MESH_Y_SIZE; ++i) {
+		for (int j = 0; j < MESH_X_SIZE; ++j) {
+			next[i*MESH_X_SIZE + j] = w_motion_matrix[i][j].y*MESH_X_SIZE + w_motion_matrix[i][j].x;
+		}
+	}
+	calc_drainage_roots(next, MESH_X_SIZE, MESH_Y_SIZE, root, found);
 
 	for (int i = 0; i < MESH_Y_SIZE; ++i) {
 		for (int j = 0; j < MESH_X_SIZE; ++j) {
@@ -1346,14 +1472,23 @@ void calc_watershed() {
 				wminside[i][j] = 0;
 				continue;
 			}
-			int x(j), y(i);
-			int const crp(point_interior_to_mesh(j, i) ? calc_rest_pos(path_x, path_y, rp_set, x, y) : 0);
+			int x(j), y(i), crp(0);
+
+			if (point_interior_to_mesh(j, i)) {
+				unsigned const ix(i*MESH_X_SIZE + j);
+				x = root[ix]%MESH_X_SIZE;
+				y = root[ix]/MESH_X_SIZE;
+				watershed_matrix[i][j].x = x;
+				watershed_matrix[i][j].y = y;
+				crp = found[ix];
+			}
 			wminside[i][j] = ((mode == 1 && mesh_height[y][x] < water_plane_z) ? 2 : crp);
 		}
 	}
 	calc_water_flow();
+	if (benchmark_watershed) {PRINT_TIME("Watershed");}
 	init_water_springs(NUM_WATER_SPRINGS);
-	matrix_clear_2d(ripples);
+	ripples.clear();
 	first_water_run = 1;
 
 	for (int i = 0; i < MESH_Y_SIZE; ++i) {
@@ -1398,41 +1533,96 @@ void calc_watershed() {
 }
 
 
-int calc_rest_pos(vector<int> &path_x, vector<int> &path_y, vector<char> &rp_set, int &x, int &y) { // return 0 if off the map
+// finds where water from each interior cell comes to rest by following the downhill pointers in next (cell index => next cell index);
+// root is either a local minimum (found=1) or the first cell that's not interior to the mesh (found=0), and roots are shared along each path
+// as in union-find path compression, so each cell is visited at most twice; roots of cells on the mesh border are left unset
+void calc_drainage_roots(vector<unsigned> const &next, int nx, int ny, vector<unsigned> &root, vector<unsigned char> &found) {
+
+	unsigned const num(nx*ny), UNSET(UINT_MAX);
+	assert(next.size() == num);
+	root.assign(num, UNSET);
+	found.assign(num, 0);
+	auto is_interior([nx, ny](unsigned ix) {int const x(ix%nx), y(ix/nx); return (x > 0 && y > 0 && x < nx-1 && y < ny-1);});
+
+	for (unsigned start = 0; start < num; ++start) {
+		if (root[start] != UNSET || !is_interior(start)) continue; // already done, or on the mesh border
+		unsigned cur(start), r(start), path_len(0);
+		bool f(1);
+
+		while (1) { // follow the path to a cell with a known root, a local minimum, or the mesh border
+			if (root[cur] != UNSET) {r = root[cur]; f = (found[cur] != 0); break;}
+			unsigned const n(next[cur]);
+			assert(n < num);
+			if (n == cur || ++path_len > num) {r = cur; f = 1; break;} // local minimum (or a cycle, which shouldn't happen)
+			if (!is_interior(n)) {r = n; f = 0; break;} // flows off the mesh interior
+			cur = n;
+		}
+		for (cur = start; root[cur] == UNSET && is_interior(cur); cur = next[cur]) { // assign the root to every cell on the path
+			root [cur] = r;
+			found[cur] = f;
+		}
+	} // for start
+}
 
-	int path_counter(0), x2(0), y2(0);
-	bool found(0);
 
-	do {
-		if (path_counter < XY_SUM_SIZE) {
-			path_x[path_counter] = x;
-			path_y[path_counter] = y;
-			++path_counter;
+// times the drainage root calculation across synthetic meshes of increasing size, and checks it against walking each path
+void benchmark_watershed_sizes() {
+
+	static bool done(0);
+	if (done) return; // only run once
+	done = 1;
+
+	for (int sz = 128; sz <= 2048; sz *= 2) {
+		unsigned const num(sz*sz);
+		vector<float> h(num);
+		vector<unsigned> next(num), root;
+		vector<unsigned char> found;
+
+		for (int y = 0; y < sz; ++y) { // rolling hills with many small pits
+			for (int x = 0; x < sz; ++x) {
+				h[y*sz + x] = sinf(0.031f*x)*cosf(0.023f*y) + 0.3f*sinf(0.11f*x + 0.07f*y) + 0.01f*(((x*7919 + y*104729) & 1023)/1023.0f);
+			}
+		}
+		for (int y = 0; y < sz; ++y) { // point each cell at its lowest neighbor, or itself if it's a local minimum
+			for (int x = 0; x < sz; ++x) {
+				unsigned best(y*sz + x);
+
+				for (int dy = -1; dy <= 1; ++dy) {
+					for (int dx = -1; dx <= 1; ++dx) {
+						int const xx(x+dx), yy(y+dy);
+						if (xx < 0 || yy < 0 || xx >= sz || yy >= sz) continue;
+						if (h[yy*sz + xx] < h[best]) {best = yy*sz + xx;}
+					}
+				}
+				next[y*sz + x] = best;
+			}
 		}
-		char const rps(rp_set[y*MESH_X_SIZE+x]);
-
-		if (rps) {
-			x2    = watershed_matrix[y][x].x;
-			y2    = watershed_matrix[y][x].y;
-			x     = x2;
-			y     = y2;
-			found = (rps == 1);
-			break;
+		int const start_time(GET_TIME_MS());
+		calc_drainage_roots(next, sz, sz, root, found);
+		int const roots_time(GET_TIME_MS() - start_time);
+		// reference: walk the full path from each cell without reusing results
+		unsigned num_diff(0), num_minima(0);
+		int const walk_start_time(GET_TIME_MS());
+
+		for (unsigned ix = 0; ix < num; ++ix) {
+			if (root[ix] == UINT_MAX) continue; // border
+			unsigned cur(ix);
+			bool f(0);
+
+			while (1) {
+				unsigned const n(next[cur]);
+				if (n == cur) {f = 1; break;}
+				cur = n;
+				int const x(cur%sz), y(cur/sz);
+				if (x == 0 || y == 0 || x == sz-1 || y == sz-1) break;
+			}
+			num_diff   += (cur != root[ix] || f != (found[ix] != 0));
+			num_minima += (cur == ix);
 		}
-		x2 = w_motion_matrix[y][x].x;
-		y2 = w_motion_matrix[y][x].y;
-		if (x2 == x && y2 == y) {found = 1; break;}
-		x = x2;
-		y = y2;
-	} while (point_interior_to_mesh(x, y));
-
-	for (--path_counter; path_counter >= 0; --path_counter) {
-		int const x2(path_x[path_counter]), y2(path_y[path_counter]);
-		watershed_matrix[y2][x2].x = x;
-		watershed_matrix[y2][x2].y = y;
-		rp_set[y2*MESH_X_SIZE+x2]  = (1 + (found == 0));
-	}
-	return found;
+		int const walk_time(GET_TIME_MS() - walk_start_time);
+		cout << "Watershed " << sz << "x" << sz << ": drainage roots " << roots_time << "ms, path walk " << walk_time << "ms, "
+			 << num_minima << " minima, " << num_diff << " differences" << endl;
+	} // for sz
 }
 
 
@@ -1458,6 +1648,7 @@ void calc_water_flow() {
 	}
 	valleys.clear();
 	spill.clear();
+	spill_edges_valid = 0;
 
 	for (int i = 0; i < MESH_Y_SIZE; ++i) {
 		for (int j = 0; j < MESH_X_SIZE; ++j) {
@@ -1529,6 +1720,9 @@ void calc_water_flow() {
 			}
 		}
 	}
+	ripples.invalidate_region(); // wminside has changed
+	spill_edges_valid = 0;
+
 	for (unsigned i = 0; i < valleys.size(); ++i) {
 		valleys[i].create(i);
 			
@@ -1626,6 +1820,8 @@ void make_outside_water(int x, int y) {
 
 	if (wminside[y][x] == 2) return; // already outside water
 	wminside[y][x] = 2; // make outside water (anything else we need to update? what if all of a valley disappears?)
+	ripples.invalidate_region();
+	spill_edges_valid = 0;
 	watershed_matrix[y][x].wsi = -1; // invalid
 	water_matrix[y][x] = water_plane_z; // may be unnecessary
 }
@@ -6,6 +6,7 @@
 
 #include "3DWorld.h"
 #include <zlib.h>
+#include <cstring> // for memcpy
 
 using std::string;
 
@@ -51,6 +52,46 @@ struct binary_file_reader : public binary_file_io {
 		else {assert(0);} // no file opened
 		return 0;
 	}
+	bool read_remaining(vector<unsigned char> &buf) { // reads everything from the current position to the end of the file
+		buf.clear();
+
+		if (fp) { // one read of the known remaining size
+			long const pos(ftell(fp));
+			if (pos < 0 || fseek(fp, 0, SEEK_END) != 0) return 0;
+			long const end(ftell(fp));
+			if (end < pos || fseek(fp, pos, SEEK_SET) != 0) return 0;
+			buf.resize(end - pos);
+			return (buf.empty() || fread(buf.data(), 1, buf.size(), fp) == buf.size());
+		}
+		else if (gzf) { // uncompressed size is unknown, read in large blocks
+			unsigned const block_sz(1 << 20);
+
+			while (1) {
+				size_t const pos(buf.size());
+				buf.resize(pos + block_sz);
+				int const num_read(gzread(gzf, &buf[pos], block_sz));
+				if (num_read < 0) {buf.clear(); return 0;}
+				buf.resize(pos + num_read);
+				if (unsigned(num_read) < block_sz) return 1; // end of file
+			}
+		}
+		else {assert(0);} // no file opened
+		return 0;
+	}
+};
+// reads from a memory buffer filled by binary_file_reader::read_remaining(), with the same interface as binary_file_reader
+struct binary_buffer_reader {
+	unsigned char const *cur, *end;
+	binary_buffer_reader(vector<unsigned char> const &buf) : cur(buf.data()), end(buf.data() + buf.size()) {}
+
+	bool read(void *ptr, size_t sz, size_t count) {
+		size_t const num_bytes(sz*count);
+		if (size_t(end - cur) < num_bytes) return 0; // not enough data
+		memcpy(ptr, cur, num_bytes);
+		cur += num_bytes;
+		return 1;
+	}
+	bool at_end() const {return (cur == end);}
 };
 struct binary_file_writer : public binary_file_io {
 	bool open(string const &filename) {return binary_file_io::open(filename, "wb", "writing");}
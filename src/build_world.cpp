@@ -49,7 +49,7 @@ vector<colorRGBA> colors_by_id; // for keycards
 vector<popup_text_t> popup_text;
 cube_light_src_vect sky_cube_lights, global_cube_lights;
 
-extern bool clear_landscape_vbo, use_voxel_cobjs, tree_4th_branches, lm_alloc, reflect_dodgeballs, begin_motion, disable_fire_delay;
+extern bool clear_landscape_vbo, use_voxel_cobjs, tree_4th_branches, lm_alloc, reflect_dodgeballs, begin_motion, disable_fire_delay, use_texture_cache, texture_cache_warm_only;
 extern int camera_view, camera_mode, camera_reset, animate2, recreated, temp_change, preproc_cube_cobjs, precip_mode;
 extern int is_cloudy, num_smileys, load_coll_objs, world_mode, start_ripple, has_snow_accum, has_accumulation, scrolling, num_items, camera_coll_id;
 extern int num_dodgeballs, display_mode, game_mode, num_trees, tree_mode, has_scenery2, UNLIMITED_WEAPONS, ground_effects_level;
@@ -58,7 +58,7 @@ extern double camera_zh;
 extern point cpos2, orig_camera, orig_cdir;
 extern unsigned create_voxel_landscape, scene_smap_vbo_invalid, num_dynam_parts, max_num_mat_spheres, init_item_counts[];
 extern obj_type object_types[];
-extern string cobjs_out_fn;
+extern string cobjs_out_fn, texture_cache_dir;
 extern coll_obj_group coll_objects;
 extern cobj_groups_t cobj_groups;
 extern cobj_draw_groups cdraw_groups;
@@ -2079,6 +2079,58 @@ int read_coll_obj_file(const char *coll_obj_file, geom_xform_t xf, coll_obj cobj
 	return 1;
 }
 
+// finds the model files loaded by a scene file and the files it includes, skipping all other commands; doesn't handle model files loaded by
+// other config options such as city and building models
+void get_scene_model_files(string const &filename, vector<string> &model_fns, unsigned depth=0) {
+
+	if (depth > 100) {cerr << "Error: Include depth limit exceeded for scene file " << filename << endl; return;} // likely a recursive include
+	FILE *fp(fopen(filename.c_str(), "r"));
+	if (fp == nullptr) {cerr << "Error: Failed to open scene file " << filename << endl; return;}
+	unsigned line_num(1);
+	bool line_start(1);
+
+	while (1) {
+		int const c(getc(fp));
+		if (is_EOF(c)) break;
+		if (c == '\n') {++line_num; line_start = 1; continue;}
+		if (!line_start || isspace(c)) continue;
+		line_start = 0; // only the first non-whitespace character of each line is a command
+
+		if (c == 'O' || c == 'i') { // load model file | include file
+			string const fn(read_quoted_string(fp, line_num));
+			if (fn.empty()) continue;
+			if (c == 'O') {model_fns.push_back(fn);} else {get_scene_model_files(fn, model_fns, depth+1);}
+			line_start = 1; // read_quoted_string() may have consumed the newline
+		}
+	} // while
+	fclose(fp);
+}
+
+// called from main() in place of the normal startup when run with -warm_tex_cache; loads and processes the global textures and the textures of
+// scene models without a GL context so that the next run can read them from the texture cache
+bool warm_texture_cache() {
+
+	timer_t timer("Warm Texture Cache");
+	use_texture_cache = texture_cache_warm_only = 1;
+	load_texture_files();
+	if (!use_texture_cache) return 0; // failed to create cache directory
+	vector<string> model_fns;
+	get_scene_model_files(coll_obj_file, model_fns);
+	unsigned num_loaded(0);
+
+	for (auto fn = model_fns.begin(); fn != model_fns.end(); ++fn) {
+		cout << "Loading textures for model " << *fn << endl;
+		model3ds models; // loaded separately and freed after each model to limit memory usage
+		// textures are processed in load_all_used_tids() after the model is read
+		if (load_model_file(*fn, models, geom_xform_t(), -1, WHITE, 0, 0.0, 0, 0, 0, 0)) {++num_loaded;}
+		else {cerr << "Error reading model file " << *fn << endl;}
+		models.tmgr.free_textures(); // free texture data only after the model is built, since building uses the texture colors
+	}
+	cout << "Warmed texture cache " << texture_cache_dir << " for global textures and " << num_loaded << " of " << model_fns.size() << " models" << endl;
+	return (num_loaded == model_fns.size());
+}
+
+
 int read_coll_objects(const char *filename) {
 
 	geom_xform_t xf;
@@ -10,6 +10,7 @@
 
 bool const USE_BKG_THREAD = 1;
 
+extern bool cobj_tree_sah_build;
 extern int MESH_Z_SIZE, display_mode, display_framerate, camera_surf_collide, animate2;
 extern unsigned LOCAL_RAYS, MAX_RAY_BOUNCES, NUM_THREADS;
 extern float indir_light_exp;
@@ -327,6 +328,7 @@ public:
 	void build_bvh(building_t const &b) {
 		bvh.clear();
 		b.gather_interior_cubes(bvh.get_objs());
+		bvh.set_sah_build(cobj_tree_sah_build);
 		bvh.build_tree_top(0); // verbose=0
 	}
 	cube_bvh_t const &get_bvh() const {return bvh;}
@@ -113,7 +113,9 @@ bool car_t::front_intersects_car(car_t const &c) const {
 
 void car_t::honk_horn_if_close() const {
 	point const pos(get_center());
-	if (dist_less_than((pos + get_tiled_terrain_model_xlate()), get_camera_pos(), 1.0)) {gen_sound(SOUND_HORN, pos);}
+	if (!dist_less_than((pos + get_tiled_terrain_model_xlate()), get_camera_pos(), 1.0)) return;
+#pragma omp critical(gen_car_sound) // may be called from threaded car collision updates
+	gen_sound(SOUND_HORN, pos);
 }
 
 void car_t::honk_horn_if_close_and_fast() const {
@@ -165,7 +167,7 @@ bool car_t::proc_sphere_coll(point &pos, point const &p_last, float radius, vect
 	//return sphere_sphere_int((bcube.get_cube_center() + xlate), pos, bcube.get_bsphere_radius(), radius, cnorm, pos); // Note: handle cnorm in if using this
 }
 
-bool car_t::check_collision(car_t &c, road_gen_base_t const &road_gen) {
+bool car_t::check_collision(car_t &c, road_gen_base_t const &road_gen, bool allow_honk) {
 
 	if (c.dim != dim) { // turning in an intersection, etc. (Note: may not be needed, but at least need to return here)
 		car_t *to_stop(nullptr);
@@ -174,7 +176,7 @@ bool car_t::check_collision(car_t &c, road_gen_base_t const &road_gen) {
 		if (!to_stop) return 0;
 		to_stop->decelerate_fast(); // attempt to prevent one car from T-boning the other
 		to_stop->bcube = to_stop->prev_bcube;
-		to_stop->honk_horn_if_close_and_fast();
+		if (allow_honk) {to_stop->honk_horn_if_close_and_fast();}
 		return 1;
 	}
 	if (dir != c.dir) return 0; // traveling on opposite sides of the road
@@ -706,7 +708,7 @@ bool car_manager_t::check_car_for_ped_colls(car_t &car) const {
 	for (auto i = peds.begin(); i != peds.end(); ++i) {
 		if (coll_area.contains_pt_xy_exp(i->pos, i->radius)) {
 			car.decelerate_fast();
-			if ((rgen.rand()&3) == 0) {car.honk_horn_if_close_and_fast();}
+			if (!in_update_bench && (rgen.rand()&3) == 0) {car.honk_horn_if_close_and_fast();}
 			return 1;
 		}
 	} // for i
@@ -730,25 +732,23 @@ bool car_manager_t::choose_dest_parked_car(unsigned city_id, unsigned &plot_id,
 	return 0;
 }
 
-void car_manager_t::next_frame(ped_manager_t const &ped_manager, float car_speed) {
-	if (cars.empty() || !animate2) return;
-	// Warning: not really thread safe, but should be okay; the ped state should valid at all points (thought maybe inconsistent) and we don't need it to be exact every frame
-	ped_manager.get_peds_crossing_roads(peds_crossing_roads);
-	//timer_t timer("Update Cars"); // 4K cars = 0.7ms / 2.1ms with destinations + navigation
-#pragma omp critical(modify_car_data)
-	{
-		if (car_destroyed) {remove_destroyed_cars();} // at least one car was destroyed in the previous frame - remove it/them
-		sort(cars.begin(), cars.end(), comp_car_road_then_pos(camera_pdu.pos - dstate.xlate)); // sort by city/road/position for intersection tests and tile shadow map binds
-	}
+void car_manager_t::move_cars(float speed, unsigned num_threads) {
 	entering_city.clear();
 	car_blocks.clear();
-	float const speed(CAR_SPEED_SCALE*car_speed*fticks);
 	bool saw_parked(0);
 	//unsigned num_on_conn_road(0);
 
+	if (num_threads > 1) { // car movement is independent per car, so it can be done in parallel; the shared state is updated serially below
+#pragma omp parallel for schedule(static,256) num_threads(num_threads)
+		for (int i = 0; i < (int)cars.size(); ++i) {
+			car_t &car(cars[i]);
+			car.car_in_front = nullptr; // reset for this frame
+			if (!car.is_parked()) {car.move(speed);}
+		}
+	}
 	for (auto i = cars.begin(); i != cars.end(); ++i) { // move cars
 		unsigned const cix(i - cars.begin());
-		i->car_in_front = nullptr; // reset for this frame
+		if (num_threads <= 1) {i->car_in_front = nullptr;} // reset for this frame
 
 		if (car_blocks.empty() || i->cur_city != car_blocks.back().cur_city) {
 			if (!saw_parked && !car_blocks.empty()) {car_blocks.back().first_parked = cix;} // no parked cars in prev city
@@ -759,14 +759,16 @@ void car_manager_t::next_frame(ped_manager_t const &ped_manager, float car_speed
 			if (!saw_parked) {car_blocks.back().first_parked = cix; saw_parked = 1;}
 			continue; // no update for parked cars
 		}
-		i->move(speed);
+		if (num_threads <= 1) {i->move(speed);}
 		if (i->entering_city) {entering_city.push_back(cix);} // record for use in collision detection
 		if (!i->stopped_at_light && i->is_almost_stopped() && i->in_isect()) {get_car_isec(*i).stoplight.mark_blocked(i->dim, i->dir);} // blocking intersection
 		register_car_at_city(*i);
 	} // for i
 	if (!saw_parked && !car_blocks.empty()) {car_blocks.back().first_parked = cars.size();} // no parked cars in final city
 	car_blocks.emplace_back(cars.size(), 0); // add terminator
+}
 
+void car_manager_t::collide_cars_serial() {
 	for (auto i = cars.begin(); i != cars.end(); ++i) { // collision detection
 		if (i->is_parked()) continue; // no collisions for parked cars
 		bool const on_conn_road(i->cur_city == CONN_CITY_IX);
@@ -792,6 +794,110 @@ void car_manager_t::next_frame(ped_manager_t const &ped_manager, float car_speed
 		}
 		if (!peds_crossing_roads.peds.empty()) {check_car_for_ped_colls(*i);}
 	} // for i
+}
+
+// Same checks as collide_cars_serial(), but split into three passes so that the first two can be run in parallel:
+// 1. same road collisions: cars are sorted by city/road, and the inner loop never leaves the current road, so each road block only modifies its own cars
+// 2. find_next_car_after_turn(): only writes car_in_front of the car being queried, and only reads positions of other cars
+// 3. collisions between cars on different roads and with pedestrians, in car order on a single thread
+// The results don't depend on the number of threads, but differ slightly from collide_cars_serial() because the order of collision updates has changed.
+void car_manager_t::collide_cars_by_road_block(unsigned num_threads) {
+	road_blocks.clear();
+
+	for (auto i = cars.begin(); i != cars.end(); ++i) {
+		if (i->is_parked()) continue;
+		unsigned const cix(i - cars.begin());
+		if (road_blocks.empty() || cix == 0 || (i-1)->is_parked() || i->cur_city != (i-1)->cur_city || i->cur_road != (i-1)->cur_road) {road_blocks.push_back(cix);}
+	}
+	unsigned const num_blocks(road_blocks.size());
+	road_blocks.push_back(cars.size()); // add terminator; parked cars at the end of a block never have collisions and are skipped below
+	next_car_after_turn.resize(cars.size());
+
+#pragma omp parallel for schedule(dynamic,16) num_threads(num_threads) if (num_threads > 1)
+	for (int b = 0; b < (int)num_blocks; ++b) { // pass 1: same road collisions
+		auto const block_end(cars.begin() + road_blocks[b+1]);
+
+		for (auto i = cars.begin() + road_blocks[b]; i != block_end; ++i) {
+			if (i->is_parked()) break; // parked cars are last in each city
+			bool const on_conn_road(i->cur_city == CONN_CITY_IX);
+			float const length(i->get_length()), max_check_dist(max(3.0f*length, (length + i->get_max_lookahead_dist())));
+
+			for (auto j = i+1; j != block_end; ++j) {
+				if (j->is_parked() || i->cur_city != j->cur_city || i->cur_road != j->cur_road) break; // end of block
+				if (!on_conn_road && i->cur_road_type == j->cur_road_type && abs((int)i->cur_seg - (int)j->cur_seg) > 0) break; // diff road segs or diff isects
+				check_collision(*i, *j);
+				i->register_adj_car(*j);
+				j->register_adj_car(*i);
+				if (!dist_xy_less_than(i->get_center(), j->get_center(), max_check_dist)) break;
+			}
+		} // for i
+	} // for b
+#pragma omp parallel for schedule(dynamic,64) num_threads(num_threads) if (num_threads > 1)
+	for (int i = 0; i < (int)cars.size(); ++i) { // pass 2: car in front after turning
+		car_t &car(cars[i]);
+		next_car_after_turn[i] = ((!car.is_parked() && car.in_isect()) ? find_next_car_after_turn(car) : -1);
+	}
+	for (auto i = cars.begin(); i != cars.end(); ++i) { // pass 3: serial cross-road collisions
+		if (i->is_parked()) continue;
+		unsigned const cix(i - cars.begin());
+
+		if (i->cur_city == CONN_CITY_IX) { // on connector road, check before entering intersection to a city
+			for (auto ix = entering_city.begin(); ix != entering_city.end(); ++ix) {
+				if (*ix != cix) {check_collision(*i, cars[*ix]);}
+			}
+		}
+		if (next_car_after_turn[cix] >= 0) {check_collision(*i, cars[next_car_after_turn[cix]]);} // make sure we collide with the correct car
+		if (!peds_crossing_roads.peds.empty()) {check_car_for_ped_colls(*i);}
+	} // for i
+}
+
+uint64_t car_manager_t::get_state_checksum() const { // for checking that simulation results are deterministic
+	uint64_t checksum(0);
+	for (auto i = cars.begin(); i != cars.end(); ++i) {checksum = 31*checksum + hash_by_bytes<point>()(i->get_center()) + hash_by_bytes<float>()(i->cur_speed);}
+	return checksum;
+}
+
+void car_manager_t::run_update_benchmark(unsigned num_frames) {
+	// time the collision update on copies of the current car state for 1 to N threads; car state is restored after each run
+	vector<car_t> const orig_cars(cars);
+	in_update_bench = 1; // no horns or random numbers, so that later updates are the same as without the benchmark
+	unsigned const max_threads(max(city_params.car_update_threads, (unsigned)omp_get_max_threads_3dw()));
+	uint64_t ref_checksum(0);
+	cout << "Car update benchmark: " << cars.size() << " cars, " << (car_blocks.size() - 1) << " city blocks, " << num_frames << " frames" << endl;
+
+	for (unsigned num_threads = 1; num_threads <= max_threads; ++num_threads) {
+		int const start_time(GET_TIME_MS());
+
+		for (unsigned n = 0; n < num_frames; ++n) {
+			cars = orig_cars; // same size, so the car_in_front pointers of the copy remain valid
+			collide_cars_by_road_block(num_threads);
+		}
+		float const ms_per_frame(float(GET_TIME_MS() - start_time)/num_frames);
+
+		uint64_t const checksum(get_state_checksum());
+		if (num_threads == 1) {ref_checksum = checksum;}
+		cout << "  " << num_threads << " threads: " << ms_per_frame << " ms/frame" << (checksum == ref_checksum ? "" : " ERROR: results differ from 1 thread") << endl;
+	} // for num_threads
+	cars = orig_cars;
+	in_update_bench = 0;
+}
+
+void car_manager_t::next_frame(ped_manager_t const &ped_manager, float car_speed) {
+	if (cars.empty() || !animate2) return;
+	// Warning: not really thread safe, but should be okay; the ped state should valid at all points (thought maybe inconsistent) and we don't need it to be exact every frame
+	ped_manager.get_peds_crossing_roads(peds_crossing_roads);
+	//timer_t timer("Update Cars"); // 4K cars = 0.7ms / 2.1ms with destinations + navigation
+#pragma omp critical(modify_car_data)
+	{
+		if (car_destroyed) {remove_destroyed_cars();} // at least one car was destroyed in the previous frame - remove it/them
+		sort(cars.begin(), cars.end(), comp_car_road_then_pos(camera_pdu.pos - dstate.xlate)); // sort by city/road/position for intersection tests and tile shadow map binds
+	}
+	unsigned const num_threads(city_params.car_update_threads);
+	if (num_threads > 1) {omp_enable_nested_3dw();} // we may be called from thread 1 of the draw/update parallel region
+	move_cars(CAR_SPEED_SCALE*car_speed*fticks, num_threads);
+	if (city_params.car_bench_frames > 0 && !bench_done) {run_update_benchmark(city_params.car_bench_frames); bench_done = 1;}
+	if (num_threads == 0) {collide_cars_serial();} else {collide_cars_by_road_block(num_threads);}
+	if (num_threads > 1) {omp_restore_nested_3dw();}
 	update_cars(); // run update logic
 
 	if (map_mode) { // create cars_by_road
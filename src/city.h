@@ -59,7 +59,7 @@ struct city_params_t {
 	float road_width, road_spacing, conn_road_seg_len, max_road_slope;
 	unsigned make_4_way_ints; // 0=all 3-way intersections; 1=allow 4-way; 2=all connector roads must have at least a 4-way on one end; 4=only 4-way (no straight roads)
 	// cars
-	unsigned num_cars;
+	unsigned num_cars, car_update_threads, car_bench_frames; // car_update_threads: 0=legacy serial update, 1+=road block update on this many threads
 	float car_speed, traffic_balance_val, new_city_prob, max_car_scale;
 	bool enable_car_path_finding, convert_model_files;
 	vector<city_model_t> car_model_files, ped_model_files;
@@ -75,17 +75,20 @@ struct city_params_t {
 	// detail objects
 	unsigned max_benches_per_plot;
 	// pedestrians
-	unsigned num_peds, num_building_peds;
+	unsigned num_peds, num_building_peds, ped_update_threads; // ped_update_threads: 0=serial update, 1+=per-plot update on this many threads
 	float ped_speed;
 	bool ped_respawn_at_dest;
+	// headless simulation benchmark
+	unsigned sim_bench_frames;
+	float sim_bench_fticks;
 	// buildings; maybe should be building params, but we have the model loading code here
 	city_model_t building_models[NUM_OBJ_MODELS];
 
 	city_params_t() : num_cities(0), num_samples(100), num_conn_tries(50), city_size_min(0), city_size_max(0), city_border(0), road_border(0), slope_width(0),
-		num_rr_tracks(0), park_rate(0), road_width(0.0), road_spacing(0.0), conn_road_seg_len(1000.0), max_road_slope(1.0), make_4_way_ints(0), num_cars(0), car_speed(0.0),
+		num_rr_tracks(0), park_rate(0), road_width(0.0), road_spacing(0.0), conn_road_seg_len(1000.0), max_road_slope(1.0), make_4_way_ints(0), num_cars(0), car_update_threads(0), car_bench_frames(0), car_speed(0.0),
 		traffic_balance_val(0.5), new_city_prob(1.0), max_car_scale(1.0), enable_car_path_finding(0), convert_model_files(0), min_park_spaces(12), min_park_rows(1),
 		min_park_density(0.0), max_park_density(1.0), car_shadows(0), max_lights(1024), max_shadow_maps(0), smap_size(0), max_trees_per_plot(0),
-		tree_spacing(1.0), max_benches_per_plot(0), num_peds(0), num_building_peds(0), ped_speed(0.0), ped_respawn_at_dest(0) {}
+		tree_spacing(1.0), max_benches_per_plot(0), num_peds(0), num_building_peds(0), ped_update_threads(0), ped_speed(0.0), ped_respawn_at_dest(0), sim_bench_frames(0), sim_bench_fticks(1.0) {}
 	bool enabled() const {return (num_cities > 0 && city_size_min > 0);}
 	bool roads_enabled() const {return (road_width > 0.0 && road_spacing > 0.0);}
 	float get_road_ar() const {return round(road_spacing/road_width);} // round to nearest texture multiple
@@ -163,7 +166,7 @@ struct car_t : public car_base_t, public waiting_obj_t { // size = 92
 	void park() {cur_speed = max_speed = 0.0;}
 	void stop() {cur_speed = 0.0;} // immediate stop
 	void move_by(float val) {bcube.d[dim][0] += val; bcube.d[dim][1] += val;}
-	bool check_collision(car_t &c, road_gen_base_t const &road_gen);
+	bool check_collision(car_t &c, road_gen_base_t const &road_gen, bool allow_honk=1);
 	bool proc_sphere_coll(point &pos, point const &p_last, float radius, vector3d const &xlate, vector3d *cnorm) const;
 	bool front_intersects_car(car_t const &c) const;
 	void honk_horn_if_close() const;
@@ -590,10 +593,11 @@ class car_manager_t {
 	ped_city_vect_t peds_crossing_roads;
 	car_draw_state_t dstate;
 	rand_gen_t rgen;
-	vector<unsigned> entering_city;
+	vector<unsigned> entering_city, road_blocks; // road_blocks: start index of each run of moving cars on the same city + road, for threaded collisions
+	vector<int> next_car_after_turn;
 	cube_t garages_bcube;
 	unsigned first_parked_car, first_garage_car;
-	bool car_destroyed;
+	bool car_destroyed, bench_done, in_update_bench; // in_update_bench: suppress horns and rgen use so that the benchmark has no side effects
 
 	cube_t get_cb_bcube(car_block_t const &cb ) const;
 	road_isec_t const &get_car_isec(car_t const &car) const;
@@ -604,8 +608,12 @@ class car_manager_t {
 	void remove_destroyed_cars();
 	void update_cars();
 	int find_next_car_after_turn(car_t &car);
+	void move_cars(float speed, unsigned num_threads);
+	void collide_cars_serial();
+	void collide_cars_by_road_block(unsigned num_threads);
+	void run_update_benchmark(unsigned num_frames);
 public:
-	car_manager_t(city_road_gen_t const &road_gen_) : road_gen(road_gen_), dstate(car_model_loader), first_parked_car(0), first_garage_car(0), car_destroyed(0) {}
+	car_manager_t(city_road_gen_t const &road_gen_) : road_gen(road_gen_), dstate(car_model_loader), first_parked_car(0), first_garage_car(0), car_destroyed(0), bench_done(0), in_update_bench(0) {}
 	bool empty() const {return cars.empty();}
 	void clear() {cars.clear(); car_blocks.clear();}
 	unsigned get_model_gpu_mem() const {return car_model_loader.get_gpu_mem();}
@@ -622,6 +630,8 @@ public:
 	bool line_intersect_cars(point const &p1, point const &p2, float &t) const;
 	bool check_car_for_ped_colls(car_t &car) const;
 	bool choose_dest_parked_car(unsigned city_id, unsigned &plot_id, unsigned &car_ix, point &car_center, rand_gen_t &rgen) const;
+	unsigned num_cars() const {return cars.size();}
+	uint64_t get_state_checksum() const;
 	void next_frame(ped_manager_t const &ped_manager, float car_speed);
 	void draw(int trans_op_mask, vector3d const &xlate, bool use_dlights, bool shadow_only, bool is_dlight_shadows, bool garages_pass);
 	void add_car_headlights(vector3d const &xlate, cube_t &lights_bcube) {dstate.add_car_headlights(cars, xlate, lights_bcube);}
@@ -629,6 +639,8 @@ public:
 }; // car_manager_t
 
 
+struct ped_update_ctx_t;
+
 struct pedestrian_t : public waiting_obj_t {
 
 	point target_pos, dest_car_center; // since cars are sorted each frame, we can't find their positions by index so we need to cache them here
@@ -636,7 +648,8 @@ struct pedestrian_t : public waiting_obj_t {
 	point pos;
 	float radius, speed, anim_time;
 	unsigned plot, next_plot, dest_plot, dest_bldg; // Note: can probably be made unsigned short later, though these are global plot and building indices
-	unsigned short city, model_id, ssn, colliding_ped;
+	unsigned short city, model_id, ssn;
+	unsigned colliding_ped; // ped index, which can be larger than 64K
 	unsigned char stuck_count;
 	bool collided, ped_coll, is_stopped, in_the_road, at_crosswalk, at_dest, has_dest_bldg, has_dest_car, destroyed, in_building;
 
@@ -650,21 +663,24 @@ struct pedestrian_t : public waiting_obj_t {
 	cube_t get_bcube() const {cube_t c; c.set_from_sphere(pos, radius); return c;}
 	bool target_valid() const {return (target_pos != all_zeros);}
 	void set_velocity(vector3d const &v) {vel = v*(speed/v.mag());} // normalize to original velocity
+	float get_coll_prox_radius() const {return (1.2*radius + 2.0*TICKS_PER_SECOND*speed);} // how far we can travel in 2s; assume other ped has a similar radius
 	void move(ped_manager_t const &ped_mgr, cube_t const &plot_bcube, cube_t const &next_plot_bcube, float &delta_dir);
 	void stop();
 	void go();
 	bool check_for_safe_road_crossing(ped_manager_t const &ped_mgr, cube_t const &plot_bcube, cube_t const &next_plot_bcube, vect_cube_t *dbg_cubes=nullptr) const;
+	bool get_ped_avoid_force(point const &opos, vector3d const &ovel, float oradius, float prox_radius_sq, vector3d &force) const;
 	bool check_ped_ped_coll_range(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_start, unsigned target_plot, float prox_radius, vector3d &force);
 	bool check_ped_ped_coll(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, float delta_dir);
-	bool check_ped_ped_coll_stopped(vector<pedestrian_t> &peds, unsigned pid);
-	bool check_inside_plot(ped_manager_t &ped_mgr, point const &prev_pos, cube_t const &plot_bcube, cube_t const &next_plot_bcube);
+	bool check_ped_ped_coll_grid(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, float delta_dir, ped_update_ctx_t &ctx);
+	bool check_ped_ped_coll_stopped(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_end);
+	bool check_inside_plot(ped_manager_t &ped_mgr, point const &prev_pos, cube_t const &plot_bcube, cube_t const &next_plot_bcube, rand_gen_t &rgen);
 	bool check_road_coll(ped_manager_t const &ped_mgr, cube_t const &plot_bcube, cube_t const &next_plot_bcube) const;
 	bool is_valid_pos(vect_cube_t const &colliders, bool &ped_at_dest, ped_manager_t const *const ped_mgr) const;
 	bool try_place_in_plot(cube_t const &plot_cube, vect_cube_t const &colliders, unsigned plot_id, rand_gen_t &rgen);
 	point get_dest_pos(cube_t const &plot_bcube, cube_t const &next_plot_bcube, ped_manager_t const &ped_mgr) const;
-	bool choose_alt_next_plot(ped_manager_t const &ped_mgr);
+	bool choose_alt_next_plot(ped_manager_t const &ped_mgr, rand_gen_t &rgen);
 	void get_avoid_cubes(ped_manager_t const &ped_mgr, vect_cube_t const &colliders, point const &dest_pos, vect_cube_t &avoid) const;
-	void next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, rand_gen_t &rgen, float delta_dir);
+	void next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, rand_gen_t &rgen, float delta_dir, ped_update_ctx_t *ctx=nullptr);
 	void register_at_dest();
 	void destroy() {destroyed = 1;} // that's it, no other effects
 	bool is_close_to_player() const;
@@ -706,6 +722,55 @@ public:
 	unsigned run(point const &pos_, point const &dest_, cube_t const &plot_bcube_, float gap_, point &new_dest);
 };
 
+struct ped_grid_t { // spatial hash of city ped positions at the start of the frame, for ped-ped proximity queries across plots
+	struct entry_t {
+		point pos;
+		vector3d vel;
+		float radius;
+		unsigned ix, plot;
+	};
+	float cell_sz;
+	unsigned mask;
+	vector<unsigned> bucket_start, ped_bucket, ped_entry; // per bucket + terminator, per ped, per ped
+	vector<entry_t> entries; // sorted by bucket
+
+	ped_grid_t() : cell_sz(0.0), mask(0) {}
+	int get_cell(float v) const {return int(floor(v/cell_sz));}
+	unsigned get_bucket(int x, int y) const {return (((unsigned)x*73856093U) ^ ((unsigned)y*19349663U)) & mask;}
+	unsigned get_bucket(point const &pos) const {return get_bucket(get_cell(pos.x), get_cell(pos.y));}
+	point const &get_pos(unsigned ped_ix) const {assert(ped_ix < ped_entry.size()); return entries[ped_entry[ped_ix]].pos;}
+	void update(vector<pedestrian_t> const &peds, bool peds_reordered);
+
+	template<typename F> void query(point const &pos, float radius, F const &f) const { // f returns 1 to stop iteration
+		if (entries.empty()) return;
+		assert(radius <= cell_sz);
+		int const x1(get_cell(pos.x - radius)), x2(get_cell(pos.x + radius)), y1(get_cell(pos.y - radius)), y2(get_cell(pos.y + radius));
+		unsigned buckets[9], num_buckets(0); // at most 3x3 cells since radius <= cell_sz
+
+		for (int y = y1; y <= y2; ++y) {
+			for (int x = x1; x <= x2; ++x) {
+				unsigned const b(get_bucket(x, y));
+				if (std::find(buckets, buckets+num_buckets, b) == buckets+num_buckets) {buckets[num_buckets++] = b;} // skip hash collisions between our cells
+			}
+		}
+		for (unsigned n = 0; n < num_buckets; ++n) {
+			for (unsigned i = bucket_start[buckets[n]]; i < bucket_start[buckets[n]+1]; ++i) {
+				if (f(entries[i])) return;
+			}
+		}
+	}
+};
+
+struct ped_update_ctx_t { // per-thread state for threaded city ped updates
+	path_finder_t path_finder;
+	rand_gen_t rgen;
+	unsigned ped_start, ped_end; // range of peds in the plot currently being updated by this thread
+	vector<pair<unsigned, unsigned>> deferred_colls; // {ped, colliding ped} for peds in plots owned by other threads, applied after the update
+
+	ped_update_ctx_t() : ped_start(0), ped_end(0) {}
+	bool owns_ped(unsigned ix) const {return (ix >= ped_start && ix < ped_end);}
+};
+
 class ped_manager_t { // pedestrians
 
 	struct city_ixs_t {
@@ -722,11 +787,14 @@ class ped_manager_t { // pedestrians
 	vector<unsigned char> need_to_sort_city;
 	vector<car_city_vect_t> cars_by_city;
 	vector<point> bldg_ppl_pos;
+	vector<ped_update_ctx_t> update_ctxs; // one per thread
+	vector<pair<unsigned, unsigned>> deferred_colls;
+	ped_grid_t ped_grid;
 	rand_gen_t rgen;
 	ao_draw_state_t dstate;
 	int selected_ped_ssn;
 	unsigned animation_id;
-	bool ped_destroyed, need_to_sort_peds;
+	bool ped_destroyed, need_to_sort_peds, peds_reordered;
 
 	void assign_ped_model(pedestrian_t &ped);
 	bool gen_ped_pos(pedestrian_t &ped);
@@ -736,6 +804,7 @@ class ped_manager_t { // pedestrians
 	road_isec_t const &get_car_isec(car_base_t const &car) const;
 	void register_ped_new_plot(pedestrian_t const &ped);
 	int get_road_ix_for_ped_crossing(pedestrian_t const &ped, bool road_dim) const;
+	void update_peds_threaded(unsigned num_threads, float delta_dir);
 	bool draw_ped(pedestrian_t const &ped, shader_t &s, pos_dir_up const &pdu, vector3d const &xlate, float def_draw_dist, float draw_dist_sq,
 		bool &in_sphere_draw, bool shadow_only, bool is_dlight_shadows, bool enable_animations);
 public:
@@ -746,19 +815,20 @@ public:
 	cube_t get_expanded_city_bcube_for_peds(unsigned city_ix) const;
 	cube_t get_expanded_city_plot_bcube_for_peds(unsigned city_ix, unsigned plot_ix) const;
 	car_manager_t const &get_car_manager() const {return car_manager;}
+	ped_grid_t const &get_ped_grid() const {return ped_grid;}
 	void choose_new_ped_plot_pos(pedestrian_t &ped);
 	bool check_isec_sphere_coll(pedestrian_t const &ped) const;
 	bool check_streetlight_sphere_coll(pedestrian_t const &ped) const;
 	bool mark_crosswalk_in_use(pedestrian_t const &ped);
 	bool choose_dest_building_or_parked_car(pedestrian_t &ped);
-	unsigned get_next_plot(pedestrian_t &ped, int exclude_plot=-1) const;
+	unsigned get_next_plot(pedestrian_t &ped, rand_gen_t &rgen, int exclude_plot=-1) const;
 	void move_ped_to_next_plot(pedestrian_t &ped);
 	bool has_nearby_car(pedestrian_t const &ped, bool road_dim, float delta_time, vect_cube_t *dbg_cubes=nullptr) const;
 	bool has_nearby_car_on_road(pedestrian_t const &ped, bool dim, unsigned road_ix, float delta_time, vect_cube_t *dbg_cubes) const;
 	bool has_car_at_pt(point const &pos, unsigned city, bool is_parked) const;
 public:
 	ped_manager_t(city_road_gen_t const &road_gen_, car_manager_t const &car_manager_) :
-		road_gen(road_gen_), car_manager(car_manager_), selected_ped_ssn(-1), animation_id(1), ped_destroyed(0), need_to_sort_peds(0) {}
+		road_gen(road_gen_), car_manager(car_manager_), selected_ped_ssn(-1), animation_id(1), ped_destroyed(0), need_to_sort_peds(0), peds_reordered(1) {}
 	void next_animation();
 	static float get_ped_radius();
 	bool empty() const {return (peds.empty() && peds_b.empty());}
@@ -768,6 +838,12 @@ public:
 	bool proc_sphere_coll(point &pos, float radius, vector3d *cnorm) const;
 	bool line_intersect_peds(point const &p1, point const &p2, float &t) const;
 	void destroy_peds_in_radius(point const &pos_in, float radius);
+	static float get_delta_dir() {return 1.2*(1.0 - pow(0.7f, fticks));} // controls pedestrian turning rate
+	unsigned num_city_peds() const {return peds.size();}
+	unsigned num_building_peds() const {return peds_b.size();}
+	uint64_t get_state_checksum() const;
+	void next_frame_city_peds(float delta_dir);
+	void next_frame_building_peds(float delta_dir);
 	void next_frame();
 	pedestrian_t const *get_ped_at(point const &p1, point const &p2) const;
 	unsigned get_first_ped_at_plot(unsigned plot) const {assert(plot < by_plot.size()); return by_plot[plot];}
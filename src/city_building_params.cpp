@@ -69,6 +69,12 @@ bool city_params_t::read_option(FILE *fp) {
 	else if (str == "num_cars") {
 		if (!read_uint(fp, num_cars)) {return read_error(str);}
 	}
+	else if (str == "car_update_threads") { // 0 = serial update
+		if (!read_uint(fp, car_update_threads) || car_update_threads > 256) {return read_error(str);}
+	}
+	else if (str == "car_bench_frames") { // 0 = no benchmark
+		if (!read_uint(fp, car_bench_frames)) {return read_error(str);}
+	}
 	else if (str == "car_speed") {
 		if (!read_float(fp, car_speed) || car_speed < 0.0) {return read_error(str);}
 	}
@@ -98,6 +104,9 @@ bool city_params_t::read_option(FILE *fp) {
 	else if (str == "num_building_peds") {
 		if (!read_uint(fp, num_building_peds)) {return read_error(str);}
 	}
+	else if (str == "ped_update_threads") { // 0 = serial update
+		if (!read_uint(fp, ped_update_threads) || ped_update_threads > 256) {return read_error(str);}
+	}
 	else if (str == "ped_speed") {
 		if (!read_float(fp, ped_speed) || ped_speed < 0.0) {return read_error(str);}
 	}
@@ -110,6 +119,13 @@ bool city_params_t::read_option(FILE *fp) {
 	else if (str == "ped_respawn_at_dest") {
 		if (!read_bool(fp, ped_respawn_at_dest)) {return read_error(str);}
 	}
+	// headless simulation benchmark
+	else if (str == "sim_bench_frames") {
+		if (!read_uint(fp, sim_bench_frames)) {return read_error(str);}
+	}
+	else if (str == "sim_bench_fticks") {
+		if (!read_float(fp, sim_bench_fticks) || sim_bench_fticks <= 0.0) {return read_error(str);}
+	}
 	// parking lots
 	else if (str == "min_park_spaces") { // with default road parameters, can be up to 28
 		if (!read_uint(fp, min_park_spaces)) {return read_error(str);}
@@ -9,6 +9,9 @@
 #include "buildings.h"
 #include "tree_3dw.h"
 #include <cfloat> // for FLT_MAX
+#ifdef __GLIBC__
+#include <malloc.h> // for mallinfo2()
+#endif
 
 using std::string;
 
@@ -22,8 +25,8 @@ float city_dlight_pcf_offset_scale(1.0);
 city_params_t city_params;
 point pre_smap_player_pos(all_zeros);
 
-extern bool enable_dlight_shadows, dl_smap_enabled, draw_building_interiors, flashlight_on, camera_in_building, have_indir_smoke_tex, disable_city_shadow_maps;
-extern int rand_gen_index, display_mode, animate2, draw_model;
+extern bool enable_dlight_shadows, dl_smap_enabled, draw_building_interiors, flashlight_on, camera_in_building, have_indir_smoke_tex, disable_city_shadow_maps, disable_sound;
+extern int rand_gen_index, display_mode, animate2, draw_model, frame_counter;
 extern unsigned shadow_map_sz, cur_display_iter;
 extern float water_plane_z, shadow_map_pcf_offset, cobj_z_bias, fticks;
 extern vector<light_source> dl_sources;
@@ -1942,7 +1945,7 @@ class city_road_gen_t : public road_gen_base_t {
 		vect_cube_t const &get_colliders_for_plot (unsigned global_plot_id) const {return plot_colliders[decode_plot_id(global_plot_id)];}
 
 		// plot = current plot, dest_plot = final destination plot; returns next plot adj to cur plot on path to dest_plot
-		unsigned get_next_plot(unsigned global_plot, unsigned global_dest_plot, int exclude_plot) const {
+		unsigned get_next_plot(unsigned global_plot, unsigned global_dest_plot, int exclude_plot, rand_gen_t &rgen) const {
 			if (global_plot == global_dest_plot) {return global_plot;} // identity, at destination, no change
 			unsigned const plot(decode_plot_id(global_plot)), dest_plot(decode_plot_id(global_dest_plot)); // convert to local space
 			assert(plot < plots.size() && dest_plot < plots.size());
@@ -1964,8 +1967,7 @@ class city_road_gen_t : public road_gen_base_t {
 				if (dx != 0 && dy != 0) { // moving in the other dimension makes progress
 					dir = (move_dir ? ((dx < 0) ? 0 : 1) : ((dy < 0) ? 2 : 3));	
 				}
-				else { // take a detour in a random direction
-					static rand_gen_t rgen;
+				else { // take a detour in a random direction; rgen is the caller's, since this may be called from multiple threads
 					bool rand_dir(rgen.rand_bool());
 					dir = (move_dir ? (rand_dir ? 0 : 1) : (rand_dir ? 2 : 3));
 					
@@ -2705,7 +2707,9 @@ public:
 		return road_network_t::gen_ped_pos(ped, rgen, road_networks);
 	}
 	cube_t const &get_plot_from_global_id(unsigned city_id, unsigned global_plot_id) const {return get_city(city_id).get_plot_from_global_id(global_plot_id);}
-	unsigned get_next_plot(unsigned city_id, unsigned plot, unsigned dest_plot, int exclude_plot) const {return get_city(city_id).get_next_plot(plot, dest_plot, exclude_plot);}
+	unsigned get_next_plot(unsigned city_id, unsigned plot, unsigned dest_plot, int exclude_plot, rand_gen_t &rgen) const {
+		return get_city(city_id).get_next_plot(plot, dest_plot, exclude_plot, rgen);
+	}
 	bool choose_dest_building(unsigned city_id, unsigned &plot, unsigned &building, rand_gen_t &rgen) const {return get_city(city_id).choose_dest_building(plot, building, rgen);}
 	
 	bool update_car_dest(car_t &car) const {
@@ -2767,7 +2771,7 @@ cube_t car_manager_t::get_cb_bcube(car_block_t const &cb ) const {
 	return road_gen.get_city_bcube_for_cars(cb.cur_city);
 }
 road_isec_t const &car_manager_t::get_car_isec(car_t const &car) const {return road_gen.get_car_isec(car);}
-bool car_manager_t::check_collision(car_t &c1, car_t &c2)        const {return c1.check_collision(c2, road_gen);}
+bool car_manager_t::check_collision(car_t &c1, car_t &c2)        const {return c1.check_collision(c2, road_gen, !in_update_bench);}
 void car_manager_t::register_car_at_city(car_t const &car) {road_gen.register_car_at_city(car.cur_city);}
 
 void car_manager_t::add_car() {
@@ -2852,7 +2856,7 @@ bool ped_manager_t::choose_dest_building_or_parked_car(pedestrian_t &ped) { // m
 		if (!ped.has_dest_car) return 0;
 		ped.dest_plot = road_gen.get_city(ped.city).encode_plot_id(ped.dest_plot);
 	}
-	ped.next_plot = get_next_plot(ped);
+	ped.next_plot = get_next_plot(ped, rgen);
 	return 1;
 }
 void ped_manager_t::choose_new_ped_plot_pos(pedestrian_t &ped) {
@@ -2869,7 +2873,9 @@ void ped_manager_t::choose_new_ped_plot_pos(pedestrian_t &ped) {
 	}
 	choose_dest_building_or_parked_car(ped);
 }
-unsigned ped_manager_t::get_next_plot(pedestrian_t &ped, int exclude_plot) const {return road_gen.get_next_plot(ped.city, ped.plot, ped.dest_plot, exclude_plot);}
+unsigned ped_manager_t::get_next_plot(pedestrian_t &ped, rand_gen_t &rgen, int exclude_plot) const {
+	return road_gen.get_next_plot(ped.city, ped.plot, ped.dest_plot, exclude_plot, rgen);
+}
 
 
 void city_lights_manager_t::add_player_flashlight(float radius_scale) {
@@ -2951,6 +2957,15 @@ void city_lights_manager_t::setup_shadow_maps(vector<light_source> &light_source
 }
 
 
+int64_t get_heap_bytes_in_use() { // for simulation benchmark memory reporting; returns 0 if unsupported
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	return mallinfo2().uordblks;
+#else
+	return 0;
+#endif
+}
+
+
 class city_gen_t : public city_plot_gen_t, public city_lights_manager_t {
 
 	city_road_gen_t road_gen;
@@ -3049,6 +3064,41 @@ public:
 		}
 		if (!use_threads_2_3 || omp_get_thread_num_3dw() == 2) {ped_manager.next_frame();} // thread=2
 	}
+	void run_sim_benchmark(unsigned num_frames, float fticks_val) { // CPU only; runs with a fixed timestep so that the final state is reproducible
+		enum {SS_CARS=0, SS_PEDS, SS_BLDG_AI, NUM_SS};
+		char const *const ss_names[NUM_SS] = {"Roads+Cars", "City Peds", "Building AI"};
+		unsigned time_ms[NUM_SS] = {0};
+		int64_t heap_delta[NUM_SS] = {0};
+		cout << "City sim benchmark: " << car_manager.num_cars() << " cars, " << ped_manager.num_city_peds() << " city peds, "
+			 << ped_manager.num_building_peds() << " building peds, " << num_frames << " frames, fticks=" << fticks_val << endl;
+
+		for (unsigned n = 0; n < num_frames; ++n) {
+			fticks   = fticks_val;
+			tfticks += fticks;
+			++frame_counter;
+			float const delta_dir(ped_manager_t::get_delta_dir());
+
+			for (unsigned ss = 0; ss < NUM_SS; ++ss) {
+				int64_t const heap_start(get_heap_bytes_in_use());
+				int const start_time(GET_TIME_MS());
+
+				switch (ss) {
+				case SS_CARS:
+					road_gen.next_frame();
+					car_manager.next_frame(ped_manager, city_params.car_speed);
+					break;
+				case SS_PEDS:    ped_manager.next_frame_city_peds    (delta_dir); break;
+				case SS_BLDG_AI: ped_manager.next_frame_building_peds(delta_dir); break;
+				}
+				time_ms   [ss] += GET_TIME_MS() - start_time;
+				heap_delta[ss] += get_heap_bytes_in_use() - heap_start;
+			} // for ss
+		} // for n
+		for (unsigned ss = 0; ss < NUM_SS; ++ss) {
+			cout << ss_names[ss] << ": " << float(time_ms[ss])/num_frames << " ms/frame, heap growth " << heap_delta[ss]/1024 << " KB" << endl;
+		}
+		cout << "Final state checksum: cars " << std::hex << car_manager.get_state_checksum() << " peds " << ped_manager.get_state_checksum() << std::dec << endl;
+	}
 	void draw(int shadow_only, int reflection_pass, int trans_op_mask, vector3d const &xlate) { // shadow_only: 0=non-shadow pass, 1=sun/moon shadow, 2=dynamic shadow
 		if (!shadow_only && !reflection_pass && (trans_op_mask & 1)) {setup_city_lights(xlate);} // setup lights on first (opaque) non-shadow pass
 		bool const use_dlights(enable_lights()), is_dlight_shadows(shadow_only == 2);
@@ -3112,6 +3162,21 @@ void gen_cities(float *heightmap, unsigned xsize, unsigned ysize) {
 	city_gen.gen_cities(city_params);
 }
 void gen_city_details() {city_gen.gen_details();} // called after gen_buildings()
+
+// Headless city simulation benchmark: called from main() when sim_bench_frames is set, before the window and GL context are created;
+// generates the tiled terrain heightmap, cities, buildings, cars, and pedestrians, then runs the simulation on the CPU only
+bool run_city_sim_benchmark() {
+	if (city_params.sim_bench_frames == 0) {cerr << "Error: The city simulation benchmark requires sim_bench_frames to be set in the city config" << endl; return 0;}
+	if (!have_cities()) {cerr << "Error: The city simulation benchmark requires cities to be enabled" << endl; return 0;}
+	timer_t timer("City Sim Benchmark");
+	world_mode      = WMODE_INF_TERRAIN;
+	disable_sound   = 1; // no OpenAL context
+	animate2        = 1;
+	draw_building_interiors = 1; // required for building AI updates
+	init_tt_heightmap_and_buildings(); // generates cities, buildings, cars, and peds
+	city_gen.run_sim_benchmark(city_params.sim_bench_frames, city_params.sim_bench_fticks);
+	return 1;
+}
 void get_city_bcubes(vect_cube_t &bcubes) {city_gen.get_city_bcubes(bcubes);}
 void get_city_road_bcubes(vect_cube_t &bcubes, bool connector_only) {city_gen.get_all_road_bcubes(bcubes, connector_only);}
 void get_city_plot_bcubes(vector<cube_with_zval_t> &bcubes) {city_gen.get_all_plot_bcubes(bcubes);}
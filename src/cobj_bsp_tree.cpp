@@ -5,14 +5,24 @@
 #include "3DWorld.h"
 #include "cobj_bsp_tree.h"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#define USE_SSE_RAY_PACKETS
+#include <immintrin.h>
+#endif
+
 
 unsigned const MAX_LEAF_SIZE = 2;
 float const POLY_TOLER       = 1.0E-6;
 float const OVERLAP_AMT      = 0.02;
+float const REFIT_REBUILD_COST = 1.5; // rebuild a subtree during refit when its SAH cost has grown by this factor since it was built
+unsigned const SAH_NUM_BINS      = 16;
+unsigned const SAH_MAX_LEAF_SIZE = 8;
+float const SAH_TRAVERSAL_COST   = 0.5; // relative to the cost of intersecting one object
 
 
-extern bool mt_cobj_tree_build, begin_motion;
+extern bool mt_cobj_tree_build, begin_motion, refit_dynamic_cobj_tree, cobj_tree_sah_build;
 extern int display_mode, frame_counter, cobj_counter;
+extern unsigned cobj_tree_bench_max_objs;
 extern coll_obj_group coll_objects;
 extern vector<unsigned> falling_cobjs;
 extern set<unsigned> moving_cobjs;
@@ -145,6 +155,91 @@ bool cobj_tree_base::node_ix_mgr::check_node(unsigned &nix) const {
 }
 
 
+// *** binned SAH split ***
+
+
+struct sah_split_t {
+	unsigned dim, bin;
+	float lo, scale;
+
+	unsigned get_bin(point const &center, unsigned d) const {
+		return min(SAH_NUM_BINS-1, unsigned(max(0.0f, (center[d] - lo)*scale)));
+	}
+	bool is_left(point const &center) const {return (get_bin(center, dim) < bin);}
+};
+
+// bins object centroids along each dim and picks the split plane with the lowest SAH cost;
+// returns false if the objects should be placed in a leaf, either because it's cheaper or because the centroids can't be separated
+template<typename F> bool find_sah_split(cube_t const &bcube, unsigned start, unsigned end, F const &get_obj_bcube, sah_split_t &split) {
+
+	struct bin_t {
+		cube_t bc;
+		unsigned count;
+		bin_t() : count(0) {}
+		void add(cube_t const &c) {if (count++ == 0) {bc = c;} else {bc.union_with_cube(c);}}
+	};
+	unsigned const num(end - start);
+	assert(num > 0);
+	cube_t cent_bc;
+
+	for (unsigned i = start; i < end; ++i) {
+		point const center(get_obj_bcube(i).get_cube_center());
+		if (i == start) {cent_bc.set_from_point(center);} else {cent_bc.union_with_pt(center);}
+	}
+	bin_t bins[3][SAH_NUM_BINS];
+	sah_split_t dsplits[3];
+
+	for (unsigned d = 0; d < 3; ++d) {
+		float const extent(cent_bc.d[d][1] - cent_bc.d[d][0]);
+		dsplits[d].dim   = d;
+		dsplits[d].lo    = cent_bc.d[d][0];
+		dsplits[d].scale = ((extent > 0.0) ? SAH_NUM_BINS/extent : 0.0);
+	}
+	for (unsigned i = start; i < end; ++i) {
+		cube_t const bc(get_obj_bcube(i));
+		point const center(bc.get_cube_center());
+
+		for (unsigned d = 0; d < 3; ++d) {
+			if (dsplits[d].scale > 0.0) {bins[d][dsplits[d].get_bin(center, d)].add(bc);}
+		}
+	}
+	float const area(bcube.get_area()), inv_area((area > 0.0) ? 1.0/area : 0.0);
+	float best_cost(0.0);
+	bool found(0);
+
+	for (unsigned d = 0; d < 3; ++d) {
+		if (dsplits[d].scale == 0.0) continue; // all centroids are at the same value in this dim
+		float right_area[SAH_NUM_BINS];
+		unsigned right_count[SAH_NUM_BINS];
+		bin_t left, right;
+
+		for (unsigned b = SAH_NUM_BINS-1; b > 0; --b) { // sweep right to left
+			if (bins[d][b].count > 0) {
+				if (right.count == 0) {right.bc = bins[d][b].bc;} else {right.bc.union_with_cube(bins[d][b].bc);}
+				right.count += bins[d][b].count;
+			}
+			right_area [b] = ((right.count > 0) ? right.bc.get_area() : 0.0);
+			right_count[b] = right.count;
+		}
+		for (unsigned b = 0; b+1 < SAH_NUM_BINS; ++b) { // sweep left to right, splitting after bin b
+			if (bins[d][b].count > 0) {
+				if (left.count == 0) {left.bc = bins[d][b].bc;} else {left.bc.union_with_cube(bins[d][b].bc);}
+				left.count += bins[d][b].count;
+			}
+			if (left.count == 0 || right_count[b+1] == 0) continue;
+			float const cost(SAH_TRAVERSAL_COST + (left.bc.get_area()*left.count + right_area[b+1]*right_count[b+1])*inv_area);
+			if (found && cost >= best_cost) continue;
+			split     = dsplits[d];
+			split.bin = b+1;
+			best_cost = cost;
+			found     = 1;
+		}
+	} // for d
+	if (!found) return 0; // can't split
+	return (num > SAH_MAX_LEAF_SIZE || best_cost < num); // split if cheaper than a leaf, or if there are too many objects for a leaf
+}
+
+
 // *** cobj_tree_simple_type_t ***
 
 
@@ -164,6 +259,12 @@ inline float get_vhi(sphere_t const &s, unsigned dim) {return (s.pos[dim] + s.ra
 inline float get_vlo(cube_t const &c,   unsigned dim) {return c.d[dim][0];}
 inline float get_vhi(cube_t const &c,   unsigned dim) {return c.d[dim][1];}
 
+template<typename T> cube_t get_obj_bcube(T const &obj) {
+	cube_t bc;
+	UNROLL_3X(bc.d[i_][0] = get_vlo(obj, i_); bc.d[i_][1] = get_vhi(obj, i_);)
+	return bc;
+}
+
 
 template<typename T> void cobj_tree_simple_type_t<T>::build_tree(unsigned nix, unsigned skip_dims, unsigned depth) {
 
@@ -173,40 +274,50 @@ template<typename T> void cobj_tree_simple_type_t<T>::build_tree(unsigned nix, u
 	unsigned const num(n.end - n.start);
 	max_depth = max(max_depth, depth);
 	if (check_for_leaf(num, skip_dims)) return; // base case
-
-	// determine split dimension and value
-	float max_sz(0), sval(0);
-	unsigned const dim(n.get_split_dim(max_sz, sval, skip_dims));
-
-	if (max_sz == 0) { // can't split
-		register_leaf(num);
-		return;
+	unsigned bin_count[3] = {0, 0, 0};
+
+	if (use_sah_build) { // split into two bins by centroid
+		sah_split_t split;
+		if (!find_sah_split(n, n.start, n.end, [this](unsigned i) {return get_obj_bcube(objects[i]);}, split)) {register_leaf(num); return;}
+		auto const mid(std::partition(objects.begin()+n.start, objects.begin()+n.end, [&split](T const &obj) {return split.is_left(get_obj_bcube(obj).get_cube_center());}));
+		bin_count[0] = unsigned(mid - (objects.begin()+n.start));
+		bin_count[1] = num - bin_count[0];
 	}
-	float const sval_lo(sval+OVERLAP_AMT*max_sz), sval_hi(sval-OVERLAP_AMT*max_sz);
-	unsigned pos(n.start), bin_count[3];
-	if (temp_bins[1].capacity() == 0) {temp_bins[1].reserve(11*num/20);} // reserve to 55% to hopefully avoid vector doubling
+	else {
+		// determine split dimension and value
+		float max_sz(0), sval(0);
+		unsigned const dim(n.get_split_dim(max_sz, sval, skip_dims));
 
-	// split in this dimension
-	for (unsigned i = n.start; i < n.end; ++i) {
-		unsigned bix(2);
-		T const &obj(objects[i]);
-		if (get_vhi(obj, dim) <= sval_lo) {bix =  (depth&1);} // ends   before the split, put in bin 0
-		if (get_vlo(obj, dim) >= sval_hi) {bix = !(depth&1);} // starts after  the split, put in bin 1
-		if (bix == 0) {objects[pos++] = objects[i];} else {temp_bins[bix].push_back(obj);}
-	}
-	bin_count[0] = (pos - n.start);
+		if (max_sz == 0) { // can't split
+			register_leaf(num);
+			return;
+		}
+		float const sval_lo(sval+OVERLAP_AMT*max_sz), sval_hi(sval-OVERLAP_AMT*max_sz);
+		unsigned pos(n.start);
+		if (temp_bins[1].capacity() == 0) {temp_bins[1].reserve(11*num/20);} // reserve to 55% to hopefully avoid vector doubling
+
+		// split in this dimension
+		for (unsigned i = n.start; i < n.end; ++i) {
+			unsigned bix(2);
+			T const &obj(objects[i]);
+			if (get_vhi(obj, dim) <= sval_lo) {bix =  (depth&1);} // ends   before the split, put in bin 0
+			if (get_vlo(obj, dim) >= sval_hi) {bix = !(depth&1);} // starts after  the split, put in bin 1
+			if (bix == 0) {objects[pos++] = objects[i];} else {temp_bins[bix].push_back(obj);}
+		}
+		bin_count[0] = (pos - n.start);
 
-	for (unsigned d = 1; d < 3; ++d) {
-		bin_count[d] = temp_bins[d].size();
-		for (unsigned i = 0; i < bin_count[d]; ++i) {objects[pos++] = temp_bins[d][i];}
-		temp_bins[d].resize(0);
-	}
-	assert(pos == n.end);
+		for (unsigned d = 1; d < 3; ++d) {
+			bin_count[d] = temp_bins[d].size();
+			for (unsigned i = 0; i < bin_count[d]; ++i) {objects[pos++] = temp_bins[d][i];}
+			temp_bins[d].resize(0);
+		}
+		assert(pos == n.end);
 
-	// check that dataset has been subdivided (not all in one bin)
-	if (bin_count[0] == num || bin_count[1] == num || bin_count[2] == num) {
-		build_tree(nix, (skip_dims | (1 << dim)), depth); // single bin, rebin with a different dim
-		return;
+		// check that dataset has been subdivided (not all in one bin)
+		if (bin_count[0] == num || bin_count[1] == num || bin_count[2] == num) {
+			build_tree(nix, (skip_dims | (1 << dim)), depth); // single bin, rebin with a different dim
+			return;
+		}
 	}
 	// create child nodes and call recursively
 	unsigned cur(n.start);
@@ -365,19 +476,25 @@ void cobj_tree_sphere_t::get_ids_int_sphere(point const &center, float radius, v
 // *** cobj_bvh_tree ***
 
 
-bool cobj_bvh_tree::create_cixs() {
+void cobj_bvh_tree::get_cixs(vector<unsigned> &ids) const { // Note: ids are added in sorted order
 
 	if (is_dynamic && !is_static) { // use dynamic_ids
 		for (cobj_id_set_t::const_iterator i = cobjs->dynamic_ids.begin(); i != cobjs->dynamic_ids.end(); ++i) {
 			assert(*i < cobjs->size());
 			assert((*cobjs)[*i].status == COLL_DYNAMIC);
-			add_cobj(*i);
+			if (obj_ok((*cobjs)[*i])) {ids.push_back(*i);}
 		}
 	}
 	else {
-		if (is_static && !occluders_only && !cubes_only) {cixs.reserve(cobjs->size());} // normal static mode
-		for (unsigned i = 0; i < cobjs->size(); ++i) {add_cobj(i);}
+		if (is_static && !occluders_only && !cubes_only) {ids.reserve(cobjs->size());} // normal static mode
+		for (unsigned i = 0; i < cobjs->size(); ++i) {if (obj_ok((*cobjs)[i])) {ids.push_back(i);}}
 	}
+}
+
+
+bool cobj_bvh_tree::create_cixs() {
+
+	get_cixs(cixs);
 	assert(cixs.size() < (1 << 29));
 	return !cixs.empty();
 }
@@ -396,6 +513,7 @@ void cobj_bvh_tree::clear() {
 
 	cobj_tree_base::clear();
 	cixs.resize(0);
+	build_node_costs.clear(); // no longer refittable
 }
 
 
@@ -419,6 +537,7 @@ void cobj_bvh_tree::add_cobjs(bool verbose) {
 void cobj_bvh_tree::build_tree_from_cixs(bool do_mt_build) {
 
 	max_depth = max_leaf_count = num_leaf_nodes = 0;
+	has_node_gaps = do_mt_build; // the MT build leaves unused nodes between the top level subtrees
 	nodes.resize(get_conservative_num_nodes(cixs.size()) + 64*do_mt_build); // add 8 extra nodes for each of 8 top level splits
 	unsigned const root(0);
 	nodes[root] = tree_node(0, (unsigned)cixs.size());
@@ -435,6 +554,193 @@ void cobj_bvh_tree::build_tree_from_cixs(bool do_mt_build) {
 }
 
 
+// *** cobj_bvh_tree refit ***
+
+
+// per-node subtree SAH cost with unit traversal and intersection costs; kids always come after their parent, so iterate in reverse
+void cobj_bvh_tree::calc_node_costs(vector<tree_node> const &nodes_, vector<float> &costs) {
+
+	costs.resize(nodes_.size());
+
+	for (unsigned nix = (unsigned)nodes_.size(); nix-- > 0;) {
+		tree_node const &n(nodes_[nix]);
+		float cost(n.get_area());
+		if (n.start < n.end) {costs[nix] = cost*(n.end - n.start); continue;} // leaf
+		for (unsigned kid = nix+1; kid < n.next_node_id; kid = nodes_[kid].next_node_id) {cost += costs[kid];}
+		costs[nix] = cost;
+	}
+}
+
+
+float cobj_bvh_tree::get_sah_cost() const { // normalized to the root node area
+
+	if (nodes.empty()) return 0.0;
+	vector<float> costs;
+	calc_node_costs(nodes, costs);
+	float const root_area(nodes[0].get_area());
+	return ((root_area > 0.0) ? costs[0]/root_area : 0.0);
+}
+
+
+void cobj_bvh_tree::record_build_state() {
+
+	if (nodes.empty() || has_node_gaps) {build_node_costs.clear(); return;} // refit not supported
+	sorted_cixs = cixs;
+	sort(sorted_cixs.begin(), sorted_cixs.end());
+	calc_node_costs(nodes, build_node_costs);
+}
+
+
+bool cobj_bvh_tree::refit_node_bboxes() { // returns true if any bbox changed
+
+	bool changed(0);
+
+	for (unsigned nix = (unsigned)nodes.size(); nix-- > 0;) { // update kids before their parents
+		tree_node &n(nodes[nix]);
+		cube_t const prev(n);
+		
+		if (n.start < n.end) {calc_node_bbox(n);} // leaf
+		else { // branch: union of kid bboxes
+			unsigned kid(nix+1);
+			assert(kid < n.next_node_id);
+			n.copy_from(nodes[kid]);
+			for (kid = nodes[kid].next_node_id; kid < n.next_node_id; kid = nodes[kid].next_node_id) {n.union_with_cube(nodes[kid]);}
+		}
+		changed |= (n != prev);
+	}
+	return changed;
+}
+
+
+// rebuilds the subtree rooted at branch node nix in place and returns the index of the node following it
+unsigned cobj_bvh_tree::rebuild_subtree(unsigned nix) {
+
+	unsigned const end_nix(nodes[nix].next_node_id);
+	unsigned first_leaf(nix), last_leaf(end_nix-1); // leaves are in the same order as their cixs ranges
+	while (nodes[first_leaf].start == nodes[first_leaf].end) {++first_leaf; assert(first_leaf < end_nix);}
+	assert(nodes[last_leaf].start < nodes[last_leaf].end);
+	vector<tree_node> sub_nodes(get_conservative_num_nodes(nodes[last_leaf].end - nodes[first_leaf].start) + 1);
+	sub_nodes.swap(nodes); // build_tree() operates on nodes
+	nodes[0] = tree_node(sub_nodes[first_leaf].start, sub_nodes[last_leaf].end);
+	per_thread_data ptd(1, nodes.size(), 1);
+	build_tree(0, 0, 0, ptd);
+	nodes.resize(ptd.get_next_node_ix());
+	nodes[0].next_node_id = (unsigned)nodes.size();
+	sub_nodes.swap(nodes);
+	vector<float> sub_costs;
+	calc_node_costs(sub_nodes, sub_costs);
+	// splice the new subtree into the nodes and costs, and shift any node IDs that point past it
+	unsigned const new_end_nix(nix + (unsigned)sub_nodes.size());
+
+	for (auto i = nodes.begin(); i != nodes.end(); ++i) {
+		if (i->next_node_id >= end_nix) {i->next_node_id = i->next_node_id - end_nix + new_end_nix;}
+	}
+	for (auto i = sub_nodes.begin(); i != sub_nodes.end(); ++i) {i->next_node_id += nix;}
+	nodes.erase (nodes.begin()+nix, nodes.begin()+end_nix);
+	nodes.insert(nodes.begin()+nix, sub_nodes.begin(), sub_nodes.end());
+
+	for (unsigned c = 0; c < 2; ++c) {
+		vector<float> &costs(c ? node_costs : build_node_costs);
+		costs.erase (costs.begin()+nix, costs.begin()+end_nix);
+		costs.insert(costs.begin()+nix, sub_costs.begin(), sub_costs.end());
+	}
+	return new_end_nix;
+}
+
+
+// updates node bboxes bottom-up for moved objects, then rebuilds the highest subtrees whose SAH cost has degraded
+void cobj_bvh_tree::refit(bool verbose) {
+
+	RESET_TIME;
+	if (!refit_node_bboxes()) return; // nothing moved
+	calc_node_costs(nodes, node_costs);
+	assert(node_costs.size() == build_node_costs.size());
+
+	if (node_costs[0] > REFIT_REBUILD_COST*build_node_costs[0]) { // the entire tree has degraded
+		build_tree_from_cixs(0); // single threaded so that it can still be refit
+		record_build_state();
+		if (verbose) {PRINT_TIME(" Cobj Tree Refit Full Rebuild");}
+		return;
+	}
+	unsigned num_rebuilt(0);
+
+	for (unsigned nix = 1; nix < nodes.size();) {
+		tree_node const &n(nodes[nix]);
+		if (n.start == n.end && node_costs[nix] > REFIT_REBUILD_COST*build_node_costs[nix]) {nix = rebuild_subtree(nix); ++num_rebuilt;} // degraded branch
+		else {++nix;}
+	}
+	if (verbose) {
+		PRINT_TIME(" Cobj Tree Refit");
+		cout << "cobjs: " << cixs.size() << ", nodes: " << nodes.size() << ", subtrees rebuilt: " << num_rebuilt << endl;
+	}
+}
+
+
+// refits the tree if the set of objects is unchanged since the last build, otherwise rebuilds it
+void cobj_bvh_tree::update_cobjs(bool verbose) {
+
+	if (!nodes.empty() && build_node_costs.size() == nodes.size()) { // refittable
+		temp_cixs.clear();
+		get_cixs(temp_cixs);
+		if (temp_cixs == sorted_cixs) {refit(verbose); return;}
+	}
+	add_cobjs(verbose);
+	record_build_state();
+}
+
+
+// compares full rebuilds vs. refits of a tree of randomly moving cubes for object counts from 1K to max_objs
+void run_cobj_tree_refit_benchmark(unsigned max_objs) {
+
+	unsigned const num_frames(100), num_rays(10000);
+	float const scene_sz(10.0);
+	cout << "Cobj tree rebuild vs. refit for " << num_frames << " frames:" << endl;
+
+	for (unsigned num = 1000; num <= max_objs; num *= 4) {
+		coll_obj_group cobjs;
+		cobjs.resize(num);
+		vector<vector3d> vels(num);
+		float const obj_sz(scene_sz/pow(float(num), 1.0f/3.0f)); // constant density
+		int times[2] = {0}, ray_times[2] = {0};
+		float sah_costs[2] = {0.0};
+
+		for (unsigned mode = 0; mode < 2; ++mode) { // 0=rebuild, 1=refit
+			rand_gen_t rgen; // same objects and motion for both modes
+
+			for (unsigned i = 0; i < num; ++i) {
+				coll_obj &c(cobjs[i]);
+				c.type   = COLL_CUBE;
+				c.status = COLL_DYNAMIC;
+				c.set_from_point(rgen.signed_rand_vector(scene_sz));
+				c.expand_by(obj_sz*rgen.rand_uniform(0.1, 0.5));
+				vels[i] = rgen.signed_rand_vector(0.05*obj_sz); // per-frame motion
+			}
+			cobj_bvh_tree tree(&cobjs, 0, 0, 0, 0, 1); // all cobjs
+			tree.update_cobjs(0);
+			int const start_time(GET_TIME_MS());
+
+			for (unsigned f = 0; f < num_frames; ++f) {
+				for (unsigned i = 0; i < num; ++i) {cobjs[i].translate(vels[i]);}
+				if (mode) {tree.update_cobjs(0);} else {tree.add_cobjs(0);}
+			}
+			times[mode] = GET_TIME_MS() - start_time;
+			sah_costs[mode] = tree.get_sah_cost();
+			int const ray_start_time(GET_TIME_MS());
+
+			for (unsigned r = 0; r < num_rays; ++r) {
+				point cpos;
+				vector3d cnorm;
+				int cindex(-1);
+				tree.check_coll_line(rgen.signed_rand_vector(scene_sz), rgen.signed_rand_vector(scene_sz), cpos, cnorm, cindex, -1, 1, 0, 0, 0, 0);
+			}
+			ray_times[mode] = GET_TIME_MS() - ray_start_time;
+		} // for mode
+		cout << "objects: " << num << ", rebuild: " << times[0] << " ms, refit: " << times[1] << " ms, SAH cost: " << sah_costs[0] << " vs. " << sah_costs[1]
+			 << ", " << num_rays << " rays: " << ray_times[0] << " vs. " << ray_times[1] << " ms" << endl;
+	} // for num
+}
+
+
 // test_alpha: 0 = allow any alpha value, 1 = require alpha = 1.0, 2 = get intersected cobj with max alpha, 3 = require alpha >= MIN_SHADOW_ALPHA
 bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex,
 	int ignore_cobj, bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const
@@ -477,6 +783,115 @@ bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpo
 }
 
 
+// SoA ray data for testing all rays of a packet against a node bbox at once, 8-wide with AVX, 4-wide with SSE, or scalar otherwise
+struct ray_packet_t {
+	alignas(32) float org[3][RAY_PACKET_SIZE], dinv[3][RAY_PACKET_SIZE], tmax[RAY_PACKET_SIZE];
+
+	ray_packet_t(unsigned num, point const *p1, point const *p2) {
+		static_assert((RAY_PACKET_SIZE % 8) == 0, "ray packet size must be a multiple of the AVX width");
+
+		for (unsigned i = 0; i < RAY_PACKET_SIZE; ++i) {
+			bool const valid(i < num);
+			tmax[i] = (valid ? 1.0 : -1.0); // unused rays never intersect anything
+
+			for (unsigned d = 0; d < 3; ++d) {
+				float const delta(valid ? (p2[i][d] - p1[i][d]) : 1.0);
+				org [d][i] = (valid ? p1[i][d] : 0.0);
+				dinv[d][i] = 1.0/((fabs(delta) < 1.0E-20) ? ((delta < 0.0) ? -1.0E-20 : 1.0E-20) : delta); // avoid 0*inf = NaN in the slab test
+			}
+		}
+	}
+	unsigned get_hit_mask(float const d[3][2]) const { // bit i is set if ray i intersects the cube in the range [0, tmax[i])
+		unsigned mask(0);
+#if defined(__AVX__)
+		for (unsigned i = 0; i < RAY_PACKET_SIZE; i += 8) {
+			__m256 tmin_v(_mm256_setzero_ps()), tmax_v(_mm256_load_ps(tmax + i));
+
+			for (unsigned dim = 0; dim < 3; ++dim) {
+				__m256 const o(_mm256_load_ps(org[dim] + i)), di(_mm256_load_ps(dinv[dim] + i));
+				__m256 const t1(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(d[dim][0]), o), di)), t2(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(d[dim][1]), o), di));
+				tmin_v = _mm256_max_ps(tmin_v, _mm256_min_ps(t1, t2));
+				tmax_v = _mm256_min_ps(tmax_v, _mm256_max_ps(t1, t2));
+			}
+			mask |= (_mm256_movemask_ps(_mm256_cmp_ps(tmin_v, tmax_v, _CMP_LT_OQ)) << i);
+		}
+#elif defined(USE_SSE_RAY_PACKETS)
+		for (unsigned i = 0; i < RAY_PACKET_SIZE; i += 4) {
+			__m128 tmin_v(_mm_setzero_ps()), tmax_v(_mm_load_ps(tmax + i));
+
+			for (unsigned dim = 0; dim < 3; ++dim) {
+				__m128 const o(_mm_load_ps(org[dim] + i)), di(_mm_load_ps(dinv[dim] + i));
+				__m128 const t1(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(d[dim][0]), o), di)), t2(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(d[dim][1]), o), di));
+				tmin_v = _mm_max_ps(tmin_v, _mm_min_ps(t1, t2));
+				tmax_v = _mm_min_ps(tmax_v, _mm_max_ps(t1, t2));
+			}
+			mask |= (_mm_movemask_ps(_mm_cmplt_ps(tmin_v, tmax_v)) << i);
+		}
+#else
+		for (unsigned i = 0; i < RAY_PACKET_SIZE; ++i) {
+			float tmin_s(0.0), tmax_s(tmax[i]);
+
+			for (unsigned dim = 0; dim < 3; ++dim) {
+				float const t1((d[dim][0] - org[dim][i])*dinv[dim][i]), t2((d[dim][1] - org[dim][i])*dinv[dim][i]);
+				tmin_s = max(tmin_s, min(t1, t2));
+				tmax_s = min(tmax_s, max(t1, t2));
+			}
+			if (tmin_s < tmax_s) {mask |= (1 << i);}
+		}
+#endif
+		return mask;
+	}
+};
+
+
+// exact closest hit for up to RAY_PACKET_SIZE coherent rays, with the same results as check_coll_line() with exact=1;
+// each node is visited once for the packet and skipped only when all active rays miss it
+void cobj_bvh_tree::check_coll_line_packet(unsigned num, point const *p1, point const *p2, point *cpos, vector3d *cnorm, int *cindex,
+	int ignore_cobj, int test_alpha, bool skip_non_drawn, bool const *skip_init_colls, bool skip_movable) const
+{
+	assert(num <= RAY_PACKET_SIZE);
+	for (unsigned r = 0; r < num; ++r) {cindex[r] = -1;}
+	if (nodes.empty() || num == 0) return;
+	ray_packet_t packet(num, p1, p2);
+	float max_alpha[RAY_PACKET_SIZE] = {0.0};
+	unsigned const num_nodes((unsigned)nodes.size());
+
+	for (unsigned nix = 0; nix < num_nodes;) {
+		tree_node const &n(nodes[nix]);
+		unsigned const mask(packet.get_hit_mask(n.d));
+
+		if (mask == 0) {
+			assert(n.next_node_id > nix);
+			nix = n.next_node_id; // all rays failed the bbox test
+			continue;
+		}
+		++nix;
+
+		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
+			if ((int)cixs[i] == ignore_cobj) continue;
+			coll_obj const &c(get_cobj(i));
+			if (!obj_ok(c))                                             continue;
+			if (skip_non_drawn  && !c.cp.might_be_drawn())              continue;
+			if (skip_movable    && c.is_movable())                      continue;
+			if (test_alpha == 1 && c.is_semi_trans())                   continue; // semi-transparent, can see through
+			if (test_alpha == 3 && c.cp.color.alpha < MIN_SHADOW_ALPHA) continue; // less than min alpha
+
+			for (unsigned r = 0; r < num; ++r) {
+				if (!(mask & (1 << r))) continue; // this ray missed the node bbox
+				if (test_alpha == 2 && c.cp.color.alpha <= max_alpha[r]) continue; // lower alpha than an earlier object
+				if (skip_init_colls && skip_init_colls[r] && c.contains_pt(p1[r]) && c.contains_point(p1[r])) continue;
+				float t(0.0);
+				if (!c.line_int_exact(p1[r], p2[r], t, cnorm[r], 0.0, packet.tmax[r])) continue;
+				cindex[r]      = cixs[i];
+				cpos  [r]      = p1[r] + (p2[r] - p1[r])*t;
+				max_alpha[r]   = c.cp.color.alpha;
+				packet.tmax[r] = t; // shorten the ray so that farther nodes and objects are skipped
+			}
+		}
+	}
+}
+
+
 bool cobj_bvh_tree::check_point_contained(point const &p, int &cindex) const {
 
 	unsigned const num_nodes((unsigned)nodes.size());
@@ -683,46 +1098,56 @@ void cobj_bvh_tree::build_tree(unsigned nix, unsigned skip_dims, unsigned depth,
 	unsigned const num(n.end - n.start);
 	max_depth = max(max_depth, depth);
 	if (check_for_leaf(num, skip_dims)) return; // base case
-	
-	// determine split dimension and value
-	float max_sz(0), sval(0);
-	unsigned const dim(n.get_split_dim(max_sz, sval, skip_dims));
-
-	if (max_sz == 0) { // can't split
-		register_leaf(num);
-		return;
+	unsigned bin_count[3] = {0, 0, 0};
+
+	if (use_sah_build) { // split into two bins by centroid
+		sah_split_t split;
+		if (!find_sah_split(n, n.start, n.end, [this](unsigned i) {return cube_t(get_cobj(i));}, split)) {register_leaf(num); return;}
+		auto const mid(std::partition(cixs.begin()+n.start, cixs.begin()+n.end, [this, &split](unsigned cix) {return split.is_left((*cobjs)[cix].get_cube_center());}));
+		bin_count[0] = unsigned(mid - (cixs.begin()+n.start));
+		bin_count[1] = num - bin_count[0];
 	}
-	float const sval_lo(sval+OVERLAP_AMT*max_sz), sval_hi(sval-OVERLAP_AMT*max_sz);
-	unsigned pos(n.start), bin_count[3];
+	else {
+		// determine split dimension and value
+		float max_sz(0), sval(0);
+		unsigned const dim(n.get_split_dim(max_sz, sval, skip_dims));
 
-	// split in this dimension: use upper 2 bits of cixs for storing bin index
-	for (unsigned i = n.start; i < n.end; ++i) {
-		unsigned bix(2);
-		coll_obj const &cobj(get_cobj(i));
-		float const *vals(cobj.d[dim]);
+		if (max_sz == 0) { // can't split
+			register_leaf(num);
+			return;
+		}
+		float const sval_lo(sval+OVERLAP_AMT*max_sz), sval_hi(sval-OVERLAP_AMT*max_sz);
+		unsigned pos(n.start);
+
+		// split in this dimension: use upper 2 bits of cixs for storing bin index
+		for (unsigned i = n.start; i < n.end; ++i) {
+			unsigned bix(2);
+			coll_obj const &cobj(get_cobj(i));
+			float const *vals(cobj.d[dim]);
 		
-		if (vals[0] > vals[1]) {
-			std::cerr << "Invalid collision object bounding cube in BVH tree: " << TXT(is_static) << TXT(is_dynamic) << TXT(i) << TXT(cixs[i]) << TXT(dim)
-				      << TXT(vals[0]) << TXT(vals[1]) << TXTi(cobj.type) << TXTi(cobj.status) << " bcube=" << cobj.str() << endl;
-			assert(0);
+			if (vals[0] > vals[1]) {
+				std::cerr << "Invalid collision object bounding cube in BVH tree: " << TXT(is_static) << TXT(is_dynamic) << TXT(i) << TXT(cixs[i]) << TXT(dim)
+						  << TXT(vals[0]) << TXT(vals[1]) << TXTi(cobj.type) << TXTi(cobj.status) << " bcube=" << cobj.str() << endl;
+				assert(0);
+			}
+			if (vals[1] <= sval_lo) {bix =  (depth&1);} // ends   before the split, put in bin 0
+			if (vals[0] >= sval_hi) {bix = !(depth&1);} // starts after  the split, put in bin 1
+			if (bix == 0) {cixs[pos++] = cixs[i];} else {ptd.temp_bins[bix].push_back(cixs[i]);}
 		}
-		if (vals[1] <= sval_lo) {bix =  (depth&1);} // ends   before the split, put in bin 0
-		if (vals[0] >= sval_hi) {bix = !(depth&1);} // starts after  the split, put in bin 1
-		if (bix == 0) {cixs[pos++] = cixs[i];} else {ptd.temp_bins[bix].push_back(cixs[i]);}
-	}
-	bin_count[0] = (pos - n.start);
+		bin_count[0] = (pos - n.start);
 
-	for (unsigned d = 1; d < 3; ++d) {
-		bin_count[d] = ptd.temp_bins[d].size();
-		for (unsigned i = 0; i < bin_count[d]; ++i) {cixs[pos++] = ptd.temp_bins[d][i];}
-		ptd.temp_bins[d].resize(0);
-	}
-	assert(pos == n.end);
+		for (unsigned d = 1; d < 3; ++d) {
+			bin_count[d] = ptd.temp_bins[d].size();
+			for (unsigned i = 0; i < bin_count[d]; ++i) {cixs[pos++] = ptd.temp_bins[d][i];}
+			ptd.temp_bins[d].resize(0);
+		}
+		assert(pos == n.end);
 
-	// check that dataset has been subdivided (not all in one bin)
-	if (bin_count[0] == num || bin_count[1] == num || bin_count[2] == num) {
-		build_tree(nix, (skip_dims | (1 << dim)), depth, ptd); // single bin, rebin with a different dim
-		return;
+		// check that dataset has been subdivided (not all in one bin)
+		if (bin_count[0] == num || bin_count[1] == num || bin_count[2] == num) {
+			build_tree(nix, (skip_dims | (1 << dim)), depth, ptd); // single bin, rebin with a different dim
+			return;
+		}
 	}
 	// create child nodes and call recursively
 	unsigned cur(n.start);
@@ -782,13 +1207,16 @@ void build_static_moving_cobj_tree() {
 void build_cobj_tree(bool dynamic, bool verbose) {
 	
 	if (!dynamic) { // static
+		get_tree(0).set_sah_build(cobj_tree_sah_build);
 		get_tree(0).add_cobjs(verbose);
 		cobj_tree_occlude.add_cobjs(verbose);
 		//cout << "occluders: " << cobj_tree_occlude.get_num_objs() << endl;
 		//cobj_tree_triangles.add_cobjs(coll_objects, verbose);
 	}
 	else { // dynamic
-		if (begin_motion) {get_tree(1).add_cobjs(verbose);}
+		static bool bench_done(0);
+		if (cobj_tree_bench_max_objs > 0 && !bench_done) {run_cobj_tree_refit_benchmark(cobj_tree_bench_max_objs); bench_done = 1;}
+		if (begin_motion) {if (refit_dynamic_cobj_tree) {get_tree(1).update_cobjs(verbose);} else {get_tree(1).add_cobjs(verbose);}}
 		//build_static_moving_cobj_tree();
 	}
 }
@@ -799,12 +1227,27 @@ bool check_coll_line_exact_tree(point const &p1, point const &p2, point &cpos, v
 {
 	cindex = -1;
 	//return cobj_tree_triangles.check_coll_line(p1, p2, cpos, cnorm, cindex, ignore_cobj, 1);
-	bool ret(get_tree(dynamic).check_coll_line(p1, p2, cpos, cnorm, cindex, ignore_cobj, 1, test_alpha, skip_non_drawn, skip_init_colls, skip_movable));
-	if (!dynamic && !no_stat_moving) {ret |= cobj_tree_static_moving.check_coll_line(p1, (ret ? cpos : p2), cpos, cnorm, cindex, ignore_cobj, 1, test_alpha, skip_non_drawn, skip_init_colls, skip_movable);}
-	if (!dynamic && include_voxels) {ret |= check_voxel_coll_line(p1, (ret ? cpos : p2), cpos, cnorm, cindex, ignore_cobj, 1);}
+	bool const ret(get_tree(dynamic).check_coll_line(p1, p2, cpos, cnorm, cindex, ignore_cobj, 1, test_alpha, skip_non_drawn, skip_init_colls, skip_movable));
+	if (dynamic) return ret;
+	return check_coll_line_exact_tree_rest(p1, p2, cpos, cnorm, cindex, ignore_cobj, ret, test_alpha, skip_non_drawn, include_voxels, skip_init_colls, skip_movable, no_stat_moving);
+}
+
+// the part of check_coll_line_exact_tree() for the static tree that comes after the main BVH query; ret is the result of that query
+bool check_coll_line_exact_tree_rest(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
+	bool ret, int test_alpha, bool skip_non_drawn, bool include_voxels, bool skip_init_colls, bool skip_movable, bool no_stat_moving)
+{
+	if (!no_stat_moving) {ret |= cobj_tree_static_moving.check_coll_line(p1, (ret ? cpos : p2), cpos, cnorm, cindex, ignore_cobj, 1, test_alpha, skip_non_drawn, skip_init_colls, skip_movable);}
+	if (include_voxels ) {ret |= check_voxel_coll_line(p1, (ret ? cpos : p2), cpos, cnorm, cindex, ignore_cobj, 1);}
 	return ret;
 }
 
+// packet version of the main static BVH query in check_coll_line_exact_tree(); each ray should be finished with check_coll_line_exact_tree_rest()
+void check_coll_line_exact_tree_packet(unsigned num, point const *p1, point const *p2, point *cpos, vector3d *cnorm, int *cindex,
+	int ignore_cobj, int test_alpha, bool skip_non_drawn, bool const *skip_init_colls, bool skip_movable)
+{
+	get_tree(0).check_coll_line_packet(num, p1, p2, cpos, cnorm, cindex, ignore_cobj, test_alpha, skip_non_drawn, skip_init_colls, skip_movable);
+}
+
 // can use with snow shadows, grass shadows, tree leaf shadows
 bool check_coll_line_tree(point const &p1, point const &p2, int &cindex, int ignore_cobj, bool dynamic,
 	int test_alpha, bool skip_non_drawn, bool include_voxels, bool skip_init_colls, bool skip_movable)
@@ -5,6 +5,8 @@
 
 #include "physics_objects.h"
 
+unsigned const RAY_PACKET_SIZE = 8; // max rays per cobj_bvh_tree::check_coll_line_packet() call
+
 
 class cobj_tree_base {
 
@@ -21,6 +23,7 @@ protected:
 
 	vector<tree_node> nodes;
 	unsigned max_depth, max_leaf_count, num_leaf_nodes;
+	bool use_sah_build;
 
 	inline void register_leaf(unsigned num) {
 		++num_leaf_nodes;
@@ -40,7 +43,8 @@ protected:
 	};
 
 public:
-	cobj_tree_base() : max_depth(0), max_leaf_count(0), num_leaf_nodes(0) {}
+	cobj_tree_base() : max_depth(0), max_leaf_count(0), num_leaf_nodes(0), use_sah_build(0) {}
+	void set_sah_build(bool enable) {use_sah_build = enable;} // slower binned SAH build for higher quality trees
 	bool is_empty() const {return nodes.empty();}
 	void clear() {nodes.resize(0);}
 	bool get_root_bcube(cube_t &bc) const;
@@ -108,7 +112,10 @@ class cobj_bvh_tree : public cobj_tree_base {
 
 	coll_obj_group const *cobjs;
 	vector<unsigned> cixs;
-	bool is_static, is_dynamic, occluders_only, cubes_only, inc_voxel_cobjs;
+	bool is_static, is_dynamic, occluders_only, cubes_only, inc_voxel_cobjs, has_node_gaps;
+	// refit state: sorted object IDs and per-node subtree SAH costs from the last build, used to detect object set changes and tree degradation
+	vector<unsigned> sorted_cixs, temp_cixs;
+	vector<float> build_node_costs, node_costs;
 
 	struct per_thread_data {
 		vector<unsigned> temp_bins[3];
@@ -122,12 +129,17 @@ class cobj_bvh_tree : public cobj_tree_base {
 		void increment_node_ix() {assert(cur_nix >= start_nix); cur_nix++;}
 	};
 
-	void add_cobj(unsigned ix) {if (obj_ok((*cobjs)[ix])) {cixs.push_back(ix);}}
 	coll_obj const &get_cobj(unsigned ix) const {return (*cobjs)[cixs[ix]];}
+	void get_cixs(vector<unsigned> &ids) const;
 	bool create_cixs();
 	void calc_node_bbox(tree_node &n) const;
 	void build_tree_top_level_omp();
 	void build_tree(unsigned nix, unsigned skip_dims, unsigned depth, per_thread_data &ptd);
+	static void calc_node_costs(vector<tree_node> const &nodes_, vector<float> &costs);
+	void record_build_state();
+	bool refit_node_bboxes();
+	unsigned rebuild_subtree(unsigned nix);
+	void refit(bool verbose);
 
 	bool obj_ok(coll_obj const &c) const {
 		return (((is_static && c.status == COLL_STATIC) || (is_dynamic && c.status == COLL_DYNAMIC) || (!is_static && !is_dynamic)) &&
@@ -137,15 +149,19 @@ class cobj_bvh_tree : public cobj_tree_base {
 
 public:
 	cobj_bvh_tree(coll_obj_group const *cobjs_, bool s, bool d, bool o, bool c, bool v)
-		: cobjs(cobjs_), is_static(s), is_dynamic(d), occluders_only(o), cubes_only(c), inc_voxel_cobjs(v) {assert(cobjs);}
+		: cobjs(cobjs_), is_static(s), is_dynamic(d), occluders_only(o), cubes_only(c), inc_voxel_cobjs(v), has_node_gaps(0) {assert(cobjs);}
 
 	unsigned get_num_objs() const {return cixs.size();}
 	void clear();
 	void add_cobj_ids(vector<unsigned> const &cids) {assert(cixs.empty() && !cids.empty()); cixs = cids;}
 	void add_cobjs(bool verbose);
 	void build_tree_from_cixs(bool do_mt_build);
+	void update_cobjs(bool verbose);
+	float get_sah_cost() const;
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
 		bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const;
+	void check_coll_line_packet(unsigned num, point const *p1, point const *p2, point *cpos, vector3d *cnorm, int *cindex, int ignore_cobj,
+		int test_alpha, bool skip_non_drawn, bool const *skip_init_colls, bool skip_movable) const;
 	bool check_point_contained(point const &p, int &cindex) const;
 	void get_intersecting_cobjs(cube_t const &cube, vector<unsigned> &cobjs, int ignore_cobj, float toler, bool check_ccounter, int id_for_cobj_int) const;
 	bool is_cobj_contained(point const &viewer, point const *const pts, unsigned npts, int ignore_cobj, int &cobj) const;
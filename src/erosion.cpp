@@ -4,17 +4,153 @@
 
 #include "3DWorld.h"
 #include "mesh.h"
+#include "function_registry.h"
 #include <cfloat> // for FLT_EPSILON
+#include <climits> // for UINT_MAX
+#include <atomic>
+#include <omp.h>
 
 
+extern bool deterministic_erosion, benchmark_erosion;
+extern unsigned erosion_tile_size;
 extern float erode_amount, water_plane_z;
 
+int const EROSION_PAD       = 4;    // padding around the full heightmap, filled with clamped edge values
+int const EROSION_TILE_HALO = 32;   // context around each tile when eroding a subset of a larger heightmap; droplets can wander into it, but changes there are discarded
+int const EROSION_BAND_ROWS = 16;   // rows per band when merging droplet results in deterministic mode
+unsigned const EROSION_BATCH_SIZE = 1024; // droplets simulated against the same heightmap state in deterministic mode; must not depend on the thread count
 
-// see http://ranmantaru.com/blog/2011/10/08/water-erosion-on-heightmap-terrain/
-void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters) {
 
-	if (num_iters == 0 || erode_amount <= 0.0) return; // erosion disabled
-	RESET_TIME;
+// a deposit or erosion at one grid cell, recorded by a droplet in deterministic mode and applied when the batch is merged
+struct erosion_op_t {
+	unsigned droplet, ix;
+	float delta;
+	bool erode, in_grid;
+	erosion_op_t(unsigned droplet_, unsigned ix_, float delta_, bool erode_, bool in_grid_) : droplet(droplet_), ix(ix_), delta(delta_), erode(erode_), in_grid(in_grid_) {}
+};
+
+
+// padded copy of a rectangular region of a heightmap, along with the erosion/deposition state of each cell
+class erosion_grid_t {
+	int x1, y1, xsize, ysize, pad;
+public:
+	int const NX, NY;
+	vector<vector2d> erosion;
+	vector<float> mh_padded;
+
+	erosion_grid_t(float const *heightmap, int hxsize, int hysize, int x1_, int y1_, int xsize_, int ysize_, int pad_) :
+		x1(x1_), y1(y1_), xsize(xsize_), ysize(ysize_), pad(pad_), NX(xsize+2*pad), NY(ysize+2*pad), erosion(NX*NY, vector2d(0.0, 0.0)), mh_padded(NX*NY)
+	{
+		// pad the region on each side to create a buffer around the edges that can be discarded;
+		// this is filled with neighboring heightmap values when available, and clamped edge values otherwise
+		for (int y = 0; y < NY; ++y) {
+			int const offset(max(min(y1+y-pad, hysize-1), 0)*hxsize);
+
+			for (int x = 0; x < NX; ++x) {
+				mh_padded[y*NX + x] = heightmap[max(min(x1+x-pad, hxsize-1), 0) + offset];
+			}
+		}
+	}
+	int get_xsize() const {return xsize;}
+	int get_ysize() const {return ysize;}
+	int get_pad  () const {return pad;}
+	unsigned get_index(int x, int y) const {return NX*max(min(y, NY-1), 0) + max(min(x, NX-1), 0);}
+	float get_height(int x, int y) const {return mh_padded[get_index(x, y)];}
+	bool is_outside(int x, int y) const {return (x < 0 || y < 0 || x >= NX || y >= NY);}
+
+	// these apply changes directly, and are also the interface used by simulate_droplet() for reading heights and recording changes
+	void begin_droplet() {}
+	void deposit(unsigned droplet, unsigned ix, float delta, bool in_grid) {
+		erosion[ix].y += delta;
+		if (in_grid) {mh_padded[ix] += delta;}
+	}
+	void erode(unsigned droplet, unsigned ix, float delta) {
+		mh_padded[ix] -= delta;
+		vector2d &e(erosion[ix]);
+		if (delta <= e.y) {e.y -= delta;} else {e.x += delta - e.y; e.y = 0;}
+	}
+	void apply_op(erosion_op_t const &op) {
+		if (op.erode) {erode(op.droplet, op.ix, op.delta);} else {deposit(op.droplet, op.ix, op.delta, op.in_grid);}
+	}
+	void write_back(float *heightmap, int hxsize, float min_zval) const { // remove padding and clamp to min_zval
+		for (int y = 0; y < ysize; ++y) {
+			for (int x = 0; x < xsize; ++x) {
+				heightmap[(y+y1)*hxsize + x+x1] = max(min_zval, mh_padded[(y+pad)*NX + x+pad]);
+			}
+		}
+	}
+};
+
+
+// height changes made by the current droplet, which it must see in order to fill pits and terminate;
+// stored in an open addressed hash table that's reused across droplets
+class droplet_height_deltas_t {
+	vector<pair<unsigned, float> > slots; // {grid index, height delta}; index is UINT_MAX if unused
+	vector<unsigned> used; // slots to reset on clear()
+
+	unsigned find_slot(unsigned ix) const {
+		unsigned const mask(slots.size() - 1);
+		unsigned slot((ix*2654435761U) & mask);
+		while (slots[slot].first != ix && slots[slot].first != UINT_MAX) {slot = (slot + 1) & mask;}
+		return slot;
+	}
+public:
+	droplet_height_deltas_t() : slots(256, make_pair(UINT_MAX, 0.0f)) {}
+
+	float get(unsigned ix) const {
+		pair<unsigned, float> const &s(slots[find_slot(ix)]);
+		return ((s.first == ix) ? s.second : 0.0f);
+	}
+	void add(unsigned ix, float delta) {
+		if (2*(used.size() + 1) > slots.size()) { // keep the load factor below 0.5
+			vector<pair<unsigned, float> > old_slots(2*slots.size(), make_pair(UINT_MAX, 0.0f));
+			old_slots.swap(slots);
+			used.clear();
+			for (auto const &s : old_slots) {if (s.first != UINT_MAX) {add(s.first, s.second);}}
+		}
+		unsigned const slot(find_slot(ix));
+		if (slots[slot].first == UINT_MAX) {slots[slot].first = ix; used.push_back(slot);}
+		slots[slot].second += delta;
+	}
+	void clear() {
+		for (unsigned slot : used) {slots[slot] = make_pair(UINT_MAX, 0.0f);}
+		used.clear();
+	}
+};
+
+
+// per-thread list of recorded droplet changes, bucketed by row band so that bands can be merged in parallel;
+// heights are read from the grid as of the start of the batch plus the changes made by the current droplet
+class erosion_op_buffer_t {
+	erosion_grid_t const *grid;
+	unsigned band_size;
+	droplet_height_deltas_t deltas;
+public:
+	vector<vector<erosion_op_t> > bands;
+
+	erosion_op_buffer_t(erosion_grid_t const &grid_) : grid(&grid_), band_size(grid_.NX*EROSION_BAND_ROWS), bands((grid_.NY + EROSION_BAND_ROWS - 1)/EROSION_BAND_ROWS) {}
+	void add(erosion_op_t const &op) {bands[op.ix/band_size].push_back(op);}
+	float get_height(int x, int y) const {
+		unsigned const ix(grid->get_index(x, y));
+		return grid->mh_padded[ix] + deltas.get(ix);
+	}
+	void begin_droplet() {deltas.clear();}
+
+	void deposit(unsigned droplet, unsigned ix, float delta, bool in_grid) {
+		add(erosion_op_t(droplet, ix, delta, 0, in_grid));
+		if (in_grid) {deltas.add(ix, delta);}
+	}
+	void erode(unsigned droplet, unsigned ix, float delta) {
+		add(erosion_op_t(droplet, ix, delta, 1, 1));
+		deltas.add(ix, -delta);
+	}
+	void clear() {for (auto &b : bands) {b.clear();}}
+};
+
+
+// see http://ranmantaru.com/blog/2011/10/08/water-erosion-on-heightmap-terrain/
+// heights are read from and changes are sent to writer, which is either grid itself or an erosion_op_buffer_t
+template<typename T> void simulate_droplet(erosion_grid_t const &grid, T &writer, unsigned droplet) {
 	// Kq and minSlope are for soil carry capacity.
 	// Kw is water evaporation speed.
 	// Kr is erosion speed (how fast the soil is removed).
@@ -22,28 +158,14 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 	// Ki is direction inertia. Higher values make channel turns smoother.
 	// g is gravity that accelerates the flows.
 	float const Kq=10, Kw=0.001f, Kr=0.9f, Kd=0.02f, Ki=0.1f, minSlope=0.05f, g=20, Kg=g*2;
-	int const PAD(4), NX(xsize+2*PAD), NY(ysize+2*PAD);
-	unsigned const MAX_PATH_LEN(4*NX*NY);
-	vector<vector2d> erosion(NX*NY, vector2d(0.0, 0.0));
-	vector<float> mh_padded(NX*NY);
-
-	// pad mesh by 1 unit on each side to create a buffer of trash around the edges that can be discarded
-	for (int y = 0; y < NY; ++y) {
-		int const offset(max(min(y-PAD, ysize-1), 0)*xsize);
-
-		for (int x = 0; x < NX; ++x) {
-			mh_padded[y*NX + x] = heightmap[max(min(x-PAD, xsize-1), 0) + offset];
-		}
-	}
+	unsigned const MAX_PATH_LEN(4*grid.NX*grid.NY);
+	int const PAD(grid.get_pad());
 
-#define HMAP_INDEX(x, y) (NX*max(min(y, NY-1), 0) + max(min(x, NX-1), 0))
-#define HMAP(x, y) mh_padded[HMAP_INDEX(x, y)]
+#define HMAP(x, y) writer.get_height((x), (y))
 
 #define DEPOSIT_AT(X, Z, W) { \
 	float const delta = ds*erode_amount*(W); \
-	unsigned const ix(HMAP_INDEX((X), (Z))); \
-	erosion[ix].y += delta; \
-	if (!(X < 0 || Z < 0 || X >= NX || Z >= NY)) {mh_padded[ix] += delta;} \
+	writer.deposit(droplet, grid.get_index((X), (Z)), delta, !grid.is_outside((X), (Z))); \
 }
 
 #define DEPOSIT(H) \
@@ -55,111 +177,215 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 
 #define ERODE(X, Z, W) { \
 	float const delta=ds*erode_amount*(W); \
-	unsigned const ix(HMAP_INDEX((X), (Z))); \
-	mh_padded[ix]-=delta; \
-	vector2d &e=erosion[ix]; \
-	float r=e.x, d=e.y; \
-	if (delta<=d) {d-=delta;} else {r+=delta-d; d=0;} \
-	e.x=r; e.y=d; \
+	writer.erode(droplet, grid.get_index((X), (Z)), delta); \
 }
 
-#pragma omp parallel for schedule(dynamic,1)
-	for (int iter=0; iter < (int)num_iters; ++iter) {
-		rand_gen_t rgen;
-		rgen.set_state(iter+11, 79*iter+121);
-		int xi = PAD + (rgen.rand()%xsize);
-		int zi = PAD + (rgen.rand()%ysize);
-		float xp=xi, zp=zi, xf=0, zf=0, s=0, v=0, w=1, dx=0, dz=0;
-		float h=HMAP(xi, zi), h00=h, h10=HMAP(xi+1, zi), h01=HMAP(xi, zi+1), h11=HMAP(xi+1, zi+1);
-
-		unsigned numMoves=0;
-		for (; numMoves<MAX_PATH_LEN; ++numMoves) {
-			// calc gradient
-			float gx=h00+h01-h10-h11, gz=h00+h10-h01-h11;
-			// calc next pos
-			dx=(dx-gx)*Ki+gx;
-			dz=(dz-gz)*Ki+gz;
-
-			float dl=sqrtf(dx*dx+dz*dz);
-			if (dl<=FLT_EPSILON) { // pick random dir
-				float a=rgen.rand_float()*TWO_PI;
-				dx=cosf(a); dz=sinf(a);
-			}
-			else {
-				dx/=dl; dz/=dl;
+	writer.begin_droplet();
+	rand_gen_t rgen;
+	rgen.set_state(droplet+11, 79*droplet+121);
+	int xi = PAD + (rgen.rand()%grid.get_xsize());
+	int zi = PAD + (rgen.rand()%grid.get_ysize());
+	float xp=xi, zp=zi, xf=0, zf=0, s=0, v=0, w=1, dx=0, dz=0;
+	float h=HMAP(xi, zi), h00=h, h10=HMAP(xi+1, zi), h01=HMAP(xi, zi+1), h11=HMAP(xi+1, zi+1);
+
+	unsigned numMoves=0;
+	for (; numMoves<MAX_PATH_LEN; ++numMoves) {
+		// calc gradient
+		float gx=h00+h01-h10-h11, gz=h00+h10-h01-h11;
+		// calc next pos
+		dx=(dx-gx)*Ki+gx;
+		dz=(dz-gz)*Ki+gz;
+
+		float dl=sqrtf(dx*dx+dz*dz);
+		if (dl<=FLT_EPSILON) { // pick random dir
+			float a=rgen.rand_float()*TWO_PI;
+			dx=cosf(a); dz=sinf(a);
+		}
+		else {
+			dx/=dl; dz/=dl;
+		}
+		float nxp=xp+dx, nzp=zp+dz;
+		// sample next height
+		int nxi=floor(nxp), nzi=floor(nzp);
+		float nxf=nxp-nxi, nzf=nzp-nzi;
+		float nh00=HMAP(nxi, nzi), nh10=HMAP(nxi+1, nzi), nh01=HMAP(nxi, nzi+1), nh11=HMAP(nxi+1, nzi+1);
+		float nh=(nh00*(1-nxf)+nh10*nxf)*(1-nzf)+(nh01*(1-nxf)+nh11*nxf)*nzf;
+		// adjust by HALF_DXY = average mesh texel size - this is river depth
+		if (max(max(nh00, nh10), max(nh01, nh11)) < water_plane_z - HALF_DXY) break; // reached ocean water, stop and ignore sediment
+
+		// if higher than current, try to deposit sediment up to neighbour height
+		bool const outside(grid.is_outside(xi, zi));
+		if (nh>=h || outside) {
+			float ds=(nh-h)+0.001f;
+
+			if (ds>=s || outside) {
+				ds=s;
+				DEPOSIT(h) // deposit all sediment
+				s=0;
+				break; // stop
 			}
-			float nxp=xp+dx, nzp=zp+dz;
-			// sample next height
-			int nxi=floor(nxp), nzi=floor(nzp);
-			float nxf=nxp-nxi, nzf=nzp-nzi;
-			float nh00=HMAP(nxi, nzi), nh10=HMAP(nxi+1, nzi), nh01=HMAP(nxi, nzi+1), nh11=HMAP(nxi+1, nzi+1);
-			float nh=(nh00*(1-nxf)+nh10*nxf)*(1-nzf)+(nh01*(1-nxf)+nh11*nxf)*nzf;
-			// adjust by HALF_DXY = average mesh texel size - this is river depth
-			if (max(max(nh00, nh10), max(nh01, nh11)) < water_plane_z - HALF_DXY) break; // reached ocean water, stop and ignore sediment
-
-			// if higher than current, try to deposit sediment up to neighbour height
-			bool const outside(xi < 0 || zi < 0 || xi >= NX || zi >= NY);
-			if (nh>=h || outside) {
-				float ds=(nh-h)+0.001f;
-
-				if (ds>=s || outside) {
-					ds=s;
-					DEPOSIT(h) // deposit all sediment
-					s=0;
-					break; // stop
+			DEPOSIT(h)
+			s-=ds;
+			v=0;
+		}
+		// compute transport capacity
+		float dh=h-nh;
+		float slope=dh;
+		//float slope=dh/sqrtf(dh*dh+1);
+		float q=max(slope, minSlope)*v*w*Kq;
+
+		// deposit/erode (don't erode more than dh)
+		float ds=s-q;
+		if (ds>=0) { // deposit
+			ds*=Kd;
+			//ds=minval(ds, 1.0f);
+			DEPOSIT(dh)
+			s-=ds;
+		}
+		else { // erode
+			ds*=-Kr;
+			ds=min(ds, dh*0.99f);
+			ds*=((get_bare_ls_tid(nh) == ROCK_TEX) ? 0.5 : 2.0); // rock erodes slower than dirt/sand
+
+			for (int z=zi-1; z<=zi+2; ++z) {
+				float zo=z-zp, zo2=zo*zo;
+
+				for (int x=xi-1; x<=xi+2; ++x) {
+					float xo=x-xp;
+					float w=1-(xo*xo+zo2)*0.25f;
+					if (w<=0) continue;
+					w*=0.1591549430918953f;
+					ERODE(x, z, w)
 				}
-				DEPOSIT(h)
-				s-=ds;
-				v=0;
-			}
-			// compute transport capacity
-			float dh=h-nh;
-			float slope=dh;
-			//float slope=dh/sqrtf(dh*dh+1);
-			float q=max(slope, minSlope)*v*w*Kq;
-
-			// deposit/erode (don't erode more than dh)
-			float ds=s-q;
-			if (ds>=0) { // deposit
-				ds*=Kd;
-				//ds=minval(ds, 1.0f);
-				DEPOSIT(dh)
-				s-=ds;
 			}
-			else { // erode
-				ds*=-Kr;
-				ds=min(ds, dh*0.99f);
-				ds*=((get_bare_ls_tid(nh) == ROCK_TEX) ? 0.5 : 2.0); // rock erodes slower than dirt/sand
-
-				for (int z=zi-1; z<=zi+2; ++z) {
-					float zo=z-zp, zo2=zo*zo;
-
-					for (int x=xi-1; x<=xi+2; ++x) {
-						float xo=x-xp;
-						float w=1-(xo*xo+zo2)*0.25f;
-						if (w<=0) continue;
-						w*=0.1591549430918953f;
-						ERODE(x, z, w)
-					}
+			dh-=ds;
+			s+=ds;
+		}
+		// move to the neighbor
+		v=sqrtf(v*v+Kg*dh);
+		w*=1-Kw;
+		xp=nxp; zp=nzp; xi=nxi; zi=nzi; xf=nxf; zf=nzf;
+		h=nh; h00=nh00; h10=nh10; h01=nh01; h11=nh11;
+	} // for numMoves
+	if (numMoves>=MAX_PATH_LEN) {cout << "droplet path is too long: " << droplet << endl;}
+#undef HMAP
+#undef DEPOSIT_AT
+#undef DEPOSIT
+#undef ERODE
+}
+
+
+// fast, but the results depend on thread timing because droplets read and write the shared grid without synchronization
+void erode_grid_shared(erosion_grid_t &grid, unsigned first_droplet, unsigned num_droplets) {
+#pragma omp parallel for schedule(dynamic,1)
+	for (int i = 0; i < (int)num_droplets; ++i) {simulate_droplet(grid, grid, first_droplet+i);}
+}
+
+// droplets are simulated in fixed size batches against the heightmap state at the start of the batch, and their changes are recorded in per-thread buffers;
+// the changes are then merged in droplet order for each row band, so the results are the same for any number of threads
+void erode_grid_deterministic(erosion_grid_t &grid, unsigned first_droplet, unsigned num_droplets) {
+	unsigned const num_threads(omp_get_max_threads_3dw());
+	vector<erosion_op_buffer_t> buffers(num_threads, erosion_op_buffer_t(grid));
+	int const num_bands(buffers.front().bands.size());
+
+	for (unsigned batch_start = 0; batch_start < num_droplets; batch_start += EROSION_BATCH_SIZE) {
+		unsigned const batch_end(min(num_droplets, batch_start+EROSION_BATCH_SIZE));
+		for (auto &b : buffers) {b.clear();}
+
+		// static scheduling ensures each thread processes its droplets in increasing order, which is required by the merge below
+#pragma omp parallel for schedule(static,16)
+		for (int i = batch_start; i < (int)batch_end; ++i) {simulate_droplet(grid, buffers[omp_get_thread_num_3dw()], first_droplet+i);}
+
+#pragma omp parallel for schedule(dynamic,1)
+		for (int b = 0; b < num_bands; ++b) {
+			vector<unsigned> pos(num_threads, 0);
+
+			while (1) { // merge the per-thread op lists for this band by droplet
+				unsigned next_thread(num_threads), next_droplet(UINT_MAX);
+
+				for (unsigned t = 0; t < num_threads; ++t) {
+					vector<erosion_op_t> const &ops(buffers[t].bands[b]);
+					if (pos[t] < ops.size() && ops[pos[t]].droplet < next_droplet) {next_droplet = ops[pos[t]].droplet; next_thread = t;}
 				}
-				dh-=ds;
-				s+=ds;
+				if (next_thread == num_threads) break; // done
+				vector<erosion_op_t> const &ops(buffers[next_thread].bands[b]);
+				unsigned &p(pos[next_thread]);
+				for (; p < ops.size() && ops[p].droplet == next_droplet; ++p) {grid.apply_op(ops[p]);}
+			} // while
+		} // for b
+	} // for batch_start
+}
+
+void erode_grid(erosion_grid_t &grid, unsigned first_droplet, unsigned num_droplets, bool deterministic) {
+	if (deterministic) {erode_grid_deterministic(grid, first_droplet, num_droplets);} else {erode_grid_shared(grid, first_droplet, num_droplets);}
+}
+
+
+// reports droplets/sec for a range of thread counts, and checks that deterministic mode produces the same results for each
+void benchmark_erosion_threads(float const *heightmap, int xsize, int ysize, unsigned num_iters) {
+	int const max_threads(omp_get_max_threads_3dw());
+	vector<float> ref_mh;
+	cout << "Erosion benchmark for " << xsize << "x" << ysize << " heightmap with " << num_iters << " droplets:" << endl;
+
+	for (unsigned deterministic = 0; deterministic < 2; ++deterministic) {
+		for (int num_threads = 1; num_threads <= max_threads; num_threads = ((num_threads == max_threads) ? max_threads+1 : min(2*num_threads, max_threads))) {
+			omp_set_num_threads(num_threads);
+			erosion_grid_t grid(heightmap, xsize, ysize, 0, 0, xsize, ysize, EROSION_PAD);
+			int const start_time(GET_TIME_MS());
+			erode_grid(grid, 0, num_iters, (deterministic != 0));
+			int const elapsed_ms(max(1, (GET_TIME_MS() - start_time)));
+			cout << (deterministic ? "  deterministic " : "  shared ") << num_threads << " threads: " << elapsed_ms << "ms, " << 1000.0*num_iters/elapsed_ms << " droplets/sec";
+
+			if (deterministic) {
+				if (ref_mh.empty()) {ref_mh.swap(grid.mh_padded);}
+				else {cout << ((grid.mh_padded == ref_mh) ? ", results match" : ", results DIFFER");}
+			}
+			cout << endl;
+		} // for num_threads
+	} // for deterministic
+	omp_set_num_threads(max_threads);
+}
+
+
+// erodes the region {x1, y1} to {x1+rxsize, y1+rysize} of a heightmap of size {xsize, ysize}, using neighboring heights outside the region for context;
+// first_droplet is used to seed the droplets so that different regions of the same heightmap get different droplet positions
+void apply_erosion_region(float *heightmap, int xsize, int ysize, int x1, int y1, int rxsize, int rysize, float min_zval, unsigned num_iters, unsigned first_droplet) {
+
+	if (num_iters == 0 || erode_amount <= 0.0 || rxsize <= 0 || rysize <= 0) return; // erosion disabled
+	assert(x1 >= 0 && y1 >= 0 && x1+rxsize <= xsize && y1+rysize <= ysize);
+	bool const full_map(rxsize == xsize && rysize == ysize);
+	erosion_grid_t grid(heightmap, xsize, ysize, x1, y1, rxsize, rysize, (full_map ? EROSION_PAD : EROSION_TILE_HALO));
+	erode_grid(grid, first_droplet, num_iters, deterministic_erosion);
+	grid.write_back(heightmap, xsize, min_zval);
+}
+
+
+void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters) {
+
+	if (num_iters == 0 || erode_amount <= 0.0) return; // erosion disabled
+	RESET_TIME;
+
+	if (benchmark_erosion && omp_get_max_threads_3dw() > 1) { // only benchmark once, and not from single threaded tile generation
+		static std::atomic<bool> benchmark_done(0);
+		if (!benchmark_done.exchange(1)) {benchmark_erosion_threads(heightmap, xsize, ysize, num_iters);}
+	}
+	unsigned const tile_size(erosion_tile_size);
+
+	if (tile_size == 0 || (xsize <= (int)tile_size && ysize <= (int)tile_size)) { // single tile
+		apply_erosion_region(heightmap, xsize, ysize, 0, 0, xsize, ysize, min_zval, num_iters, 0);
+	}
+	else { // large heightmap; split into tiles and erode them in sequence, distributing droplets based on area
+		float const droplets_per_texel(float(num_iters)/(float(xsize)*float(ysize)));
+		unsigned first_droplet(0);
+
+		for (int y = 0; y < ysize; y += tile_size) {
+			for (int x = 0; x < xsize; x += tile_size) {
+				int const rxsize(min((int)tile_size, xsize-x)), rysize(min((int)tile_size, ysize-y));
+				unsigned const tile_iters(round_fp(droplets_per_texel*rxsize*rysize));
+				apply_erosion_region(heightmap, xsize, ysize, x, y, rxsize, rysize, min_zval, tile_iters, first_droplet);
+				first_droplet += tile_iters;
 			}
-			// move to the neighbor
-			v=sqrtf(v*v+Kg*dh);
-			w*=1-Kw;
-			xp=nxp; zp=nzp; xi=nxi; zi=nzi; xf=nxf; zf=nzf;
-			h=nh; h00=nh00; h10=nh10; h01=nh01; h11=nh11;
-		} // for numMoves
-		if (numMoves>=MAX_PATH_LEN) {cout << "droplet path is too long: " << iter << endl;}
-	} // for iter
-
-	// remove padding and clamp to min_zval
-	for (int y = 0; y < ysize; ++y) {
-		for (int x = 0; x < xsize; ++x) {
-			heightmap[y*xsize + x] = max(min_zval, mh_padded[(y+PAD)*NX + x+PAD]);
 		}
 	}
 	PRINT_TIME("Erosion");
 }
-
@@ -19,10 +19,13 @@ protected:
 	char buffer[MAX_CHARS] = {0};
 	char file_buf[FILE_BUF_SZ] = {0};
 	unsigned file_buf_pos, file_buf_end;
+	char const *mem_buf; // if set, characters are read from this in-memory range rather than from fp
+	size_t mem_pos, mem_end;
 
 	bool open_file(bool binary=0);
 	void close_file();
-	int get_next_char() {assert(fp); return get_char(fp);}
+	void set_mem_buf(char const *buf, size_t sz) {mem_buf = buf; mem_pos = 0; mem_end = sz;}
+	int get_next_char() {assert(fp || mem_buf); return get_char(fp);}
 	void unget_last_char(int c);
 	static bool fast_isspace(char c) {return (c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r');}
 	static bool fast_isdigit(char c) {return (c >= '0' && c <= '9');}
@@ -69,7 +72,7 @@ protected:
 	bool read_string(char *s, unsigned max_len);
 
 public:
-	base_file_reader(std::string const &fn) : filename(fn), fp(NULL), verbose(0), file_buf_pos(0), file_buf_end(0) {assert(!fn.empty());}
+	base_file_reader(std::string const &fn) : filename(fn), fp(NULL), verbose(0), file_buf_pos(0), file_buf_end(0), mem_buf(nullptr), mem_pos(0), mem_end(0) {assert(!fn.empty());}
 	~base_file_reader() {close_file();}
 };
 
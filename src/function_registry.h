@@ -9,6 +9,9 @@ struct xform_matrix;
 struct cube_with_zval_t;
 
 int omp_get_thread_num_3dw();
+int omp_get_max_threads_3dw();
+void omp_enable_nested_3dw();
+void omp_restore_nested_3dw();
 
 // function prototypes - main (3DWorld.cpp, etc.)
 bool get_gl_error(unsigned loc_id=0);
@@ -80,6 +83,7 @@ void gen_scene(int generate_mesh, int gen_trees, int keep_sin_table, int update_
 void write_def_coll_objects_file();
 void init_models();
 void free_models();
+bool warm_texture_cache();
 
 // function prototypes - display_world
 void glClearColor_rgba(const colorRGBA &color);
@@ -260,6 +264,7 @@ float get_tiled_terrain_height_tex(float xval, float yval, bool nearest_texel=0)
 vector3d get_tiled_terrain_height_tex_norm(int x, int y);
 bool write_default_hmap_modmap();
 float update_tiled_terrain(float &min_camera_dist);
+void init_tt_heightmap_and_buildings();
 void pre_draw_tiled_terrain();
 void render_tt_models(int reflection_pass, bool transparent_pass);
 void draw_tiled_terrain(int reflection_pass);
@@ -320,6 +325,7 @@ void gen_gauss_rand_arr();
 bool bmp_to_chars(char const *const fname, unsigned char **&data);
 void gen_mesh(int surface_type, int keep_sin_table, int update_zvals);
 float do_glaciate_exp(float value);
+uint64_t get_mesh_gen_params_hash();
 float get_rel_wpz();
 void init_terrain_mesh();
 float eval_mesh_sin_terms(float xv, float yv);
@@ -337,6 +343,7 @@ bool save_state(const char *filename);
 
 // function prototypes - erosion
 void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters);
+void apply_erosion_region(float *heightmap, int xsize, int ysize, int x1, int y1, int rxsize, int rysize, float min_zval, unsigned num_iters, unsigned first_droplet);
 
 // function prototypes - city_gen
 template<typename T> bool check_bcubes_sphere_coll(vector<T> const &bcubes, point const &sc, float radius, bool xy_only);
@@ -349,6 +356,7 @@ float get_road_max_width();
 float get_min_obj_spacing();
 void gen_cities(float *heightmap, unsigned xsize, unsigned ysize);
 void gen_city_details();
+bool run_city_sim_benchmark();
 void get_city_bcubes(vect_cube_t &bcubes);
 void get_city_road_bcubes(vect_cube_t &bcubes, bool connector_only);
 void get_city_plot_bcubes(vector<cube_with_zval_t> &bcubes);
@@ -448,6 +456,10 @@ void build_static_moving_cobj_tree();
 void build_cobj_tree(bool dynamic=0, bool verbose=1);
 bool check_coll_line_exact_tree(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
 	bool dynamic=0, int test_alpha=0, bool skip_non_drawn=0, bool include_voxels=1, bool skip_init_colls=0, bool skip_movable=0, bool no_stat_moving=0);
+bool check_coll_line_exact_tree_rest(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
+	bool ret, int test_alpha, bool skip_non_drawn, bool include_voxels, bool skip_init_colls, bool skip_movable, bool no_stat_moving);
+void check_coll_line_exact_tree_packet(unsigned num, point const *p1, point const *p2, point *cpos, vector3d *cnorm, int *cindex,
+	int ignore_cobj, int test_alpha, bool skip_non_drawn, bool const *skip_init_colls, bool skip_movable);
 bool check_coll_line_tree(point const &p1, point const &p2, int &cindex, int ignore_cobj, bool dynamic=0, int test_alpha=0,
 	bool skip_non_drawn=0, bool include_voxels=1, bool skip_init_colls=0, bool skip_movable=0);
 bool cobj_contained_tree(point const &viewer, point const *const pts, unsigned npts, int ignore_cobj, int &cobj);
@@ -590,6 +602,7 @@ void update_water_zval(int x, int y, float old_mh);
 
 // function prototypes - textures
 void load_texture_names();
+void load_texture_files();
 void load_textures();
 unsigned get_loaded_textures_cpu_mem();
 unsigned get_loaded_textures_gpu_mem();
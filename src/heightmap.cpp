@@ -7,17 +7,36 @@
 #include "inlines.h"
 #include "file_utils.h"
 #include "sinf.h"
+#include "model3d.h" // for fnv_hasher_t
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h> // for stat
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
 
 bool const APPLY_2X_EROSION_DOWNSAMPLE = 0; // faster, but more noise
 unsigned const TEX_EDGE_MODE = 2; // 0 = clamp, 1 = cliff/underwater, 2 = mirror
+unsigned const HMAP_TILE_SIZE = 256; // in pixels
+unsigned const HMAP_TILE_MAGIC = 0x544d4848; // "HHMT"
+unsigned const HMAP_TILE_VERSION = 2; // version 2 adds source_key
 
-extern unsigned hmap_filter_width, erosion_iters_tt;
+extern unsigned hmap_filter_width, erosion_iters_tt, hmap_tile_cache_mb;
 extern int display_mode;
 extern float mesh_scale, dxdy;
-extern string hmap_out_fn;
+extern string hmap_out_fn, hmap_tile_fn;
+
+bool have_cities();
 
 
 void adjust_brush_weight(float &delta, float dval, int shape) {
@@ -111,6 +130,268 @@ void heightmap_t::modify_heightmap_value(unsigned x, unsigned y, int val, bool v
 }
 
 
+// hash of the current heightmap values, including any erosion, city flattening, and mod map edits; used to validate cached tile data
+uint64_t heightmap_t::get_data_hash() const {
+
+	if (!is_allocated()) return 0;
+	fnv_hasher_t hasher;
+	hasher.add(width);
+	hasher.add(height);
+	hasher.add(ncolors);
+	size_t const nbytes(num_bytes()), num_words(nbytes/sizeof(uint64_t));
+	for (size_t i = 0; i < num_words; ++i) {uint64_t w; memcpy(&w, data + i*sizeof(uint64_t), sizeof(uint64_t)); hasher.add(w);}
+	for (size_t i = num_words*sizeof(uint64_t); i < nbytes; ++i) {hasher.add(data[i]);}
+	return hasher.get();
+}
+
+
+// *** tiled_heightmap_t ***
+
+bool tiled_heightmap_t::is_tile_file(string const &fn) {
+	return (fn.size() > 4 && fn.compare(fn.size()-4, 4, ".hmt") == 0);
+}
+
+// identifies the source image and how it was read, so that a tile file can be checked against it without loading the image; returns 0 if not found
+uint64_t tiled_heightmap_t::get_source_key(string const &image_fn, bool invert_y) {
+
+	struct stat st;
+	if (stat(image_fn.c_str(), &st) != 0) return 0;
+	fnv_hasher_t hasher;
+	for (char c : image_fn) {hasher.add((unsigned char)c);}
+	hasher.add(image_fn.size());
+	hasher.add((uint64_t)st.st_size);
+	hasher.add((uint64_t)st.st_mtime);
+	hasher.add(invert_y);
+	return max(hasher.get(), uint64_t(1)); // zero is reserved for "unknown"
+}
+
+// converts a PNG/TIFF/BMP/etc. heightmap image into a pre-tiled file; the source image is loaded once here, but never by the tile reader
+bool tiled_heightmap_t::convert_image(string const &image_fn, string const &tile_fn, bool invert_y) {
+
+	cout << "Converting heightmap " << image_fn << " to tiled heightmap " << tile_fn << endl;
+	timer_t timer("Heightmap Tile Conversion");
+	heightmap_t hmap(0, 7, 0, 0, image_fn, invert_y);
+	hmap.load(-1, 0, 1, 1);
+	assert(hmap.is_allocated() && hmap.width > 0 && hmap.height > 0);
+	assert(hmap.ncolors == 1 || hmap.ncolors == 2); // one or two byte grayscale
+	header_t header;
+	header.magic           = HMAP_TILE_MAGIC;
+	header.version         = HMAP_TILE_VERSION;
+	header.width           = hmap.width;
+	header.height          = hmap.height;
+	header.tile_size       = HMAP_TILE_SIZE;
+	header.bytes_per_pixel = hmap.ncolors;
+	header.data_hash       = hmap.get_data_hash();
+	header.source_key      = get_source_key(image_fn, invert_y);
+	FILE *fp(fopen(tile_fn.c_str(), "wb"));
+
+	if (fp == NULL) {
+		cerr << "Error opening tiled heightmap " << tile_fn << " for write" << endl;
+		hmap.free_data();
+		return 0;
+	}
+	bool success(fwrite(&header, sizeof(header_t), 1, fp) == 1);
+	unsigned const tsz(header.tile_size), bpp(header.bytes_per_pixel);
+	unsigned const ntx((header.width + tsz - 1)/tsz), nty((header.height + tsz - 1)/tsz);
+	vector<unsigned char> tile(tsz*tsz*bpp);
+
+	for (unsigned ty = 0; ty < nty && success; ++ty) {
+		for (unsigned tx = 0; tx < ntx && success; ++tx) {
+			for (unsigned y = 0; y < tsz; ++y) {
+				unsigned const py(min(ty*tsz + y, header.height-1)); // partial edge tiles are padded by clamping
+
+				for (unsigned x = 0; x < tsz; ++x) {
+					unsigned const val(hmap.get_pixel_value(min(tx*tsz + x, header.width-1), py));
+					unsigned char *const dest(&tile[(y*tsz + x)*bpp]);
+					if (bpp == 2) {unsigned short const v16(val); memcpy(dest, &v16, 2);} else {*dest = (unsigned char)val;}
+				}
+			}
+			success = (fwrite(&tile.front(), 1, tile.size(), fp) == tile.size());
+		}
+	}
+	hmap.free_data();
+	checked_fclose(fp);
+	if (!success) {cerr << "Error writing tiled heightmap " << tile_fn << endl;}
+	return success;
+}
+
+bool tiled_heightmap_t::open(string const &fn, unsigned cache_mb) {
+
+	close();
+#ifdef _WIN32
+	HANDLE const file(CreateFileA(fn.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+	if (file == INVALID_HANDLE_VALUE) {cerr << "Error opening tiled heightmap " << fn << endl; return 0;}
+	LARGE_INTEGER fsize;
+
+	if (GetFileSizeEx(file, &fsize) && fsize.QuadPart > 0) {
+		HANDLE const mapping(CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL));
+
+		if (mapping != NULL) {
+			file_data = (unsigned char const *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping); // the view keeps the mapping open
+			if (file_data != nullptr) {file_size = (size_t)fsize.QuadPart;}
+		}
+	}
+	CloseHandle(file);
+#else
+	int const fd(::open(fn.c_str(), O_RDONLY));
+	if (fd < 0) {cerr << "Error opening tiled heightmap " << fn << endl; return 0;}
+	struct stat st;
+
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void *const ptr(mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+
+		if (ptr != MAP_FAILED) {
+			file_data = (unsigned char const *)ptr;
+			file_size = (size_t)st.st_size;
+			madvise(ptr, file_size, MADV_RANDOM); // tiles are read on demand in any order
+		}
+	}
+	::close(fd); // the mapping stays valid after the file is closed
+#endif
+	if (file_data == nullptr) {cerr << "Error mapping tiled heightmap " << fn << endl; return 0;}
+	if (file_size >= sizeof(header_t)) {memcpy(&header, file_data, sizeof(header_t));}
+
+	if (file_size < sizeof(header_t) || header.magic != HMAP_TILE_MAGIC || header.version != HMAP_TILE_VERSION ||
+		header.width == 0 || header.height == 0 || header.tile_size == 0 || (header.bytes_per_pixel != 1 && header.bytes_per_pixel != 2))
+	{
+		cerr << "Error: invalid header in tiled heightmap " << fn << endl;
+		close();
+		return 0;
+	}
+	num_tiles_x = (header.width  + header.tile_size - 1)/header.tile_size;
+	num_tiles_y = (header.height + header.tile_size - 1)/header.tile_size;
+	unsigned const num_tiles(num_tiles_x*num_tiles_y);
+
+	if (file_size < sizeof(header_t) + (size_t)num_tiles*get_tile_bytes()) {
+		cerr << "Error: tiled heightmap " << fn << " is truncated" << endl;
+		close();
+		return 0;
+	}
+	size_t const slot_bytes(header.tile_size*header.tile_size*sizeof(unsigned short));
+	// at least a few slots per thread so that a tile can't be evicted by other threads before it's read
+	num_slots  = min(num_tiles, max(unsigned(((size_t)cache_mb << 20)/slot_bytes), 4U*omp_get_max_threads_3dw()));
+	tile_slots.reset(new std::atomic<int>[num_tiles]);
+	for (unsigned i = 0; i < num_tiles; ++i) {tile_slots[i] = -1;}
+	slots.reset(new cache_slot_t[num_slots]);
+	clock_hand = 0;
+	overlay.clear();
+	overlay.resize(num_tiles);
+	cout << "Opened tiled heightmap " << fn << ": " << header.width << "x" << header.height << ", " << (8*header.bytes_per_pixel) << " bits, "
+		 << num_tiles << " tiles, cache of " << num_slots << " tiles (" << ((num_slots*slot_bytes) >> 20) << " MB)" << endl;
+	return 1;
+}
+
+void tiled_heightmap_t::close() {
+
+	if (file_data == nullptr) return; // not open
+#ifdef _WIN32
+	UnmapViewOfFile(file_data);
+#else
+	munmap((void *)file_data, file_size);
+#endif
+	file_data = nullptr;
+	file_size = 0;
+	tile_slots.reset();
+	slots.reset();
+	overlay.clear();
+	num_tiles_x = num_tiles_y = num_slots = 0;
+}
+
+int tiled_heightmap_t::load_tile(unsigned tile_ix) const { // returns the cache slot index
+
+	int const cur_slot(tile_slots[tile_ix].load(std::memory_order_relaxed));
+	if (cur_slot >= 0) return cur_slot; // loaded by another thread while waiting for the lock
+
+	while (slots[clock_hand].tile_ix.load(std::memory_order_relaxed) >= 0 && slots[clock_hand].referenced.exchange(0, std::memory_order_relaxed)) {
+		clock_hand = (clock_hand + 1) % num_slots; // clock replacement: skip (and clear) recently used slots
+	}
+	unsigned const slot_ix(clock_hand);
+	clock_hand = (clock_hand + 1) % num_slots;
+	cache_slot_t &slot(slots[slot_ix]);
+	unsigned const seq(slot.seq.load(std::memory_order_relaxed));
+	slot.seq.store(seq+1, std::memory_order_relaxed); // odd = being written
+	std::atomic_thread_fence(std::memory_order_release);
+	int const prev_tile(slot.tile_ix.load(std::memory_order_relaxed));
+	if (prev_tile >= 0) {tile_slots[prev_tile].store(-1, std::memory_order_relaxed);} // evict
+	slot.tile_ix.store(tile_ix, std::memory_order_relaxed);
+	unsigned const num_pixels(header.tile_size*header.tile_size);
+	slot.data.resize(num_pixels);
+	size_t const tile_bytes(get_tile_bytes()), offset(sizeof(header_t) + (size_t)tile_ix*tile_bytes);
+	unsigned char const *const src(file_data + offset);
+
+	if (header.bytes_per_pixel == 2) {memcpy(&slot.data.front(), src, tile_bytes);}
+	else {for (unsigned i = 0; i < num_pixels; ++i) {slot.data[i] = src[i];}}
+#ifndef _WIN32
+	// drop the mapped pages, since the decoded copy is now cached; this keeps the resident size bounded by the cache size
+	size_t const page_sz(sysconf(_SC_PAGESIZE)), page_start(offset - (offset % page_sz)), page_end((offset + tile_bytes) - ((offset + tile_bytes) % page_sz));
+	if (page_end > page_start) {madvise((void *)(file_data + page_start), (page_end - page_start), MADV_DONTNEED);}
+#endif
+	for (auto const &m : overlay[tile_ix]) {slot.data[m.first] = m.second;} // apply modified pixels
+	slot.referenced.store(1, std::memory_order_relaxed);
+	slot.seq.store(seq+2, std::memory_order_release); // even = valid
+	tile_slots[tile_ix].store(slot_ix, std::memory_order_release);
+	return slot_ix;
+}
+
+unsigned tiled_heightmap_t::get_pixel_value(unsigned x, unsigned y) const { // thread safe and lock-free on cache hits
+
+	assert(is_open());
+	assert(x < header.width && y < header.height);
+	unsigned const tile_ix(get_tile_ix(x, y)), pixel_ix(get_pixel_ix(x, y));
+
+	while (1) {
+		int slot_ix(tile_slots[tile_ix].load(std::memory_order_acquire));
+
+		if (slot_ix < 0) { // cache miss
+			std::lock_guard<std::mutex> lock(mutex);
+			slot_ix = load_tile(tile_ix);
+		}
+		cache_slot_t &slot(slots[slot_ix]);
+		unsigned const seq(slot.seq.load(std::memory_order_acquire));
+		if ((seq & 1) || slot.tile_ix.load(std::memory_order_relaxed) != (int)tile_ix) continue; // slot is being refilled with another tile; retry
+		if (!slot.referenced.load(std::memory_order_relaxed)) {slot.referenced.store(1, std::memory_order_relaxed);} // avoid writing a shared cache line on every read
+		unsigned const val(slot.data[pixel_ix]);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.seq.load(std::memory_order_relaxed) == seq) return val; // slot wasn't modified during the read
+	}
+	return 0; // never gets here
+}
+
+void tiled_heightmap_t::modify_heightmap_value(unsigned x, unsigned y, int val, bool val_is_delta) {
+
+	assert(is_open());
+	assert(x < header.width && y < header.height);
+	unsigned const tile_ix(get_tile_ix(x, y)), pixel_ix(get_pixel_ix(x, y));
+	std::lock_guard<std::mutex> lock(mutex); // slots can't be evicted while this is held
+	cache_slot_t &slot(slots[load_tile(tile_ix)]);
+	unsigned short &pixel(slot.data[pixel_ix]);
+	if (val_is_delta) {val += pixel;}
+	unsigned short const new_val(max(0, min(((header.bytes_per_pixel == 2) ? 65535 : 255), val))); // clamp
+	unsigned const seq(slot.seq.load(std::memory_order_relaxed));
+	slot.seq.store(seq+1, std::memory_order_relaxed); // odd = being written, so that lock-free readers retry
+	std::atomic_thread_fence(std::memory_order_release);
+	pixel = new_val;
+	slot.seq.store(seq+2, std::memory_order_release); // even = valid
+	overlay[tile_ix][pixel_ix] = new_val; // record so that the value persists if the tile is evicted
+}
+
+// must match the hash of the source image if unmodified; cheap because the image hash is precomputed and stored in the file
+uint64_t tiled_heightmap_t::get_data_hash() const {
+
+	if (!is_open()) return 0;
+	fnv_hasher_t hasher(header.data_hash);
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (unsigned t = 0; t < overlay.size(); ++t) {
+		if (overlay[t].empty()) continue;
+		hasher.add(t);
+		for (auto const &m : overlay[t]) {hasher.add((uint64_t(m.first) << 16) | m.second);}
+	}
+	return hasher.get();
+}
+
+
 float get_mh_texture_mult();
 float get_mh_texture_add ();
 
@@ -277,25 +558,26 @@ bool terrain_hmap_manager_t::clamp_xy(int &x, int &y, float fract_x, float fract
 
 bool terrain_hmap_manager_t::clamp_no_scale(int &x, int &y, bool allow_wrap) const {
 
-	assert(hmap.width > 0 && hmap.height > 0);
-	x += hmap.width /2; // scale and offset (0,0) to texture center
-	y += hmap.height/2;
-	if (x >= 0 && y >= 0 && x < hmap.width && y < hmap.height) return 1; // nothing to do (optimization)
+	int const width(get_width()), height(get_height());
+	assert(width > 0 && height > 0);
+	x += width /2; // scale and offset (0,0) to texture center
+	y += height/2;
+	if (x >= 0 && y >= 0 && x < width && y < height) return 1; // nothing to do (optimization)
 	unsigned tex_edge_mode(TEX_EDGE_MODE);
 	if (!allow_wrap && tex_edge_mode == 2) {tex_edge_mode = 0;} // replace mirror with clamp
 
 	switch (tex_edge_mode) {
 	case 0: // clamp
-		x = max(0, min(hmap.width -1, x));
-		y = max(0, min(hmap.height-1, y));
+		x = max(0, min(width -1, x));
+		y = max(0, min(height-1, y));
 		break;
 	case 1: // cliff/underwater
 		return 0; // off the texture
 	case 2: // mirror
 		{
-			int const xmod(abs(x)%hmap.width), ymod(abs(y)%hmap.height), xdiv(x/hmap.width), ydiv(y/hmap.height);
-			x = ((xdiv & 1) ? (hmap.width  - xmod - 1) : xmod);
-			y = ((ydiv & 1) ? (hmap.height - ymod - 1) : ymod);
+			int const xmod(abs(x)%width), ymod(abs(y)%height), xdiv(x/width), ydiv(y/height);
+			x = ((xdiv & 1) ? (width  - xmod - 1) : xmod);
+			y = ((ydiv & 1) ? (height - ymod - 1) : ymod);
 		}
 		break;
 	}
@@ -307,11 +589,35 @@ void terrain_hmap_manager_t::load(char const *const fn, bool invert_y) {
 	assert(fn != NULL);
 	cout << "Loading terrain heightmap file " << fn << endl;
 	RESET_TIME;
-	assert(!hmap.is_allocated()); // can only call once
+	assert(!enabled()); // can only call once
+	string tile_fn(tiled_heightmap_t::is_tile_file(fn) ? string(fn) : hmap_tile_fn);
+
+	if (!tile_fn.empty()) { // stream from a pre-tiled heightmap, converting from the image first if needed
+		bool const from_image(tile_fn != fn);
+		bool opened(0);
+
+		if ((!from_image || check_file_exists(tile_fn)) && tiled_hmap.open(tile_fn, hmap_tile_cache_mb)) { // open() reports errors for missing .hmt files
+			uint64_t const source_key(from_image ? tiled_heightmap_t::get_source_key(fn, invert_y) : 0); // 0 if there's no image to check against
+
+			if (source_key != 0 && tiled_hmap.get_source_key() != source_key) { // image was modified, or is a different image
+				cout << "Tiled heightmap " << tile_fn << " is out of date with " << fn << "; converting it again" << endl;
+				tiled_hmap.close();
+			}
+			else {opened = 1;}
+		}
+		if (!opened && from_image && tiled_heightmap_t::convert_image(fn, tile_fn, invert_y)) {opened = tiled_hmap.open(tile_fn, hmap_tile_cache_mb);}
+		if (!opened) {tile_fn.clear();}
+		if (!tile_fn.empty() && (erosion_iters_tt > 0 || have_cities())) {cout << "Warning: Erosion and city generation are not supported for tiled heightmaps" << endl;}
+		if (!tile_fn.empty() && !hmap_out_fn.empty()) {cout << "Warning: write_heightmap_png is not supported for tiled heightmaps" << endl;}
+		if (tiled_hmap.is_open()) {++mod_version; PRINT_TIME("Heightmap Load"); return;}
+		if (tiled_heightmap_t::is_tile_file(fn)) {exit(1);} // failed to open a tiled heightmap given directly; there's no image to fall back to
+		cerr << "Failed to use tiled heightmap; loading the full image" << endl;
+	}
 	hmap = heightmap_t(0, 7, 0, 0, fn, invert_y);
 	hmap.load(-1, 0, 1, 1);
 	PRINT_TIME("Heightmap Load");
 	hmap.postprocess_height(); // apply erosion, etc. directly after loading, before applying mod brushes
+	++mod_version;
 	if (!hmap_out_fn.empty()) {write_png(hmap_out_fn);}
 }
 
@@ -323,13 +629,14 @@ bool terrain_hmap_manager_t::maybe_load(char const *const fn, bool invert_y) {
 }
 
 void terrain_hmap_manager_t::write_png(std::string const &fn) const {
+	if (is_tiled()) {cerr << "Error: Can't write tiled heightmap to PNG" << endl; return;}
 	timer_t timer("Heightmap PNG Write");
 	hmap.write_to_png(fn);
 }
 
 tex_mod_map_manager_t::hmap_val_t terrain_hmap_manager_t::get_clamped_pixel_value(int x, int y, bool allow_wrap) const {
 	if (!clamp_xy(x, y, allow_wrap)) return 0; // not sure what to do in this case - can we ever get here?
-	return hmap.get_pixel_value(x, y);
+	return (is_tiled() ? tiled_hmap.get_pixel_value(x, y) : hmap.get_pixel_value(x, y));
 }
 
 float terrain_hmap_manager_t::get_clamped_height(int x, int y) const { // translate so that (0,0) is in the center of the heightmap texture
@@ -362,12 +669,14 @@ vector3d terrain_hmap_manager_t::get_norm(int x, int y) const {
 }
 
 void terrain_hmap_manager_t::modify_height(mod_elem_t const &elem, bool is_delta) {
-	assert((unsigned)max(hmap.width, hmap.height) <= max_tex_ix());
-	hmap.modify_heightmap_value(elem.x, elem.y, elem.delta, is_delta);
+	assert((unsigned)max(get_width(), get_height()) <= max_tex_ix());
+	if (is_tiled()) {tiled_hmap.modify_heightmap_value(elem.x, elem.y, elem.delta, is_delta);}
+	else {hmap.modify_heightmap_value(elem.x, elem.y, elem.delta, is_delta);}
+	++mod_version;
 }
 
 tex_mod_map_manager_t::hmap_val_t terrain_hmap_manager_t::scale_delta(float delta) const {
-	int const scale_factor(1 << (hmap.bytes_per_channel() << 3));
+	int const scale_factor(1 << ((is_tiled() ? tiled_hmap.bytes_per_channel() : hmap.bytes_per_channel()) << 3));
 	return scale_factor*CLIP_TO_pm1(delta);
 }
 
@@ -380,9 +689,11 @@ bool terrain_hmap_manager_t::read_and_apply_mod(string const &fn) {
 
 void terrain_hmap_manager_t::apply_cur_mod_map() {
 	for (tex_mod_map_t::const_iterator i = mod_map.begin(); i != mod_map.end(); ++i) { // apply the mod to the current texture
-		assert(i->first.x < hmap.width && i->first.y < hmap.height); // ensure the mod values fit within the texture
-		hmap.modify_heightmap_value(i->first.x, i->first.y, i->second.val, 1); // no clamping
+		assert(i->first.x < get_width() && i->first.y < get_height()); // ensure the mod values fit within the texture
+		if (is_tiled()) {tiled_hmap.modify_heightmap_value(i->first.x, i->first.y, i->second.val, 1);} // only modified pixels are stored
+		else {hmap.modify_heightmap_value(i->first.x, i->first.y, i->second.val, 1);} // no clamping
 	}
+	++mod_version;
 }
 
 void terrain_hmap_manager_t::apply_cur_brushes() { // apply the brushes to the current texture
@@ -4,6 +4,9 @@
 #pragma once
 
 #include "3DWorld.h"
+#include <atomic>
+#include <mutex>
+#include <memory>
 
 float const HMAP_DETAIL_SCALE = 16.0;
 float const HMAP_DETAIL_MAG   = 0.01;
@@ -27,6 +30,61 @@ public:
 	float get_heightmap_value(unsigned x, unsigned y) const;
 	void modify_heightmap_value(unsigned x, unsigned y, int val, bool val_is_delta);
 	void postprocess_height();
+	uint64_t get_data_hash() const;
+};
+
+
+// pre-tiled heightmap file that is memory mapped and decoded on demand into a bounded cache of tiles;
+// modified pixels are kept in a sparse per-tile overlay so that mod maps and brushes can be applied without loading the full image
+class tiled_heightmap_t {
+
+	struct header_t {
+		unsigned magic, version, width, height, tile_size, bytes_per_pixel;
+		uint64_t data_hash; // hash of the source image values, computed during conversion
+		uint64_t source_key; // source image path, size, and modification time; see get_source_key()
+		header_t() : magic(0), version(0), width(0), height(0), tile_size(0), bytes_per_pixel(0), data_hash(0), source_key(0) {}
+	};
+	struct cache_slot_t {
+		std::atomic<unsigned> seq; // odd while the slot is being refilled; readers retry if it changes
+		std::atomic<int> tile_ix; // tile held in this slot, or -1 if unused
+		std::atomic<bool> referenced; // for clock replacement
+		vector<unsigned short> data; // decoded pixel values
+		cache_slot_t() : seq(0), tile_ix(-1), referenced(0) {}
+	};
+	header_t header;
+	unsigned num_tiles_x=0, num_tiles_y=0, num_slots=0;
+	unsigned char const *file_data=nullptr;
+	size_t file_size=0;
+	// cache state is mutable because it's updated by const reads; mutex is held for all slot refills and overlay updates
+	mutable std::unique_ptr<std::atomic<int>[]> tile_slots; // cache slot of each tile, or -1 if not cached
+	mutable std::unique_ptr<cache_slot_t[]> slots;
+	mutable unsigned clock_hand=0;
+	mutable std::mutex mutex;
+	vector<map<unsigned, unsigned short> > overlay; // per-tile modified pixel values, indexed by pixel offset within the tile
+
+	unsigned get_tile_ix (unsigned x, unsigned y) const {return ((y/header.tile_size)*num_tiles_x + x/header.tile_size);}
+	unsigned get_pixel_ix(unsigned x, unsigned y) const {return ((y%header.tile_size)*header.tile_size + x%header.tile_size);}
+	unsigned get_tile_bytes() const {return header.tile_size*header.tile_size*header.bytes_per_pixel;}
+	int load_tile(unsigned tile_ix) const; // mutex must be held
+public:
+	static bool is_tile_file(std::string const &fn);
+	static uint64_t get_source_key(std::string const &image_fn, bool invert_y);
+	static bool convert_image(std::string const &image_fn, std::string const &tile_fn, bool invert_y);
+	bool open(std::string const &fn, unsigned cache_mb);
+	void close();
+	bool is_open() const {return (file_data != nullptr);}
+	int get_width () const {return header.width;}
+	int get_height() const {return header.height;}
+	unsigned bytes_per_channel() const {return header.bytes_per_pixel;}
+	uint64_t get_source_key() const {return header.source_key;}
+	unsigned get_pixel_value (unsigned x, unsigned y) const;
+	float get_heightmap_value(unsigned x, unsigned y) const { // returns values from 0 to 256
+		unsigned const val(get_pixel_value(x, y));
+		return ((header.bytes_per_pixel == 2) ? val/256.0 : val);
+	}
+	void modify_heightmap_value(unsigned x, unsigned y, int val, bool val_is_delta);
+	uint64_t get_data_hash() const;
+	~tiled_heightmap_t() {close();}
 };
 
 
@@ -106,15 +164,22 @@ public:
 class terrain_hmap_manager_t : public tex_mod_map_manager_t {
 
 	heightmap_t hmap;
+	tiled_heightmap_t tiled_hmap; // used instead of hmap when streaming from a pre-tiled heightmap file
+	unsigned mod_version; // incremented when the heightmap data changes
+
+	bool is_tiled() const {return tiled_hmap.is_open();}
+	int get_width () const {return (is_tiled() ? tiled_hmap.get_width () : hmap.width );}
+	int get_height() const {return (is_tiled() ? tiled_hmap.get_height() : hmap.height);}
 
 public:
+	terrain_hmap_manager_t() : mod_version(0) {}
 	void load(char const *const fn, bool invert_y=0);
 	bool maybe_load(char const *const fn, bool invert_y=0);
 	void write_png(std::string const &fn) const;
 	bool clamp_xy(int &x, int &y, float fract_x=0.0, float fract_y=0.0, bool allow_wrap=1) const;
 	bool clamp_no_scale(int &x, int &y, bool allow_wrap=1) const;
 	hmap_val_t get_clamped_pixel_value(int x, int y, bool allow_wrap=1) const;
-	float get_raw_height(int x, int y) const {return scale_mh_texture_val(hmap.get_heightmap_value(x, y));}
+	float get_raw_height(int x, int y) const {return scale_mh_texture_val(is_tiled() ? tiled_hmap.get_heightmap_value(x, y) : hmap.get_heightmap_value(x, y));}
 	float get_clamped_height(int x, int y) const;
 	float interpolate_height(float x, float y) const;
 	float get_nearest_height(float x, float y) const;
@@ -131,7 +196,9 @@ public:
 	bool read_and_apply_mod(std::string const &fn);
 	void apply_cur_mod_map();
 	void apply_cur_brushes();
-	bool enabled() const {return hmap.is_allocated();}
+	bool enabled() const {return (hmap.is_allocated() || is_tiled());}
+	unsigned get_mod_version() const {return mod_version;}
+	uint64_t get_data_hash() const {return (is_tiled() ? tiled_hmap.get_data_hash() : hmap.get_data_hash());}
 	~terrain_hmap_manager_t() {hmap.free_data();}
 };
 
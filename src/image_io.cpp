@@ -3,7 +3,17 @@
 // 10/14/13
 #include "targa.h"
 #include "textures.h"
+#include "model3d.h" // for fnv_hasher_t
 #include <fstream> // for filebuf
+#include <iomanip> // for setw
+#include <atomic>
+#ifdef _WIN32
+#include <direct.h> // for _mkdir
+#include <process.h> // for _getpid
+#else
+#include <sys/stat.h> // for mkdir
+#include <unistd.h> // for getpid
+#endif
 
 using namespace std;
 
@@ -32,6 +42,10 @@ void wrap_png_error(png_structp, png_const_charp) {
 
 string const texture_dir("textures");
 
+extern bool use_texture_cache, mipmap_gamma_correct, invert_bump_maps, texture_alpha_in_red_comp;
+extern float mipmap_alpha_coverage;
+extern string texture_cache_dir;
+
 string append_texture_dir(string const &filename) {return (texture_dir + "/" + filename);}
 
 
@@ -801,4 +815,218 @@ void texture_t::load_ppm(int index, bool allow_diff_width_height) {
 		cerr << "Error reading PPM file" << endl;
 		exit(1);
 	}
-}
+}
+
+// ************ processed texture cache ************
+
+// Textures are cached by a hash of their source file contents and every parameter that affects how they're processed, so the file name
+// is the key and cache entries never need to be invalidated; stale entries can be removed by deleting the cache directory
+unsigned const TEX_CACHE_MAGIC   = 0x48435854; // "TXCH"
+unsigned const TEX_CACHE_VERSION = 1; // increment when the loading or processing of textures changes
+
+struct tex_cache_header_t {
+	unsigned magic, version;
+	uint64_t hash;
+	int width, height, ncolors;
+	unsigned char format, use_mipmaps, is_16_bit_gray, has_binary_alpha, normal_map, unused[3];
+	float color[4];
+	unsigned data_bytes, mm_bytes, num_mm_levels;
+};
+
+class tex_cache_hasher_t : public fnv_hasher_t {
+public:
+	void add_str(string const &str) {for (char c : str) {add((unsigned char)c);} add(str.size());}
+
+	bool add_file(string const &fn) {
+		FILE *fp(open_texture_file_no_check(fn));
+		if (fp == nullptr) return 0;
+		vector<uint64_t> buf(1 << 16); // 512KB
+		size_t num_read(0);
+
+		while ((num_read = fread(buf.data(), 1, buf.size()*sizeof(uint64_t), fp)) > 0) {
+			size_t const num_words((num_read + sizeof(uint64_t) - 1)/sizeof(uint64_t));
+			if (num_read < num_words*sizeof(uint64_t)) {memset((char *)buf.data() + num_read, 0, num_words*sizeof(uint64_t) - num_read);} // zero pad the last word
+			for (size_t i = 0; i < num_words; ++i) {add(buf[i]);}
+			add(num_read);
+		}
+		checked_fclose(fp);
+		return 1;
+	}
+	uint64_t get() const {return max(fnv_hasher_t::get(), uint64_t(1));} // zero is reserved for "no hash"
+};
+
+bool tex_cache_dir_exists(0);
+
+bool make_tex_cache_dir() { // not thread safe
+	if (tex_cache_dir_exists) return 1;
+#ifdef _WIN32
+	int const ret(_mkdir(texture_cache_dir.c_str()));
+#else
+	int const ret(mkdir(texture_cache_dir.c_str(), 0755));
+#endif
+	if (ret != 0 && errno != EEXIST) {
+		cerr << "Error: Failed to create texture cache directory " << texture_cache_dir << "; texture cache will be disabled" << endl;
+		use_texture_cache = 0;
+		return 0;
+	}
+	tex_cache_dir_exists = 1;
+	return 1;
+}
+
+string get_tex_cache_fn(uint64_t hash) {
+	std::ostringstream oss;
+	oss << texture_cache_dir << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".tcache";
+	return oss.str();
+}
+
+// unique per process and write, so that processes or threads writing the same cache entry at the same time don't share a temp file
+string get_tex_cache_tmp_fn(string const &fn) {
+	static std::atomic<unsigned> write_id(0);
+#ifdef _WIN32
+	int const pid(_getpid());
+#else
+	int const pid(getpid());
+#endif
+	std::ostringstream oss;
+	oss << fn << "." << pid << "." << write_id++ << ".tmp";
+	return oss.str();
+}
+
+// mipmap offsets and total size for a texture of this size, matching the layout of build_mipmaps() and build_custom_mipmaps()
+unsigned calc_tex_cache_mm_offsets(unsigned width, unsigned height, unsigned ncolors, vector<unsigned> &offsets) {
+	unsigned data_size(0);
+	offsets.clear();
+
+	for (unsigned w = width, h = height; w > 1 || h > 1; w >>= 1, h >>= 1) {
+		offsets.push_back(data_size);
+		data_size += ncolors*max(w>>1, 1U)*max(h>>1, 1U);
+	}
+	return data_size;
+}
+
+// stage 0 is the texture as returned by load() + fix_word_alignment(); stage 1 additionally includes the alpha texture, normal map, color, and mipmaps;
+// returns 0 if the texture can't be cached
+uint64_t texture_t::get_cache_hash(unsigned stage, texture_t const *alpha_tex, bool is_bump) const {
+
+	if (!use_texture_cache || type != 0 || name.empty() || defer_load()) return 0; // not loaded from a file
+	if (format == 10 || get_file_extension(name, 0, 1) == "dds") return 0; // DDS textures are already compressed and are loaded on demand
+	bool dir_exists(0);
+#pragma omp critical(make_tex_cache_dir)
+	dir_exists = make_tex_cache_dir();
+	if (!dir_exists) return 0;
+	tex_cache_hasher_t hasher;
+	hasher.add(TEX_CACHE_VERSION);
+	hasher.add(stage);
+	if (!hasher.add_file(name)) return 0; // file not found; let load() report the error
+	hasher.add_str(get_file_extension(name, 0, 1)); // for format autodetect
+	unsigned const flags[10] = {(unsigned)format, (unsigned)width, (unsigned)height, (unsigned)ncolors, (unsigned)use_mipmaps, invert_y, invert_alpha, normal_map, is_16_bit_gray, is_bump};
+	for (unsigned i = 0; i < 10; ++i) {hasher.add(flags[i]);}
+	hasher.add_float(mipmap_alpha_weight);
+
+	if (stage > 0) { // add the global options that affect processing
+		unsigned const gflags[4] = {mipmap_gamma_correct, invert_bump_maps, texture_alpha_in_red_comp, (alpha_tex != nullptr)};
+		for (unsigned i = 0; i < 4; ++i) {hasher.add(gflags[i]);}
+		hasher.add_float(mipmap_alpha_coverage);
+
+		if (alpha_tex != nullptr) { // only use the fields of the alpha texture that don't change when it's loaded, since it may already be loaded
+			if (alpha_tex->type != 0 || !hasher.add_file(alpha_tex->name)) return 0;
+			hasher.add(alpha_tex->invert_y);
+			hasher.add(alpha_tex->invert_alpha);
+		}
+	}
+	return hasher.get();
+}
+
+bool texture_t::read_from_cache(uint64_t hash) {
+
+	assert(hash != 0 && !is_allocated());
+	FILE *fp(fopen(get_tex_cache_fn(hash).c_str(), "rb"));
+	if (fp == nullptr) return 0; // not yet cached
+	tex_cache_header_t header;
+	bool valid(fread(&header, sizeof(header), 1, fp) == 1 && header.magic == TEX_CACHE_MAGIC && header.version == TEX_CACHE_VERSION && header.hash == hash &&
+		header.width > 0 && header.height > 0 && header.width <= 65536 && header.height <= 65536 && header.ncolors >= 1 && header.ncolors <= 4 &&
+		uint64_t(header.data_bytes) == uint64_t(header.width)*uint64_t(header.height)*uint64_t(header.ncolors));
+	vector<unsigned> exp_mm_offsets;
+
+	if (valid && header.num_mm_levels > 0) { // mipmap sizes must match the texture size, so that a corrupt file can't cause a huge alloc
+		unsigned const exp_mm_bytes(calc_tex_cache_mm_offsets(header.width, header.height, header.ncolors, exp_mm_offsets));
+		valid = (header.num_mm_levels == exp_mm_offsets.size() && header.mm_bytes == exp_mm_bytes);
+	}
+	if (!valid) {
+		cerr << "Warning: Ignoring invalid texture cache file " << get_tex_cache_fn(hash) << " for texture " << name << endl;
+		checked_fclose(fp);
+		return 0;
+	}
+	width  = header.width;
+	height = header.height;
+	ncolors= header.ncolors;
+	format = header.format;
+	use_mipmaps      = header.use_mipmaps;
+	is_16_bit_gray   = (header.is_16_bit_gray   != 0);
+	has_binary_alpha = (header.has_binary_alpha != 0);
+	normal_map       = (header.normal_map       != 0);
+	color = colorRGBA(header.color[0], header.color[1], header.color[2], header.color[3]);
+	alloc();
+	mm_offsets.resize(header.num_mm_levels);
+	bool ok(fread(data, 1, header.data_bytes, fp) == header.data_bytes);
+
+	if (ok && header.num_mm_levels > 0) {
+		ok = (fread(mm_offsets.data(), sizeof(unsigned), mm_offsets.size(), fp) == mm_offsets.size() && mm_offsets == exp_mm_offsets); // no out of range offsets
+
+		if (ok) {
+			mm_data = new unsigned char[header.mm_bytes];
+			ok = (fread(mm_data, 1, header.mm_bytes, fp) == header.mm_bytes);
+		}
+	}
+	checked_fclose(fp);
+
+	if (!ok) {
+		cerr << "Warning: Truncated or invalid texture cache file " << get_tex_cache_fn(hash) << " for texture " << name << endl;
+		free_client_mem();
+		return 0;
+	}
+	return 1;
+}
+
+bool texture_t::write_to_cache(uint64_t hash) const {
+
+	assert(hash != 0 && is_allocated());
+	unsigned const num_levels((unsigned)mm_offsets.size());
+	tex_cache_header_t header;
+	memset(&header, 0, sizeof(header)); // zero padding so that files are deterministic
+	header.magic   = TEX_CACHE_MAGIC;
+	header.version = TEX_CACHE_VERSION;
+	header.hash    = hash;
+	header.width   = width;
+	header.height  = height;
+	header.ncolors = ncolors;
+	header.format  = format;
+	header.use_mipmaps      = use_mipmaps;
+	header.is_16_bit_gray   = is_16_bit_gray;
+	header.has_binary_alpha = has_binary_alpha;
+	header.normal_map       = normal_map;
+	UNROLL_4X(header.color[i_] = color[i_];)
+	header.data_bytes    = num_bytes();
+	header.num_mm_levels = num_levels;
+	// the last mipmap level follows the last offset
+	if (num_levels > 0) {header.mm_bytes = mm_offsets.back() + ncolors*max((width >> num_levels), 1)*max((height >> num_levels), 1);}
+	string const fn(get_tex_cache_fn(hash)), tmp_fn(get_tex_cache_tmp_fn(fn));
+	FILE *fp(fopen(tmp_fn.c_str(), "wb"));
+	if (fp == nullptr) {cerr << "Error: Failed to open texture cache file " << tmp_fn << " for writing" << endl; return 0;}
+	bool ok(fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(data, 1, header.data_bytes, fp) == header.data_bytes);
+
+	if (ok && num_levels > 0) {
+		assert(mm_data);
+		ok = (fwrite(mm_offsets.data(), sizeof(unsigned), num_levels, fp) == num_levels && fwrite(mm_data, 1, header.mm_bytes, fp) == header.mm_bytes);
+	}
+	checked_fclose(fp);
+	// write to a temp file and rename it so that partially written files are never read, even by another process
+	if (ok) {remove(fn.c_str()); ok = (rename(tmp_fn.c_str(), fn.c_str()) == 0);}
+
+	if (!ok) {
+		cerr << "Error writing texture cache file " << fn << endl;
+		remove(tmp_fn.c_str());
+		return 0;
+	}
+	return 1;
+}
@@ -844,6 +844,46 @@ void indir_light_tex_from_lmap(unsigned &tid, lmap_manager_t const &lmap, vector
 	if (tid == 0) {tid = create_3d_texture(zsize, xsize, ysize, 4, tex_data, GL_LINEAR, GL_CLAMP_TO_EDGE);} // see update_smoke_indir_tex_range
 	else {update_3d_texture(tid, 0, 0, 0, zsize, xsize, ysize, 4, tex_data.data());} // stored {Z,X,Y}
 }
+// same as indir_light_tex_from_lmap() for a dense grid where only ltype is set, without expanding the bricks to lmcells
+void indir_light_tex_from_bricks(unsigned &tid, lmap_bricks_t const &bricks, int ltype, vector<unsigned char> &tex_data, unsigned xsize, unsigned ysize, unsigned zsize) {
+
+	tex_data.resize(4*xsize*ysize*zsize, 0);
+	unsigned const nbx((xsize + LMAP_BRICK_SIZE - 1)/LMAP_BRICK_SIZE), nbz((zsize + LMAP_BRICK_SIZE - 1)/LMAP_BRICK_SIZE);
+	int const num_brick_rows((ysize + LMAP_BRICK_SIZE - 1)/LMAP_BRICK_SIZE);
+	assert(bricks.size() == nbx*nbz*num_brick_rows);
+
+#pragma omp parallel for schedule(static)
+	for (int byi = 0; byi < num_brick_rows; ++byi) {
+		unsigned const by(byi*LMAP_BRICK_SIZE);
+
+		for (unsigned bx = 0; bx < xsize; bx += LMAP_BRICK_SIZE) {
+			for (unsigned bz = 0; bz < zsize; bz += LMAP_BRICK_SIZE) {
+				unsigned const bix((byi*nbx + bx/LMAP_BRICK_SIZE)*nbz + bz/LMAP_BRICK_SIZE);
+				bool const uniform(bricks.is_uniform(bix));
+				unsigned char cval[3] = {0};
+				unsigned cell_ix(0);
+
+				for (unsigned y = by; y < min(by+LMAP_BRICK_SIZE, ysize); ++y) {
+					for (unsigned x = bx; x < min(bx+LMAP_BRICK_SIZE, xsize); ++x) {
+						for (unsigned z = bz; z < min(bz+LMAP_BRICK_SIZE, zsize); ++z, ++cell_ix) {
+							if (cell_ix == 0 || !uniform) { // uniform bricks only need one color calculation
+								lmcell lmc;
+								bricks.get_cell_val(bix, cell_ix, lmc.get_offset(ltype));
+								colorRGB color;
+								lmc.get_final_color(color, 1.0, 1.0);
+								UNROLL_3X(cval[i_] = (unsigned char)(255*CLIP_TO_01(color[i_]));)
+							}
+							unsigned const off(4*(zsize*(y*xsize + x) + z));
+							UNROLL_3X(tex_data[off+i_] = cval[i_];)
+						} // for z
+					} // for x
+				} // for y
+			} // for bz
+		} // for bx
+	} // for by
+	if (tid == 0) {tid = create_3d_texture(zsize, xsize, ysize, 4, tex_data, GL_LINEAR, GL_CLAMP_TO_EDGE);}
+	else {update_3d_texture(tid, 0, 0, 0, zsize, xsize, ysize, 4, tex_data.data());} // stored {Z,X,Y}
+}
 
 
 // *** Dynamic Lights Code ***
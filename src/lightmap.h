@@ -44,6 +44,37 @@ struct lmcell { // size = 52
 };
 
 
+struct binary_file_reader;
+struct binary_file_writer;
+class lmap_manager_t;
+
+unsigned const LMAP_BRICK_SIZE = 4; // in cells, in each dimension
+enum {LMAP_BRICK_ZERO=0, LMAP_BRICK_UNIFORM, LMAP_BRICK_QUANT, NUM_LMAP_BRICK_TYPES};
+
+// temporary decoded form of one lighting type from a bricked lighting file, used while copying it into an lmap or a texture;
+// zero and uniform bricks are a single value, and quantized bricks keep their 16-bit values; bricks are in file order
+// ({y, x, z} with bricks that have no allocated columns skipped), and cells within a brick are in {y, x, z} order, skipping unallocated columns
+class lmap_bricks_t {
+
+	struct brick_t {
+		unsigned char type;
+		unsigned vals_ix, qvals_ix; // offset of {vmin, vscale} in vals, and of the first cell's values in qvals
+		brick_t(unsigned char type_, unsigned vals_ix_, unsigned qvals_ix_) : type(type_), vals_ix(vals_ix_), qvals_ix(qvals_ix_) {}
+	};
+	unsigned dsz; // values per cell
+	vector<brick_t> bricks;
+	vector<float> vals; // vmin for uniform bricks, vmin and vscale for quantized bricks; dsz values each
+	vector<unsigned short> qvals; // dsz values per cell for quantized bricks
+
+public:
+	lmap_bricks_t() : dsz(0) {}
+	bool read(binary_file_reader &reader, int ltype, unsigned data_size, unsigned xsize, unsigned ysize, unsigned zsize, lmap_manager_t const *lmap);
+	bool read_file(char const *const fn, int ltype, unsigned xsize, unsigned ysize, unsigned zsize, bool &is_bricked);
+	unsigned size() const {return bricks.size();}
+	bool is_uniform(unsigned bix) const {assert(bix < bricks.size()); return (bricks[bix].type != LMAP_BRICK_QUANT);}
+	void get_cell_val(unsigned bix, unsigned cell_ix, float *val) const; // cell_ix is unused for zero and uniform bricks
+};
+
 class lmap_manager_t {
 
 	vector<lmcell> vldata_alloc;
@@ -52,6 +83,9 @@ class lmap_manager_t {
 
 	lmap_manager_t(lmap_manager_t const &) = delete; // forbidden
 	void operator=(lmap_manager_t const &) = delete; // forbidden
+	void get_brick_cells(unsigned bx, unsigned by, unsigned bz, vector<lmcell *> &cells) const;
+	bool read_bricks_from_file(binary_file_reader &reader, int ltype);
+	bool write_bricks_to_file(binary_file_writer &writer, int ltype) const;
 
 public:
 	bool was_updated;
@@ -336,4 +370,5 @@ void update_indir_light_tex_range(lmap_manager_t const &lmap, vector<unsigned ch
 	unsigned xsize, unsigned y1, unsigned y2, unsigned zsize, float lighting_exponent=1.0, bool local_only=0, bool mt=0);
 void indir_light_tex_from_lmap(unsigned &tid, lmap_manager_t const &lmap, vector<unsigned char> &tex_data,
 	unsigned xsize, unsigned ysize, unsigned zsize, float lighting_exponent=1.0, bool local_only=0);
+void indir_light_tex_from_bricks(unsigned &tid, lmap_bricks_t const &bricks, int ltype, vector<unsigned char> &tex_data, unsigned xsize, unsigned ysize, unsigned zsize);
 
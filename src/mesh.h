@@ -11,8 +11,28 @@ float const MESH_MIN_Z = -1.0E6; // special mesh height that is guaranteed to be
 extern float sthresh[2][2];
 
 
-struct ripple_state {
-	float rval, acc;
+// water ripple state stored as a structure of arrays, indexed by y*nx + x
+class ripple_grid_t {
+	unsigned nx, ny;
+public:
+	vector<float> rval, acc;
+	vector<unsigned> send_mask; // inside8 bits of the neighbors that each cell sends ripples to, plus RIPPLE_ACTIVE_BIT; 0 for inactive cells
+	int x1, y1, x2, y2; // inclusive bounds of the cells that can contain water; empty when x1 > x2
+
+	ripple_grid_t() : nx(0), ny(0) {invalidate_region();}
+	void alloc(unsigned nx_, unsigned ny_) {nx = nx_; ny = ny_; rval.resize(nx*ny); acc.resize(nx*ny); send_mask.resize(nx*ny); clear();}
+	void free_data() {nx = ny = 0; rval.clear(); acc.clear(); send_mask.clear(); invalidate_region();}
+	void clear() {
+		std::fill(rval.begin(), rval.end(), 0.0f);
+		std::fill(acc.begin(), acc.end(), 0.0f);
+		std::fill(send_mask.begin(), send_mask.end(), 0U);
+		invalidate_region();
+	}
+	void invalidate_region() {x1 = y1 = 0; x2 = y2 = -1;} // must be called when wminside changes
+	bool region_valid() const {return (x1 <= x2 && y1 <= y2);}
+	unsigned get_ix(int y, int x) const {return y*nx + x;}
+	float &get_rval(int y, int x) {return rval[get_ix(y, x)];}
+	float &get_acc (int y, int x) {return acc [get_ix(y, x)];}
 };
 
 
@@ -122,7 +142,7 @@ extern vector3d  **surface_normals;
 extern vector3d  **vertex_normals;
 extern float     **charge_dist;
 extern float     **surface_damage;
-extern ripple_state **ripples;
+extern ripple_grid_t ripples;
 extern unsigned char **mesh_draw;
 extern unsigned char **water_enabled;
 extern unsigned char **flower_weight;
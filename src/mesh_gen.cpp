@@ -7,9 +7,16 @@
 #include "textures.h"
 #include "sinf.h"
 #include "heightmap.h"
+#include "model3d.h" // for fnv_hasher_t
 #include "shaders.h"
 #include "gl_ext_arb.h"
 #include <glm/gtc/noise.hpp>
+#include "profiler.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define USE_SSE_NOISE
+#include <immintrin.h>
+#endif
 
 
 int      const NUM_FREQ_COMP      = 9;
@@ -33,6 +40,7 @@ int   const F_TABLE_SIZE = NUM_FREQ_COMP*N_RAND_SIN2;
 
 // Global Variables
 float MESH_START_MAG(0.02), MESH_START_FREQ(240.0), MESH_MAG_MULT(2.0), MESH_FREQ_MULT(0.5);
+bool force_cpu_mesh_gen(0); // evaluate GPU noise modes on the CPU
 int cache_counter(1), start_eval_sin(0), GLACIATE(DEF_GLACIATE), mesh_gen_mode(MGEN_SINE), mesh_gen_shape(0), mesh_freq_filter(FREQ_FILTER);
 float zmax, zmin, zmax_est, zcenter(0.0), zbottom(0.0), ztop(0.0), h_sum(0.0), alt_temp(DEF_TEMPERATURE);
 float mesh_scale(1.0), tree_scale(1.0), mesh_scale_z(1.0), mesh_scale_z_inv(1.0), glaciate_exp(1.0), glaciate_exp_inv(1.0);
@@ -48,10 +56,10 @@ vector<float> height_histogram;
 hmap_params_t hmap_params;
 
 
-extern bool combined_gu;
+extern bool combined_gu, benchmark_cpu_noise;
 extern int xoff, yoff, xoff2, yoff2, world_mode, rand_gen_index, mesh_rgen_index, mesh_scale_change, display_mode;
 extern int read_heightmap, read_landscape, do_read_mesh, mesh_seed, scrolling, camera_mode, invert_mh_image;
-extern unsigned erosion_iters;
+extern unsigned erosion_iters, hmap_tile_cache_mb;
 extern double c_radius, c_phi, c_theta;
 extern float water_plane_z, temperature, mesh_file_scale, mesh_file_tz, custom_glaciate_exp, MESH_HEIGHT, XY_SCENE_SIZE;
 extern float water_h_off, water_h_off_rel, disabled_mesh_z, read_mesh_zmm, init_temperature, univ_temp;
@@ -134,6 +142,23 @@ bool read_mesh_height_image(char const *fn, bool allow_resize=1) {
 	}
 	//timer_t timer("Read Mesh Heightmap");
 	cout << "Reading mesh heightmap " << mh_filename << endl;
+
+	if (tiled_heightmap_t::is_tile_file(fn)) { // pre-tiled heightmap: only the tiles containing sampled pixels are read
+		tiled_heightmap_t tiles;
+		if (!tiles.open(fn, hmap_tile_cache_mb)) return 0;
+
+		if (!allow_resize && (tiles.get_width() != MESH_X_SIZE || tiles.get_height() != MESH_Y_SIZE)) {
+			std::cerr << "Error reading mesh height tiles: Expected size " << MESH_X_SIZE << "x" << MESH_Y_SIZE
+				      << ", got size " << tiles.get_width() << "x" << tiles.get_height() << endl;
+			return 0;
+		}
+		for (int i = 0; i < MESH_Y_SIZE; ++i) { // nearest neighbor resize
+			for (int j = 0; j < MESH_X_SIZE; ++j) {
+				mesh_height[i][j] = scale_mh_texture_val(tiles.get_heightmap_value((j*tiles.get_width())/MESH_X_SIZE, (i*tiles.get_height())/MESH_Y_SIZE));
+			}
+		}
+		return 1;
+	}
 	heightmap_t hmap(0, 7, MESH_X_SIZE, MESH_Y_SIZE, fn, (invert_mh_image != 0));
 	hmap.load(-1, allow_resize, 1, 1); // allow 2-byte grayscale (currently only works for PNGs)
 	if (allow_resize) {hmap.resize(MESH_X_SIZE, MESH_Y_SIZE);}
@@ -580,6 +605,227 @@ void gen_rx_ry(float &rx, float &ry) {
 	ry = rgen.rand_float() + 1.0;
 }
 
+// hash of the state used by mesh_xy_grid_cache_t to generate procedural heights; changes if the mesh is regenerated or rescaled
+uint64_t get_mesh_gen_params_hash() {
+
+	fnv_hasher_t hasher;
+	float rx, ry;
+	gen_rx_ry(rx, ry);
+	int const ivals[] = {mesh_gen_mode, mesh_gen_shape, mesh_seed, mesh_rgen_index, start_eval_sin, GLACIATE};
+	float const fvals[] = {rx, ry, mesh_scale, mesh_scale_z, mesh_scale_z_inv, mesh_height_scale, MESH_HEIGHT, custom_glaciate_exp,
+		zmax_est, zmax_est2, zmax_est2_inv, zmin, DX_VAL, DY_VAL, MESH_START_MAG, MESH_START_FREQ, MESH_MAG_MULT, MESH_FREQ_MULT};
+	for (unsigned i = 0; i < sizeof(ivals)/sizeof(int); ++i) {hasher.add(ivals[i]);}
+	hasher.add_floats(fvals, sizeof(fvals)/sizeof(float));
+	hasher.add_floats(&sinTable[0][0], F_TABLE_SIZE*5);
+	hasher.add_floats(&hmap_params.plat_bot, sizeof(hmap_params_t)/sizeof(float)); // hmap_params_t is all floats
+	return hasher.get();
+}
+
+
+// 8-wide float vector for batched CPU noise evaluation: one AVX register, two SSE registers, or scalar;
+// each lane does the same IEEE float ops in the same order as glm's scalar noise functions, so the results are identical
+#if defined(__AVX__)
+typedef __m256 nv_reg_t;
+unsigned const NV_REG_WIDTH = 8;
+inline nv_reg_t nv_set1(float v) {return _mm256_set1_ps(v);}
+inline nv_reg_t nv_add(nv_reg_t a, nv_reg_t b) {return _mm256_add_ps(a, b);}
+inline nv_reg_t nv_sub(nv_reg_t a, nv_reg_t b) {return _mm256_sub_ps(a, b);}
+inline nv_reg_t nv_mul(nv_reg_t a, nv_reg_t b) {return _mm256_mul_ps(a, b);}
+inline nv_reg_t nv_div(nv_reg_t a, nv_reg_t b) {return _mm256_div_ps(a, b);}
+inline nv_reg_t nv_max(nv_reg_t a, nv_reg_t b) {return _mm256_max_ps(a, b);}
+inline nv_reg_t nv_abs(nv_reg_t a) {return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);}
+inline nv_reg_t nv_floor(nv_reg_t a) {return _mm256_floor_ps(a);}
+inline nv_reg_t nv_select_gt(nv_reg_t a, nv_reg_t b, nv_reg_t x, nv_reg_t y) {return _mm256_blendv_ps(y, x, _mm256_cmp_ps(a, b, _CMP_GT_OQ));} // (a > b) ? x : y
+#elif defined(USE_SSE_NOISE)
+typedef __m128 nv_reg_t;
+unsigned const NV_REG_WIDTH = 4;
+inline nv_reg_t nv_set1(float v) {return _mm_set1_ps(v);}
+inline nv_reg_t nv_add(nv_reg_t a, nv_reg_t b) {return _mm_add_ps(a, b);}
+inline nv_reg_t nv_sub(nv_reg_t a, nv_reg_t b) {return _mm_sub_ps(a, b);}
+inline nv_reg_t nv_mul(nv_reg_t a, nv_reg_t b) {return _mm_mul_ps(a, b);}
+inline nv_reg_t nv_div(nv_reg_t a, nv_reg_t b) {return _mm_div_ps(a, b);}
+inline nv_reg_t nv_max(nv_reg_t a, nv_reg_t b) {return _mm_max_ps(a, b);}
+inline nv_reg_t nv_abs(nv_reg_t a) {return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);}
+inline nv_reg_t nv_floor(nv_reg_t a) { // SSE2 has no floor, so truncate and subtract 1 where that rounded up; exact for |a| < 2^31
+	nv_reg_t const t(_mm_cvtepi32_ps(_mm_cvttps_epi32(a)));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)));
+}
+inline nv_reg_t nv_select_gt(nv_reg_t a, nv_reg_t b, nv_reg_t x, nv_reg_t y) { // (a > b) ? x : y
+	nv_reg_t const mask(_mm_cmpgt_ps(a, b));
+	return _mm_or_ps(_mm_and_ps(mask, x), _mm_andnot_ps(mask, y));
+}
+#else
+typedef float nv_reg_t;
+unsigned const NV_REG_WIDTH = 1;
+inline nv_reg_t nv_set1(float v) {return v;}
+inline nv_reg_t nv_add(nv_reg_t a, nv_reg_t b) {return a + b;}
+inline nv_reg_t nv_sub(nv_reg_t a, nv_reg_t b) {return a - b;}
+inline nv_reg_t nv_mul(nv_reg_t a, nv_reg_t b) {return a * b;}
+inline nv_reg_t nv_div(nv_reg_t a, nv_reg_t b) {return a / b;}
+inline nv_reg_t nv_max(nv_reg_t a, nv_reg_t b) {return ((a < b) ? b : a);}
+inline nv_reg_t nv_abs(nv_reg_t a) {return fabs(a);}
+inline nv_reg_t nv_floor(nv_reg_t a) {return floor(a);}
+inline nv_reg_t nv_select_gt(nv_reg_t a, nv_reg_t b, nv_reg_t x, nv_reg_t y) {return ((a > b) ? x : y);}
+#endif
+
+unsigned const NOISE_BATCH_SIZE = 8;
+unsigned const NV_NUM_REGS      = NOISE_BATCH_SIZE/NV_REG_WIDTH;
+
+struct noise_vec_t {
+	union {
+		nv_reg_t r[NV_NUM_REGS];
+		float v[NOISE_BATCH_SIZE];
+	};
+	noise_vec_t() {}
+	noise_vec_t(float val) {for (unsigned i = 0; i < NV_NUM_REGS; ++i) {r[i] = nv_set1(val);}}
+	template<typename F> static noise_vec_t apply(noise_vec_t const &a, noise_vec_t const &b, F const &func) {
+		noise_vec_t ret;
+		for (unsigned i = 0; i < NV_NUM_REGS; ++i) {ret.r[i] = func(a.r[i], b.r[i]);}
+		return ret;
+	}
+	template<typename F> static noise_vec_t apply(noise_vec_t const &a, F const &func) {
+		noise_vec_t ret;
+		for (unsigned i = 0; i < NV_NUM_REGS; ++i) {ret.r[i] = func(a.r[i]);}
+		return ret;
+	}
+};
+inline noise_vec_t operator+(noise_vec_t const &a, noise_vec_t const &b) {return noise_vec_t::apply(a, b, nv_add);}
+inline noise_vec_t operator-(noise_vec_t const &a, noise_vec_t const &b) {return noise_vec_t::apply(a, b, nv_sub);}
+inline noise_vec_t operator*(noise_vec_t const &a, noise_vec_t const &b) {return noise_vec_t::apply(a, b, nv_mul);}
+inline noise_vec_t operator/(noise_vec_t const &a, noise_vec_t const &b) {return noise_vec_t::apply(a, b, nv_div);}
+inline noise_vec_t nv_max  (noise_vec_t const &a, noise_vec_t const &b) {return noise_vec_t::apply(a, b, (nv_reg_t (*)(nv_reg_t, nv_reg_t))nv_max);}
+inline noise_vec_t nv_abs  (noise_vec_t const &a) {return noise_vec_t::apply(a, (nv_reg_t (*)(nv_reg_t))nv_abs);}
+inline noise_vec_t nv_floor(noise_vec_t const &a) {return noise_vec_t::apply(a, (nv_reg_t (*)(nv_reg_t))nv_floor);}
+inline noise_vec_t nv_fract(noise_vec_t const &a) {return a - nv_floor(a);}
+inline noise_vec_t nv_mod289(noise_vec_t const &a) {return a - nv_floor(a*(1.0f/289.0f))*289.0f;} // glm detail::mod289()
+inline noise_vec_t nv_mod(noise_vec_t const &a, float b) {return a - b*nv_floor(a/b);} // glm mod()
+inline noise_vec_t nv_permute(noise_vec_t const &a) {return nv_mod289((a*34.0f + 1.0f)*a);}
+
+inline noise_vec_t nv_select_gt(noise_vec_t const &a, noise_vec_t const &b, noise_vec_t const &x, noise_vec_t const &y) {
+	noise_vec_t ret;
+	for (unsigned i = 0; i < NV_NUM_REGS; ++i) {ret.r[i] = nv_select_gt(a.r[i], b.r[i], x.r[i], y.r[i]);}
+	return ret;
+}
+
+// batched glm::simplex(vec2)
+noise_vec_t simplex_noise_batch(noise_vec_t const &vx, noise_vec_t const &vy) {
+
+	float const C0(0.211324865405187f), C1(0.366025403784439f), C2(-0.577350269189626f), C3(0.024390243902439f);
+	// first corner
+	noise_vec_t const s(vx*C1 + vy*C1);
+	noise_vec_t ix(nv_floor(vx + s)), iy(nv_floor(vy + s));
+	noise_vec_t const t(ix*C0 + iy*C0);
+	noise_vec_t const x0x(vx - ix + t), x0y(vy - iy + t);
+	// other corners
+	noise_vec_t const i1x(nv_select_gt(x0x, x0y, 1.0f, 0.0f)), i1y(nv_select_gt(x0x, x0y, 0.0f, 1.0f));
+	noise_vec_t const x12x(x0x + C0 - i1x), x12y(x0y + C0 - i1y), x12z(x0x + C2), x12w(x0y + C2);
+	// permutations
+	ix = nv_mod(ix, 289.0f);
+	iy = nv_mod(iy, 289.0f);
+	noise_vec_t const px[3] = {(x0x), (x12x), (x12z)}, py[3] = {(x0y), (x12y), (x12w)};
+	noise_vec_t const oy[3] = {0.0f, i1y, 1.0f}, ox[3] = {0.0f, i1x, 1.0f};
+	noise_vec_t ret(0.0f);
+
+	for (unsigned n = 0; n < 3; ++n) { // 3 corners
+		noise_vec_t const p(nv_permute(nv_permute(iy + oy[n]) + ix + ox[n]));
+		noise_vec_t m(nv_max((0.5f - (px[n]*px[n] + py[n]*py[n])), 0.0f));
+		m = m*m;
+		m = m*m;
+		// gradients: 41 points uniformly over a line, mapped onto a diamond
+		noise_vec_t const x(2.0f*nv_fract(p*C3) - 1.0f), h(nv_abs(x) - 0.5f), a0(x - nv_floor(x + 0.5f));
+		m = m*(1.79284291400159f - 0.85373472095314f*(a0*a0 + h*h)); // normalize gradients implicitly by scaling m
+		noise_vec_t const g(a0*px[n] + h*py[n]);
+		ret = ((n == 0) ? m*g : (ret + m*g)); // same summation order as glm dot()
+	}
+	return 130.0f*ret;
+}
+
+// batched glm::perlin(vec2)
+noise_vec_t perlin_noise_batch(noise_vec_t const &px, noise_vec_t const &py) {
+
+	noise_vec_t const fpx(nv_floor(px)), fpy(nv_floor(py));
+	noise_vec_t const pi[4] = {nv_mod(fpx + 0.0f, 289.0f), nv_mod(fpy + 0.0f, 289.0f), nv_mod(fpx + 1.0f, 289.0f), nv_mod(fpy + 1.0f, 289.0f)};
+	noise_vec_t const pf[4] = {nv_fract(px) - 0.0f, nv_fract(py) - 0.0f, nv_fract(px) - 1.0f, nv_fract(py) - 1.0f};
+	// corners in order {00, 10, 01, 11}
+	noise_vec_t const *const ix[4] = {&pi[0], &pi[2], &pi[0], &pi[2]}, *const iy[4] = {&pi[1], &pi[1], &pi[3], &pi[3]};
+	noise_vec_t const *const fx[4] = {&pf[0], &pf[2], &pf[0], &pf[2]}, *const fy[4] = {&pf[1], &pf[1], &pf[3], &pf[3]};
+	noise_vec_t nv[4];
+
+	for (unsigned n = 0; n < 4; ++n) {
+		noise_vec_t const i(nv_permute(nv_permute(*ix[n]) + *iy[n]));
+		noise_vec_t gx(2.0f*nv_fract(i/41.0f) - 1.0f);
+		noise_vec_t const gy(nv_abs(gx) - 0.5f);
+		gx = gx - nv_floor(gx + 0.5f);
+		noise_vec_t const norm(1.79284291400159f - 0.85373472095314f*(gx*gx + gy*gy)); // taylorInvSqrt()
+		nv[n] = (gx*norm)*(*fx[n]) + (gy*norm)*(*fy[n]);
+	}
+	noise_vec_t const fade_x(((pf[0]*pf[0])*pf[0])*(pf[0]*(pf[0]*6.0f - 15.0f) + 10.0f)), fade_y(((pf[1]*pf[1])*pf[1])*(pf[1]*(pf[1]*6.0f - 15.0f) + 10.0f));
+	noise_vec_t const nx0(nv[0] + fade_x*(nv[1] - nv[0])), nx1(nv[2] + fade_x*(nv[3] - nv[2]));
+	return 2.3f*(nx0 + fade_y*(nx1 - nx0));
+}
+
+// batched gen_noise(); rx and ry come from gen_rx_ry()
+noise_vec_t gen_noise_batch(noise_vec_t const &xv, noise_vec_t const &yv, int mode, int shape, float rx, float ry) {
+
+	noise_vec_t zval(0.0f);
+	float mag(1.0), freq(1.0);
+	unsigned const end_octave(NUM_FREQ_COMP - start_eval_sin/N_RAND_SIN2);
+	float const lacunarity(1.92), gain(0.5);
+	bool const is_simplex(mode == MGEN_SIMPLEX || mode == MGEN_SIMPLEX_GPU || mode == MGEN_DWARP_GPU);
+
+	for (unsigned i = 0; i < end_octave; ++i) {
+		noise_vec_t const px(freq*xv + rx), py(freq*yv + ry);
+		noise_vec_t noise(is_simplex ? simplex_noise_batch(px, py) : perlin_noise_batch(px, py));
+		switch (shape) {
+		case 0: break; // linear - do nothing
+		case 1: noise = nv_abs(noise) - 0.40f; break; // billowy
+		case 2: noise = 0.45f - nv_abs(noise); break; // ridged
+		}
+		zval = zval + mag*noise;
+		mag  *= gain;
+		freq *= lacunarity;
+		rx   *= 1.5;
+		ry   *= 1.5;
+	}
+	return zval;
+}
+
+float get_noise_zval(float xval, float yval, int mode, int shape);
+
+// batched get_noise_zval(), evaluated NOISE_BATCH_SIZE values at a time; results are the same as calling get_noise_zval() for each value
+void get_noise_zvals(float const *xvals, float const *yvals, float *zvals, unsigned num, int mode, int shape) {
+
+	assert(mode != MGEN_SINE); // mode 0 not supported by this function
+	float const xy_scale(MESH_SCALE_FACTOR*mesh_scale), hmap_scale(get_hmap_scale(mode));
+	float rx, ry;
+	gen_rx_ry(rx, ry);
+
+	for (unsigned i = 0; i < num; i += NOISE_BATCH_SIZE) {
+		unsigned const n(min(NOISE_BATCH_SIZE, num-i));
+		noise_vec_t xv, yv;
+
+		for (unsigned j = 0; j < NOISE_BATCH_SIZE; ++j) { // pad the last batch by repeating the last value
+			xv.v[j] = xy_scale*xvals[i + min(j, n-1)];
+			yv.v[j] = xy_scale*yvals[i + min(j, n-1)];
+		}
+		if (mode == MGEN_DWARP_GPU) { // domain warping
+			float const scale(0.2);
+			noise_vec_t const dx1(gen_noise_batch(xv+0.0f, yv+0.0f, mode, shape, rx, ry));
+			noise_vec_t const dy1(gen_noise_batch(xv+5.2f, yv+1.3f, mode, shape, rx, ry));
+			noise_vec_t const dx2(gen_noise_batch((xv + scale*dx1 + 1.7f), (yv + scale*dy1 + 9.2f), mode, shape, rx, ry));
+			noise_vec_t const dy2(gen_noise_batch((xv + scale*dx1 + 8.3f), (yv + scale*dy1 + 2.8f), mode, shape, rx, ry));
+			xv = xv + scale*dx2; yv = yv + scale*dy2;
+		}
+		noise_vec_t const zval(gen_noise_batch(xv, yv, mode, shape, rx, ry));
+
+		for (unsigned j = 0; j < n; ++j) {
+			float z(zval.v[j]);
+			postproc_noise_zval(z);
+			zvals[i+j] = z*hmap_scale;
+		}
+	}
+}
+
 
 bool mesh_xy_grid_cache_t::build_arrays(float x0, float y0, float dx, float dy,
 	unsigned nx, unsigned ny, bool cache_values, bool force_sine_mode, bool no_wait)
@@ -592,13 +838,41 @@ bool mesh_xy_grid_cache_t::build_arrays(float x0, float y0, float dx, float dy,
 	do_glaciate = 0; // must set enable_glaciate() after this call if needed
 	cached_vals.clear();
 
-	if (gen_mode >= MGEN_SIMPLEX_GPU) { // GPU simplex noise - always cache values
+	if (gen_mode >= MGEN_SIMPLEX_GPU && !force_cpu_mesh_gen) { // GPU simplex noise - always cache values
 		bool const is_running(cshader && cshader->get_is_running());
 		if (!is_running) {run_gpu_simplex();} // launch the job
 		if (no_wait && !is_running) return 0; // just started, results not yet available
 		cache_gpu_simplex_vals();
 		return 1; // results are available
 	}
+	if (gen_mode != MGEN_SINE) { // CPU simplex/perlin noise - always cache values, computed with the batched noise kernel
+		cached_vals.resize(cur_nx*cur_ny);
+		highres_timer_t timer("CPU Noise Tile Batched", benchmark_cpu_noise);
+
+#pragma omp parallel for schedule(static,1)
+		for (int y = 0; y < (int)cur_ny; ++y) {
+			vector<float> xvals(cur_nx), yvals(cur_nx, (y*mdy + my0)*DY_VAL_INV);
+			for (unsigned x = 0; x < cur_nx; ++x) {xvals[x] = (x*mdx + mx0)*DX_VAL_INV;}
+			get_noise_zvals(&xvals.front(), &yvals.front(), &cached_vals[y*cur_nx], cur_nx, gen_mode, gen_shape);
+		}
+		timer.end();
+
+		if (benchmark_cpu_noise) { // time the scalar version on the same tile and check that the results agree
+			highres_timer_t timer2("CPU Noise Tile Scalar");
+			unsigned num_diff(0);
+
+#pragma omp parallel for schedule(static,1) reduction(+:num_diff)
+			for (int y = 0; y < (int)cur_ny; ++y) {
+				for (unsigned x = 0; x < cur_nx; ++x) {
+					float const xval((x*mdx + mx0)*DX_VAL_INV), yval((y*mdy + my0)*DY_VAL_INV);
+					if (get_noise_zval(xval, yval, gen_mode, gen_shape) != cached_vals[y*cur_nx + x]) {++num_diff;}
+				}
+			}
+			timer2.end();
+			if (num_diff > 0) {cout << "Warning: " << num_diff << " of " << cached_vals.size() << " batched CPU noise values differ from the scalar version" << endl;}
+		}
+		return 1; // results are available
+	}
 	yterms_start = nx*F_TABLE_SIZE;
 	xyterms.resize((nx + ny)*F_TABLE_SIZE, 0.0);
 	float const msx(mesh_scale*DX_VAL_INV), msy(mesh_scale*DY_VAL_INV), ms2(0.5*mesh_scale);
@@ -712,8 +986,8 @@ float gen_noise(float xv, float yv, int mode, int shape) {
 		float noise((mode == MGEN_SIMPLEX || mode == MGEN_SIMPLEX_GPU || mode == MGEN_DWARP_GPU) ? glm::simplex(pos) : glm::perlin(pos));
 		switch (shape) {
 		case 0: break; // linear - do nothing
-		case 1: noise = fabs(noise) - 0.40; break; // billowy
-		case 2: noise = 0.45 - fabs(noise); break; // ridged
+		case 1: noise = fabs(noise) - 0.40f; break; // billowy
+		case 2: noise = 0.45f - fabs(noise); break; // ridged
 		//abs(0.5-abs(noise)*2.0)*2.0-0.5
 		}
 		zval += mag*noise;
@@ -735,10 +1009,10 @@ float get_noise_zval(float xval, float yval, int mode, int shape) {
 
 	if (mode == MGEN_DWARP_GPU) { // domain warping
 		float const scale(0.2);
-		float const dx1(gen_noise(xv+0.0, yv+0.0, mode, shape));
-		float const dy1(gen_noise(xv+5.2, yv+1.3, mode, shape));
-		float const dx2(gen_noise((xv + scale*dx1 + 1.7), (yv + scale*dy1 + 9.2), mode, shape));
-		float const dy2(gen_noise((xv + scale*dx1 + 8.3), (yv + scale*dy1 + 2.8), mode, shape));
+		float const dx1(gen_noise(xv+0.0f, yv+0.0f, mode, shape)); // float constants to match the shader and get_noise_zvals()
+		float const dy1(gen_noise(xv+5.2f, yv+1.3f, mode, shape));
+		float const dx2(gen_noise((xv + scale*dx1 + 1.7f), (yv + scale*dy1 + 9.2f), mode, shape));
+		float const dy2(gen_noise((xv + scale*dx1 + 8.3f), (yv + scale*dy1 + 2.8f), mode, shape));
 		xv += scale*dx2; yv += scale*dy2;
 	}
 	float zval(gen_noise(xv, yv, mode, shape));
@@ -752,7 +1026,7 @@ float mesh_xy_grid_cache_t::eval_index(unsigned x, unsigned y, int min_start_sin
 	assert(x < cur_nx && y < cur_ny);
 	float zval(0.0);
 
-	if ((use_cache || gen_mode >= MGEN_SIMPLEX_GPU) && !cached_vals.empty()) {
+	if ((use_cache || gen_mode != MGEN_SINE) && !cached_vals.empty()) {
 		zval += cached_vals[y*cur_nx + x];
 	}
 	else if (gen_mode != MGEN_SINE) { // perlin/simplex
@@ -13,11 +13,24 @@
 #include <fstream>
 #include <queue>
 #include "meshoptimizer.h"
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 bool const ENABLE_BUMP_MAPS  = 1;
 bool const ENABLE_SPEC_MAPS  = 1;
 bool const ENABLE_INTER_REFLECTIONS = 1;
 unsigned const MAGIC_NUMBER  = 42987143; // arbitrary file signature
+unsigned const MAGIC_NUMBER_MAPPED  = 42987144; // signature of the page-aligned format, which is followed by the version
+unsigned const MODEL3D_FILE_VERSION = 2;
 unsigned const BLOCK_SIZE    = 32768; // in vertex indices
 
 bool model_calc_tan_vect(1); // slower and more memory but sometimes better quality/smoother transitions
@@ -25,7 +38,8 @@ bool model_calc_tan_vect(1); // slower and more memory but sometimes better qual
 extern bool group_back_face_cull, enable_model3d_tex_comp, disable_shader_effects, texture_alpha_in_red_comp, use_model2d_tex_mipmaps, enable_model3d_bump_maps;
 extern bool two_sided_lighting, have_indir_smoke_tex, use_core_context, model3d_wn_normal, invert_model_nmap_bscale, use_z_prepass, all_model3d_ref_update;
 extern bool use_interior_cube_map_refl, enable_model3d_custom_mipmaps, enable_tt_model_indir, no_subdiv_model, auto_calc_tt_model_zvals, use_model_lod_blocks;
-extern bool flatten_tt_mesh_under_models, no_store_model_textures_in_memory, disable_model_textures, allow_model3d_quads, merge_model_objects;
+extern bool flatten_tt_mesh_under_models, no_store_model_textures_in_memory, disable_model_textures, allow_model3d_quads, merge_model_objects, cobj_tree_sah_build;
+extern bool parallel_model_tex_load, texture_cache_warm_only;
 extern unsigned shadow_map_sz, reflection_tid;
 extern int display_mode;
 extern float model3d_alpha_thresh, model3d_texture_anisotropy, model_triplanar_tc_scale, model_mat_lod_thresh, cobj_z_bias, model_hemi_lighting_scale, light_int_scale[];
@@ -91,18 +105,60 @@ bool texture_manager::ensure_texture_loaded(texture_t &t, int tid, bool is_bump)
 	// Note: it's incorrect to call t.has_alpha() here because that uses color, which hasn't been computed yet (t.init() is called later);
 	// but that's okay, do_gl_init() will disable custom mipmaps for textures with color.A == 1.0
 	if (use_model2d_tex_mipmaps && enable_model3d_custom_mipmaps /*&& t.has_alpha()*/) {t.use_mipmaps = 4;}
+	bool const has_alpha_tex(t.alpha_tid >= 0 && t.alpha_tid != tid); // if alpha is the same texture then the alpha channel should already be set
+	// the cache stores the result of all of the processing below, so that only the upload is left
+	uint64_t const cache_hash(t.get_cache_hash(1, (has_alpha_tex ? &get_texture(t.alpha_tid) : nullptr), is_bump));
+	if (cache_hash != 0 && t.read_from_cache(cache_hash)) return 1;
 	t.load(-1);
 		
-	if (t.alpha_tid >= 0 && t.alpha_tid != tid) { // if alpha is the same texture then the alpha channel should already be set
+	if (has_alpha_tex) {
 		ensure_tid_loaded(t.alpha_tid, 0);
 		t.copy_alpha_from_texture(get_texture(t.alpha_tid), texture_alpha_in_red_comp);
 	}
 	if (is_bump) {t.make_normal_map();}
 	t.init(); // must be after alpha copy
+	t.build_custom_mipmaps(); // on the CPU, so that only the upload is left for the GL thread
 	assert(t.is_loaded());
+	if (cache_hash != 0) {t.write_to_cache(cache_hash);}
 	return 1;
 }
 
+// CPU stage of texture loading (decode, resize, alpha channel, normal map, color, and mipmaps) for a set of textures, run in parallel;
+// each texture is loaded once, using the is_bump flag of its first use; GL upload is done later, on the main thread
+void texture_manager::load_textures(vector<pair<int, bool> > const &to_load) {
+
+	vector<int> is_bump(textures.size(), -1); // -1 = not requested
+	vector<unsigned> pending;
+
+	for (auto i = to_load.begin(); i != to_load.end(); ++i) {
+		if (i->first < 0 || (unsigned)i->first >= textures.size()) continue; // no texture, or builtin texture (already loaded)
+		if (is_bump[i->first] >= 0) continue; // duplicate
+		is_bump[i->first] = i->second;
+		pending.push_back(i->first);
+	}
+	for (unsigned i = 0; i < pending.size(); ++i) { // add alpha textures, which must be loaded before the textures they're copied into
+		int const alpha_tid(textures[pending[i]].alpha_tid);
+		if (alpha_tid < 0 || (unsigned)alpha_tid >= textures.size() || is_bump[alpha_tid] >= 0) continue;
+		is_bump[alpha_tid] = 0;
+		pending.push_back(alpha_tid);
+	}
+	while (!pending.empty()) { // load in waves, where each texture's alpha texture was loaded in a previous wave
+		vector<unsigned> ready, waiting;
+
+		for (unsigned tid : pending) {
+			texture_t const &t(textures[tid]);
+			if (t.is_loaded()) continue; // already loaded
+			bool const alpha_ready(t.alpha_tid < 0 || t.alpha_tid == (int)tid || get_texture(t.alpha_tid).is_loaded());
+			(alpha_ready ? ready : waiting).push_back(tid);
+		}
+		if (ready.empty() && !waiting.empty()) {ready.push_back(waiting.back()); waiting.pop_back();} // alpha cycle (shouldn't happen); load serially
+
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < (int)ready.size(); ++i) {ensure_texture_loaded(textures[ready[i]], ready[i], (is_bump[ready[i]] == 1));}
+		pending.swap(waiting);
+	}
+}
+
 void texture_manager::bind_alpha_channel_to_texture(int tid, int alpha_tid) {
 
 	if (tid < 0 || alpha_tid < 0) return; // no texture
@@ -147,21 +203,12 @@ unsigned texture_manager::get_gpu_mem() const {
 
 // ************ read/write code ************
 
-void write_uint(ostream &out, unsigned val) {
-	out.write((const char *)&val, sizeof(unsigned));
-}
-
 unsigned read_uint(istream &in) {
 	unsigned val(0);
 	in.read((char *)&val, sizeof(unsigned));
 	return val;
 }
 
-template<typename V> void write_vector(ostream &out, V const &v) {
-	write_uint(out, (unsigned)v.size());
-	out.write((const char *)&v.front(), (std::streamsize)v.size()*sizeof(typename V::value_type));
-}
-
 template<typename V> void read_vector(istream &in, V &v) {
 	v.clear();
 	v.resize(read_uint(in));
@@ -169,6 +216,66 @@ template<typename V> void read_vector(istream &in, V &v) {
 }
 
 
+// ************ model3d_file_writer_t/model3d_file_reader_t ************
+
+void model3d_file_writer_t::align_to_page() {
+
+	static char const zeros[MODEL3D_PAGE_SIZE] = {0};
+	size_t const pos((size_t)out.tellp()), num_pad((MODEL3D_PAGE_SIZE - (pos % MODEL3D_PAGE_SIZE)) % MODEL3D_PAGE_SIZE);
+	if (num_pad > 0) {write(zeros, num_pad);}
+}
+
+bool model3d_file_reader_t::open(string const &fn) {
+
+	close();
+#ifdef _WIN32
+	HANDLE const file(CreateFileA(fn.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+	if (file == INVALID_HANDLE_VALUE) return 0;
+	LARGE_INTEGER file_size;
+
+	if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+		HANDLE const mapping(CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL));
+
+		if (mapping != NULL) {
+			data = (char const *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping); // the view keeps the mapping open
+			if (data != nullptr) {size = (size_t)file_size.QuadPart;}
+		}
+	}
+	CloseHandle(file);
+#else
+	int const fd(::open(fn.c_str(), O_RDONLY));
+	if (fd < 0) return 0;
+	struct stat st;
+
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void *const ptr(mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+		
+		if (ptr != MAP_FAILED) {
+			data = (char const *)ptr;
+			size = (size_t)st.st_size;
+			madvise(ptr, size, MADV_SEQUENTIAL);
+		}
+	}
+	::close(fd); // the mapping stays valid after the file is closed
+#endif
+	pos = 0;
+	return (data != nullptr);
+}
+
+void model3d_file_reader_t::close() {
+
+	if (data == nullptr) return; // not open
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap((void *)data, size);
+#endif
+	data = nullptr;
+	size = pos = 0;
+}
+
+
 // ************ vntc_vect_t/indexed_vntc_vect_t ************
 
 // explicit template instantiations of vert_norm case, used for voxel_model, where tc=0.0
@@ -540,8 +647,10 @@ template<> void indexed_vntc_vect_t<vert_norm_tc_tan>::calc_tangents(unsigned np
 }
 
 
-template<typename T> void vntc_vect_t<T>::write(ostream &out) const {
-	write_vector(out, *this);
+template<typename T> void vntc_vect_t<T>::write(model3d_file_writer_t &out) const {
+	out.write_vector(*this);
+	out.write(&bsphere, sizeof(sphere_t));
+	out.write(&bcube,   sizeof(cube_t));
 }
 
 template<typename T> void vntc_vect_t<T>::read(istream &in) {
@@ -555,6 +664,13 @@ template<typename T> void vntc_vect_t<T>::read(istream &in) {
 	calc_bounding_volumes();
 }
 
+template<typename T> bool vntc_vect_t<T>::read(model3d_file_reader_t &in) {
+
+	if (!in.read_vector(*this) || !in.read(&bsphere, sizeof(sphere_t)) || !in.read(&bcube, sizeof(cube_t))) return 0;
+	has_tangents = (sizeof(T) == sizeof(vert_norm_tc_tan)); // HACK to get the type
+	return 1; // bounding volumes were stored, so don't need to be recomputed
+}
+
 
 // Note: non-const due to VBO caching
 template<typename T> void indexed_vntc_vect_t<T>::render(shader_t &shader, bool is_shadow_pass, point const *const xlate, unsigned npts, bool no_vfc) {
@@ -645,16 +761,12 @@ template<typename T> unsigned indexed_vntc_vect_t<T>::add_vertex(T const &v, ver
 
 	T v2(v);
 	if (vmap.get_average_normals()) {v2.n = zero_vector;}
-	auto it(vmap.find(v2));
-	unsigned ix;
+	unsigned const ix(vmap.find_or_insert(v2, (unsigned)size()));
 
-	if (it == vmap.end()) { // not found
-		ix = (unsigned)size();
+	if (ix == size()) { // not found
 		this->push_back(v);
-		vmap[v2] = ix;
 	}
 	else { // found
-		ix = it->second;
 		assert(ix < size());
 
 		if (vmap.get_average_normals()) {
@@ -763,9 +875,16 @@ template<typename T> void indexed_vntc_vect_t<T>::invert_tcy() {
 	for (auto i = begin(); i != end(); ++i) {invert_vert_tcy(*i);}
 }
 
-template<typename T> void indexed_vntc_vect_t<T>::write(ostream &out) const {
+// Note: stores the finalized state (subdivision blocks and LOD blocks) so that it doesn't need to be recomputed on load
+template<typename T> void indexed_vntc_vect_t<T>::write(model3d_file_writer_t &out) const {
+
 	vntc_vect_t<T>::write(out);
-	write_vector(out, indices);
+	out.write_vector(indices);
+	out.write_vector(blocks);
+	out.write_vector(lod_blocks);
+	float const areas[3] = {avg_area_per_tri, amin, amax};
+	out.write(areas, sizeof(areas));
+	out.write_uint(unsigned(finalized) | (unsigned(optimized) << 1));
 }
 
 template<typename T> void indexed_vntc_vect_t<T>::read(istream &in) {
@@ -773,6 +892,20 @@ template<typename T> void indexed_vntc_vect_t<T>::read(istream &in) {
 	read_vector(in, indices);
 }
 
+template<typename T> bool indexed_vntc_vect_t<T>::read(model3d_file_reader_t &in) {
+
+	if (!vntc_vect_t<T>::read(in) || !in.read_vector(indices) || !in.read_vector(blocks) || !in.read_vector(lod_blocks)) return 0;
+	float areas[3] = {0};
+	unsigned flags(0);
+	if (!in.read(areas, sizeof(areas)) || !in.read(&flags, sizeof(unsigned))) return 0;
+	avg_area_per_tri = areas[0];
+	amin      = areas[1];
+	amax      = areas[2];
+	finalized = ((flags & 1) != 0);
+	optimized = ((flags & 2) != 0);
+	return 1;
+}
+
 
 // ************ polygon_t ************
 
@@ -922,11 +1055,19 @@ template<typename T> void vntc_vect_block_t<T>::merge_into_single_vector() {
 	this->resize(1); // remove all but the first block
 }
 
-template<typename T> bool vntc_vect_block_t<T>::write(ostream &out) const {
+template<typename T> bool vntc_vect_block_t<T>::write(model3d_file_writer_t &out, unsigned npts) const {
 
-	write_uint(out, (unsigned)this->size());
-	for (auto i = begin(); i != end(); ++i) {i->write(out);}
-	return 1;
+	out.write_uint((unsigned)this->size());
+
+	for (auto i = begin(); i != end(); ++i) {
+		if (!i->needs_tangents()) {i->write(out); continue;}
+		// tangent vectors are needed for reading, but computing them in place would modify the model (they're computed later, after TC inversion)
+		indexed_vntc_vect_t<T> temp(*i);
+		temp.make_private_copy();
+		temp.calc_tangents(npts);
+		temp.write(out);
+	}
+	return out.good();
 }
 
 template<typename T> bool vntc_vect_block_t<T>::read(istream &in) {
@@ -938,6 +1079,20 @@ template<typename T> bool vntc_vect_block_t<T>::read(istream &in) {
 	return 1;
 }
 
+template<typename T> bool vntc_vect_block_t<T>::read(model3d_file_reader_t &in) {
+
+	this->clear();
+	unsigned num(0);
+	if (!in.read(&num, sizeof(unsigned))) return 0;
+	this->resize(num);
+
+	for (auto i = begin(); i != end(); ++i) {
+		if (!i->read(in)) return 0;
+	}
+	if (merge_model_objects) {merge_into_single_vector();} // model was split per object, and we don't want that; merge into a single vector
+	return 1;
+}
+
 
 // ************ geometry_t ************
 
@@ -1068,6 +1223,16 @@ void maybe_upload_and_free(texture_manager &tmgr, unsigned tid) {
 	if (tid < BUILTIN_TID_START) {tmgr.ensure_tid_bound(tid);} // upload to GPU and free if not a built-in texture
 }
 
+void material_t::add_textures_to_load(texture_manager &tmgr, vector<pair<int, bool> > &to_load) { // {tid, is_bump}
+
+	if (!mat_is_used()) return;
+	tmgr.bind_alpha_channel_to_texture(get_render_texture(), alpha_tid); // must be done before the texture is loaded
+	to_load.emplace_back(get_render_texture(), 0);
+	if (use_bump_map()) {to_load.emplace_back(bump_tid, 1);}
+	if (use_spec_map()) {to_load.emplace_back(s_tid,  0);}
+	if (use_spec_map()) {to_load.emplace_back(ns_tid, 0);}
+}
+
 void material_t::init_textures(texture_manager &tmgr) {
 
 	if (!mat_is_used()) return;
@@ -1221,11 +1386,11 @@ bool material_t::add_poly(polygon_t const &poly, vntc_map_t vmap[2], vntct_map_t
 }
 
 
-bool material_t::write(ostream &out) const {
+bool material_t::write(model3d_file_writer_t &out) const {
 
 	out.write((char const *)this, sizeof(material_params_t));
-	write_vector(out, name);
-	write_vector(out, filename);
+	out.write_vector(name);
+	out.write_vector(filename);
 	return (geom.write(out) && geom_tan.write(out));
 }
 
@@ -1239,6 +1404,12 @@ bool material_t::read(istream &in) {
 }
 
 
+bool material_t::read(model3d_file_reader_t &in) {
+	if (!in.read((char *)this, sizeof(material_params_t)) || !in.read_vector(name) || !in.read_vector(filename)) return 0;
+	return (geom.read(in) && geom_tan.read(in));
+}
+
+
 // ************ model3d ************
 
 
@@ -1601,9 +1772,28 @@ void model3d::clear_smaps() { // frees GL state
 void model3d::load_all_used_tids() {
 
 	if (textures_loaded) return; // is this safe to skip?
+
+	if (texture_cache_warm_only) { // no GL context: process all textures on the CPU to write them to the texture cache
+		vector<pair<int, bool> > to_load;
+		for (auto m = materials.begin(); m != materials.end(); ++m) {m->add_textures_to_load(tmgr, to_load);}
+		tmgr.load_textures(to_load); // not freed here, since the model build reads texture colors; freed by the caller once the model is loaded
+		textures_loaded = 1;
+		return;
+	}
 	tmgr.free_after_upload = no_store_model_textures_in_memory;
-//#pragma omp parallel for schedule(dynamic) // not thread safe due to texture_t::resize() GL calls and reuse of textures across materials
-	for (int i = 0; i < (int)materials.size(); ++i) {materials[i].init_textures(tmgr);}
+	// textures are loaded and processed in parallel, then uploaded serially; if textures are freed after upload, this is done in batches of materials to limit peak memory
+	unsigned const batch_sz(tmgr.free_after_upload ? 4*omp_get_max_threads_3dw() : max((unsigned)materials.size(), 1U));
+
+	for (unsigned b = 0; b < materials.size(); b += batch_sz) {
+		unsigned const e(min(b+batch_sz, (unsigned)materials.size()));
+
+		if (parallel_model_tex_load) {
+			vector<pair<int, bool> > to_load;
+			for (unsigned i = b; i < e; ++i) {materials[i].add_textures_to_load(tmgr, to_load);}
+			tmgr.load_textures(to_load);
+		}
+		for (unsigned i = b; i < e; ++i) {materials[i].init_textures(tmgr);} // Note: not thread safe due to GL texture upload
+	}
 	textures_loaded = 1;
 }
 
@@ -1973,20 +2163,35 @@ void model3d::create_indir_texture() {
 	unsigned const xsize(sky_lighting_sz[0]), ysize(sky_lighting_sz[1]), zsize(sky_lighting_sz[2]), tot_sz(xsize*ysize*zsize);
 	assert(tot_sz > 0);
 	if (tot_sz == 0) return; // nothing to do
+	float const init_weight(light_int_scale[LIGHTING_SKY]); // record orig value
+	vector<unsigned char> tex_data;
+	bool read_orig_format(!sky_lighting_fn.empty());
+
+	if (read_orig_format) { // bricked files are converted directly to the texture, without allocating the dense lmcell grid
+		lmap_bricks_t bricks;
+		bool is_bricked(0);
+
+		if (bricks.read_file(sky_lighting_fn.c_str(), LIGHTING_SKY, xsize, ysize, zsize, is_bricked)) {
+			assert(sky_lighting_weight > 0.0);
+			light_int_scale[LIGHTING_SKY] = sky_lighting_weight;
+			indir_light_tex_from_bricks(model_indir_tid, bricks, LIGHTING_SKY, tex_data, xsize, ysize, zsize);
+			light_int_scale[LIGHTING_SKY] = init_weight; // restore orig value
+			return;
+		}
+		read_orig_format = !is_bricked; // don't try to read an invalid bricked file again below
+	}
 	lmap_manager_t local_lmap_manager; // store in the model3d and cache for reuse on context change (at the cost of more CPU memory usage)? only matters when ray tracing (below)?
 	lmcell init_lmcell;
 	unsigned char **need_lmcell = nullptr; // not used - dense mode
 	local_lmap_manager.alloc(tot_sz, xsize, ysize, zsize, need_lmcell, init_lmcell);
-	float const init_weight(light_int_scale[LIGHTING_SKY]); // record orig value
 
-	if (!sky_lighting_fn.empty() && local_lmap_manager.read_data_from_file(sky_lighting_fn.c_str(), LIGHTING_SKY)) {
+	if (read_orig_format && local_lmap_manager.read_data_from_file(sky_lighting_fn.c_str(), LIGHTING_SKY)) {
 		assert(sky_lighting_weight > 0.0);
 		light_int_scale[LIGHTING_SKY] = sky_lighting_weight;
 	}
 	else {
 		// FIXME: run raytracing to fill in local_lmap_manager, use bcube for bounds (scale to get_scene_bounds_bcube())
 	}
-	vector<unsigned char> tex_data;
 	indir_light_tex_from_lmap(model_indir_tid, local_lmap_manager, tex_data, xsize, ysize, zsize);
 	light_int_scale[LIGHTING_SKY] = init_weight; // restore orig value
 	//cout << TXT(zsize) << TXT(tot_sz) << TXT(model_indir_tid) << endl;
@@ -2089,6 +2294,7 @@ void model3d::build_cobj_tree(bool verbose) {
 	RESET_TIME;
 	get_polygons(coll_tree.get_tquads_ref());
 	PRINT_TIME(" Get Model3d Polygons");
+	coll_tree.set_sah_build(cobj_tree_sah_build);
 	coll_tree.build_tree_top(verbose);
 	PRINT_TIME(" Cobj Tree Create (from model3d)");
 }
@@ -2158,7 +2364,8 @@ void model3d::show_stats() const {
 }
 
 
-bool model3d::write_to_disk(string const &fn) const { // Note: transforms not written
+// Note: source_hash identifies the source file (and read options) this file was converted from, or is 0 if unknown
+bool model3d::write_to_disk(string const &fn, uint64_t source_hash) const { // Note: transforms not written
 
 	ofstream out(fn, ios::out | ios::binary);
 	
@@ -2167,23 +2374,62 @@ bool model3d::write_to_disk(string const &fn) const { // Note: transforms not wr
 		return 0;
 	}
 	cout << "Writing model3d file " << fn << endl;
-	write_uint(out, MAGIC_NUMBER);
-	out.write((char const *)&bcube, sizeof(cube_t));
-	if (!unbound_geom.write(out)) return 0;
-	write_uint(out, (unsigned)materials.size());
+	model3d_file_writer_t writer(out);
+	writer.write_uint(MAGIC_NUMBER_MAPPED);
+	writer.write_uint(MODEL3D_FILE_VERSION);
+	writer.write(&source_hash, sizeof(uint64_t));
+	writer.write(&bcube, sizeof(cube_t));
+	if (!unbound_geom.write(writer)) return 0;
+	writer.write_uint((unsigned)materials.size());
 	
 	for (deque<material_t>::const_iterator m = materials.begin(); m != materials.end(); ++m) {
-		if (!m->write(out)) {
+		if (!m->write(writer)) {
 			cerr << "Error writing material" << endl;
 			return 0;
 		}
 	}
-	return out.good();
+	return writer.good();
 }
 
 
-bool model3d::read_from_disk(string const &fn) { // Note: transforms not read
+// if source_hash is nonzero, the file is only read if it was written from a source file with the same hash; otherwise, 0 is returned
+bool model3d::read_from_disk(string const &fn, uint64_t source_hash) { // Note: transforms not read
+
+	model3d_file_reader_t reader;
+	unsigned header[2] = {0}; // magic number, version
+
+	if (reader.open(fn) && reader.read(header, sizeof(header)) && header[0] == MAGIC_NUMBER_MAPPED) { // page-aligned format
+		if (header[1] != MODEL3D_FILE_VERSION) {
+			cerr << "Error reading model3d file " << fn << ": Unsupported version " << header[1] << "." << endl;
+			return 0;
+		}
+		uint64_t file_source_hash(0);
+		if (!reader.read(&file_source_hash, sizeof(uint64_t))) return 0;
 
+		if (source_hash != 0 && file_source_hash != source_hash) {
+			cout << "Model3d file " << fn << " is out of date and will be rebuilt" << endl;
+			return 0;
+		}
+		clear();
+		cout << "Reading model3d file " << fn << endl;
+		from_model3d_file = 1;
+		unsigned num_materials(0);
+		bool success(reader.read(&bcube, sizeof(cube_t)) && unbound_geom.read(reader) && reader.read(&num_materials, sizeof(unsigned)));
+		if (success) {materials.resize(num_materials);}
+
+		for (deque<material_t>::iterator m = materials.begin(); m != materials.end() && success; ++m) {
+			success = m->read(reader);
+			mat_map[m->name] = (m - materials.begin());
+		}
+		if (!success) {
+			cerr << "Error reading model3d file " << fn << ": File is truncated or corrupt." << endl;
+			clear();
+			from_model3d_file = 0;
+		}
+		return success;
+	}
+	reader.close();
+	if (source_hash != 0) return 0; // missing file or old format without a source hash; needs to be rebuilt
 	ifstream in(fn, ios::in | ios::binary);
 	
 	if (!in.good()) {
@@ -8,6 +8,7 @@
 #include "cobj_bsp_tree.h" // for cobj_tree_tquads_t
 #include "shadow_map.h" // for smap_data_t and rotation_t
 #include "gl_ext_arb.h"
+#include <cstring> // for memcpy
 //#include <unordered_map>
 
 using namespace std;
@@ -181,17 +182,102 @@ template<typename T> struct hash_by_bytes { // should work with all packed verte
 	//uint32_t operator()(T const &v) const {return jenkins_one_at_a_time_hash((const uint32_t*)&v, sizeof(T)>>2);} // faster but lower quality hash
 };
 
-//template<typename T> class vertex_map_t : public unordered_map<T, unsigned, hash_by_bytes<T>> {
-template<typename T> class vertex_map_t : public map<T, unsigned> {
+// 64-bit FNV-1a over words with an extra xorshift per word; used for content hashes that validate on-disk caches (models, textures, tiles, heightmaps)
+class fnv_hasher_t {
+	uint64_t hash;
+public:
+	fnv_hasher_t(uint64_t init=0xcbf29ce484222325ULL) : hash(init) {} // FNV offset basis, or a previous hash to extend
+	void add(uint64_t val) {hash = (hash ^ val)*0x100000001b3ULL; hash ^= (hash >> 29);}
+	void add_float(float val) {uint32_t bits(0); memcpy(&bits, &val, sizeof(float)); add(bits);}
+	void add_floats(float const *vals, unsigned num) {for (unsigned i = 0; i < num; ++i) {add_float(vals[i]);}}
+	uint64_t get() const {return hash;}
+};
 
+// open addressing (linear probing) hash map from vertex to index, used to merge duplicate vertices;
+// memory is kept across clear() calls so that a single map is reused as a pool for all material blocks
+template<typename T> class vertex_map_t {
+
+	struct entry_t {
+		uint32_t hash, kix; // kix = key index + 1, or 0 if empty
+		entry_t() : hash(0), kix(0) {}
+	};
+	vector<entry_t> table; // size is zero or a power of 2, with a max load factor of 0.5
+	vector<T> keys; // in insertion order
+	vector<unsigned> vals;
+	vector<unsigned> used_slots; // for clearing a mostly empty table without touching every entry
 	int last_mat_id;
 	unsigned last_obj_id;
 	bool average_normals;
 
+	static uint32_t hash_vertex(T const &v) { // murmur3 mixing of 32-bit float words; faster than hash_by_bytes
+		static_assert(sizeof(T) % sizeof(uint32_t) == 0, "vertex size must be a multiple of 4 bytes");
+		uint32_t words[sizeof(T)/sizeof(uint32_t)], h(0x811c9dc5);
+		memcpy(words, &v, sizeof(T));
+
+		for (unsigned i = 0; i < sizeof(T)/sizeof(uint32_t); ++i) {
+			uint32_t w(words[i]);
+			if (w == 0x80000000) {w = 0;} // -0.0 == 0.0, so they must hash the same
+			w *= 0xcc9e2d51; w = (w << 15) | (w >> 17); w *= 0x1b873593;
+			h ^= w; h = (h << 13) | (h >> 19); h = h*5 + 0xe6546b64;
+		}
+		h ^= h >> 16; h *= 0x85ebca6b; h ^= h >> 13; h *= 0xc2b2ae35; h ^= h >> 16;
+		return h;
+	}
+	void rehash(size_t new_size) {
+		vector<entry_t> old_table(new_size);
+		old_table.swap(table);
+		used_slots.clear();
+		uint32_t const mask(uint32_t(table.size() - 1));
+
+		for (entry_t const &e : old_table) {
+			if (e.kix == 0) continue; // empty
+			uint32_t pos(e.hash & mask);
+			while (table[pos].kix != 0) {pos = (pos + 1) & mask;}
+			table[pos] = e;
+			used_slots.push_back(pos);
+		}
+	}
 public:
 	vertex_map_t(bool average_normals_=0) : last_mat_id(-1), last_obj_id(0), average_normals(average_normals_) {}
 	bool get_average_normals() const {return average_normals;}
-	
+	size_t size() const {return keys.size();}
+	bool empty() const {return keys.empty();}
+	size_t get_mem_usage() const {return (table.capacity()*sizeof(entry_t) + keys.capacity()*sizeof(T) + (vals.capacity() + used_slots.capacity())*sizeof(unsigned));}
+
+	void reserve(size_t num) {
+		size_t table_sz(64);
+		while (table_sz < 2*num) {table_sz *= 2;}
+		if (table_sz > table.size()) {rehash(table_sz);}
+		keys.reserve(num);
+		vals.reserve(num);
+		used_slots.reserve(num);
+	}
+	void clear() { // keeps allocated memory for reuse
+		if (8*used_slots.size() < table.size()) {for (unsigned pos : used_slots) {table[pos].kix = 0;}}
+		else {std::fill(table.begin(), table.end(), entry_t());}
+		keys.clear();
+		vals.clear();
+		used_slots.clear();
+	}
+	unsigned find_or_insert(T const &v, unsigned ix) { // returns the index of an equal vertex if present, otherwise inserts v with index ix and returns ix
+		if (2*(keys.size() + 1) > table.size()) {rehash(max((size_t)64, 2*table.size()));}
+		uint32_t const hash(hash_vertex(v)), mask(uint32_t(table.size() - 1));
+
+		for (uint32_t pos = (hash & mask); ; pos = ((pos + 1) & mask)) {
+			entry_t &e(table[pos]);
+
+			if (e.kix == 0) { // empty slot; not found
+				e.hash = hash;
+				e.kix  = (uint32_t)keys.size() + 1;
+				keys.push_back(v);
+				vals.push_back(ix);
+				used_slots.push_back(pos);
+				return ix;
+			}
+			if (e.hash == hash && keys[e.kix-1] == v) return vals[e.kix-1]; // found
+		}
+		return ix; // never gets here
+	}
 	void check_for_clear(int mat_id) {
 		if (mat_id != last_mat_id || this->size() >= MAX_VMAP_SIZE) {
 			last_mat_id = mat_id;
@@ -223,6 +309,59 @@ template<typename T> cube_t get_polygon_bbox(vector<T> const &p) {
 }
 
 
+unsigned const MODEL3D_PAGE_SIZE = 4096; // arrays at least this large are page aligned in model3d files
+
+// writes the page-aligned (version 2) model3d file format
+class model3d_file_writer_t {
+	ostream &out;
+
+public:
+	model3d_file_writer_t(ostream &out_) : out(out_) {}
+	bool good() const {return out.good();}
+	void write(void const *data, size_t sz) {out.write((char const *)data, (std::streamsize)sz);}
+	void write_uint(unsigned val) {write(&val, sizeof(unsigned));}
+	void align_to_page();
+
+	template<typename V> void write_vector(V const &v) { // V is a vector or string of POD values
+		size_t const num_bytes(v.size()*sizeof(typename V::value_type));
+		write_uint((unsigned)v.size());
+		if (num_bytes >= MODEL3D_PAGE_SIZE) {align_to_page();}
+		if (num_bytes > 0) {write(&v.front(), num_bytes);}
+	}
+};
+
+// reads the page-aligned (version 2) model3d file format from a read-only memory mapping of the file;
+// arrays are copied straight from the mapped pages into their final containers without going through a stream
+class model3d_file_reader_t {
+	char const *data;
+	size_t size, pos;
+
+public:
+	model3d_file_reader_t() : data(nullptr), size(0), pos(0) {}
+	~model3d_file_reader_t() {close();}
+	bool open(string const &fn);
+	void close();
+	void align_to_page() {pos = MODEL3D_PAGE_SIZE*((pos + MODEL3D_PAGE_SIZE - 1)/MODEL3D_PAGE_SIZE);}
+	char const *get_data() const {return data;}
+	size_t get_size() const {return size;}
+
+	bool read(void *dest, size_t sz) {
+		if (pos + sz > size) return 0; // truncated file
+		memcpy(dest, (data + pos), sz);
+		pos += sz;
+		return 1;
+	}
+	template<typename V> bool read_vector(V &v) { // V is a vector or string of POD values
+		unsigned num(0);
+		if (!read(&num, sizeof(unsigned))) return 0;
+		size_t const num_bytes(num*sizeof(typename V::value_type));
+		if (num_bytes >= MODEL3D_PAGE_SIZE) {align_to_page();}
+		v.resize(num);
+		return ((num_bytes == 0) || read(&v[0], num_bytes));
+	}
+};
+
+
 template<typename T> class vntc_vect_t : public vector<T>, public indexed_vao_manager_with_shadow_t {
 
 protected:
@@ -246,8 +385,10 @@ public:
 	unsigned get_gpu_mem() const {return (vbo_valid() ? size()*sizeof(T) : 0);}
 	void optimize(unsigned npts) {remove_excess_cap();}
 	void remove_excess_cap() {if (20*vector<T>::size() < 19*vector<T>::capacity()) {vector<T>::shrink_to_fit();}}
-	void write(ostream &out) const;
+	bool needs_tangents() const {return (!has_tangents && sizeof(T) == sizeof(vert_norm_tc_tan));} // HACK to get the type, same as read()
+	void write(model3d_file_writer_t &out) const;
 	void read(istream &in);
+	bool read(model3d_file_reader_t &in);
 };
 
 
@@ -313,8 +454,9 @@ public:
 	void get_polygons(get_polygon_args_t &args, unsigned npts) const;
 	unsigned get_gpu_mem() const {return (vntc_vect_t<T>::get_gpu_mem() + (this->ivbo_valid() ? indices.size()*sizeof(unsigned) : 0));}
 	void invert_tcy();
-	void write(ostream &out) const;
+	void write(model3d_file_writer_t &out) const;
 	void read(istream &in);
+	bool read(model3d_file_reader_t &in);
 	bool indexing_enabled() const {return !indices.empty();}
 	void mark_need_normalize() {need_normalize = 1;}
 };
@@ -339,8 +481,9 @@ template<typename T> struct vntc_vect_block_t : public deque<indexed_vntc_vect_t
 	void invert_tcy();
 	void simplify_indices(float reduce_target);
 	void merge_into_single_vector();
-	bool write(ostream &out) const;
+	bool write(model3d_file_writer_t &out, unsigned npts) const;
 	bool read(istream &in);
+	bool read(model3d_file_reader_t &in);
 };
 
 
@@ -365,8 +508,9 @@ template<typename T> struct geometry_t {
 	void get_stats(model3d_stats_t &stats) const;
 	void calc_area(float &area, unsigned &ntris);
 	void simplify_indices(float reduce_target);
-	bool write(ostream &out) const {return (triangles.write(out) && quads.write(out));}
-	bool read(istream &in)         {return (triangles.read (in ) && quads.read (in ));}
+	bool write(model3d_file_writer_t &out) const {return (triangles.write(out, 3) && quads.write(out, 4));}
+	bool read(istream &in)                {return (triangles.read (in ) && quads.read (in ));}
+	bool read(model3d_file_reader_t &in)  {return (triangles.read (in ) && quads.read (in ));}
 };
 
 
@@ -385,6 +529,7 @@ public:
 	void free_tids();
 	void free_textures();
 	bool ensure_texture_loaded(texture_t &t, int tid, bool is_bump);
+	void load_textures(vector<pair<int, bool> > const &to_load);
 	void bind_alpha_channel_to_texture(int tid, int alpha_tid);
 	bool ensure_tid_loaded(int tid, bool is_bump) {return ((tid >= 0) ? ensure_texture_loaded(get_texture(tid), tid, is_bump) : 0);}
 	void ensure_tid_bound(int tid) {if (tid >= 0) {get_texture(tid).check_init(free_after_upload);}} // if allocated
@@ -438,14 +583,16 @@ struct material_t : public material_params_t {
 	void compute_area_per_tri();
 	void simplify_indices(float reduce_target);
 	void ensure_textures_loaded(texture_manager &tmgr);
+	void add_textures_to_load(texture_manager &tmgr, vector<pair<int, bool> > &to_load);
 	void init_textures(texture_manager &tmgr);
 	void check_for_tc_invert_y(texture_manager &tmgr);
 	void render(shader_t &shader, texture_manager const &tmgr, int default_tid, bool is_shadow_pass, bool is_z_prepass,
 		int enable_alpha_mask, bool is_bmap_pass, point const *const xlate);
 	colorRGBA get_ad_color() const;
 	colorRGBA get_avg_color(texture_manager const &tmgr, int default_tid=-1) const;
-	bool write(ostream &out) const;
+	bool write(model3d_file_writer_t &out) const;
 	bool read(istream &in);
+	bool read(model3d_file_reader_t &in);
 };
 
 
@@ -584,8 +731,8 @@ public:
 	void get_stats(model3d_stats_t &stats) const;
 	void show_stats() const;
 	void get_all_mat_lib_fns(set<std::string> &mat_lib_fns) const;
-	bool write_to_disk (string const &fn) const;
-	bool read_from_disk(string const &fn);
+	bool write_to_disk (string const &fn, uint64_t source_hash=0) const;
+	bool read_from_disk(string const &fn, uint64_t source_hash=0);
 	static void proc_model_normals(vector<counted_normal> &cn, int recalc_normals, float nmag_thresh=0.7);
 	static void proc_model_normals(vector<weighted_normal> &wn, int recalc_normals, float nmag_thresh=0.7);
 	void write_to_cobj_file(std::ostream &out) const;
@@ -12,7 +12,7 @@
 #include "fast_atof.h"
 
 
-extern bool use_obj_file_bump_grayscale;
+extern bool use_obj_file_bump_grayscale, use_model3d_cache, use_model_lod_blocks, no_subdiv_model, parallel_obj_reader, benchmark_obj_reader;
 extern float model_auto_tc_scale, model_mat_lod_thresh;
 extern model3ds all_models;
 
@@ -37,6 +37,10 @@ void base_file_reader::close_file() {
 }
 
 void base_file_reader::unget_last_char(int c) {
+	if (mem_buf) {
+		if (c != EOF) {assert(mem_pos > 0); --mem_pos;} // can't unget EOF
+		return;
+	}
 	if (FILE_BUF_SZ == 0) {assert(fp != nullptr); _ungetc_nolock(c, fp); return;}
 	if (c == EOF) return; // can't unget EOF
 	assert(file_buf_pos > 0); // can't unget without previous get
@@ -45,6 +49,7 @@ void base_file_reader::unget_last_char(int c) {
 
 int base_file_reader::get_char(FILE *fp_) {
 
+	if (mem_buf) {return ((mem_pos < mem_end) ? mem_buf[mem_pos++] : EOF);}
 	if (FILE_BUF_SZ == 0) {return _getc_nolock(fp_);}
 
 	if (file_buf_pos == file_buf_end) { // fill file buffer
@@ -279,6 +284,175 @@ bool endswith(string const &value, string const &ending) {
 	return std::equal(ending.rbegin(), ending.rend(), value.rbegin());
 }
 
+// state that persists across lines of an object file, shared by the serial and parallel readers
+struct obj_read_state_t {
+	int cur_mat_id;
+	unsigned smoothing_group, prev_smoothing_group, num_faces, num_objects, num_groups, obj_group_id;
+	bool is_textured, had_npts_error;
+	vector<point> v; // vertices
+	vector<vector3d> n; // normals
+	// weighted_normal can also be used, but doesn't work well; see face_weight_avg mode selected by recalc_normals==2
+	vector<counted_normal> vn; // vertex normals
+	vector<point2d<float> > tc; // texture coords
+	vector<colorRGB> colors; // vertex colors
+	deque<poly_data_block> pblocks;
+	set<string> loaded_mat_libs;
+
+	obj_read_state_t() : cur_mat_id(-1), smoothing_group(0), prev_smoothing_group(0), num_faces(0), num_objects(0), num_groups(0), obj_group_id(0), is_textured(0), had_npts_error(0) {
+		tc.push_back(point2d<float>(0.0, 0.0)); // default tex coords
+		n.push_back(zero_vector); // default normal
+	}
+	bool same_geom_as(obj_read_state_t const &s) const; // for validating the parallel reader against the serial reader
+};
+
+
+// results of parsing one line-aligned chunk of an object file; indices are left unresolved until chunks are merged in order
+struct obj_chunk_t {
+	enum {REC_FACE=0, REC_OBJECT, REC_GROUP, REC_SMOOTH, REC_USEMTL, REC_MTLLIB};
+
+	struct record_t {
+		unsigned char type;
+		unsigned line, val, start; // val: face npts or smoothing group; start: index into ixs for faces or strs for names
+		unsigned nv, ntc, nn; // chunk-local element counts at this face, for resolving relative indices
+		record_t(unsigned char type_, unsigned line_, unsigned start_=0) : type(type_), line(line_), val(0), start(start_), nv(0), ntc(0), nn(0) {}
+	};
+	vector<point> v;
+	vector<vector3d> n;
+	vector<point2d<float> > tc;
+	vector<colorRGB> colors; // empty if no vertex in this chunk has a color
+	vector<record_t> records; // faces and state changes in file order
+	vector<int> ixs; // raw {vix, tix, nix} per face vertex, OBJ_IX_NONE if not specified
+	vector<string> strs; // material and material library names
+	vector<pair<unsigned, string> > messages; // {line, message} to print after the parallel section
+	unsigned num_lines;
+	bool error;
+
+	obj_chunk_t() : num_lines(0), error(0) {}
+	void add_message(string const &msg, unsigned line) {messages.push_back(make_pair(line, msg));}
+	void set_error(string const &msg, unsigned line) {add_message(msg, line); error = 1;}
+};
+
+int const OBJ_IX_NONE = numeric_limits<int>::min();
+
+
+// parses a chunk of an object file that has been read or mapped into memory; may be run in parallel with other chunks
+class obj_chunk_reader_t : public object_file_reader {
+
+public:
+	obj_chunk_reader_t(string const &fn, char const *buf, size_t sz) : object_file_reader(fn) {set_mem_buf(buf, sz);}
+
+	void parse(obj_chunk_t &chunk, geom_xform_t const &xf, int recalc_normals) {
+		char s[MAX_CHARS];
+		string str;
+		unsigned &approx_line(chunk.num_lines);
+
+		while (read_string(s, MAX_CHARS)) {
+			++approx_line;
+
+			if (s[0] == 0) {
+				chunk.add_message("empty/unparseable line?", approx_line);
+				continue;
+			}
+			else if (s[0] == '#') { // comment
+				read_to_newline(fp); // ignore
+			}
+			else if (strcmp(s, "f") == 0) { // face
+				obj_chunk_t::record_t rec(obj_chunk_t::REC_FACE, approx_line, (unsigned)chunk.ixs.size());
+				rec.nv  = (unsigned)chunk.v.size();
+				rec.ntc = (unsigned)chunk.tc.size();
+				rec.nn  = (unsigned)chunk.n.size();
+				int vix(0), tix(0), nix(0);
+
+				while (read_int(vix)) { // read vertex index
+					int ix[3] = {vix, OBJ_IX_NONE, OBJ_IX_NONE};
+					int const c(get_next_char());
+
+					if (c == '/') {
+						if (read_int(tix)) {ix[1] = tix;} // read text coord index
+						int const c2(get_next_char());
+
+						if (c2 == '/') {
+							if (read_int(nix)) {ix[2] = nix;} // read normal index
+						}
+						else {unget_last_char(c2);}
+					}
+					else {unget_last_char(c);}
+					chunk.ixs.insert(chunk.ixs.end(), ix, ix+3);
+					++rec.val; // npts
+				} // end while vertex
+				chunk.records.push_back(rec);
+			}
+			else if (strcmp(s, "v") == 0) { // vertex
+				chunk.v.push_back(point());
+
+				if (!read_point(chunk.v.back())) {
+					chunk.set_error("Error reading vertex from object file " + filename, approx_line);
+					return;
+				}
+				colorRGB color;
+				int const color_ret(read_optional_color_RGB(color));
+				if (color_ret == 2) {chunk.set_error("Error reading vertex color from object file " + filename, approx_line); return;}
+				else if (color_ret == 1) {
+					if (chunk.colors.empty()) {chunk.colors.resize(chunk.v.size()-1, WHITE);} // pad colors up to this point with white
+					chunk.colors.push_back(color);
+				}
+				else if (!chunk.colors.empty()) {chunk.colors.push_back(WHITE);} // color not specified, and in colors mode, pad with white
+				xf.xform_pos(chunk.v.back());
+			}
+			else if (strcmp(s, "vt") == 0) { // tex coord
+				point tc3d;
+
+				if (!read_point(tc3d, 2)) {
+					chunk.set_error("Error reading texture coord from object file " + filename, approx_line);
+					return;
+				}
+				chunk.tc.push_back(point2d<float>(tc3d.x, tc3d.y)); // discard tc3d.z
+			}
+			else if (strcmp(s, "vn") == 0) { // normal
+				vector3d normal;
+
+				if (!read_point(normal)) {
+					chunk.set_error("Error reading normal from object file " + filename, approx_line);
+					return;
+				}
+				if (!recalc_normals) {
+					xf.xform_pos_rm(normal);
+					chunk.n.push_back(normal);
+				}
+			}
+			else if (strcmp(s, "l") == 0) { // line
+				read_to_newline(fp); // ignore
+			}
+			else if (strcmp(s, "o") == 0 || strcmp(s, "g") == 0) { // object definition or group; names are unused
+				read_str_to_newline(fp, str);
+				chunk.records.push_back(obj_chunk_t::record_t(((s[0] == 'o') ? obj_chunk_t::REC_OBJECT : obj_chunk_t::REC_GROUP), approx_line));
+			}
+			else if (strcmp(s, "s") == 0) { // smoothing/shading (off/on or 0/1)
+				obj_chunk_t::record_t rec(obj_chunk_t::REC_SMOOTH, approx_line);
+
+				if (!read_uint(rec.val)) {
+					if (!read_string(s, MAX_CHARS) || strcmp(s, "off") != 0) {
+						chunk.set_error("Error reading smoothing group from object file " + filename, approx_line);
+						return;
+					}
+					rec.val = 0;
+				}
+				chunk.records.push_back(rec);
+			}
+			else if (strcmp(s, "usemtl") == 0 || strcmp(s, "mtllib") == 0) { // use material or material library; resolved later, in order
+				chunk.records.push_back(obj_chunk_t::record_t(((s[0] == 'u') ? obj_chunk_t::REC_USEMTL : obj_chunk_t::REC_MTLLIB), approx_line, (unsigned)chunk.strs.size()));
+				chunk.strs.push_back(string());
+				read_str_to_newline(fp, chunk.strs.back());
+			}
+			else {
+				chunk.add_message("Error: Undefined entry '" + string(s) + "' in object file " + filename, approx_line);
+				read_to_newline(fp); // ignore this line
+			}
+		} // while
+	}
+};
+
+
 class object_file_reader_model : public object_file_reader, public model_from_file_t {
 
 	bool had_empty_mat_error;
@@ -482,11 +656,13 @@ public:
 		read_to_newline(mat_in); // ignore
 	}
 
-	bool load_from_model3d_file(bool verbose) {
+	// model3d_fn defaults to filename; if source_hash is nonzero, model3d_fn is a cache file that is only used if it was built from the same source file
+	bool load_from_model3d_file(bool verbose, string const &model3d_fn=string(), uint64_t source_hash=0) {
 		RESET_TIME;
+		string const &fn(model3d_fn.empty() ? filename : model3d_fn);
 
-		if (!model.read_from_disk(filename)) {
-			cerr << "Error reading model3d file " << filename << endl;
+		if (!model.read_from_disk(fn, source_hash)) {
+			if (source_hash == 0) {cerr << "Error reading model3d file " << fn << endl;} // missing or stale caches are expected
 			return 0;
 		}
 		PRINT_TIME("Model3d File Load");
@@ -529,27 +705,105 @@ public:
 		return 1;
 	}
 
-	bool read(geom_xform_t const &xf, int recalc_normals, bool verbose) {
-		RESET_TIME;
-		if (!open_file()) return 0;
-		cout << "Reading object file " << filename << endl;
+	poly_data_block &start_face(obj_read_state_t &st) {
 		unsigned const block_size = (1 << 18); // 256K
-		int cur_mat_id(-1);
-		unsigned smoothing_group(0), prev_smoothing_group(0), num_faces(0), num_objects(0), num_groups(0), obj_group_id(0);
-		vector<point> v; // vertices
-		vector<vector3d> n; // normals
-		// weighted_normal can also be used, but doesn't work well; see face_weight_avg mode selected by recalc_normals==2
-		vector<counted_normal> vn; // vertex normals
-		vector<point2d<float> > tc; // texture coords
-		vector<colorRGB> colors; // vertex colors
-		deque<poly_data_block> pblocks;
-		set<string> loaded_mat_libs;
+		model.mark_mat_as_used(st.cur_mat_id);
+
+		if (st.pblocks.empty() || st.pblocks.back().pts.size() >= block_size || st.smoothing_group != st.prev_smoothing_group) { // create a new block
+			if (!st.pblocks.empty()) {
+				remove_excess_cap(st.pblocks.back().polys);
+				remove_excess_cap(st.pblocks.back().pts);
+			}
+			st.pblocks.push_back(poly_data_block());
+			st.prev_smoothing_group = st.smoothing_group;
+		}
+		poly_data_block &pb(st.pblocks.back());
+		pb.polys.push_back(poly_header_t(st.cur_mat_id, st.obj_group_id));
+		return pb;
+	}
+
+	// called after the points of the face starting at pix have been added; returns false if the face was invalid and removed
+	bool end_face(obj_read_state_t &st, unsigned pix, int recalc_normals, unsigned approx_line) {
+		poly_data_block &pb(st.pblocks.back());
+		unsigned const npts(pb.polys.back().npts);
+
+		if (npts < 3) {
+			if (!st.had_npts_error) {cerr << "Error near line " << approx_line << ": face has only " << npts << " vertices." << endl; st.had_npts_error = 1;}
+			pb.pts.resize(pix);
+			pb.polys.pop_back(); // remove pts and polygon
+			return 0; // skip it
+		}
+		vector<point> const &v(st.v);
+		vector<counted_normal> &vn(st.vn);
+		vector3d &normal(pb.polys.back().n);
+
+		for (unsigned i = pix; i < pix+npts-2; ++i) { // find a nonzero normal
+			normal = cross_product((v[pb.pts[i+1].vix] - v[pb.pts[i].vix]), (v[pb.pts[i+2].vix] - v[pb.pts[i].vix])); // backwards?
+			// if we disable this normalize() we will weight normal contributions by polygon area,
+			// but we have to change the code below and it causes problems with vertex uniquing
+			normal.normalize();
+			if (normal != zero_vector) break; // got a good normal
+		}
+		if (recalc_normals) {
+			bool const face_weight_avg(recalc_normals == 2 && (npts == 3 || npts == 4)); // only works for quads and triangles
+			float face_area(0.0);
+
+			if (face_weight_avg) {
+				point face_pts[4];
+				for (unsigned i = 0; i < npts; ++i) {face_pts[i] = v[pb.pts[i+pix].vix];}
+				face_area = polygon_area(face_pts, npts);
+			}
+			for (unsigned i = pix; i < pix+npts; ++i) {
+				unsigned const vix(pb.pts[i].vix);
+				assert((unsigned)vix < vn.size());
+				bool const using_texgen(st.is_textured && model_auto_tc_scale > 0.0 && pb.pts[i].tix == 0);
+
+				if (vn[vix].is_valid() && (using_texgen || dot_product(normal, vn[vix].get_norm()) < 0.25)) { // normals in disagreement (or using texgen)
+					vn[vix] = zero_vector; // zero it out so that it becomes invalid later
+				}
+				else if (face_weight_avg) {vn[vix].add_normal(face_area*normal);} // face weighted average
+				else {vn[vix].add_normal(normal);} // unweighted average of normals
+			}
+		}
+		return 1;
+	}
+
+	bool use_material(obj_read_state_t &st, string const &material_name, unsigned approx_line) {
+		if (material_name.empty()) {
+			if (!had_empty_mat_error) {cerr << "Error reading material from object file " << filename << " near line " << approx_line << endl;}
+			had_empty_mat_error = 1;
+			return 0;
+		}
+		st.cur_mat_id = model.find_material(material_name);
+
+		if (st.cur_mat_id >= 0) { // material was valid
+			int const tid(model.get_material(st.cur_mat_id).d_tid);
+			st.is_textured = (tid >= 0 && model.tmgr.get_tex_avg_color(tid) != WHITE); // no texture, or all white texture
+		}
+		return 1;
+	}
+
+	bool use_mat_lib(obj_read_state_t &st, string const &mat_lib, unsigned approx_line) {
+		if (mat_lib.empty()) {
+			cerr << "Error reading material library from object file " << filename << " near line " << approx_line << endl;
+			return 0;
+		}
+		if (!try_load_mat_lib(mat_lib, st.loaded_mat_libs, approx_line)) {
+			//return 0; // nonfatal
+		}
+		return 1;
+	}
+
+	bool parse_serial(obj_read_state_t &st, geom_xform_t const &xf, int recalc_normals) {
+		if (!open_file()) return 0;
 		char s[MAX_CHARS];
 		string material_name, mat_lib, group_name, object_name;
-		tc.push_back(point2d<float>(0.0, 0.0)); // default tex coords
-		n.push_back(zero_vector); // default normal
+		vector<point> &v(st.v);
+		vector<vector3d> &n(st.n);
+		vector<counted_normal> &vn(st.vn);
+		vector<point2d<float> > &tc(st.tc);
+		vector<colorRGB> &colors(st.colors);
 		unsigned approx_line(0);
-		bool is_textured(0), had_npts_error(0);
 
 		while (read_string(s, MAX_CHARS)) {
 			++approx_line;
@@ -562,20 +816,9 @@ public:
 				read_to_newline(fp); // ignore
 			}
 			else if (strcmp(s, "f") == 0) { // face
-				model.mark_mat_as_used(cur_mat_id);
-
-				if (pblocks.empty() || pblocks.back().pts.size() >= block_size || smoothing_group != prev_smoothing_group) { // create a new block
-					if (!pblocks.empty()) {
-						remove_excess_cap(pblocks.back().polys);
-						remove_excess_cap(pblocks.back().pts);
-					}
-					pblocks.push_back(poly_data_block());
-					prev_smoothing_group = smoothing_group;
-				}
-				poly_data_block &pb(pblocks.back());
-				pb.polys.push_back(poly_header_t(cur_mat_id, obj_group_id));
+				poly_data_block &pb(start_face(st));
 				unsigned &npts(pb.polys.back().npts);
-				unsigned const pix((unsigned)pb.pts.size()), pts_start(pb.pts.size());
+				unsigned const pix((unsigned)pb.pts.size());
 				int vix(0), tix(0), nix(0);
 
 				while (read_int(vix)) { // read vertex index
@@ -602,47 +845,12 @@ public:
 					pb.pts.push_back(vntc_ix);
 					++npts;
 				} // end while vertex
-				if (npts < 3) {
-					if (!had_npts_error) {cerr << "Error near line " << approx_line << ": face has only " << npts << " vertices." << endl; had_npts_error = 1;}
-					pb.pts.resize(pts_start);
-					pb.polys.pop_back(); // remove pts and polygon
-					continue; // skip it
-				}
-				vector3d &normal(pb.polys.back().n);
-				
-				for (unsigned i = pix; i < pix+npts-2; ++i) { // find a nonzero normal
-					normal = cross_product((v[pb.pts[i+1].vix] - v[pb.pts[i].vix]), (v[pb.pts[i+2].vix] - v[pb.pts[i].vix])); // backwards?
-					// if we disable this normalize() we will weight normal contributions by polygon area,
-					// but we have to change the code below and it causes problems with vertex uniquing
-					normal.normalize();
-					if (normal != zero_vector) break; // got a good normal
-				}
-				if (recalc_normals) {
-					bool const face_weight_avg(recalc_normals == 2 && (npts == 3 || npts == 4)); // only works for quads and triangles
-					float face_area(0.0);
-
-					if (face_weight_avg) {
-						point face_pts[4];
-						for (unsigned i = 0; i < npts; ++i) {face_pts[i] = v[pb.pts[i+pix].vix];}
-						face_area = polygon_area(face_pts, npts);
-					}
-					for (unsigned i = pix; i < pix+npts; ++i) {
-						unsigned const vix(pb.pts[i].vix);
-						assert((unsigned)vix < vn.size());
-						bool const using_texgen(is_textured && model_auto_tc_scale > 0.0 && pb.pts[i].tix == 0);
-
-						if (vn[vix].is_valid() && (using_texgen || dot_product(normal, vn[vix].get_norm()) < 0.25)) { // normals in disagreement (or using texgen)
-							vn[vix] = zero_vector; // zero it out so that it becomes invalid later
-						}
-						else if (face_weight_avg) {vn[vix].add_normal(face_area*normal);} // face weighted average
-						else {vn[vix].add_normal(normal);} // unweighted average of normals
-					}
-				}
+				end_face(st, pix, recalc_normals, approx_line);
 			}
 			else if (strcmp(s, "v") == 0) { // vertex
 				v.push_back(point());
 				if (recalc_normals) {vn.push_back(counted_normal());} // vertex normal
-			
+
 				if (!read_point(v.back())) {
 					cerr << "Error reading vertex from object file " << filename << " near line " << approx_line << endl;
 					return 0;
@@ -659,7 +867,7 @@ public:
 			}
 			else if (strcmp(s, "vt") == 0) { // tex coord
 				point tc3d;
-			
+
 				if (!read_point(tc3d, 2)) {
 					cerr << "Error reading texture coord from object file " << filename << " near line " << approx_line << endl;
 					return 0;
@@ -668,7 +876,7 @@ public:
 			}
 			else if (strcmp(s, "vn") == 0) { // normal
 				vector3d normal;
-			
+
 				if (!read_point(normal)) {
 					cerr << "Error reading normal from object file " << filename << " near line " << approx_line << endl;
 					return 0;
@@ -683,48 +891,30 @@ public:
 			}
 			else if (strcmp(s, "o") == 0) { // object definition
 				read_str_to_newline(fp, object_name); // can be empty?
-				++num_objects;
-				++obj_group_id;
+				++st.num_objects;
+				++st.obj_group_id;
 			}
 			else if (strcmp(s, "g") == 0) { // group
 				read_str_to_newline(fp, group_name); // can be empty
-				++num_groups;
-				++obj_group_id;
+				++st.num_groups;
+				++st.obj_group_id;
 			}
 			else if (strcmp(s, "s") == 0) { // smoothing/shading (off/on or 0/1)
-				if (!read_uint(smoothing_group)) {
+				if (!read_uint(st.smoothing_group)) {
 					if (!read_string(s, MAX_CHARS) || strcmp(s, "off") != 0) {
 						cerr << "Error reading smoothing group from object file " << filename << " near line " << approx_line << endl;
 						return 0;
 					}
-					smoothing_group = 0;
+					st.smoothing_group = 0;
 				}
 			}
 			else if (strcmp(s, "usemtl") == 0) { // use material
 				read_str_to_newline(fp, material_name);
-
-				if (material_name.empty()) {
-					if (!had_empty_mat_error) {cerr << "Error reading material from object file " << filename << " near line " << approx_line << endl;}
-					had_empty_mat_error = 1;
-					return 0;
-				}
-				cur_mat_id = model.find_material(material_name);
-				
-				if (cur_mat_id >= 0) { // material was valid
-					int const tid(model.get_material(cur_mat_id).d_tid);
-					is_textured = (tid >= 0 && model.tmgr.get_tex_avg_color(tid) != WHITE); // no texture, or all white texture
-				}
+				if (!use_material(st, material_name, approx_line)) return 0;
 			}
 			else if (strcmp(s, "mtllib") == 0) { // material library
 				read_str_to_newline(fp, mat_lib);
-
-				if (mat_lib.empty()) {
-					cerr << "Error reading material library from object file " << filename << " near line " << approx_line << endl;
-					return 0;
-				}
-				if (!try_load_mat_lib(mat_lib, loaded_mat_libs, approx_line)) {
-					//return 0; // nonfatal
-				}
+				if (!use_mat_lib(st, mat_lib, approx_line)) return 0;
 			}
 			else {
 				cerr << "Error: Undefined entry '" << s << "' in object file " << filename << " near line " << approx_line << endl;
@@ -732,12 +922,122 @@ public:
 				//return 0;
 			}
 		} // while
-		remove_excess_cap(v);
-		remove_excess_cap(n);
-		remove_excess_cap(tc);
-		remove_excess_cap(vn);
-		remove_excess_cap(colors);
-		PRINT_TIME("Object File Load");
+		close_file();
+		return 1;
+	}
+
+	// splits the memory mapped file into line-aligned chunks and parses their vertex data and face indices in parallel,
+	// then merges the chunks in file order, resolving relative indices and applying material/group/smoothing changes serially
+	bool parse_parallel(obj_read_state_t &st, geom_xform_t const &xf, int recalc_normals) {
+		model3d_file_reader_t file; // used only to memory map the file
+
+		if (!file.open(filename)) {
+			cerr << "Error: Could not open object file " << filename << endl;
+			return 0;
+		}
+		char const *const data(file.get_data());
+		size_t const size(file.get_size()), min_chunk_size(1 << 20); // 1MB
+		unsigned const max_chunks(4*omp_get_max_threads_3dw()); // more chunks than threads for better load balancing
+		unsigned const num_chunks(max(1U, (unsigned)min(size_t(max_chunks), size/min_chunk_size)));
+		vector<size_t> chunk_start(1, 0);
+
+		for (unsigned i = 1; i < num_chunks; ++i) { // split at line boundaries
+			size_t pos(max(chunk_start.back(), i*(size/num_chunks)));
+
+			while (pos < size) {
+				char const *const nl((char const *)memchr((data + pos), '\n', (size - pos)));
+				if (nl == nullptr) {pos = size; break;} // no more lines
+				pos = (nl - data) + 1; // start of next line
+				if (nl == data || *(nl-1) != '\\') break; // not an escaped newline
+			}
+			if (pos < size && pos > chunk_start.back()) {chunk_start.push_back(pos);}
+		}
+		chunk_start.push_back(size);
+		vector<obj_chunk_t> chunks(chunk_start.size()-1);
+
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < (int)chunks.size(); ++i) {
+			obj_chunk_reader_t reader(filename, (data + chunk_start[i]), (chunk_start[i+1] - chunk_start[i]));
+			reader.parse(chunks[i], xf, recalc_normals);
+		}
+		size_t num_v(0), num_n(0), num_tc(0);
+		bool has_colors(0);
+
+		for (auto c = chunks.begin(); c != chunks.end(); ++c) {
+			num_v  += c->v.size();
+			num_n  += c->n.size();
+			num_tc += c->tc.size();
+			has_colors |= !c->colors.empty();
+		}
+		st.v.reserve(num_v);
+		st.n.reserve(num_n + 1); // account for n[0]
+		st.tc.reserve(num_tc + 1); // account for tc[0]
+		if (has_colors) {st.colors.reserve(num_v);}
+		unsigned line_offset(0);
+
+		for (auto c = chunks.begin(); c != chunks.end(); ++c) {
+			for (auto m = c->messages.begin(); m != c->messages.end(); ++m) {cerr << m->second << " near line " << (line_offset + m->first) << endl;}
+			if (c->error) return 0;
+			// global offsets of this chunk's elements, not counting the defaults in n[0] and tc[0]
+			unsigned const v_off((unsigned)st.v.size()), n_off((unsigned)st.n.size()-1), tc_off((unsigned)st.tc.size()-1);
+			st.v.insert(st.v.end(), c->v.begin(), c->v.end());
+			st.n.insert(st.n.end(), c->n.begin(), c->n.end());
+			st.tc.insert(st.tc.end(), c->tc.begin(), c->tc.end());
+			if (recalc_normals) {st.vn.resize(st.v.size());}
+
+			if (!has_colors) {}
+			else if (c->colors.empty()) {st.colors.resize(st.v.size(), WHITE);} // pad with white
+			else {st.colors.insert(st.colors.end(), c->colors.begin(), c->colors.end());}
+
+			for (auto r = c->records.begin(); r != c->records.end(); ++r) {
+				unsigned const approx_line(line_offset + r->line);
+
+				switch (r->type) {
+				case obj_chunk_t::REC_FACE: {
+					poly_data_block &pb(start_face(st));
+					unsigned const pix((unsigned)pb.pts.size());
+
+					for (unsigned p = 0; p < r->val; ++p) {
+						int const *const ix(&c->ixs[r->start + 3*p]);
+						int vix(ix[0]), tix(ix[1]), nix(ix[2]);
+						normalize_index(vix, (v_off + r->nv));
+						vntc_ix_t vntc_ix(vix, 0, 0);
+
+						if (tix != OBJ_IX_NONE) {
+							normalize_index(tix, (tc_off + r->ntc));
+							vntc_ix.tix = tix+1; // account for tc[0]
+						}
+						if (nix != OBJ_IX_NONE && !recalc_normals) {
+							normalize_index(nix, (n_off + r->nn));
+							vntc_ix.nix = nix+1; // account for n[0]
+						} // else the normal will be recalculated later
+						pb.pts.push_back(vntc_ix);
+					}
+					pb.polys.back().npts = r->val;
+					end_face(st, pix, recalc_normals, approx_line);
+					break;
+				}
+				case obj_chunk_t::REC_OBJECT: ++st.num_objects; ++st.obj_group_id; break;
+				case obj_chunk_t::REC_GROUP:  ++st.num_groups;  ++st.obj_group_id; break;
+				case obj_chunk_t::REC_SMOOTH: st.smoothing_group = r->val; break;
+				case obj_chunk_t::REC_USEMTL: if (!use_material(st, c->strs[r->start], approx_line)) return 0; break;
+				case obj_chunk_t::REC_MTLLIB: if (!use_mat_lib (st, c->strs[r->start], approx_line)) return 0; break;
+				default: assert(0);
+				}
+			} // for r
+			line_offset += c->num_lines;
+			*c = obj_chunk_t(); // free memory
+		} // for c
+		return 1;
+	}
+
+	void build_model(obj_read_state_t &st, int recalc_normals, bool verbose, int const timer1) { // timer1 is the start time of the read
+		vector<point> const &v(st.v);
+		vector<vector3d> const &n(st.n);
+		vector<counted_normal> &vn(st.vn);
+		vector<point2d<float> > const &tc(st.tc);
+		vector<colorRGB> const &colors(st.colors);
+		deque<poly_data_block> &pblocks(st.pblocks);
 		model.load_all_used_tids(); // need to load the textures here to get the colors
 		PRINT_TIME("Model Texture Load");
 		size_t const num_blocks(pblocks.size());
@@ -749,10 +1049,11 @@ public:
 			polygon_t poly;
 			vntc_map_t vmap[2]; // {triangles, quads}
 			vntct_map_t vmap_tan[2]; // {triangles, quads}
+			vmap[0].reserve(min(pd.pts.size()/4, (size_t)MAX_VMAP_SIZE)); // most faces are triangles, and most vertices are shared by several faces
 
 			for (vector<poly_header_t>::const_iterator j = pd.polys.begin(); j != pd.polys.end(); ++j) {
 				poly.resize(j->npts);
-				
+
 				for (unsigned p = 0; p < j->npts; ++p) {
 					vntc_ix_t const &V(pd.pts[pix+p]);
 					vector3d normal;
@@ -779,39 +1080,204 @@ public:
 					if (!colors.empty()) {assert(V.vix < colors.size()); poly.color += colors[V.vix];}
 				} // for p
 				if (!colors.empty()) {poly.color = poly.color/j->npts; poly.color.A = 1.0;} // FIXME: uses average vertex color for each face/polygon
-				num_faces += model.add_polygon(poly, vmap, vmap_tan, j->mat_id, j->obj_id);
+				st.num_faces += model.add_polygon(poly, vmap, vmap_tan, j->mat_id, j->obj_id);
 				pix += j->npts;
 			} // for j
 			pblocks.pop_back();
 		}
 		model.finalize(); // optimize vertices, remove excess capacity, compute bounding cube, subdivide, generate LOD blocks
 		PRINT_TIME("Model3d Build");
-		
+
 		if (verbose) {
 			size_t const nn(recalc_normals ? vn.size() : n.size());
-			cout << "verts: " << v.size() << ", normals: " << nn << ", tcs: " << tc.size() << ", colors: " << colors.size() << ", faces: " << num_faces
-				 << ", objects: " << num_objects << ", groups: " << num_groups << ", blocks: " << num_blocks << endl;
+			cout << "verts: " << v.size() << ", normals: " << nn << ", tcs: " << tc.size() << ", colors: " << colors.size() << ", faces: " << st.num_faces
+				 << ", objects: " << st.num_objects << ", groups: " << st.num_groups << ", blocks: " << num_blocks << endl;
 			model.show_stats();
 		}
+	}
+
+	bool parse(obj_read_state_t &st, geom_xform_t const &xf, int recalc_normals, bool parallel) {
+		if (!(parallel ? parse_parallel(st, xf, recalc_normals) : parse_serial(st, xf, recalc_normals))) return 0;
+		remove_excess_cap(st.v);
+		remove_excess_cap(st.n);
+		remove_excess_cap(st.tc);
+		remove_excess_cap(st.vn);
+		remove_excess_cap(st.colors);
+		return 1;
+	}
+
+	bool read(geom_xform_t const &xf, int recalc_normals, bool verbose) {
+		RESET_TIME;
+		cout << "Reading object file " << filename << endl;
+		obj_read_state_t st;
+		if (!parse(st, xf, recalc_normals, (parallel_obj_reader && omp_get_max_threads_3dw() > 1))) return 0;
+		PRINT_TIME("Object File Load");
+		build_model(st, recalc_normals, verbose, timer1);
 		return 1;
 	}
 };
 
 
+bool obj_read_state_t::same_geom_as(obj_read_state_t const &s) const {
+
+	if (v != s.v || n != s.n || colors != s.colors || tc.size() != s.tc.size() || vn.size() != s.vn.size() || pblocks.size() != s.pblocks.size()) return 0;
+	if (num_objects != s.num_objects || num_groups != s.num_groups) return 0;
+
+	for (unsigned i = 0; i < tc.size(); ++i) {
+		if (tc[i].x != s.tc[i].x || tc[i].y != s.tc[i].y) return 0;
+	}
+	for (unsigned i = 0; i < vn.size(); ++i) {
+		if (vn[i] != s.vn[i] || vn[i].count != s.vn[i].count) return 0;
+	}
+	for (unsigned b = 0; b < pblocks.size(); ++b) {
+		poly_data_block const &A(pblocks[b]), &B(s.pblocks[b]);
+		if (A.polys.size() != B.polys.size() || A.pts.size() != B.pts.size()) return 0;
+
+		for (unsigned i = 0; i < A.polys.size(); ++i) {
+			poly_header_t const &a(A.polys[i]), &b(B.polys[i]);
+			if (a.npts != b.npts || a.obj_id != b.obj_id || a.mat_id != b.mat_id || a.n != b.n) return 0;
+		}
+		for (unsigned i = 0; i < A.pts.size(); ++i) {
+			vntc_ix_t const &a(A.pts[i]), &b(B.pts[i]);
+			if (a.vix != b.vix || a.nix != b.nix || a.tix != b.tix) return 0;
+		}
+	}
+	return 1;
+}
+
+// parses the object file with both the serial and parallel readers, then compares their results and timing; the model is not built
+void benchmark_obj_file_parse(string const &filename, texture_manager &tmgr, geom_xform_t const &xf, int recalc_normals) {
+
+	obj_read_state_t state[2];
+	int parse_time[2] = {0, 0};
+
+	for (unsigned parallel = 0; parallel < 2; ++parallel) {
+		model3d temp_model(filename, tmgr); // only used for materials
+		object_file_reader_model reader(filename, temp_model);
+		int const start_time(GET_TIME_MS());
+		if (!reader.parse(state[parallel], xf, recalc_normals, (parallel != 0))) return;
+		parse_time[parallel] = GET_TIME_MS() - start_time;
+	}
+	cout << "Object file parse time for " << filename << ": serial " << parse_time[0] << "ms, parallel " << parse_time[1] << "ms with "
+		 << omp_get_max_threads_3dw() << " threads; results " << (state[0].same_geom_as(state[1]) ? "match" : "DIFFER") << endl;
+}
+
+
 void check_obj_file_ext(string const &filename, string const &ext) {
 	if (ext != "obj") {cout << "Warning: Attempting to read file '" << filename << "' with extension '" << ext << "' as an object file." << endl;}
 }
 
 
-bool write_model3d_file(string const &base_fn, model3d &cur_model) {
+string get_model3d_fn(string const &base_fn) {
+	assert(base_fn.size() > 4);
+	return string(base_fn.begin(), base_fn.end()-4) + ".model3d"; // strip off the '.obj'
+}
+
+// collects the material library names from the mtllib lines of an OBJ file as it's read in blocks
+class obj_mtllib_finder_t {
+	string cur_line; // start of the current line, while it may still be a mtllib line
+	bool skip_line;
+
+	bool could_be_mtllib() const {
+		if (cur_line.size() >= 4096) return 0; // too long
+		size_t const start(cur_line.find_first_not_of(" \t"));
+		if (start == string::npos) return 1; // only whitespace so far
+		size_t const len(min(cur_line.size() - start, (size_t)6));
+		return (cur_line.compare(start, len, "mtllib", len) == 0);
+	}
+	void end_line() {
+		if (!skip_line) {
+			size_t const start(cur_line.find_first_not_of(" \t"));
+
+			if (start != string::npos && cur_line.compare(start, 6, "mtllib") == 0 && start+6 < cur_line.size() && isspace(cur_line[start+6])) {
+				string mat_lib(cur_line.substr(start+6));
+				size_t const name_start(mat_lib.find_first_not_of(" \t")), name_end(mat_lib.find_last_not_of(" \t\r"));
+				if (name_start != string::npos) {mat_libs.push_back(mat_lib.substr(name_start, name_end-name_start+1));}
+			}
+		}
+		cur_line.clear();
+		skip_line = 0;
+	}
+public:
+	vector<string> mat_libs; // in file order
+	obj_mtllib_finder_t() : skip_line(0) {}
+
+	void add_data(char const *data, size_t len) {
+		char const *const end(data + len);
+
+		for (char const *p = data; p < end;) {
+			char const *const nl((char const *)memchr(p, '\n', (end - p)));
+			if (!skip_line) {cur_line.append(p, (nl ? nl : end)); skip_line = !could_be_mtllib();}
+			if (nl == nullptr) break; // line continues in the next block
+			end_line();
+			p = nl + 1;
+		}
+	}
+	void finish() {end_line();}
+};
+
+bool add_file_contents_to_hash(string const &fn, fnv_hasher_t &hasher, obj_mtllib_finder_t *mtllib_finder=nullptr) {
+
+	FILE *fp(fopen(fn.c_str(), "rb"));
+	if (fp == nullptr) return 0;
+	vector<uint64_t> buf(1 << 17); // 1MB
+	size_t num_read(0);
+
+	while ((num_read = fread(&buf.front(), 1, buf.size()*sizeof(uint64_t), fp)) > 0) {
+		if (mtllib_finder) {mtllib_finder->add_data((char const *)&buf.front(), num_read);}
+		size_t const num_words((num_read + sizeof(uint64_t) - 1)/sizeof(uint64_t));
+		if (num_read < num_words*sizeof(uint64_t)) {memset((char *)&buf.front() + num_read, 0, num_words*sizeof(uint64_t) - num_read);} // zero pad the last word
+		for (size_t i = 0; i < num_words; ++i) {hasher.add(buf[i]);}
+		hasher.add(num_read);
+	}
+	fclose(fp);
+	if (mtllib_finder) {mtllib_finder->finish();}
+	return 1;
+}
+
+void add_mat_lib_to_hash(string const &mat_lib, string const &rel_path, fnv_hasher_t &hasher, bool split_on_ws) {
+
+	for (char c : mat_lib) {hasher.add((unsigned char)c);}
+	hasher.add(mat_lib.size());
+	string const fns[3] = {mat_lib, (rel_path + mat_lib), ("textures/" + mat_lib)}; // same search order as model_from_file_t::open_include_file()
+
+	for (unsigned i = 0; i < 3; ++i) {
+		if (add_file_contents_to_hash(fns[i], hasher)) return;
+	}
+	hasher.add(0); // not found
+	if (!split_on_ws) return;
+	// the reader also tries splitting by whitespace, in case there are multiple mtllib filenames on the same line
+	istringstream iss(mat_lib);
+	string str;
+	while (iss >> str) {if (str != mat_lib) {add_mat_lib_to_hash(str, rel_path, hasher, 0);}}
+}
+
+// hash of the source file contents combined with the options that affect how it's read, used to detect stale model3d caches;
+// includes the contents of the material libraries it references, since materials affect how the geometry is stored
+uint64_t get_model3d_source_hash(string const &filename, geom_xform_t const &xf, int recalc_normals) {
+
+	fnv_hasher_t hasher;
+	obj_mtllib_finder_t mtllib_finder;
+	if (!add_file_contents_to_hash(filename, hasher, &mtllib_finder)) return 0;
+	string const rel_path(model_from_file_t::get_path(filename));
+	for (auto i = mtllib_finder.mat_libs.begin(); i != mtllib_finder.mat_libs.end(); ++i) {add_mat_lib_to_hash(*i, rel_path, hasher, 1);}
+	hasher.add(mtllib_finder.mat_libs.size());
+	unsigned char xf_data[sizeof(geom_xform_t)] = {0};
+	memcpy(xf_data, &xf, sizeof(geom_xform_t)); // geom_xform_t is packed POD
+	for (unsigned i = 0; i < sizeof(geom_xform_t); ++i) {hasher.add(xf_data[i]);}
+	hasher.add(recalc_normals);
+	hasher.add_float(model_auto_tc_scale);
+	hasher.add(use_model_lod_blocks);
+	hasher.add(no_subdiv_model);
+	return max(hasher.get(), uint64_t(1)); // zero is reserved for "no hash"
+}
+
+bool write_model3d_file(string const &base_fn, model3d &cur_model, uint64_t source_hash=0) {
 
 	RESET_TIME;
-	assert(base_fn.size() > 4);
-	string out_fn(base_fn.begin(), base_fn.end()-4); // strip off the '.obj'
-	out_fn += ".model3d";
-	cur_model.calc_tangent_vectors(); // tangent vectors are needed for writing
+	string const out_fn(get_model3d_fn(base_fn));
 				
-	if (!cur_model.write_to_disk(out_fn)) {
+	if (!cur_model.write_to_disk(out_fn, source_hash)) {
 		cerr << "Error writing model3d file " << out_fn << endl;
 		return 0;
 	}
@@ -844,9 +1310,16 @@ bool load_model_file(string const &filename, model3ds &models, geom_xform_t cons
 		}
 		else {
 			check_obj_file_ext(filename, ext);
-			//test_other_obj_loader(filename); // placeholder for testing other object file loaders (tinyobjloader, assimp, etc.)
-			if (!reader.read(xf, recalc_normals, verbose)) {models.pop_back(); return 0;}
-			if (write_file && !write_model3d_file(filename, cur_model)) return 0; // don't need to pop the model
+			if (benchmark_obj_reader) {benchmark_obj_file_parse(filename, models.tmgr, xf, recalc_normals);}
+			uint64_t const source_hash(use_model3d_cache ? get_model3d_source_hash(filename, xf, recalc_normals) : 0);
+
+			if (source_hash != 0 && reader.load_from_model3d_file(verbose, get_model3d_fn(filename), source_hash)) {} // loaded from an up-to-date cache
+			else {
+				//test_other_obj_loader(filename); // placeholder for testing other object file loaders (tinyobjloader, assimp, etc.)
+				if (!reader.read(xf, recalc_normals, verbose)) {models.pop_back(); return 0;}
+				if (write_file && !write_model3d_file(filename, cur_model, source_hash)) return 0; // don't need to pop the model
+				if (source_hash != 0 && !write_file) {write_model3d_file(filename, cur_model, source_hash);} // write cache; failure is nonfatal
+			}
 		}
 	}
 	if (model_mat_lod_thresh > 0.0) {cur_model.compute_area_per_tri();} // used for TT LOD/distance culling
@@ -52,7 +52,7 @@ float get_sidewalk_width(cube_t const &plot_bcube) { // Note: technically should
 	return -STREETLIGHT_DIST_FROM_PLOT_EDGE*plot_sz + streetlight_ns::get_streetlight_pole_radius();
 }
 
-bool pedestrian_t::check_inside_plot(ped_manager_t &ped_mgr, point const &prev_pos, cube_t const &plot_bcube, cube_t const &next_plot_bcube) {
+bool pedestrian_t::check_inside_plot(ped_manager_t &ped_mgr, point const &prev_pos, cube_t const &plot_bcube, cube_t const &next_plot_bcube, rand_gen_t &rgen) {
 	if (in_building) return 0; // not implemented yet
 	//if (ssn == 2516) {cout << "in_the_road: " << in_the_road << ", pos: " << pos.str() << ", plot_bcube: " << plot_bcube.str() << ", npbc: " << next_plot_bcube.str() << endl;}
 	if (plot_bcube.contains_pt_xy(pos)) {return 1;} // inside the plot
@@ -61,7 +61,7 @@ bool pedestrian_t::check_inside_plot(ped_manager_t &ped_mgr, point const &prev_p
 	
 	if (next_plot_bcube.contains_pt_xy(pos)) {
 		ped_mgr.move_ped_to_next_plot(*this);
-		next_plot = ped_mgr.get_next_plot(*this);
+		next_plot = ped_mgr.get_next_plot(*this, rgen);
 		return 1;
 	}
 	cube_t union_plot_bcube(plot_bcube);
@@ -125,36 +125,40 @@ void register_ped_coll(pedestrian_t &p1, pedestrian_t &p2, unsigned pid1, unsign
 	p2.collided = p2.ped_coll = 1; p2.colliding_ped = pid1;
 }
 
+bool pedestrian_t::get_ped_avoid_force(point const &opos, vector3d const &ovel, float oradius, float prox_radius_sq, vector3d &force) const { // returns 1 on collision
+	float const dist_sq(p2p_dist_xy_sq(pos, opos));
+	if (dist_sq > prox_radius_sq) return 0; // proximity test
+	float const r_sum(0.6f*(radius + oradius)); // using a smaller radius to allow peds to get close to each other
+	if (dist_sq < r_sum*r_sum) return 1; // collision
+	if (speed < TOLERANCE) return 0;
+	vector3d const delta_v(vel - ovel), delta_p((pos.x - opos.x), (pos.y - opos.y), 0.0);
+	float const dp(-dot_product_xy(delta_v, delta_p));
+	if (dp <= 0.0) return 0; // diverging, no avoidance needed
+	float const dv_mag(delta_v.mag()), dist(sqrt(dist_sq)), fmag(dist/(dist - 0.9*r_sum));
+	if (dv_mag < TOLERANCE) return 0;
+	vector3d const rejection(delta_p - (dp/(dv_mag*dv_mag))*delta_v); // component of velocity perpendicular to delta_p (avoid dir)
+	float const rmag(rejection.mag()), rel_vel(max(dv_mag/speed, 0.5f)); // higher when peds are converging
+	if (rmag < TOLERANCE) return 0;
+	float const force_mult(dp/(dv_mag*dist)); // stronger with head-on collisions
+	force += rejection*(rel_vel*force_mult*fmag/rmag);
+	//cout << TXT(r_sum) << TXT(dist) << TXT(fmag) << ", dv: " << delta_v.str() << ", dp: " << delta_p.str() << ", rej: " << rejection.str() << ", force: " << force.str() << endl;
+	return 0;
+}
+
 bool pedestrian_t::check_ped_ped_coll_range(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_start, unsigned target_plot, float prox_radius, vector3d &force) {
 	float const prox_radius_sq(prox_radius*prox_radius);
 
 	for (auto i = peds.begin()+ped_start; i != peds.end(); ++i) { // check every ped until we exit target_plot
 		if (i->plot != target_plot) break; // moved to a new plot, no collision, done; since plots are globally unique across cities, we don't need to check cities
-		float const dist_sq(p2p_dist_xy_sq(pos, i->pos));
-		if (dist_sq > prox_radius_sq) continue; // proximity test
-		float const r_sum(0.6f*(radius + i->radius)); // using a smaller radius to allow peds to get close to each other
-		if (dist_sq < r_sum*r_sum) {register_ped_coll(*this, *i, pid, (i - peds.begin())); return 1;} // collision
-		if (speed < TOLERANCE) continue;
-		vector3d const delta_v(vel - i->vel), delta_p((pos.x - i->pos.x), (pos.y - i->pos.y), 0.0);
-		float const dp(-dot_product_xy(delta_v, delta_p));
-		if (dp <= 0.0) continue; // diverging, no avoidance needed
-		float const dv_mag(delta_v.mag()), dist(sqrt(dist_sq)), fmag(dist/(dist - 0.9*r_sum));
-		if (dv_mag < TOLERANCE) continue;
-		vector3d const rejection(delta_p - (dp/(dv_mag*dv_mag))*delta_v); // component of velocity perpendicular to delta_p (avoid dir)
-		float const rmag(rejection.mag()), rel_vel(max(dv_mag/speed, 0.5f)); // higher when peds are converging
-		if (rmag < TOLERANCE) continue;
-		float const force_mult(dp/(dv_mag*dist)); // stronger with head-on collisions
-		force += rejection*(rel_vel*force_mult*fmag/rmag);
-		//cout << TXT(r_sum) << TXT(dist) << TXT(fmag) << ", dv: " << delta_v.str() << ", dp: " << delta_p.str() << ", rej: " << rejection.str() << ", force: " << force.str() << endl;
-	} // for i
+		if (get_ped_avoid_force(i->pos, i->vel, i->radius, prox_radius_sq, force)) {register_ped_coll(*this, *i, pid, (i - peds.begin())); return 1;} // collision
+	}
 	return 0;
 }
 
 bool pedestrian_t::check_ped_ped_coll(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, float delta_dir) {
 	if (in_building) return 0; // no ped-ped collisions in buildings (yet)
 	assert(pid < peds.size());
-	float const timestep(2.0*TICKS_PER_SECOND), lookahead_dist(timestep*speed); // how far we can travel in 2s
-	float const prox_radius(1.2*radius + lookahead_dist); // assume other ped has a similar radius
+	float const prox_radius(get_coll_prox_radius());
 	vector3d force(zero_vector);
 	if (check_ped_ped_coll_range(peds, pid, pid+1, plot, prox_radius, force)) return 1;
 
@@ -168,12 +172,45 @@ bool pedestrian_t::check_ped_ped_coll(ped_manager_t const &ped_mgr, vector<pedes
 	return 0;
 }
 
-bool pedestrian_t::check_ped_ped_coll_stopped(vector<pedestrian_t> &peds, unsigned pid) {
+// threaded version of check_ped_ped_coll() that finds nearby peds with the spatial hash rather than scanning plot ranges;
+// peds in our plot are owned by this thread and use the live state, while peds in other plots use the state from the start of the frame
+bool pedestrian_t::check_ped_ped_coll_grid(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, float delta_dir, ped_update_ctx_t &ctx) {
 	if (in_building) return 0; // no ped-ped collisions in buildings (yet)
 	assert(pid < peds.size());
+	float const prox_radius(get_coll_prox_radius()), prox_radius_sq(prox_radius*prox_radius);
+	bool const check_next_plot(in_the_road && next_plot != plot); // peds crossing the street from different sides
+	vector3d force(zero_vector);
+	int coll_ix(-1);
+
+	ped_mgr.get_ped_grid().query(pos, prox_radius, [&](ped_grid_t::entry_t const &e) {
+		if (ctx.owns_ped(e.ix)) { // same plot; only check peds after this one, to match the serial update
+			pedestrian_t const &ped(peds[e.ix]);
+			if (e.ix <= pid || ped.plot != plot) return 0;
+			if (get_ped_avoid_force(ped.pos, ped.vel, ped.radius, prox_radius_sq, force)) {coll_ix = e.ix; return 1;}
+		}
+		else if (check_next_plot && e.plot == next_plot) {
+			if (get_ped_avoid_force(e.pos, e.vel, e.radius, prox_radius_sq, force)) {coll_ix = e.ix; return 1;}
+		}
+		return 0;
+	});
+	if (coll_ix >= 0) {
+		if (ctx.owns_ped(coll_ix)) {register_ped_coll(*this, peds[coll_ix], pid, coll_ix);}
+		else { // other ped is updated by another thread; register the collision for it after the update
+			collided = ped_coll = 1; colliding_ped = coll_ix;
+			ctx.deferred_colls.emplace_back(coll_ix, pid);
+		}
+		return 1;
+	}
+	if (force != zero_vector) {set_velocity((0.1*delta_dir)*force + ((1.0 - delta_dir)/speed)*vel);} // apply ped repulsive force
+	return 0;
+}
+
+bool pedestrian_t::check_ped_ped_coll_stopped(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_end) {
+	if (in_building) return 0; // no ped-ped collisions in buildings (yet)
+	assert(pid < peds.size() && ped_end <= peds.size());
 
 	// Note: shouldn't have to check peds in the next plot, assuming that if we're stopped, they likely are as well, and won't be walking toward us
-	for (auto i = peds.begin()+pid+1; i != peds.end(); ++i) { // check every ped until we exit target_plot
+	for (auto i = peds.begin()+pid+1; i != peds.begin()+ped_end; ++i) { // check every ped until we exit target_plot
 		if (i->plot != plot) break; // moved to a new plot, no collision, done; since plots are globally unique across cities, we don't need to check cities
 		if (!dist_xy_less_than(pos, i->pos, 0.6f*(radius + i->radius))) continue; // no collision
 		i->collided = i->ped_coll = 1; i->colliding_ped = pid;
@@ -420,11 +457,11 @@ point pedestrian_t::get_dest_pos(cube_t const &plot_bcube, cube_t const &next_pl
 	return pos; // no dest
 }
 
-bool pedestrian_t::choose_alt_next_plot(ped_manager_t const &ped_mgr) {
+bool pedestrian_t::choose_alt_next_plot(ped_manager_t const &ped_mgr, rand_gen_t &rgen) {
 	reset_waiting(); // reset waiting state regardless of outcome; we don't want to get here every frame if we fail to find another plot
 	if (plot == next_plot) return 0; // no next plot (error?)
 	//if (next_plot == dest_plot) return 0; // the next plot is our desination, should we still choose another plot?
-	unsigned const cand_next_plot(ped_mgr.get_next_plot(*this, next_plot));
+	unsigned const cand_next_plot(ped_mgr.get_next_plot(*this, rgen, next_plot));
 	if (cand_next_plot == next_plot || cand_next_plot == plot) return 0; // failed
 	next_plot = cand_next_plot;
 	return 1; // success
@@ -476,17 +513,19 @@ void pedestrian_t::move(ped_manager_t const &ped_mgr, cube_t const &plot_bcube,
 	anim_time += timestep*speed;
 }
 
-void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, rand_gen_t &rgen, float delta_dir) {
+// ctx is non-null for threaded updates, where the at_dest and at_crosswalk updates have already been done serially
+void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, rand_gen_t &rgen, float delta_dir, ped_update_ctx_t *ctx) {
 	if (destroyed)    return; // destroyed
 	if (speed == 0.0) return; // not moving, no update needed
 	if (in_building)  return; // building update/movement logic handled elsewhere
 
-	// navigation with destination
-	if (at_dest) {
-		register_at_dest();
-		ped_mgr.choose_new_ped_plot_pos(*this);
+	if (!ctx) { // navigation with destination
+		if (at_dest) {
+			register_at_dest();
+			ped_mgr.choose_new_ped_plot_pos(*this);
+		}
+		if (at_crosswalk) {ped_mgr.mark_crosswalk_in_use(*this);}
 	}
-	if (at_crosswalk) {ped_mgr.mark_crosswalk_in_use(*this);}
 	// movement logic
 	cube_t const &plot_bcube(ped_mgr.get_city_plot_bcube_for_peds(city, plot));
 	cube_t const &next_plot_bcube(ped_mgr.get_city_plot_bcube_for_peds(city, next_plot));
@@ -494,12 +533,12 @@ void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds
 	move(ped_mgr, plot_bcube, next_plot_bcube, delta_dir);
 
 	if (is_stopped) { // ignore any collisions and just stand there, keeping the same target_pos; will go when path is clear
-		if (get_wait_time_secs() > CROSS_WAIT_TIME && choose_alt_next_plot(ped_mgr)) { // give up and choose another destination if waiting for too long
+		if (get_wait_time_secs() > CROSS_WAIT_TIME && choose_alt_next_plot(ped_mgr, rgen)) { // give up and choose another destination if waiting for too long
 			target_pos = all_zeros;
 			go(); // back up or turn so that we don't walk forward into the street? move() should attempt to rotate in place
 		}
 		else {
-			check_ped_ped_coll_stopped(peds, pid); // still need to check for other peds colliding with us; this doesn't always work
+			check_ped_ped_coll_stopped(peds, pid, (ctx ? ctx->ped_end : peds.size())); // still need to check for other peds colliding with us; this doesn't always work
 			collided = ped_coll = 0;
 			return;
 		}
@@ -509,10 +548,10 @@ void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds
 	bool outside_plot(0);
 
 	if (collided) {} // already collided with a previous ped this frame, handled below
-	else if (!check_inside_plot(ped_mgr, prev_pos, plot_bcube, next_plot_bcube)) {collided = outside_plot = 1;} // outside the plot, treat as a collision with the plot bounds
+	else if (!check_inside_plot(ped_mgr, prev_pos, plot_bcube, next_plot_bcube, rgen)) {collided = outside_plot = 1;} // outside the plot, treat as a collision with the plot bounds
 	else if (!is_valid_pos(colliders, at_dest, &ped_mgr)) {collided = 1;} // collided with a static collider
 	else if (check_road_coll(ped_mgr, plot_bcube, next_plot_bcube)) {collided = 1;} // collided with something in the road (stoplight, streetlight, etc.)
-	else if (check_ped_ped_coll(ped_mgr, peds, pid, delta_dir)) {collided = 1;} // collided with another pedestrian
+	else if (ctx ? check_ped_ped_coll_grid(ped_mgr, peds, pid, delta_dir, *ctx) : check_ped_ped_coll(ped_mgr, peds, pid, delta_dir)) {collided = 1;} // collided with another pedestrian
 	else { // no collisions
 		//cout << TXT(pid) << TXT(plot) << TXT(dest_plot) << TXT(next_plot) << TXT(at_dest) << TXT(delta_dir) << TXT((unsigned)stuck_count) << TXT(collided) << endl;
 		vector3d dest_pos(get_dest_pos(plot_bcube, next_plot_bcube, ped_mgr));
@@ -527,12 +566,13 @@ void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds
 			}
 			// run only every several frames to reduce runtime; also run when at dest and when close to the current target pos or at the destination
 			if (at_dest || update_path) {
-				get_avoid_cubes(ped_mgr, colliders, dest_pos, ped_mgr.path_finder.get_avoid_vector());
+				path_finder_t &path_finder(ctx ? ctx->path_finder : ped_mgr.path_finder);
+				get_avoid_cubes(ped_mgr, colliders, dest_pos, path_finder.get_avoid_vector());
 				target_pos = all_zeros;
 				cube_t union_plot_bcube(plot_bcube);
 				union_plot_bcube.union_with_cube(next_plot_bcube); // this is the area the ped is constrained to (both plots + road in between)
 				// run path finding between pos and dest_pos using avoid cubes
-				if (ped_mgr.path_finder.run(pos, dest_pos, union_plot_bcube, 0.1*radius, dest_pos)) {target_pos = dest_pos;}
+				if (path_finder.run(pos, dest_pos, union_plot_bcube, 0.1*radius, dest_pos)) {target_pos = dest_pos;}
 			}
 			else if (target_valid()) {dest_pos = target_pos;} // use previous frame's dest if valid
 			vector3d dest_dir((dest_pos.x - pos.x), (dest_pos.y - pos.y), 0.0); // zval=0, not normalized
@@ -563,7 +603,8 @@ void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds
 		}
 		if (ped_coll) {
 			assert(colliding_ped < peds.size());
-			vector3d const coll_dir(peds[colliding_ped].pos - pos);
+			bool const use_grid_pos(ctx && !ctx->owns_ped(colliding_ped)); // ped may be concurrently updated by another thread
+			vector3d const coll_dir((use_grid_pos ? ped_mgr.get_ped_grid().get_pos(colliding_ped) : peds[colliding_ped].pos) - pos);
 			new_dir = cross_product(vel, plus_z);
 			if (dot_product_xy(new_dir, coll_dir) > 0.0) {new_dir = -new_dir;} // orient away from the other ped
 		}
@@ -713,6 +754,50 @@ void ped_manager_t::sort_by_city_and_plot() {
 		by_plot[plot+1] = pix; // next plot begins here
 	}
 	need_to_sort_peds = 0; // peds are now sorted
+	peds_reordered    = 1; // ped_grid must be rebuilt
+}
+
+void ped_grid_t::update(vector<pedestrian_t> const &peds, bool peds_reordered) {
+	//timer_t timer("Ped Grid Update");
+	bool rebuild(peds_reordered || ped_entry.size() != peds.size());
+
+	if (!rebuild) { // if no ped has changed bucket, update positions in place
+		for (unsigned i = 0; i < peds.size() && !rebuild; ++i) {rebuild = (get_bucket(peds[i].pos) != ped_bucket[i]);}
+	}
+	if (!rebuild) {
+		for (unsigned i = 0; i < peds.size(); ++i) {
+			entry_t &e(entries[ped_entry[i]]);
+			e.pos  = peds[i].pos;
+			e.vel  = peds[i].vel;
+			e.plot = peds[i].plot;
+		}
+		return;
+	}
+	if (cell_sz == 0.0 || peds_reordered) { // cell size must cover the max query radius; speeds and radii don't change, but the set of peds may
+		cell_sz = 0.0;
+		for (auto i = peds.begin(); i != peds.end(); ++i) {max_eq(cell_sz, i->get_coll_prox_radius());}
+		if (cell_sz == 0.0) {cell_sz = 1.0;} // no peds?
+	}
+	unsigned num_buckets(1);
+	while (num_buckets < 2*peds.size()) {num_buckets <<= 1;} // power of 2 with load factor <= 0.5
+	mask = num_buckets - 1;
+	bucket_start.clear();
+	bucket_start.resize(num_buckets+1, 0);
+	ped_bucket.resize(peds.size());
+	ped_entry .resize(peds.size());
+	entries   .resize(peds.size());
+	// counting sort of peds by bucket
+	for (unsigned i = 0; i < peds.size(); ++i) {ped_bucket[i] = get_bucket(peds[i].pos); ++bucket_start[ped_bucket[i]+1];}
+	for (unsigned b = 0; b < num_buckets; ++b) {bucket_start[b+1] += bucket_start[b];} // prefix sum
+	vector<unsigned> next(bucket_start.begin(), bucket_start.end()-1);
+
+	for (unsigned i = 0; i < peds.size(); ++i) {
+		pedestrian_t const &ped(peds[i]);
+		unsigned const eix(next[ped_bucket[i]]++);
+		entry_t &e(entries[eix]);
+		e.pos = ped.pos; e.vel = ped.vel; e.radius = ped.radius; e.ix = i; e.plot = ped.plot;
+		ped_entry[i] = eix;
+	}
 }
 
 bool ped_manager_t::proc_sphere_coll(point &pos, float radius, vector3d *cnorm) const { // Note: no p_last; for potential use with ped/ped collisions
@@ -789,8 +874,12 @@ void ped_manager_t::remove_destroyed_peds() {
 	ped_destroyed = 0;
 }
 
-void ped_manager_t::register_ped_new_plot(pedestrian_t const &ped) {
-	if (!need_to_sort_city.empty()) {need_to_sort_city[ped.city] = 1;}
+void ped_manager_t::register_ped_new_plot(pedestrian_t const &ped) { // Note: may be called by multiple threads
+	if (!need_to_sort_city.empty()) {
+#pragma omp atomic write
+		need_to_sort_city[ped.city] = 1;
+	}
+#pragma omp atomic write
 	need_to_sort_peds = 1;
 }
 void ped_manager_t::move_ped_to_next_plot(pedestrian_t &ped) {
@@ -799,29 +888,90 @@ void ped_manager_t::move_ped_to_next_plot(pedestrian_t &ped) {
 	register_ped_new_plot(ped);
 }
 
+void ped_manager_t::next_frame_city_peds(float delta_dir) {
+	if (peds.empty()) return;
+	//timer_t timer("Ped Update"); // ~3.9ms for 10K peds
+
+	// Note: should make sure this is after sorting cars, so that road_ix values are actually in order; however, that makes things slower, and is unlikely to make a difference
+#pragma omp critical(modify_car_data)
+	{car_manager.extract_car_data(cars_by_city);}
+
+	if (ped_destroyed) {remove_destroyed_peds();} // at least one ped was destroyed in the previous frame - remove it/them
+	static bool first_frame(1);
+
+	if (first_frame) { // choose initial ped destinations (must be after building setup, etc.)
+		for (auto i = peds.begin(); i != peds.end(); ++i) {choose_dest_building_or_parked_car(*i);}
+	}
+	unsigned const num_threads(city_params.ped_update_threads);
+
+	if (num_threads == 0) { // serial update
+		for (auto i = peds.begin(); i != peds.end(); ++i) {i->next_frame(*this, peds, (i - peds.begin()), rgen, delta_dir);}
+	}
+	else {update_peds_threaded(num_threads, delta_dir);}
+	if (need_to_sort_peds) {sort_by_city_and_plot();}
+	first_frame = 0;
+}
+
+void ped_manager_t::next_frame_building_peds(float delta_dir) {
+	if (!peds_b.empty() && enable_building_people_ai()) {update_building_ai_state(peds_b, delta_dir);} // update people in buildings
+}
+
 void ped_manager_t::next_frame() {
 	if (!animate2) return; // nothing to do (only applies to moving peds)
-	float const delta_dir(1.2*(1.0 - pow(0.7f, fticks))); // controls pedestrian turning rate
-
-	if (!peds.empty()) {
-		//timer_t timer("Ped Update"); // ~3.9ms for 10K peds
+	float const delta_dir(get_delta_dir());
+	next_frame_city_peds(delta_dir);
+	next_frame_building_peds(delta_dir);
+}
 
-		// Note: should make sure this is after sorting cars, so that road_ix values are actually in order; however, that makes things slower, and is unlikely to make a difference
-	#pragma omp critical(modify_car_data)
-		{car_manager.extract_car_data(cars_by_city);}
+uint64_t ped_manager_t::get_state_checksum() const { // for checking that simulation results are deterministic
+	uint64_t checksum(0);
+	for (auto i = peds.begin();   i != peds.end();   ++i) {checksum = 31*checksum + hash_by_bytes<point>()(i->pos);}
+	for (auto i = peds_b.begin(); i != peds_b.end(); ++i) {checksum = 31*checksum + hash_by_bytes<point>()(i->pos);}
+	return checksum;
+}
 
-		if (ped_destroyed) {remove_destroyed_peds();} // at least one ped was destroyed in the previous frame - remove it/them
-		static bool first_frame(1);
+// Each plot is updated independently by one thread; peds stay in their plot's index range until the next sort, even if they move to another plot.
+// Updates that modify shared state (destinations, crosswalks) are done serially first, and collisions with peds in other plots are applied at the end.
+// The results depend only on the plot and frame number, not on the number of threads.
+void ped_manager_t::update_peds_threaded(unsigned num_threads, float delta_dir) {
+	//timer_t timer("Ped Update Threaded");
+	for (auto i = peds.begin(); i != peds.end(); ++i) {
+		if (i->destroyed || i->speed == 0.0 || i->in_building) continue;
 
-		if (first_frame) { // choose initial ped destinations (must be after building setup, etc.)
-			for (auto i = peds.begin(); i != peds.end(); ++i) {choose_dest_building_or_parked_car(*i);}
+		if (i->at_dest) {
+			i->register_at_dest();
+			choose_new_ped_plot_pos(*i);
 		}
-		for (auto i = peds.begin(); i != peds.end(); ++i) {i->next_frame(*this, peds, (i - peds.begin()), rgen, delta_dir);}
-		if (need_to_sort_peds) {sort_by_city_and_plot();}
-		first_frame = 0;
+		if (i->at_crosswalk) {mark_crosswalk_in_use(*i);}
+	} // for i
+	ped_grid.update(peds, peds_reordered); // after any respawns above
+	peds_reordered = 0;
+	if (num_threads > 1) {omp_enable_nested_3dw();} // we may be called from thread 2 of the draw/update parallel region
+	update_ctxs.resize(max(num_threads, (unsigned)update_ctxs.size()));
+	for (auto i = update_ctxs.begin(); i != update_ctxs.end(); ++i) {i->deferred_colls.clear();}
+	assert(!by_plot.empty() && by_plot.back() == peds.size());
+	int const num_plots(by_plot.size() - 1);
+
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+	for (int plot = 0; plot < num_plots; ++plot) {
+		unsigned const ped_start(by_plot[plot]), ped_end(by_plot[plot+1]);
+		if (ped_start == ped_end) continue; // no peds
+		ped_update_ctx_t &ctx(update_ctxs[omp_get_thread_num_3dw()]);
+		ctx.ped_start = ped_start;
+		ctx.ped_end   = ped_end;
+		ctx.rgen.set_state(plot+1, frame_counter+1); // seed per plot and frame so that results don't depend on thread assignment
+		ctx.rgen.rand_mix();
+		for (unsigned i = ped_start; i < ped_end; ++i) {peds[i].next_frame(*this, peds, i, ctx.rgen, delta_dir, &ctx);}
 	}
-	if (!peds_b.empty() && enable_building_people_ai()) { // update people in buildings
-		update_building_ai_state(peds_b, delta_dir);
+	if (num_threads > 1) {omp_restore_nested_3dw();}
+	// merge step: register collisions with peds in other plots, in a consistent order
+	deferred_colls.clear();
+	for (auto i = update_ctxs.begin(); i != update_ctxs.end(); ++i) {vector_add_to(i->deferred_colls, deferred_colls);}
+	sort(deferred_colls.begin(), deferred_colls.end());
+
+	for (auto i = deferred_colls.begin(); i != deferred_colls.end(); ++i) {
+		pedestrian_t &ped(peds[i->first]);
+		ped.collided = ped.ped_coll = 1; ped.colliding_ped = i->second;
 	}
 }
 
@@ -8,6 +8,7 @@
 #include "binary_file_io.h"
 #include <atomic>
 #include <thread>
+#include <mutex>
 
 
 bool const COLOR_FROM_COBJ_TEX = 0; // 0 = fast/average color, 1 = true color
@@ -26,7 +27,7 @@ std::atomic<unsigned long long> tot_rays(0), num_hits(0), cells_touched(0);
 unsigned const NUM_RAY_SPLITS [NUM_LIGHTING_TYPES] = {1, 1, 1, 1, 1}; // sky, global, local, cobj_accum, dynamic
 unsigned const INIT_RAY_SPLITS[NUM_LIGHTING_TYPES] = {1, 4, 1, 1, 1}; // sky, global, local, cobj_accum, dynamic
 
-extern bool has_snow, combined_gu, global_lighting_update, lighting_update_offline, store_cobj_accum_lighting_as_blocked;
+extern bool has_snow, combined_gu, global_lighting_update, lighting_update_offline, store_cobj_accum_lighting_as_blocked, compress_lighting_files, rt_task_stealing;
 extern int read_light_files[], write_light_files[], display_mode, DISABLE_WATER;
 extern float water_plane_z, temperature, snow_depth, ray_step_size_mult, first_ray_weight[];
 extern char *lighting_file[];
@@ -258,8 +259,15 @@ unsigned add_path_to_lmcs(lmap_manager_t *lmgr, cube_t *bcube, point p1, point c
 }
 
 
+struct packet_hit_t { // static BVH query result for the first segment of a light ray, computed as part of a ray packet
+	point cpos;
+	vector3d cnorm;
+	int cindex;
+	packet_hit_t() : cindex(-1) {}
+};
+
 void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, float weight0, colorRGBA color, float line_length,
-	int ignore_cobj, int ltype, unsigned depth, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map, cube_t *bcube=nullptr)
+	int ignore_cobj, int ltype, unsigned depth, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map, cube_t *bcube=nullptr, packet_hit_t const *packet_hit=nullptr)
 {
 	if (depth > MAX_RAY_BOUNCES) return;
 	if (ltype == LIGHTING_DYNAMIC && depth > 4) return; // use a sensible default since this is running during rendering
@@ -276,7 +284,17 @@ void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, floa
 	float t(0.0), zval(0.0);
 	bool snow_coll(0), ice_coll(0), water_coll(0), mesh_coll(0);
 	vector3d const dir((p2 - p1).get_norm());
-	bool coll(check_coll_line_exact(p1, p2, cpos, cnorm, cindex, 0.0, ignore_cobj, 1, 0, 1, 1, (p1 == orig_p1), no_stat_moving)); // fast=1, exclude voxels, maybe skip init colls
+	bool coll(0);
+
+	if (packet_hit) { // the static BVH part of check_coll_line_exact() was already done for this ray
+		assert(depth == 0);
+		cindex = packet_hit->cindex;
+		if (cindex >= 0) {cpos = packet_hit->cpos; cnorm = packet_hit->cnorm;}
+		coll = check_coll_line_exact_tree_rest(p1, p2, cpos, cnorm, cindex, ignore_cobj, (cindex >= 0), 0, 0, 1, (p1 == orig_p1), 0, no_stat_moving);
+	}
+	else {
+		coll = check_coll_line_exact(p1, p2, cpos, cnorm, cindex, 0.0, ignore_cobj, 1, 0, 1, 1, (p1 == orig_p1), no_stat_moving); // fast=1, exclude voxels, maybe skip init colls
+	}
 	assert(coll ? (cindex >= 0 && cindex < (int)coll_objects.size()) : (cindex == -1));
 
 	// find the intersection point with the model3ds
@@ -494,23 +512,137 @@ void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, floa
 }
 
 
+unsigned const RT_TASK_RAYS = 1024; // rays per ray trace task: small enough to balance load across threads, large enough to amortize scheduling
+
+
+// maps task IDs to item (usually ray) ranges for a job made of independent groups of items, such as one group per light source
+class rt_task_list_t {
+
+	struct seg_t {
+		unsigned num_items, items_per_task, first_task;
+		seg_t(unsigned n, unsigned ipt, unsigned ft) : num_items(n), items_per_task(ipt), first_task(ft) {}
+	};
+	vector<seg_t> segs;
+	unsigned num_tasks;
+
+public:
+	rt_task_list_t() : num_tasks(0) {}
+	unsigned get_num_tasks() const {return num_tasks;}
+
+	void add(unsigned num_items, unsigned items_per_task=RT_TASK_RAYS) { // segment IDs are assigned in order, including empty segments
+		assert(items_per_task > 0);
+		segs.emplace_back(num_items, items_per_task, num_tasks);
+		num_tasks += (num_items + items_per_task - 1)/items_per_task;
+	}
+	unsigned get_task(unsigned task_id, unsigned &start, unsigned &end) const { // returns the segment ID
+		assert(task_id < num_tasks);
+		auto it(std::upper_bound(segs.begin(), segs.end(), task_id, [](unsigned t, seg_t const &s) {return (t < s.first_task);}));
+		assert(it != segs.begin());
+		--it; // last segment starting at or before task_id, which can't be empty
+		assert(it->num_items > 0);
+		start = (task_id - it->first_task)*it->items_per_task;
+		end   = min(it->num_items, start + it->items_per_task);
+		return unsigned(it - segs.begin());
+	}
+};
+
+
+// work-stealing pool of ray trace tasks shared by all threads of a job: each thread starts on its own contiguous range of task IDs,
+// then steals tasks from the other threads' ranges once its range is empty, so that threads with cheap rays don't sit idle;
+// with rt_task_stealing=0 each thread only runs its own range, which is the static per-thread split, for comparing timing
+class rt_task_pool_t {
+
+	struct thread_range_t {
+		std::atomic<unsigned> next;
+		unsigned end;
+		char pad[64 - sizeof(std::atomic<unsigned>) - sizeof(unsigned)]; // one cache line per thread to avoid false sharing
+		thread_range_t() : next(0), end(0) {}
+	};
+	unique_ptr<thread_range_t[]> ranges;
+	unsigned num_threads, num_tasks;
+	bool verbose, inited;
+	std::atomic<unsigned> num_claimed, last_pct;
+	std::mutex init_mutex;
+
+	void update_progress() {
+		unsigned const pct((100ULL*(++num_claimed))/num_tasks);
+		unsigned prev(last_pct.load());
+		if (pct/10 <= prev/10) return; // print in 10% increments
+		if (!last_pct.compare_exchange_strong(prev, pct)) return; // another thread is printing
+		cout << " " << pct << "%";
+		if (pct == 100) {cout << endl;}
+		cout.flush();
+	}
+public:
+	rt_task_pool_t() : num_threads(0), num_tasks(0), verbose(0), inited(0), num_claimed(0), last_pct(0) {}
+
+	void reset(unsigned num_threads_, bool verbose_) { // must not be called while threads are running
+		assert(num_threads_ > 0);
+		num_threads = num_threads_;
+		num_tasks   = 0;
+		verbose     = verbose_;
+		inited      = 0;
+		num_claimed = last_pct = 0;
+		ranges.reset(new thread_range_t[num_threads]);
+	}
+	void init_tasks(unsigned num_tasks_) { // called by every thread of the job with the same value; the first caller assigns the initial ranges
+		std::lock_guard<std::mutex> lock(init_mutex);
+		if (inited) {assert(num_tasks_ == num_tasks); return;}
+		num_tasks = num_tasks_;
+		inited    = 1;
+
+		for (unsigned t = 0; t < num_threads; ++t) {
+			ranges[t].next = unsigned((num_tasks*(unsigned long long)t)/num_threads);
+			ranges[t].end  = unsigned((num_tasks*(unsigned long long)(t+1))/num_threads);
+		}
+		if (verbose && num_tasks > 0) {cout << "Ray trace progress (" << num_tasks << " tasks):"; cout.flush();}
+	}
+	bool get_next_task(unsigned thread_id, unsigned &task_id) { // returns false when all tasks have been claimed or the job was cancelled
+		assert(inited && thread_id < num_threads);
+
+		unsigned const num_ranges(rt_task_stealing ? num_threads : 1);
+
+		for (unsigned n = 0; n < num_ranges && !kill_raytrace; ++n) { // own range first, then steal from the other threads in order
+			thread_range_t &range(ranges[(thread_id + n) % num_threads]);
+			if (range.next.load() >= range.end) continue; // empty
+			unsigned const t(range.next.fetch_add(1));
+			if (t >= range.end) continue; // another thread took the last task
+			task_id = t;
+			if (verbose) {update_progress();}
+			return 1;
+		}
+		return 0;
+	}
+};
+
+rt_task_pool_t rt_task_pool;
+
+
 struct rt_data {
 	unsigned ix, num, job_id, checksum;
 	int rseed, ltype;
 	bool is_thread, verbose, randomized, is_running;
 	cube_t update_bcube;
 	lmap_manager_t *lmgr;
+	rt_task_pool_t *task_pool;
 	cobj_ray_accum_map_t accum_map;
 
 	rt_data(unsigned i=0, unsigned n=0, int s=1, bool t=0, bool v=0, bool r=0, int lt=0, unsigned jid=0)
-		: ix(i), num(n), job_id(jid), checksum(0), rseed(s), ltype(lt), is_thread(t), verbose(v), randomized(r), is_running(0), lmgr(nullptr) {update_bcube.set_to_zeros();}
+		: ix(i), num(n), job_id(jid), checksum(0), rseed(s), ltype(lt), is_thread(t), verbose(v), randomized(r), is_running(0), lmgr(nullptr), task_pool(nullptr) {update_bcube.set_to_zeros();}
 
-	void pre_run(rand_gen_t &rgen) {
-		assert(lmgr);
+	void pre_run() {
+		assert(lmgr && task_pool);
 		assert(num > 0);
 		assert(!is_running);
 		is_running = 1;
-		rgen.set_state(rseed, 1);
+	}
+	void init_tasks(unsigned num_tasks) {task_pool->init_tasks(num_tasks);}
+
+	bool get_next_task(unsigned &task_id, rand_gen_t &rgen) {
+		if (!task_pool->get_next_task(ix, task_id)) return 0;
+		// seed per task rather than per thread so that the rays traced don't depend on the thread count or scheduling
+		rgen.set_state(long((unsigned(rseed) + task_id*2654435761U)%2147483562U) + 1, long(task_id%2147483398U) + 1);
+		return 1;
 	}
 	void post_run() {
 		assert(is_running); // can this fail due to race conditions? too strong? remove?
@@ -596,13 +728,16 @@ void launch_threaded_job(unsigned num_threads, void (*start_func)(rt_data *), bo
 	bool const single_thread(num_threads == 1);
 	if (verbose) {cout << "Computing lighting on " << num_threads << " threads." << endl;}
 	thread_manager.create(num_threads);
+	rt_task_pool.reset(num_threads, verbose);
 	vector<rt_data> &data(thread_manager.data);
 	if (use_temp_lmap) {thread_temp_lmap.init_from(lmap_manager);}
 
 	for (unsigned t = 0; t < data.size(); ++t) {
 		// create a custom lmap_manager_t for each thread then merge them together?
-		data[t] = rt_data(t, num_threads, 234323*(t+1), !single_thread, (verbose && t == 0), randomized, ltype, job_id);
-		data[t].lmgr = (use_temp_lmap ? &thread_temp_lmap : &lmap_manager);
+		// all threads share the same seed; work is split dynamically with the task pool and each task is seeded from its ID
+		data[t] = rt_data(t, num_threads, 234323, !single_thread, (verbose && t == 0), randomized, ltype, job_id);
+		data[t].lmgr      = (use_temp_lmap ? &thread_temp_lmap : &lmap_manager);
+		data[t].task_pool = &rt_task_pool;
 	}
 	if (single_thread && blocking) { // threads disabled
 		start_func((rt_data *)(&data[0]));
@@ -640,12 +775,60 @@ bool cube_light_src_vect::ray_intersects_any(point const &start_pt, point const
 }
 
 
-void trace_one_global_ray(lmap_manager_t *lmgr, point const &pos, point const &pt, colorRGBA const &color, float ray_wt,
+// batches coherent primary light rays so that the static cobj BVH is traversed once per packet rather than once per ray
+class light_ray_packet_t {
+	unsigned num;
+	point p1[RAY_PACKET_SIZE], p2[RAY_PACKET_SIZE];
+
+public:
+	light_ray_packet_t() : num(0) {}
+
+	bool add(point const &pa, point const &pb) { // returns true when the packet is full
+		assert(num < RAY_PACKET_SIZE);
+		p1[num] = pa;
+		p2[num] = pb;
+		return (++num == RAY_PACKET_SIZE);
+	}
+	void cast(lmap_manager_t *lmgr, float weight, colorRGBA const &color, float line_length, int ltype, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map) {
+		if (num == 0) return;
+		point cp1[RAY_PACKET_SIZE], cp2[RAY_PACKET_SIZE], cpos[RAY_PACKET_SIZE];
+		vector3d cnorm[RAY_PACKET_SIZE];
+		int cindex[RAY_PACKET_SIZE];
+		bool skip_init_colls[RAY_PACKET_SIZE];
+		unsigned ray_ixs[RAY_PACKET_SIZE], num_valid(0);
+		float const z1(min(zbottom, czmin)), z2(max(ztop, czmax));
+
+		for (unsigned i = 0; i < num; ++i) { // clip to the scene the same way cast_light_ray() does
+			point a(p1[i]), b(p2[i]);
+			if (!do_line_clip_scene(a, b, z1, z2)) {ray_ixs[i] = RAY_PACKET_SIZE; continue;} // will be rejected by cast_light_ray()
+			cp1[num_valid] = a;
+			cp2[num_valid] = b;
+			skip_init_colls[num_valid] = (a == p1[i]);
+			ray_ixs[i] = num_valid++;
+		}
+		check_coll_line_exact_tree_packet(num_valid, cp1, cp2, cpos, cnorm, cindex, -1, 0, 0, skip_init_colls, 0);
+
+		for (unsigned i = 0; i < num; ++i) {
+			unsigned const ix(ray_ixs[i]);
+			packet_hit_t hit;
+
+			if (ix < num_valid) {
+				hit.cindex = cindex[ix];
+				if (hit.cindex >= 0) {hit.cpos = cpos[ix]; hit.cnorm = cnorm[ix];}
+			}
+			cast_light_ray(lmgr, p1[i], p2[i], weight, weight, color, line_length, -1, ltype, 0, rgen, accum_map, nullptr, ((ix < num_valid) ? &hit : nullptr));
+		}
+		num = 0;
+	}
+};
+
+
+void trace_one_global_ray(light_ray_packet_t &packet, lmap_manager_t *lmgr, point const &pos, point const &pt, colorRGBA const &color, float ray_wt,
 	int ltype, bool is_scene_cube, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map, float line_length)
 {
 	point const end_pt(pt + (pt - pos).get_norm()*line_length);
 	if (is_scene_cube && global_cube_lights.ray_intersects_any(pt, end_pt)) return; // don't double count
-	cast_light_ray(lmgr, pos, end_pt, ray_wt, ray_wt, color, line_length, -1, ltype, 0, rgen, accum_map);
+	if (packet.add(pos, end_pt)) {packet.cast(lmgr, ray_wt, color, line_length, ltype, rgen, accum_map);}
 }
 
 
@@ -672,6 +855,7 @@ void trace_ray_block_global_cube(lmap_manager_t *lmgr, cube_t const &bnds, point
 		unsigned const num_rays(unsigned(nrays*proj_area[i]/tot_area + 0.5));
 		point pt;
 		pt[i] = bnds.d[i][dir];
+		light_ray_packet_t packet;
 		if (verbose) {cout << "Dim " << i+1 << " of 3, num (this thread): " << num_rays << ", progress (of " << 1+num_rays/1000 << "): 0";}
 
 		if (randomized) {
@@ -680,7 +864,7 @@ void trace_ray_block_global_cube(lmap_manager_t *lmgr, cube_t const &bnds, point
 				if (verbose && ((s%1000) == 0)) {increment_printed_number(s/1000);}
 				pt[d0] = rgen.rand_uniform(bnds.d[d0][0], bnds.d[d0][1]);
 				pt[d1] = rgen.rand_uniform(bnds.d[d1][0], bnds.d[d1][1]);
-				trace_one_global_ray(lmgr, pos, pt, color, ray_wt, ltype, is_scene_cube, rgen, accum_map, line_length);
+				trace_one_global_ray(packet, lmgr, pos, pt, color, ray_wt, ltype, is_scene_cube, rgen, accum_map, line_length);
 			}
 		}
 		else {
@@ -697,124 +881,139 @@ void trace_ray_block_global_cube(lmap_manager_t *lmgr, cube_t const &bnds, point
 					if (kill_raytrace) break;
 					if (verbose && ((num%1000) == 0)) increment_printed_number(num/1000);
 					pt[d1] = bnds.d[d1][0] + (s1 + rgen.rand_uniform(0.0, 1.0))*len1/n1;
-					trace_one_global_ray(lmgr, pos, pt, color, ray_wt, ltype, is_scene_cube, rgen, accum_map, line_length);
+					trace_one_global_ray(packet, lmgr, pos, pt, color, ray_wt, ltype, is_scene_cube, rgen, accum_map, line_length);
 				}
 			}
 		}
+		packet.cast(lmgr, ray_wt, color, line_length, ltype, rgen, accum_map); // remaining rays
 		if (verbose) {cout << endl;}
 	} // for i
 }
 
 
-void trace_ray_block_global_light(rt_data *data, point const &pos, colorRGBA const &color, float weight) {
+void trace_ray_block_global(rt_data *data) {
 
-	if (pos.z < 0.0 || weight == 0.0 || color.alpha == 0.0) return; // below the horizon or zero weight, skip it
+	if (GLOBAL_RAYS == 0 && global_cube_lights.empty()) return; // nothing to do
 	assert(data);
-	rand_gen_t rgen;
-	data->pre_run(rgen);
+	// Note: The light color here is white because it will be multiplied by the ambient color later,
+	//       and the moon color is generally similar to the sun color so they can be approximated as equal
+	float const lfn(CLIP_TO_01(1.0f - 5.0f*(light_factor - 0.4f)));
+	colorRGBA const color(WHITE);
+	vector<pair<point, float>> lights; // {pos, weight}
+	if (light_factor >= 0.4 && !combined_gu) {lights.emplace_back(sun_pos, 1.0-lfn);}
+	if (light_factor <= 0.6) {lights.emplace_back(moon_pos, lfn);}
+	rt_task_list_t tasks; // per light: one segment for the scene bounds followed by one segment per global cube light
+
+	for (auto l = lights.begin(); l != lights.end(); ++l) {
+		bool const enabled(l->first.z >= 0.0 && l->second != 0.0 && color.alpha != 0.0); // skip if below the horizon or zero weight
+		tasks.add((enabled ? GLOBAL_RAYS : 0));
+		for (auto i = global_cube_lights.begin(); i != global_cube_lights.end(); ++i) {tasks.add((enabled ? i->num_rays : 0));}
+	}
+	data->pre_run();
+	data->init_tasks(tasks.get_num_tasks());
 	unsigned long long cube_start_rays(0);
+	unsigned task_id(0);
+	rand_gen_t rgen;
 
-	if (GLOBAL_RAYS > 0) {
-		float const ray_wt(RAY_WEIGHT*weight*color.alpha/GLOBAL_RAYS);
-		assert(ray_wt > 0.0);
-		cube_t const bnds(get_scene_bounds());
-		trace_ray_block_global_cube(data->lmgr, bnds, pos, color, ray_wt, max(1U, GLOBAL_RAYS/data->num), LIGHTING_GLOBAL, 0, 1, data->verbose, data->randomized, rgen, &data->accum_map);
-	}
-	for (cube_light_src_vect::const_iterator i = global_cube_lights.begin(); i != global_cube_lights.end(); ++i) {
-		if (data->num == 0 || i->num_rays == 0) continue; // disabled
-		if (data->verbose) {cout << "Cube volume light source " << (i - global_cube_lights.begin()) << " of " << global_cube_lights.size() << endl;}
-		unsigned const num_rays(i->num_rays/data->num);
-		float const cube_weight(RAY_WEIGHT*weight*i->intensity/i->num_rays);
-		trace_ray_block_global_cube(data->lmgr, i->bounds, pos, color, cube_weight, num_rays, LIGHTING_GLOBAL, i->disabled_edges, 0, data->verbose, data->randomized, rgen, &data->accum_map);
-		cube_start_rays += num_rays;
+	while (data->get_next_task(task_id, rgen)) {
+		unsigned start(0), end(0);
+		unsigned const seg(tasks.get_task(task_id, start, end)), segs_per_light(global_cube_lights.size() + 1), cube_ix(seg % segs_per_light);
+		assert(seg < lights.size()*segs_per_light);
+		point const &pos(lights[seg/segs_per_light].first);
+		float const weight(lights[seg/segs_per_light].second);
+
+		if (cube_ix == 0) { // scene bounds
+			float const ray_wt(RAY_WEIGHT*weight*color.alpha/GLOBAL_RAYS);
+			assert(ray_wt > 0.0);
+			trace_ray_block_global_cube(data->lmgr, get_scene_bounds(), pos, color, ray_wt, (end - start), LIGHTING_GLOBAL, 0, 1, 0, data->randomized, rgen, &data->accum_map);
+		}
+		else { // global cube light
+			cube_light_src const &cl(global_cube_lights[cube_ix-1]);
+			float const cube_weight(RAY_WEIGHT*weight*cl.intensity/cl.num_rays);
+			trace_ray_block_global_cube(data->lmgr, cl.bounds, pos, color, cube_weight, (end - start), LIGHTING_GLOBAL, cl.disabled_edges, 0, 0, data->randomized, rgen, &data->accum_map);
+			cube_start_rays += (end - start);
+		}
 	}
 	if (data->verbose) {
-		cout << "start rays: " << GLOBAL_RAYS << ", cube_start_rays: " << cube_start_rays << ", total rays: "
+		cout << "start rays: " << GLOBAL_RAYS << ", cube_start_rays (this thread): " << cube_start_rays << ", total rays: "
 			 << tot_rays << ", hits: " << num_hits << ", cells touched: " << cells_touched << endl;
 	}
 	data->post_run();
 }
 
 
-void trace_ray_block_global(rt_data *data) {
-
-	if (GLOBAL_RAYS == 0 && global_cube_lights.empty()) return; // nothing to do
-	// Note: The light color here is white because it will be multiplied by the ambient color later,
-	//       and the moon color is generally similar to the sun color so they can be approximated as equal
-	float const lfn(CLIP_TO_01(1.0f - 5.0f*(light_factor - 0.4f)));
-	if (light_factor >= 0.4 && !combined_gu) trace_ray_block_global_light(data, sun_pos,  WHITE, 1.0-lfn);
-	if (light_factor <= 0.6) trace_ray_block_global_light(data, moon_pos, WHITE, lfn);
-}
-
-
 float get_sky_light_ray_weight() {return RAY_WEIGHT/(((float)NPTS)*NRAYS);}
 
 void trace_ray_block_sky(rt_data *data) {
 
 	assert(data);
-	rand_gen_t rgen;
-	data->pre_run(rgen);
+	data->pre_run();
 	float const scene_radius(get_scene_radius()), line_length(2.0*scene_radius);
 	unsigned long long start_rays(0), cube_start_rays(0);
+	rt_task_list_t tasks;
+	tasks.add(((NRAYS > 0) ? NPTS : 0), max(1U, RT_TASK_RAYS/max(NRAYS, 1U))); // segment 0: sky points, each with NRAYS rays
+	for (auto i = sky_cube_lights.begin(); i != sky_cube_lights.end(); ++i) {tasks.add(i->num_rays);} // one segment per cube light
+	data->init_tasks(tasks.get_num_tasks());
+	vector<point> pts;
+	vector<vector3d> dirs(NRAYS);
+	unsigned task_id(0);
+	rand_gen_t rgen;
 
-	if (NPTS > 0 && NRAYS > 0) {
-		float const ray_wt(get_sky_light_ray_weight());
-		unsigned const block_npts(max(1U, NPTS/data->num));
-		vector<point> pts(block_npts);
-		vector<vector3d> dirs(NRAYS);
+	while (data->get_next_task(task_id, rgen)) {
+		unsigned start(0), end(0);
+		unsigned const seg(tasks.get_task(task_id, start, end));
 
-		for (unsigned p = 0; p < block_npts; ++p) {
-			do {
-				pts[p] = rgen.signed_rand_vector_spherical(1.0).get_norm()*scene_radius; // start the ray here
-			} while (pts[p].z < zbottom); // force above zbottom
-		}
-		sort(pts.begin(), pts.end());
-		if (data->verbose) {cout << "Sky light source progress (of " << block_npts << "): 0";}
-
-		for (unsigned p = 0; p < block_npts; ++p) {
-			if (kill_raytrace) break;
-			if (data->verbose) {increment_printed_number(p);}
-			point const &pt(pts[p]);
-
-			for (unsigned r = 0; r < NRAYS; ++r) {
-				point const target_pt(X_SCENE_SIZE*rgen.signed_rand_float(), Y_SCENE_SIZE*rgen.signed_rand_float(), rgen.rand_uniform(czmin, czmax));
-				dirs[r] = (target_pt - pt).get_norm();
-				//dirs[r].z = -fabs(dirs[r].z); // pointing down
+		if (seg == 0) { // sky points
+			float const ray_wt(get_sky_light_ray_weight());
+			pts.resize(end - start);
+
+			for (auto p = pts.begin(); p != pts.end(); ++p) {
+				do {
+					*p = rgen.signed_rand_vector_spherical(1.0).get_norm()*scene_radius; // start the ray here
+				} while (p->z < zbottom); // force above zbottom
 			}
-			sort(dirs.begin(), dirs.end());
+			sort(pts.begin(), pts.end());
 
-			for (unsigned r = 0; r < NRAYS; ++r) {
+			for (auto p = pts.begin(); p != pts.end(); ++p) {
 				if (kill_raytrace) break;
-				if (dot_product(dirs[r], pt) >= 0.0) continue; // can get here when (-Z_SCENE_SIZE, Z_SCENE_SIZE) does not contain (czmin, czmax)
-				point const end_pt(pt + dirs[r]*line_length);
-				if (sky_cube_lights.ray_intersects_any(pt, end_pt)) continue; // don't double count
-				cast_light_ray(data->lmgr, pt, end_pt, ray_wt, ray_wt, WHITE, line_length, -1, LIGHTING_SKY, 0, rgen, &data->accum_map);
-				++start_rays;
-			}
+				point const &pt(*p);
+
+				for (unsigned r = 0; r < NRAYS; ++r) {
+					point const target_pt(X_SCENE_SIZE*rgen.signed_rand_float(), Y_SCENE_SIZE*rgen.signed_rand_float(), rgen.rand_uniform(czmin, czmax));
+					dirs[r] = (target_pt - pt).get_norm();
+					//dirs[r].z = -fabs(dirs[r].z); // pointing down
+				}
+				sort(dirs.begin(), dirs.end());
+				light_ray_packet_t packet; // rays from the same point with sorted dirs are coherent
+
+				for (unsigned r = 0; r < NRAYS; ++r) {
+					if (kill_raytrace) break;
+					if (dot_product(dirs[r], pt) >= 0.0) continue; // can get here when (-Z_SCENE_SIZE, Z_SCENE_SIZE) does not contain (czmin, czmax)
+					point const end_pt(pt + dirs[r]*line_length);
+					if (sky_cube_lights.ray_intersects_any(pt, end_pt)) continue; // don't double count
+					if (packet.add(pt, end_pt)) {packet.cast(data->lmgr, ray_wt, WHITE, line_length, LIGHTING_SKY, rgen, &data->accum_map);}
+					++start_rays;
+				}
+				packet.cast(data->lmgr, ray_wt, WHITE, line_length, LIGHTING_SKY, rgen, &data->accum_map); // remaining rays
+			} // for p
 		}
-		if (data->verbose) {cout << endl;}
-	}
-	for (cube_light_src_vect::const_iterator i = sky_cube_lights.begin(); i != sky_cube_lights.end(); ++i) {
-		if (kill_raytrace) break;
-		if (data->num == 0 || i->num_rays == 0) continue; // disabled
-		unsigned const num_rays(i->num_rays/data->num);
-		float const cube_weight(RAY_WEIGHT*i->intensity/i->num_rays);
-		if (data->verbose) {cout << "Cube volume light source " << (i - sky_cube_lights.begin()) << " of " << sky_cube_lights.size() << ", progress (of " << 1+num_rays/1000 << "): 0";}
-		cube_start_rays += num_rays;
-
-		for (unsigned p = 0; p < num_rays; ++p) {
-			if (kill_raytrace) break;
-			if (data->verbose && ((p%1000) == 0)) {increment_printed_number(p/1000);}
-			point const pt(rgen.gen_rand_cube_point(i->bounds));
-			vector3d dir(rgen.signed_rand_vector_spherical().get_norm()); // need high quality distribution
-			dir.z = -fabs(dir.z); // make sure z is negative since this is supposed to be light from the sky
-			point const end_pt(pt + dir*line_length);
-			cast_light_ray(data->lmgr, pt, end_pt, cube_weight, cube_weight, i->color, line_length, -1, LIGHTING_SKY, 0, rgen, &data->accum_map);
+		else { // sky cube light
+			cube_light_src const &cl(sky_cube_lights[seg-1]);
+			float const cube_weight(RAY_WEIGHT*cl.intensity/cl.num_rays);
+			cube_start_rays += (end - start);
+
+			for (unsigned p = start; p < end; ++p) {
+				if (kill_raytrace) break;
+				point const pt(rgen.gen_rand_cube_point(cl.bounds));
+				vector3d dir(rgen.signed_rand_vector_spherical().get_norm()); // need high quality distribution
+				dir.z = -fabs(dir.z); // make sure z is negative since this is supposed to be light from the sky
+				point const end_pt(pt + dir*line_length);
+				cast_light_ray(data->lmgr, pt, end_pt, cube_weight, cube_weight, cl.color, line_length, -1, LIGHTING_SKY, 0, rgen, &data->accum_map);
+			}
 		}
-		if (data->verbose) {cout << endl;}
-	}
+	} // while task
 	if (data->verbose) {
-		cout << "start rays: " << start_rays << ", cube start rays: " << cube_start_rays << ", total rays: " << tot_rays
+		cout << "start rays (this thread): " << start_rays << ", cube start rays (this thread): " << cube_start_rays << ", total rays: " << tot_rays
 			 << ", hits: " << num_hits << ", cells touched: " << cells_touched << endl;
 	}
 	data->checksum = rgen.rand();
@@ -843,16 +1042,26 @@ coll_obj &find_accum_cobj(unsigned id, cobj_ray_accum_t const &arc) {
 void trace_ray_block_cobj_accum(rt_data *data) {
 
 	assert(data);
-	rand_gen_t rgen;
-	data->pre_run(rgen);
+	data->pre_run();
 	float const line_length(2.0*get_scene_radius()), ray_wt(get_sky_light_ray_weight()); // Note: weight assumes not using cube sky lights
+	vector<cobj_ray_accum_t const *> accums; // one task list segment per entry
+	rt_task_list_t tasks;
 
 	for (auto i = merged_accum_map.begin(); i != merged_accum_map.end(); ++i) {
 		coll_obj &cobj(find_accum_cobj(i->first, i->second));
 		cobj.unexpand_from_platform_max_bounds(); // unexpand if it was expanded
+		accums.push_back(&i->second);
+		tasks.add(i->second.rays.size());
+	}
+	data->init_tasks(tasks.get_num_tasks());
+	unsigned task_id(0);
+	rand_gen_t rgen;
 
-		// round robin distribute rays across threads
-		for (auto r = (i->second.rays.begin() + data->ix); r < i->second.rays.end(); r += data->num) {
+	while (data->get_next_task(task_id, rgen)) {
+		unsigned start(0), end(0);
+		vector<rt_ray_t> const &rays(accums[tasks.get_task(task_id, start, end)]->rays);
+
+		for (auto r = rays.begin() + start; r != rays.begin() + end; ++r) {
 			if (kill_raytrace) break; // not needed?
 			assert(r->weight > 0.0);
 			float const weight0(ray_wt ? ray_wt : r->weight);
@@ -865,8 +1074,7 @@ void trace_ray_block_cobj_accum(rt_data *data) {
 void trace_ray_block_cobj_accum_single_update(rt_data *data) {
 
 	assert(data);
-	rand_gen_t rgen;
-	data->pre_run(rgen);
+	data->pre_run();
 	unsigned const cid(data->job_id);
 	coll_obj &cobj(coll_objects.get_cobj(cid));
 	assert(cobj.is_update_light_platform());
@@ -883,15 +1091,26 @@ void trace_ray_block_cobj_accum_single_update(rt_data *data) {
 		}
 		assert(it != merged_accum_map.end());
 	}
-	// round robin distribute rays across threads
-	for (auto r = (it->second.rays.begin() + data->ix); r < it->second.rays.end(); r += data->num) {
-		assert(r->weight > 0.0);
-		point const end_pt(r->get_p2(line_length));
-		bool const cur_hit(check_line_clip(r->pos, end_pt, cobj.d)), prev_hit(check_line_clip(r->pos, end_pt, prev_bcube.d));
-		if (cur_hit == prev_hit) continue; // no change in hit status
-		float const weight(r->weight*(cur_hit ? -1.0 : 1.0)); // if ray is newly blocked, subtract its contribution by negating its weight
-		// Note: cobj is ignored here because it can't be in both the prev and cur position at the same time, and temporarily moving it isn't thread safe
-		cast_light_ray(data->lmgr, r->pos, end_pt, weight, (ray_wt ? ray_wt : r->weight), r->get_color(), line_length, cid, LIGHTING_COBJ_ACCUM, 0, rgen, nullptr, &data->update_bcube);
+	vector<rt_ray_t> const &rays(it->second.rays);
+	rt_task_list_t tasks;
+	tasks.add(rays.size());
+	data->init_tasks(tasks.get_num_tasks());
+	unsigned task_id(0);
+	rand_gen_t rgen;
+
+	while (data->get_next_task(task_id, rgen)) {
+		unsigned start(0), end(0);
+		tasks.get_task(task_id, start, end);
+
+		for (auto r = rays.begin() + start; r != rays.begin() + end; ++r) {
+			assert(r->weight > 0.0);
+			point const end_pt(r->get_p2(line_length));
+			bool const cur_hit(check_line_clip(r->pos, end_pt, cobj.d)), prev_hit(check_line_clip(r->pos, end_pt, prev_bcube.d));
+			if (cur_hit == prev_hit) continue; // no change in hit status
+			float const weight(r->weight*(cur_hit ? -1.0 : 1.0)); // if ray is newly blocked, subtract its contribution by negating its weight
+			// Note: cobj is ignored here because it can't be in both the prev and cur position at the same time, and temporarily moving it isn't thread safe
+			cast_light_ray(data->lmgr, r->pos, end_pt, weight, (ray_wt ? ray_wt : r->weight), r->get_color(), line_length, cid, LIGHTING_COBJ_ACCUM, 0, rgen, nullptr, &data->update_bcube);
+		}
 	}
 	data->post_run();
 }
@@ -999,20 +1218,23 @@ void trace_ray_block_local(rt_data *data) {
 
 	assert(data);
 	if (LOCAL_RAYS == 0) return; // nothing to do
-	rand_gen_t rgen;
-	data->pre_run(rgen);
+	data->pre_run();
 	float const line_length(2.0*get_scene_radius());
-	
-	if (data->verbose) {
-		cout << "Local light sources progress (of " << light_sources_a.size() << "): 0";
-		cout.flush();
-	}
+	rt_task_list_t tasks; // one segment per light source
+
 	for (unsigned i = 0; i < light_sources_a.size(); ++i) {
-		if (data->verbose) {increment_printed_number(i);}
-		unsigned const light_nrays(light_sources_a[i].get_num_rays()), NRAYS(light_nrays ? light_nrays : LOCAL_RAYS), num_rays(max(1U, NRAYS/data->num));
-		ray_trace_local_light_source(data->lmgr, light_sources_a[i], line_length, num_rays, rgen, data->ltype, NRAYS);
+		unsigned const light_nrays(light_sources_a[i].get_num_rays());
+		tasks.add(light_nrays ? light_nrays : LOCAL_RAYS);
+	}
+	data->init_tasks(tasks.get_num_tasks());
+	unsigned task_id(0);
+	rand_gen_t rgen;
+
+	while (data->get_next_task(task_id, rgen)) {
+		unsigned start(0), end(0);
+		unsigned const i(tasks.get_task(task_id, start, end)), light_nrays(light_sources_a[i].get_num_rays()), NRAYS(light_nrays ? light_nrays : LOCAL_RAYS);
+		ray_trace_local_light_source(data->lmgr, light_sources_a[i], line_length, (end - start), rgen, data->ltype, NRAYS);
 	}
-	if (data->verbose) {cout << endl;}
 	data->post_run();
 }
 
@@ -1024,17 +1246,26 @@ void trace_ray_block_dynamic(rt_data *data) {
 	light_volume_local const &lvol(get_local_light_volume(data->ltype));
 	vector<unsigned> const &dlight_ixs(indir_dlight_group_manager.get_dlight_ixs_for_tag_ix(lvol.get_tag_ix()));
 	assert(!dlight_ixs.empty());
-	rand_gen_t rgen;
-	data->pre_run(rgen);
+	data->pre_run();
 	float const max_line_length(2.0*get_scene_radius());
-	
+	rt_task_list_t tasks; // one segment per dynamic light source
+
 	for (auto i = dlight_ixs.begin(); i != dlight_ixs.end(); ++i) {
 		assert(*i < light_sources_d.size());
-		light_source_trig const &ls(light_sources_d[*i]);
+		unsigned const light_nrays(light_sources_d[*i].get_num_rays());
+		tasks.add(light_nrays ? light_nrays : DYNAMIC_RAYS);
+	}
+	data->init_tasks(tasks.get_num_tasks());
+	unsigned task_id(0);
+	rand_gen_t rgen;
+
+	while (data->get_next_task(task_id, rgen)) {
+		unsigned start(0), end(0);
+		light_source_trig const &ls(light_sources_d[dlight_ixs[tasks.get_task(task_id, start, end)]]);
 		//if (!ls.is_enabled()) continue; // error?
 		float const line_length(min(4.0f*ls.get_radius(), max_line_length)); // limit ray length to improve perf
-		unsigned const light_nrays(ls.get_num_rays()), NRAYS(light_nrays ? light_nrays : DYNAMIC_RAYS), num_rays(max(1U, NRAYS/data->num));
-		ray_trace_local_light_source(nullptr, ls, line_length, num_rays, rgen, data->ltype, NRAYS); // lmgr is unused, so leave it as null
+		unsigned const light_nrays(ls.get_num_rays()), NRAYS(light_nrays ? light_nrays : DYNAMIC_RAYS);
+		ray_trace_local_light_source(nullptr, ls, line_length, (end - start), rgen, data->ltype, NRAYS); // lmgr is unused, so leave it as null
 	}
 	data->post_run();
 }
@@ -1066,8 +1297,15 @@ void compute_ray_trace_lighting(unsigned ltype, bool verbose) {
 		if (c_ltype != LIGHTING_LOCAL && !dynamic) {cout << X_SCENE_SIZE << " " << Y_SCENE_SIZE << " " << Z_SCENE_SIZE << " " << czmin << " " << czmax << endl;}
 		all_models.build_cobj_trees(1);
 		if (enable_platform_lights(ltype)) {pre_rt_bvh_build_hook();}
+		unsigned long long const start_rays(tot_rays);
+		int const start_time(GET_TIME_MS());
 		launch_threaded_job(NUM_THREADS, rt_funcs[c_ltype], verbose, 1, 0, 0, ltype);
 		if (enable_platform_lights(ltype)) {post_rt_bvh_build_hook();}
+
+		if (verbose) { // for comparing BVH quality (cobj_tree_sah_build) and thread load balancing (rt_task_stealing, see config.txt)
+			float const elapsed_secs(max(1, (GET_TIME_MS() - start_time))/1000.0f);
+			cout << "rays: " << (tot_rays - start_rays) << ", rays/sec: " << (tot_rays - start_rays)/elapsed_secs << endl;
+		}
 	}
 	if (!dynamic && write_light_files[c_ltype]) {
 		if (c_ltype == LIGHTING_COBJ_ACCUM) {
@@ -1131,6 +1369,182 @@ void check_all_platform_cobj_lighting_update() {
 // lmap_manager_t
 
 
+// bricked lighting file format: the lmap is split into 4x4x4 cell bricks; bricks with no allocated columns aren't stored,
+// bricks where all values are zero or equal are stored as a single type byte/value, and other bricks are stored as 16-bit values
+// quantized to the per-channel range of the brick; the original format starts with the cell count rather than the magic number
+unsigned const LMAP_BRICK_MAGIC   = 0x4B52424C; // "LBRK"
+unsigned const LMAP_BRICK_VERSION = 1;
+
+// reads the rest of the file after the magic number with a single bulk read, then decodes it; lmap is used to skip unallocated columns,
+// and may be null for a dense grid; nothing is stored unless the entire file is valid
+bool lmap_bricks_t::read(binary_file_reader &reader, int ltype, unsigned data_size, unsigned xsize, unsigned ysize, unsigned zsize, lmap_manager_t const *lmap) {
+
+	vector<unsigned char> buf;
+	if (!reader.read_remaining(buf)) return 0;
+	binary_buffer_reader breader(buf);
+	unsigned header[5] = {0}; // version, data_size, xsize, ysize, zsize
+	if (!breader.read(header, sizeof(unsigned), 5)) return 0;
+
+	if (header[0] != LMAP_BRICK_VERSION) {
+		cerr << "Error: Unsupported bricked lighting file version " << header[0] << ". Ignoring file." << endl;
+		return 0;
+	}
+	if (header[1] != data_size || header[2] != xsize || header[3] != ysize || header[4] != zsize) {
+		cerr << "Error: Lighting file data size of " << header[1] << " (" << header[2] << "x" << header[3] << "x" << header[4] << ") does not equal the expected size of "
+			 << data_size << " (" << xsize << "x" << ysize << "x" << zsize << "). Ignoring file." << endl;
+		return 0;
+	}
+	unsigned const sz(lmcell::get_dsz(ltype));
+	vector<brick_t> new_bricks;
+	vector<float> new_vals;
+	vector<unsigned short> new_qvals;
+
+	for (unsigned by = 0; by < ysize; by += LMAP_BRICK_SIZE) {
+		for (unsigned bx = 0; bx < xsize; bx += LMAP_BRICK_SIZE) {
+			unsigned num_cols(0);
+
+			for (unsigned y = by; y < min(by+LMAP_BRICK_SIZE, ysize); ++y) {
+				for (unsigned x = bx; x < min(bx+LMAP_BRICK_SIZE, xsize); ++x) {num_cols += (!lmap || lmap->get_column(x, y) != nullptr);}
+			}
+			if (num_cols == 0) continue; // no bricks stored for this column of bricks
+
+			for (unsigned bz = 0; bz < zsize; bz += LMAP_BRICK_SIZE) {
+				unsigned char btype(0);
+				if (!breader.read(&btype, sizeof(unsigned char), 1) || btype >= NUM_LMAP_BRICK_TYPES) return 0;
+				new_bricks.emplace_back(btype, (unsigned)new_vals.size(), (unsigned)new_qvals.size());
+				if (btype == LMAP_BRICK_ZERO) continue; // no values stored
+				new_vals.resize(new_vals.size() + ((btype == LMAP_BRICK_QUANT) ? 2 : 1)*sz);
+				if (!breader.read(&new_vals[new_bricks.back().vals_ix], sizeof(float), sz)) return 0; // vmin
+				if (btype != LMAP_BRICK_QUANT) continue;
+				unsigned const num_qvals(num_cols*(min(bz+LMAP_BRICK_SIZE, zsize) - bz)*sz);
+				new_qvals.resize(new_qvals.size() + num_qvals);
+				if (!breader.read(&new_vals[new_bricks.back().vals_ix + sz], sizeof(float), sz)) return 0; // vscale
+				if (!breader.read(&new_qvals[new_bricks.back().qvals_ix], sizeof(unsigned short), num_qvals)) return 0;
+			} // for bz
+		} // for bx
+	} // for by
+	if (!breader.at_end()) {cerr << "Error: Extra data at the end of bricked lighting file. Ignoring file." << endl; return 0;}
+	dsz = sz;
+	bricks.swap(new_bricks);
+	vals.swap(new_vals);
+	qvals.swap(new_qvals);
+	return 1;
+}
+
+// reads a bricked lighting file for a dense xsize*ysize*zsize grid; is_bricked is set to false if the file exists but is in the original format
+bool lmap_bricks_t::read_file(char const *const fn, int ltype, unsigned xsize, unsigned ysize, unsigned zsize, bool &is_bricked) {
+
+	assert(fn != nullptr);
+	is_bricked = 0;
+	binary_file_reader reader;
+	if (!reader.open(fn)) return 0;
+	unsigned magic(0);
+	if (!reader.read(&magic, sizeof(unsigned), 1) || magic != LMAP_BRICK_MAGIC) return 0;
+	is_bricked = 1;
+	cout << "Reading bricked lighting file from " << fn << endl;
+	if (read(reader, ltype, xsize*ysize*zsize, xsize, ysize, zsize, nullptr)) return 1;
+	cerr << "Error reading bricked data from lighting file " << fn << endl;
+	return 0;
+}
+
+void lmap_bricks_t::get_cell_val(unsigned bix, unsigned cell_ix, float *val) const {
+
+	assert(bix < bricks.size());
+	brick_t const &b(bricks[bix]);
+
+	for (unsigned n = 0; n < dsz; ++n) {
+		if      (b.type == LMAP_BRICK_ZERO   ) {val[n] = 0.0;}
+		else if (b.type == LMAP_BRICK_UNIFORM) {val[n] = vals[b.vals_ix + n];}
+		else {val[n] = vals[b.vals_ix + n] + vals[b.vals_ix + dsz + n]*qvals[b.qvals_ix + cell_ix*dsz + n];}
+	}
+}
+
+void lmap_manager_t::get_brick_cells(unsigned bx, unsigned by, unsigned bz, vector<lmcell *> &cells) const {
+
+	cells.clear();
+
+	for (unsigned y = by; y < min(by+LMAP_BRICK_SIZE, lm_ysize); ++y) {
+		for (unsigned x = bx; x < min(bx+LMAP_BRICK_SIZE, lm_xsize); ++x) {
+			if (vlmap[y][x] == nullptr) continue; // unallocated column
+			for (unsigned z = bz; z < min(bz+LMAP_BRICK_SIZE, lm_zsize); ++z) {cells.push_back(&vlmap[y][x][z]);}
+		}
+	}
+}
+
+// the whole file is read and validated before any cells are modified
+bool lmap_manager_t::read_bricks_from_file(binary_file_reader &reader, int ltype) {
+
+	lmap_bricks_t bricks;
+	if (!bricks.read(reader, ltype, vldata_alloc.size(), lm_xsize, lm_ysize, lm_zsize, this)) return 0;
+	vector<lmcell *> cells;
+	unsigned bix(0);
+
+	for (unsigned by = 0; by < lm_ysize; by += LMAP_BRICK_SIZE) {
+		for (unsigned bx = 0; bx < lm_xsize; bx += LMAP_BRICK_SIZE) {
+			for (unsigned bz = 0; bz < lm_zsize; bz += LMAP_BRICK_SIZE) {
+				get_brick_cells(bx, by, bz, cells);
+				if (cells.empty()) continue; // not stored
+				for (unsigned c = 0; c < cells.size(); ++c) {bricks.get_cell_val(bix, c, cells[c]->get_offset(ltype));}
+				++bix;
+			} // for bz
+		} // for bx
+	} // for by
+	assert(bix == bricks.size());
+	return 1;
+}
+
+bool lmap_manager_t::write_bricks_to_file(binary_file_writer &writer, int ltype) const {
+
+	unsigned const header[6] = {LMAP_BRICK_MAGIC, LMAP_BRICK_VERSION, (unsigned)vldata_alloc.size(), lm_xsize, lm_ysize, lm_zsize};
+	if (!writer.write(header, sizeof(unsigned), 6)) return 0;
+	unsigned const sz(lmcell::get_dsz(ltype));
+	unsigned num_bricks[NUM_LMAP_BRICK_TYPES] = {0};
+	vector<lmcell *> cells;
+	vector<unsigned short> qvals;
+
+	for (unsigned by = 0; by < lm_ysize; by += LMAP_BRICK_SIZE) {
+		for (unsigned bx = 0; bx < lm_xsize; bx += LMAP_BRICK_SIZE) {
+			for (unsigned bz = 0; bz < lm_zsize; bz += LMAP_BRICK_SIZE) {
+				get_brick_cells(bx, by, bz, cells);
+				if (cells.empty()) continue; // not stored
+				float vmin[4] = {0}, vmax[4] = {0}, vscale[4] = {0};
+				for (unsigned n = 0; n < sz; ++n) {vmin[n] = vmax[n] = cells.front()->get_offset(ltype)[n];}
+
+				for (auto c = cells.begin(); c != cells.end(); ++c) {
+					float const *ptr((*c)->get_offset(ltype));
+					for (unsigned n = 0; n < sz; ++n) {vmin[n] = min(vmin[n], ptr[n]); vmax[n] = max(vmax[n], ptr[n]);}
+				}
+				bool is_zero(1), is_uniform(1);
+
+				for (unsigned n = 0; n < sz; ++n) {
+					is_uniform &= (vmin[n] == vmax[n]);
+					is_zero    &= (vmin[n] == 0.0 && vmax[n] == 0.0);
+				}
+				unsigned char const btype(is_zero ? LMAP_BRICK_ZERO : (is_uniform ? LMAP_BRICK_UNIFORM : LMAP_BRICK_QUANT));
+				++num_bricks[btype];
+				if (!writer.write(&btype, sizeof(unsigned char), 1)) return 0;
+				if (btype != LMAP_BRICK_ZERO && !writer.write(vmin, sizeof(float), sz)) return 0;
+				if (btype != LMAP_BRICK_QUANT) continue;
+				for (unsigned n = 0; n < sz; ++n) {vscale[n] = (vmax[n] - vmin[n])/65535.0f;}
+				qvals.clear();
+
+				for (auto c = cells.begin(); c != cells.end(); ++c) {
+					float const *ptr((*c)->get_offset(ltype));
+
+					for (unsigned n = 0; n < sz; ++n) {
+						float const qv((vscale[n] > 0.0) ? (ptr[n] - vmin[n])/vscale[n] : 0.0f);
+						qvals.push_back((unsigned short)max(0, min(65535, round_fp(qv))));
+					}
+				}
+				if (!writer.write(vscale, sizeof(float), sz) || !writer.write(&qvals.front(), sizeof(unsigned short), qvals.size())) return 0;
+			} // for bz
+		} // for bx
+	} // for by
+	cout << "Lighting bricks: " << num_bricks[LMAP_BRICK_ZERO] << " zero, " << num_bricks[LMAP_BRICK_UNIFORM] << " uniform, " << num_bricks[LMAP_BRICK_QUANT] << " quantized" << endl;
+	return 1;
+}
+
+
 bool lmap_manager_t::read_data_from_file(char const *const fn, int ltype) {
 
 	assert(fn != nullptr);
@@ -1140,6 +1554,11 @@ bool lmap_manager_t::read_data_from_file(char const *const fn, int ltype) {
 	unsigned data_size(0);
 	if (!reader.read(&data_size, sizeof(unsigned), 1)) return 0;
 
+	if (data_size == LMAP_BRICK_MAGIC) { // bricked format
+		if (read_bricks_from_file(reader, ltype)) return 1;
+		cerr << "Error reading bricked data from lighting file " << fn << endl;
+		return 0;
+	}
 	if (data_size != vldata_alloc.size()) {
 		cerr << "Error: Lighting file " << fn << " data size of " << data_size
 			 << " does not equal the expected size of " << vldata_alloc.size() << ". Ignoring file." << endl;
@@ -1168,6 +1587,12 @@ bool lmap_manager_t::write_data_to_file(char const *const fn, int ltype) const {
 	binary_file_writer writer;
 	if (!writer.open(fn)) return 0;
 	cout << "Writing lighting file to " << fn << endl;
+
+	if (compress_lighting_files) {
+		if (write_bricks_to_file(writer, ltype)) return 1;
+		cerr << "Error writing bricked data to lighting file " << fn << endl;
+		return 0;
+	}
 	unsigned const data_size((unsigned)vldata_alloc.size()); // should be size_t?
 	if (!writer.write(&data_size, sizeof(unsigned), 1)) return 0;
 	unsigned const sz(lmcell::get_dsz(ltype));
@@ -3,6 +3,7 @@
 // 9/3/03
 
 #include "spillover.h"
+#include <climits> // for UINT_MAX
 
 using std::cout;
 using std::endl;
@@ -16,18 +17,23 @@ void spillover::init(unsigned max_index) {
 void spillover::insert(unsigned index1, unsigned index2) { // insert index2 into index1 (source, dest)
 	assert(index1 < data.size() && index2 < data.size());
 	assert(index1 != index2);
-	data[index1].insert(index2);
+	if (!data[index1].insert(index2).second) return; // already present
+	// a new edge only merges components if index2 can reach index1
+	if (comps_valid && comp_id[index1] != comp_id[index2] && !data[index2].empty()) {comps_valid = 0;}
 }
 
 void spillover::remove(unsigned index1, unsigned index2) { // remove index2 from index1
 	assert(index1 < data.size() && index2 < data.size());
 	assert(index1 != index2);
-	data[index1].erase(index2);
+	// only edges within a component can split it
+	if (data[index1].erase(index2) && comps_valid && comp_id[index1] == comp_id[index2]) {comps_valid = 0;}
 }
 
 void spillover::remove_all_i(unsigned index1) { // remove outgoing edges
 	assert(index1 < data.size());
+	if (data[index1].empty()) return;
 	data[index1].clear();
+	if (comps_valid && comp_start[comp_id[index1]+1] - comp_start[comp_id[index1]] > 1) {comps_valid = 0;} // index1 was part of a larger component
 }
 
 void spillover::remove_connected(unsigned index1) { // remove incoming edges
@@ -46,69 +52,88 @@ bool spillover::member(unsigned index1, unsigned index2) const { // index2 is a
 	return (data[index1].find(index2) != data[index1].end());
 }
 
-bool spillover::member_deep(unsigned index1, unsigned index2) {
-	assert(index2 < data.size());
-	++cur_seen_ix; // invalidate seen values
-	return member_recur(index1, index2);
-}
-
-bool spillover::member_recur(unsigned index1, unsigned index2, bool use_cache, vector<unsigned char> *used) { // index2 is a member of index1
-
+bool spillover::member2way(unsigned index1, unsigned index2) { // index1 and index2 can reach each other
+	assert(index1 < data.size() && index2 < data.size());
 	assert(index1 != index2);
-	data[index1].seen = cur_seen_ix;
-	if (used != nullptr && (*used)[index1]) return 0; // already used
-	if (use_cache && data[index1].unconnected == cur_connected) return 0;
-	if (use_cache && data[index1].connected   == cur_connected) return 1;
-
-	for (auto i = data[index1].begin(); i != data[index1].end(); ++i) {
-		assert(*i < data.size());
-		if (*i == index2) return 1; // found it
-		if (data[*i].seen == cur_seen_ix) continue; // already seen
-		
-		if (member_recur(*i, index2, use_cache, used)) {
-			if (use_cache) {data[*i].connected = cur_connected;}
-			return 1;
-		}
-	}
-	return 0;
+	if (data[index1].empty() || data[index2].empty()) return 0; // optimization
+	update_components();
+	return (comp_id[index1] == comp_id[index2]);
 }
 
-bool spillover::member2way(unsigned index1, unsigned index2) {
-	return (member_deep(index1, index2) && member_deep(index2, index1));
-}
-
-void spillover::get_fanout(unsigned index1, vector<unsigned> &fanout, vector<unsigned char> *used) {
-	
-	for (auto i = data[index1].begin(); i != data[index1].end(); ++i) {
-		assert(*i < data.size());
-		if (used != nullptr && (*used)[*i]) continue; // already used
-		if (data[*i].seen == cur_seen_ix)   continue; // already seen
-		data[*i].seen = cur_seen_ix;
-		fanout.push_back(*i);
-		get_fanout(*i, fanout, used);
-	}
+// iterative version of Tarjan's algorithm, so that long spill chains can't overflow the stack
+void spillover::update_components() {
+
+	if (comps_valid) return;
+	unsigned const num(data.size());
+	vector<unsigned> index(num, UINT_MAX), lowlink(num, 0), scc_stack;
+	vector<unsigned char> on_stack(num, 0);
+	vector<pair<unsigned, set<unsigned>::const_iterator> > call_stack; // {node, next edge to visit}
+	unsigned next_index(0);
+	comp_id.assign(num, UINT_MAX);
+	comp_start.clear();
+	comp_nodes.clear();
+
+	for (unsigned n = 0; n < num; ++n) {
+		if (index[n] != UINT_MAX) continue; // already visited
+		index[n] = lowlink[n] = next_index++;
+		scc_stack.push_back(n);
+		on_stack[n] = 1;
+		call_stack.push_back(make_pair(n, data[n].cbegin()));
+
+		while (!call_stack.empty()) {
+			unsigned const v(call_stack.back().first);
+			auto &e(call_stack.back().second);
+
+			if (e != data[v].cend()) { // visit the next edge
+				unsigned const w(*(e++));
+
+				if (index[w] == UINT_MAX) { // recurse
+					index[w] = lowlink[w] = next_index++;
+					scc_stack.push_back(w);
+					on_stack[w] = 1;
+					call_stack.push_back(make_pair(w, data[w].cbegin()));
+				}
+				else if (on_stack[w]) {lowlink[v] = min(lowlink[v], index[w]);}
+				continue;
+			}
+			call_stack.pop_back(); // done with v
+
+			if (lowlink[v] == index[v]) { // v is the root of a component; pop it off the stack
+				unsigned const cid(comp_start.size());
+				comp_start.push_back(comp_nodes.size());
+				unsigned w(0);
+
+				do {
+					w = scc_stack.back();
+					scc_stack.pop_back();
+					on_stack[w] = 0;
+					comp_id [w] = cid;
+					comp_nodes.push_back(w);
+				} while (w != v);
+			}
+			if (!call_stack.empty()) { // return to the caller
+				unsigned const u(call_stack.back().first);
+				lowlink[u] = min(lowlink[u], lowlink[v]);
+			}
+		} // while
+	} // for n
+	comp_start.push_back(comp_nodes.size()); // end marker
+	comps_valid = 1;
 }
 
+// returns the other nodes in the same strongly connected component as index1, excluding used nodes
 void spillover::get_connected_components(unsigned index1, vector<unsigned> &cc, vector<unsigned char> *used) {
 
 	cc.resize(0);
 	assert(index1 < data.size());
 	if (data[index1].empty()) return;
-	++cur_seen_ix;   // invalidate seen values
-	++cur_connected; // invalidate connected/unconnected
-	data[index1].seen = cur_seen_ix;
-	fanout.resize(0);
-	get_fanout(index1, fanout, used); // excludes index1
-
-	for (auto i = fanout.begin(); i != fanout.end(); ++i) {
-		assert(*i != index1);
-		++cur_seen_ix; // invalidate seen values
-		bool const ret(member_recur(*i, index1, 1, used));
-		(ret ? data[*i].connected : data[*i].unconnected) = cur_connected;
-		if (ret) {cc.push_back(*i);}
+	update_components();
+	unsigned const cid(comp_id[index1]);
+
+	for (unsigned i = comp_start[cid]; i < comp_start[cid+1]; ++i) {
+		unsigned const n(comp_nodes[i]);
+		if (n == index1 || (used != nullptr && (*used)[n])) continue;
+		cc.push_back(n);
 	}
 }
 
-
-
-
@@ -6,30 +6,27 @@
 #include "3DWorld.h" // need iterator #defs
 
 
+// directed graph of pools spilling into other pools; pools in the same strongly connected component are combined
 class spillover {
 
 public:
-	spillover() : cur_seen_ix(1), cur_connected(1) {}
-	void clear() {data.clear(); cur_seen_ix = cur_connected = 1;}
+	spillover() : comps_valid(0) {}
+	void clear() {data.clear(); comps_valid = 0;}
 	void init(unsigned max_index);
 	void insert(unsigned index1, unsigned index2);
 	void remove(unsigned index1, unsigned index2);
 	void remove_all_i(unsigned index1);
 	void remove_connected(unsigned index1);
 	bool member(unsigned index1, unsigned index2) const;
-	bool member_deep(unsigned index1, unsigned index2);
-	bool member_recur(unsigned index1, unsigned index2, bool use_cache=0, vector<unsigned char> *used=nullptr);
 	bool member2way(unsigned index1, unsigned index2);
-	void get_fanout(unsigned index1, vector<unsigned> &fanout, vector<unsigned char> *used);
 	void get_connected_components(unsigned index1, vector<unsigned> &cc, vector<unsigned char> *used=nullptr);
 
 private:
-	struct graph_node : public set<unsigned> {
-		unsigned seen, connected, unconnected;
-		graph_node() : seen(0), connected(0), unconnected(0) {}
-	};
-	vector<graph_node> data;
-	vector<unsigned> fanout;
-	unsigned cur_seen_ix, cur_connected;
+	void update_components();
+
+	vector<set<unsigned> > data;
+	// strongly connected components, computed lazily after the graph changes
+	vector<unsigned> comp_id, comp_start, comp_nodes; // comp_nodes[comp_start[c]..comp_start[c+1]) are the nodes of component c
+	bool comps_valid;
 };
 
@@ -7,6 +7,9 @@
 #include "shaders.h"
 #include "openal_wrap.h"
 #include "heightmap.h"
+#include "binary_file_io.h"
+#include <omp.h>
+#include <fstream>
 
 
 bool const DEBUG_TILES        = 0;
@@ -46,17 +49,18 @@ enum {FM_NONE, FM_INC_MESH, FM_DEC_MESH, FM_FLATTEN, FM_REM_TREES, FM_ADD_TREES,
 
 bool tt_lightning_enabled(0), check_tt_mesh_occlusion(1);
 unsigned inf_terrain_fire_mode(0); // none, increase height, decrease height
-string read_hmap_modmap_fn, write_hmap_modmap_fn("heightmap.mod");
+string read_hmap_modmap_fn, write_hmap_modmap_fn("heightmap.mod"), tile_cache_dir; // tile cache is disabled if tile_cache_dir is empty
+unsigned tile_cache_max_mb(256);
 hmap_brush_param_t cur_brush_param;
 tile_offset_t model3d_offset;
 
 extern bool inf_terrain_scenery, enable_tiled_mesh_ao, underwater, fog_enabled, volume_lighting, combined_gu, enable_depth_clamp, tt_triplanar_tex, use_grass_tess;
-extern bool use_instanced_pine_trees, enable_tt_model_reflect, water_is_lava, tt_fire_button_down, flashlight_on;
-extern unsigned grass_density, max_unique_trees, shadow_map_sz, num_birds_per_tile, num_fish_per_tile, erosion_iters_tt, num_rnd_grass_blocks;
+extern bool force_cpu_mesh_gen, async_tile_gen, deterministic_erosion, use_instanced_pine_trees, enable_tt_model_reflect, water_is_lava, tt_fire_button_down, flashlight_on;
+extern unsigned grass_density, max_unique_trees, shadow_map_sz, num_birds_per_tile, num_fish_per_tile, erosion_iters_tt, erosion_tile_size, num_rnd_grass_blocks;
 extern int DISABLE_WATER, display_mode, tree_mode, leaf_color_changed, ground_effects_level, animate2, iticks, num_trees, window_width, window_height;
 extern int invert_mh_image, is_cloudy, camera_surf_collide, show_fog, mesh_gen_mode, mesh_gen_shape, cloud_model, precip_mode, auto_time_adv, draw_model;
 extern float zmax, zmin, water_plane_z, mesh_scale, mesh_scale_z, vegetation, relh_adj_tex, grass_length, grass_width, fticks, cloud_height_offset, clouds_per_tile;
-extern float ocean_wave_height, sm_tree_density, tree_density_thresh, atmosphere, cloud_cover, temperature, flower_density, FAR_CLIP, shadow_map_pcf_offset, biome_x_offset;
+extern float erode_amount, ocean_wave_height, sm_tree_density, tree_density_thresh, atmosphere, cloud_cover, temperature, flower_density, FAR_CLIP, shadow_map_pcf_offset, biome_x_offset;
 extern float smap_thresh_scale, tt_grass_scale_factor;
 extern double tfticks;
 extern point sun_pos, moon_pos, surface_pos;
@@ -77,6 +81,7 @@ void setup_detail_normal_map(shader_t &s, float tscale);
 void draw_distant_mesh_bottom(float terrain_zmin);
 bool no_grass_under_buildings();
 bool check_buildings_no_grass(point const &pos);
+bool inf_buildings_enabled();
 colorRGBA get_avg_color_for_landscape_tex(unsigned id); // defined later in this file
 
 
@@ -160,11 +165,11 @@ void update_tiled_grass_colors() {grass_tile_manager.clear();} // regenerate gra
 class tiled_terrain_hmap_manager_t : public terrain_hmap_manager_t {
 
 	tile_t *cur_tile;
-	bool modified[3][3];
+	int mod_x1, mod_y1, mod_x2, mod_y2; // bounds of modified heights in global mesh index space; empty if mod_x1 > mod_x2
 
 public:
 	tiled_terrain_hmap_manager_t() : cur_tile(NULL) {clear_modified();}
-	void clear_modified() {for (unsigned i = 0; i < 3; ++i) {UNROLL_3X(modified[i][i_] = 0;)}}
+	void clear_modified() {mod_x1 = mod_y1 = INT_MAX; mod_x2 = mod_y2 = INT_MIN;}
 
 	void apply_brush(tex_mod_map_manager_t::hmap_brush_t brush, tile_t *tile, bool cache) { // Note: brush is copied and may be modified
 		cur_tile = tile;
@@ -177,18 +182,20 @@ public:
 		int const step_sz(max(1, int(1.0/mesh_scale + SMALL_NUMBER))); // Note: only intended to work when mesh_scale is a power of 0.5 (or generally an integer reciprocol)
 		unsigned const num_steps(max(1U, unsigned(mesh_scale + SMALL_NUMBER))); // Note: only intended to work when mesh_scale is a power of 2 (or generally an integer)
 		if (cache) {apply_and_cache_brush(brush, step_sz, num_steps);} else {terrain_hmap_manager_t::apply_brush(brush, step_sz, num_steps);}
-		if (cur_tile == NULL) return; // no tile specified, so can't do any updates
-		tile_xy_pair const tp(cur_tile->get_tile_xy_pair());
-
-		for (int dy = -1; dy <= 1; ++dy) {
-			for (int dx = -1; dx <= 1; ++dx) {
-				if (!modified[dy+1][dx+1]) continue;
-				tile_t *adj_tile(get_tile_from_xy(tile_xy_pair(tp.x + dx, tp.y + dy)));
-				if (adj_tile) {adj_tile->invalidate_mesh_height();}
+		if (cur_tile == NULL || mod_x1 > mod_x2) {cur_tile = NULL; return;} // no tile specified or nothing modified, so can't do any updates
+		// update all tiles whose zvals or AO context (AO_RAY_LEN) overlap the modified region
+		int const tsize(get_tile_size()), pad(AO_RAY_LEN + tsize + 1);
+		int const tx1(floor_div(mod_x1 - pad, tsize)), ty1(floor_div(mod_y1 - pad, tsize)), tx2(floor_div(mod_x2 + pad, tsize)), ty2(floor_div(mod_y2 + pad, tsize));
+
+		for (int ty = ty1; ty <= ty2; ++ty) {
+			for (int tx = tx1; tx <= tx2; ++tx) {
+				tile_t *tile(get_tile_from_xy(tile_xy_pair(tx, ty)));
+				if (tile) {tile->update_mesh_height_region(mod_x1, mod_y1, mod_x2, mod_y2);}
 			}
 		}
 		cur_tile = NULL;
 	}
+	static int floor_div(int v, int d) {return ((v >= 0) ? v/d : -((d - 1 - v)/d));}
 	void flatten_region(cube_t const &cube) {
 		// Note: to be applied before tiles are generated so that they don't need to be invalidated
 		// Note: assumes unscaled mesh (mesh_scale == 1)
@@ -214,7 +221,7 @@ public:
 		if (!clamp_xy(clamped_x, clamped_y, fract_x, fract_y, allow_wrap)) return 0;
 		assert(clamped_x >= 0 && clamped_y >= 0);
 		modify_height(tex_mod_map_manager_t::mod_elem_t(clamped_x, clamped_y, val), is_delta); // Note: *not* cached at this level
-		if (cur_tile) {cur_tile->fill_adj_mask(modified, x, y);}
+		if (cur_tile) {min_eq(mod_x1, x); min_eq(mod_y1, y); max_eq(mod_x2, x); max_eq(mod_y2, y);}
 		return 1;
 	}
 };
@@ -253,12 +260,12 @@ bool write_default_hmap_modmap() {
 tile_t::tile_t() : x1(0), y1(0), x2(0), y2(0), wx1(0), wy1(0), wx2(0), wy2(0),
 	last_occluded_frame(0), weight_tid(0), height_tid(0), normal_tid(0), shadow_tid(0), size(0), stride(0), zvsize(0), base_tsize(0), gen_tsize(0), smap_lod_level(0),
 	radius(0), mzmin(0), mzmax(0), mesh_dz(0), ptzmax(0), dtzmax(0), trmax(0), xstart(0), ystart(0), min_normal_z(0.0), deltax(0.0), deltay(0.0),
-	sun_shadows_invalid(1), moon_shadows_invalid(1), recalc_tree_grass_weights(1), mesh_height_invalid(0), in_queue(0), last_occluded(0), has_any_grass(0),
+	sun_shadows_invalid(1), moon_shadows_invalid(1), recalc_tree_grass_weights(1), in_queue(0), last_occluded(0), has_any_grass(0), mesh_weights_valid(0),
 	is_distant(0), no_trees(0), just_cleared(0), has_tunnel(0), decid_trees(tree_data_manager) {}
 
 tile_t::tile_t(unsigned size_, int x, int y) : last_occluded_frame(0), weight_tid(0), height_tid(0), normal_tid(0), shadow_tid(0),
 	size(size_), stride(size+1), zvsize(stride+1), gen_tsize(0), smap_lod_level(0), mesh_dz(0.0), trmax(0.0), min_normal_z(0.0), deltax(DX_VAL), deltay(DY_VAL),
-	sun_shadows_invalid(1), moon_shadows_invalid(1), recalc_tree_grass_weights(1), mesh_height_invalid(0), in_queue(0), last_occluded(0), has_any_grass(0),
+	sun_shadows_invalid(1), moon_shadows_invalid(1), recalc_tree_grass_weights(1), in_queue(0), last_occluded(0), has_any_grass(0), mesh_weights_valid(0),
 	is_distant(0), no_trees(0), just_cleared(0), has_tunnel(0), mesh_off(xoff-xoff2, yoff-yoff2), decid_trees(tree_data_manager)
 {
 	assert(size > 0);
@@ -302,16 +309,6 @@ void tile_t::update_terrain_params() { // setup biomes
 }
 
 
-// used to determine what adjacent tiles modifying this location in global space can affect
-void tile_t::fill_adj_mask(bool mask[3][3], int x, int y) const { // mask is {y-1, y, y+1} x {x-1, x, x+1}
-
-	if (x >= x1 && x <= x2 && y >= y1 && y <= y2) {mask[1][1] |= 1;} // ourself
-	if (x <= x1) {mask[1][0] |= 1; mask[0][0] |= (y <= y1); mask[2][0] |= (y >= y2);} // left  + top/bottom left  corners
-	if (x >= x2) {mask[1][2] |= 1; mask[0][2] |= (y <= y1); mask[2][2] |= (y >= y2);} // right + top/bottom right corners
-	mask[0][1] |= (y <= y1); mask[2][1] |= (y >= y2); // top/bottom edges
-}
-
-
 float tile_t::get_min_dist_to_pt(point const &pt, bool xy_only, bool mesh_only) const {
 
 	cube_t const bcube(mesh_only ? get_mesh_bcube() : get_bcube());
@@ -402,6 +399,7 @@ void tile_t::clear_vbo_tid(tile_shadow_map_manager *smap_manager) {
 	scenery.clear_vbos();
 	flowers.clear_vbo();
 	free_texture(weight_tid);
+	mesh_weights_valid = 0; // weights may depend on state that changed
 	free_texture(height_tid);
 	free_texture(normal_tid);
 	free_texture(shadow_tid);
@@ -425,13 +423,11 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 	//timer_t timer("Create Zvals");
 	if (enable_terrain_env) {update_terrain_params();}
 	zvals.resize(zvsize*zvsize);
-	mzmin =  FAR_DISTANCE;
-	mzmax = -FAR_DISTANCE;
-	unsigned const block_size(zvsize/4), context_sz(stride + 2*AO_RAY_LEN);
+	unsigned const context_sz(stride + 2*AO_RAY_LEN);
 	bool const using_hmap(using_tiled_terrain_hmap_tex()), add_detail(using_hmap_with_detail()); // add procedural detail to heightmap
 
 	// When using AO + GPU noise generation, it's faster to compute the AO + context and clip the zvals from this rather than making two separate compute calls (one without blocking)
-	if (enable_tiled_mesh_ao && !using_hmap && mesh_gen_mode >= MGEN_SIMPLEX_GPU) {
+	if (enable_tiled_mesh_ao && !using_hmap && mesh_gen_mode >= MGEN_SIMPLEX_GPU && !force_cpu_mesh_gen) {
 		bool results_ready(setup_height_gen(height_gen, get_xval(x1 - AO_RAY_LEN), get_yval(y1 - AO_RAY_LEN), deltax, deltay, context_sz, context_sz, 0, no_wait)); // cache_values=0
 		if (!results_ready) {assert(no_wait); return 0;} // cached heights are not yet ready
 		ao_zvals.resize(context_sz*context_sz);
@@ -445,7 +441,7 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 		bool results_ready(setup_height_gen(height_gen, get_xval(x1), get_yval(y1), deltax, deltay, zvsize, zvsize, 0, no_wait)); // cache_values=0
 		if (!results_ready) {assert(no_wait); return 0;} // cached heights are not yet ready
 	}
-	float const xy_mult(1.0/float(size)), wpz_max(get_water_z_height() + ocean_wave_height);
+	float const xy_mult(1.0/float(size));
 
 #pragma omp parallel for schedule(static,1)
 	for (int y = 0; y < (int)zvsize; ++y) {
@@ -468,6 +464,17 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 		} // for x
 	} // for y
 	if (!using_hmap) {apply_erosion(&zvals.front(), zvsize, zvsize, zmin, erosion_iters_tt);} // heightmap is eroded during load
+	calc_zval_bounds();
+	return 1; // results are ready
+}
+
+void tile_t::calc_zval_bounds() { // also used for zvals read from the tile cache
+
+	assert(zvals.size() == zvsize*zvsize);
+	mzmin =  FAR_DISTANCE;
+	mzmax = -FAR_DISTANCE;
+	unsigned const block_size(zvsize/4);
+	float const wpz_max(get_water_z_height() + ocean_wave_height);
 
 	for (unsigned yy = 0; yy < 4; ++yy) {
 		for (unsigned xx = 0; xx < 4; ++xx) {
@@ -497,7 +504,6 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 	ptzmax = dtzmax = mzmin; // no trees yet
 	if (!can_have_trees()) {no_trees = 1;} // mark as no_trees so that trees don't pop when water is disabled later
 	if (DEBUG_TILES) {cout << "new tile coords: " << x1 << " " << y1 << " " << x2 << " " << y2 << endl;}
-	return 1; // results are ready
 }
 
 void tile_t::get_z_minmax_for_area(point const &pos, float radius, float &zmin, float &zmax) const {
@@ -538,9 +544,11 @@ float tile_t::get_zval_at(float x, float y, bool in_global_space) const {
 
 // *** shadows + AO lighting ***
 
-void tile_t::calc_mesh_ao_lighting() {
+// calculates AO for texels in the range [ax1,ax2) x [ay1,ay2), which is the entire tile unless called for a mesh height edit
+void tile_t::calc_mesh_ao_lighting_region(unsigned ax1, unsigned ay1, unsigned ax2, unsigned ay2) {
 
 	//timer_t timer("Calc Tile AO Lighting");
+	assert(ax1 < ax2 && ay1 < ay2 && ax2 <= stride && ay2 <= stride);
 	// caclulate ray step directions
 	tile_xy_pair ao_dirs[NUM_AO_DIRS]; // 0  1  2  3  4  5  6  7
 	unsigned ix(0);
@@ -554,15 +562,17 @@ void tile_t::calc_mesh_ao_lighting() {
 	assert(AO_RAY_LEN <= size);
 
 	// create context zvals, which may overlap with other tiles (that need not be created at this point)
-	unsigned const context_sz(stride + 2*AO_RAY_LEN);
-	bool const using_hmap(using_tiled_terrain_hmap_tex()), add_detail(using_hmap_with_detail()), use_ao_zvals(!ao_zvals.empty());
+	int const cx0(int(ax1) - int(AO_RAY_LEN)), cy0(int(ay1) - int(AO_RAY_LEN)); // context origin relative to the tile
+	unsigned const cxsz(ax2 - ax1 + 2*AO_RAY_LEN), cysz(ay2 - ay1 + 2*AO_RAY_LEN);
+	bool const full_tile(ax1 == 0 && ay1 == 0 && ax2 == stride && ay2 == stride);
+	bool const using_hmap(using_tiled_terrain_hmap_tex()), add_detail(using_hmap_with_detail()), use_ao_zvals(full_tile && !ao_zvals.empty());
 	vector<float> czv;
 	mesh_xy_grid_cache_t height_gen;
 	
 	if (use_ao_zvals) {czv.swap(ao_zvals);} // use precomputed values, will clear ao_zvals at the end
 	else {
-		czv.resize(context_sz*context_sz);
-		setup_height_gen(height_gen, get_xval(x1 - AO_RAY_LEN), get_yval(y1 - AO_RAY_LEN), deltax, deltay, context_sz, context_sz, 0); // cache_values=0
+		czv.resize(cxsz*cysz);
+		setup_height_gen(height_gen, get_xval(x1 + cx0), get_yval(y1 + cy0), deltax, deltay, cxsz, cysz, 0); // cache_values=0
 	}
 	float const dz(0.5*HALF_DXY);
 	ao_lighting.resize(stride*stride);
@@ -571,10 +581,10 @@ void tile_t::calc_mesh_ao_lighting() {
 	{
 		if (!use_ao_zvals) {
 #pragma omp for schedule(static,1)
-			for (int y = 0; y < (int)context_sz; ++y) {
-				for (int x = 0; x < (int)context_sz; ++x) {
-					int const xv(x - AO_RAY_LEN), yv(y - AO_RAY_LEN);
-					float &zv(czv[y*context_sz + x]);
+			for (int y = 0; y < (int)cysz; ++y) {
+				for (int x = 0; x < (int)cxsz; ++x) {
+					int const xv(x + cx0), yv(y + cy0);
+					float &zv(czv[y*cxsz + x]);
 					if (xv >= 0 && yv >= 0 && xv < (int)zvsize && yv < (int)zvsize) {zv = zvals[yv*zvsize + xv];}
 					else if (using_hmap) {
 						zv = terrain_hmap_manager.get_clamped_height((x1 + xv), (y1 + yv));
@@ -586,8 +596,8 @@ void tile_t::calc_mesh_ao_lighting() {
 		}
 		// calculate ao_lighting values by casting rays through the mesh zvals
 #pragma omp for schedule(static,1)
-		for (int y = 0; y < (int)stride; ++y) {
-			for (int x = 0; x < (int)stride; ++x) {
+		for (int y = ay1; y < (int)ay2; ++y) {
+			for (int x = ax1; x < (int)ax2; ++x) {
 				unsigned atten(0);
 
 				for (unsigned d = 0; d < NUM_AO_DIRS; ++d) {
@@ -600,10 +610,10 @@ void tile_t::calc_mesh_ao_lighting() {
 						z0   += dz;
 						//step += step; // multiply by 2 for exponential step size
 						step += ao_dirs[d]; // linear increase (Note: must agree with max_ray_length)
-						int const xv(v.x + AO_RAY_LEN), yv(v.y + AO_RAY_LEN);
-						//assert(xv >= 0 && yv >= 0 && xv < (int)context_sz && yv < (int)context_sz);
+						int const xv(v.x - cx0), yv(v.y - cy0);
+						//assert(xv >= 0 && yv >= 0 && xv < (int)cxsz && yv < (int)cysz);
 						
-						if (czv[yv*context_sz + xv] > z0) { // hit a higher point
+						if (czv[yv*cxsz + xv] > z0) { // hit a higher point
 							atten += (NUM_AO_STEPS - s); // Note: ambient obscurance - uses actual distance to occluder
 							break;
 						}
@@ -617,6 +627,268 @@ void tile_t::calc_mesh_ao_lighting() {
 	}
 }
 
+void tile_t::clear_trees_and_scenery() { // they will be regenerated on the current mesh surface
+
+	pine_trees.clear_vbos();
+	pine_trees.clear_all();
+	decid_trees.clear_context();
+	decid_trees.clear();
+	scenery.clear_vbos();
+	scenery.clear();
+	clear_flowers();
+	tree_map.clear();
+}
+
+// incremental update for a heightmap edit covering the inclusive global mesh index range {gx1, gy1} - {gx2, gy2};
+// edited zvals are reread from the heightmap, and only AO texels within ray range of the edit are recalculated;
+// mesh shadows are recalculated for this tile, and only propagate to adjacent tiles if the shadows at the shared edge change
+bool tile_t::update_mesh_height_region(int gx1, int gy1, int gx2, int gy2) { // returns 1 if anything in this tile was updated
+
+	if (zvals.empty() || is_distant) return 0;
+	int const R(AO_RAY_LEN), zx1(max(gx1 - x1, 0)), zy1(max(gy1 - y1, 0)), zx2(min(gx2 - x1, int(zvsize)-1)), zy2(min(gy2 - y1, int(zvsize)-1));
+	int const ax1(max(gx1 - x1 - R, 0)), ay1(max(gy1 - y1 - R, 0)), ax2(min(gx2 - x1 + R + 1, int(stride))), ay2(min(gy2 - y1 + R + 1, int(stride))); // ax2/ay2 are exclusive
+	bool const update_zvals(zx1 <= zx2 && zy1 <= zy2), update_ao(enable_tiled_mesh_ao && !ao_lighting.empty() && ax1 < ax2 && ay1 < ay2);
+	if (!update_zvals && !update_ao) return 0; // edit is out of range of this tile
+
+	if (update_zvals) {
+		bool const add_detail(using_hmap_with_detail());
+		mesh_xy_grid_cache_t height_gen;
+		if (add_detail) {setup_height_gen(height_gen, get_xval(x1 + zx1), get_yval(y1 + zy1), deltax, deltay, (zx2 - zx1 + 1), (zy2 - zy1 + 1), 0);} // cache_values=0
+
+		for (int y = zy1; y <= zy2; ++y) {
+			for (int x = zx1; x <= zx2; ++x) {
+				float &zval(zvals[y*zvsize + x]);
+				zval = terrain_hmap_manager.get_clamped_height((x1 + x), (y1 + y));
+				if (add_detail) {zval += HMAP_DETAIL_MAG*height_gen.eval_index((x - zx1), (y - zy1));}
+			}
+		}
+		calc_zval_bounds();
+		clear_trees_and_scenery(); // placed on the old surface
+		free_texture(weight_tid); // weights depend on height and slope; recalculated in pre_draw()
+		mesh_weights_valid = 0;
+		free_texture(height_tid);
+		free_texture(normal_tid);
+		clear_shadows(1, 1, 1); // no_clear_adj=1 so that proc_tile_queue() can tell if the shadows leaving this tile have changed
+		clear_shadow_map(nullptr);
+	}
+	if (update_ao) {calc_mesh_ao_lighting_region(ax1, ay1, ax2, ay2);}
+	sun_shadows_invalid = moon_shadows_invalid = 1; // upload the updated AO and shadows
+	return 1;
+}
+
+
+// *** tile cache ***
+
+unsigned const TILE_CACHE_MAGIC   = 0x43545433; // "3TTC"
+unsigned const TILE_CACHE_VERSION = 1;
+string const TILE_CACHE_INDEX_FN("tile_cache.idx");
+
+bool tile_t::write_cache_file(string const &fn, uint64_t key) const {
+
+	binary_file_writer writer;
+	if (!writer.open(fn)) return 0;
+	unsigned const header[4] = {TILE_CACHE_MAGIC, TILE_CACHE_VERSION, zvsize, (unsigned)ao_lighting.size()};
+	int const xy[2] = {x1, y1};
+	if (!writer.write(header, sizeof(unsigned), 4) || !writer.write(&key, sizeof(uint64_t), 1) || !writer.write(xy, sizeof(int), 2)) return 0;
+	if (!writer.write(zvals.data(), sizeof(float), zvals.size())) return 0;
+	if (!ao_lighting.empty() && !writer.write(ao_lighting.data(), sizeof(unsigned char), ao_lighting.size())) return 0;
+	return 1;
+}
+
+bool tile_t::read_cache_file(string const &fn, uint64_t key) { // returns 0 if the file is missing, corrupt, or doesn't match this tile
+
+	binary_file_reader reader;
+	if (!reader.open(fn)) return 0;
+	unsigned header[4] = {0};
+	uint64_t file_key(0);
+	int xy[2] = {0};
+	if (!reader.read(header, sizeof(unsigned), 4) || !reader.read(&file_key, sizeof(uint64_t), 1) || !reader.read(xy, sizeof(int), 2)) return 0;
+	if (header[0] != TILE_CACHE_MAGIC || header[1] != TILE_CACHE_VERSION || header[2] != zvsize || file_key != key || xy[0] != x1 || xy[1] != y1) return 0;
+	if (header[3] != 0 && header[3] != stride*stride) return 0;
+	zvals.resize(zvsize*zvsize);
+	if (!reader.read(zvals.data(), sizeof(float), zvals.size())) {zvals.clear(); return 0;}
+	ao_lighting.resize(header[3]);
+	if (!ao_lighting.empty() && !reader.read(ao_lighting.data(), sizeof(unsigned char), ao_lighting.size())) {zvals.clear(); ao_lighting.clear(); return 0;}
+	calc_zval_bounds();
+	return 1;
+}
+
+// persistent on-disk LRU cache of generated tile zvals and AO lighting, one gzipped file per tile in tile_cache_dir;
+// files are keyed by tile position and a hash of the mesh generation parameters and heightmap contents (including mod map edits)
+class tile_cache_t {
+
+	struct entry_t {
+		uint64_t last_used;
+		unsigned size;
+		entry_t(uint64_t lu=0, unsigned sz=0) : last_used(lu), size(sz) {}
+	};
+	mutable std::mutex mutex;
+	map<string, entry_t> entries; // by file name; guarded by mutex
+	uint64_t params_key, use_counter, total_size; // guarded by mutex
+	unsigned num_hits, num_misses, num_writes, num_evicted; // guarded by mutex
+	uint64_t hmap_hash; // main thread only
+	unsigned hmap_mod_version; // main thread only
+	bool index_loaded, index_dirty; // guarded by mutex; index_dirty means LRU times changed since the index was last rewritten
+
+	string get_fn(tile_t const &tile, uint64_t key) const {
+		tile_xy_pair const txy(tile.get_tile_xy_pair());
+		ostringstream oss;
+		oss << "tile_" << txy.x << "_" << txy.y << "_" << std::hex << key << ".tt.gz";
+		return oss.str();
+	}
+	string get_path(string const &fn) const {return tile_cache_dir + "/" + fn;}
+
+	void load_index() { // Note: mutex must be locked
+		if (index_loaded) return;
+		index_loaded = 1;
+		ifstream in(get_path(TILE_CACHE_INDEX_FN));
+		string fn;
+		entry_t entry;
+
+		while (in >> fn >> entry.size >> entry.last_used) { // later records for the same file replace earlier ones
+			auto it(entries.find(fn));
+			if (it != entries.end()) {total_size -= it->second.size; entries.erase(it);}
+			if (entry.size == 0) continue; // removal record
+			entries[fn] = entry;
+			total_size += entry.size;
+			use_counter = max(use_counter, entry.last_used);
+		}
+	}
+	void append_to_index(string const &fn, entry_t const &entry) { // Note: mutex must be locked
+		// writes and removals are appended rather than rewriting the whole index; the index is compacted when rewritten by flush() or update_key()
+		ofstream out(get_path(TILE_CACHE_INDEX_FN), std::ios::app);
+		if (out.good()) {out << fn << " " << entry.size << " " << entry.last_used << "\n";} else {index_dirty = 1;} // rewrite on the next flush
+	}
+	bool write_index() { // Note: mutex must be locked
+		ofstream out(get_path(TILE_CACHE_INDEX_FN));
+		if (!out.good()) {cerr << "Error: Failed to write tile cache index " << get_path(TILE_CACHE_INDEX_FN) << endl; return 0;}
+		for (auto i = entries.begin(); i != entries.end(); ++i) {out << i->first << " " << i->second.size << " " << i->second.last_used << "\n";}
+		index_dirty = 0;
+		return 1;
+	}
+	void remove_entry(map<string, entry_t>::iterator it) { // Note: mutex must be locked
+		remove(get_path(it->first).c_str());
+		total_size -= it->second.size;
+		append_to_index(it->first, entry_t()); // size 0 = removal record
+		entries.erase(it);
+	}
+	void evict_to_size_limit() { // remove least recently used files; Note: mutex must be locked
+		uint64_t const max_size(uint64_t(tile_cache_max_mb) << 20);
+
+		while (total_size > max_size && !entries.empty()) {
+			auto lru(entries.begin());
+			for (auto i = entries.begin(); i != entries.end(); ++i) {if (i->second.last_used < lru->second.last_used) {lru = i;}}
+			remove_entry(lru);
+			++num_evicted;
+		}
+	}
+public:
+	tile_cache_t() : params_key(0), use_counter(0), total_size(0), num_hits(0), num_misses(0), num_writes(0), num_evicted(0),
+		hmap_hash(0), hmap_mod_version(0), index_loaded(0), index_dirty(0) {}
+	bool enabled() const {return !tile_cache_dir.empty();}
+
+	void update_key(unsigned tile_size) { // called from the main thread before tiles are queued for generation
+		if (!enabled()) return;
+		bool const using_hmap(using_tiled_terrain_hmap_tex());
+
+		if (!index_loaded) { // first use, before any worker threads read from the cache
+			std::unique_lock<std::mutex> lock(mutex);
+			load_index();
+			if (!write_index()) {cerr << "Disabling tile cache; tile_cache_dir " << tile_cache_dir << " must be an existing, writable directory" << endl; tile_cache_dir.clear(); return;}
+		}
+
+		if (using_hmap && (hmap_hash == 0 || terrain_hmap_manager.get_mod_version() != hmap_mod_version)) { // heightmap loaded or modified
+			hmap_hash        = terrain_hmap_manager.get_data_hash(); // slow for large heightmaps, but only done when they change
+			hmap_mod_version = terrain_hmap_manager.get_mod_version();
+		}
+		fnv_hasher_t hasher(get_mesh_gen_params_hash());
+		hasher.add(tile_size);
+		hasher.add(using_hmap ? hmap_hash : 0);
+		hasher.add(using_hmap_with_detail());
+		hasher.add(erosion_iters_tt);
+		hasher.add_float(erode_amount);
+		hasher.add(deterministic_erosion);
+		hasher.add(erosion_tile_size);
+		hasher.add(enable_tiled_mesh_ao);
+		hasher.add(USE_PARAMS_HSCALE);
+		std::unique_lock<std::mutex> lock(mutex);
+		params_key = hasher.get();
+	}
+	uint64_t get_key() const { // may be called from worker threads; read once per tile so that read() and write() use the same key
+		std::unique_lock<std::mutex> lock(mutex);
+		return params_key;
+	}
+	bool read(tile_t &tile, uint64_t key) { // may be called from worker threads
+		if (!enabled()) return 0;
+		string fn;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			load_index();
+			fn = get_fn(tile, key);
+			if (entries.find(fn) == entries.end()) {++num_misses; return 0;}
+		}
+		bool const success(tile.read_cache_file(get_path(fn), key));
+		std::unique_lock<std::mutex> lock(mutex);
+		auto it(entries.find(fn));
+
+		if (success) {
+			++num_hits;
+			if (it != entries.end()) {it->second.last_used = ++use_counter; index_dirty = 1;}
+			return 1;
+		}
+		++num_misses; // missing, corrupt, or out of date; will be rewritten
+		if (it != entries.end()) {remove_entry(it);}
+		return 0;
+	}
+	void write(tile_t const &tile, uint64_t key) { // may be called from worker threads
+		if (!enabled()) return;
+		string const fn(get_fn(tile, key));
+		if (!tile.write_cache_file(get_path(fn), key)) {remove(get_path(fn).c_str()); return;} // failure is nonfatal, but don't leave a partial file
+		FILE *fp(fopen(get_path(fn).c_str(), "rb"));
+		if (fp == nullptr) return;
+		fseek(fp, 0, SEEK_END);
+		unsigned const size((unsigned)ftell(fp));
+		fclose(fp);
+		std::unique_lock<std::mutex> lock(mutex);
+		load_index();
+		auto it(entries.find(fn));
+		if (it != entries.end()) {total_size -= it->second.size;} // replacing an old file
+		entry_t const entry(++use_counter, size);
+		entries[fn] = entry;
+		total_size += size;
+		++num_writes;
+		append_to_index(fn, entry);
+		evict_to_size_limit();
+	}
+	void flush() { // writes updated LRU times to the index, and compacts it
+		std::unique_lock<std::mutex> lock(mutex);
+		if (index_dirty) {write_index();}
+	}
+	void print_stats() const {
+		std::unique_lock<std::mutex> lock(mutex);
+		unsigned const num_lookups(num_hits + num_misses);
+		if (num_lookups == 0) return;
+		cout << "tile cache: " << num_hits << " hits, " << num_misses << " misses (" << (100*num_hits)/num_lookups << "% hit rate), " << num_writes << " writes, "
+			 << num_evicted << " evicted, " << entries.size() << " files, " << (total_size >> 20) << " of " << tile_cache_max_mb << " MB" << endl;
+	}
+};
+
+tile_cache_t tile_cache;
+
+
+void tile_t::create_zvals_and_ao(mesh_xy_grid_cache_t &height_gen, bool calc_weights) { // CPU only, no GL calls; called from tile_gen_queue_t worker threads
+
+	// the key can be updated by the main thread while this tile is generated, so read it once; the tile is generated from the state it describes
+	uint64_t const cache_key(tile_cache.get_key());
+
+	if (!tile_cache.read(*this, cache_key)) { // zvals and AO were not loaded from the on-disk cache
+		create_zvals(height_gen, 0);
+		if (enable_tiled_mesh_ao) {calc_mesh_ao_lighting();} // AO context is independent of adjacent tiles, so it can be computed before they exist
+		tile_cache.write(*this, cache_key);
+	}
+	if (calc_weights) {calc_mesh_weights(height_gen, 1);} // the weight texture itself is created in pre_draw()
+}
+
 
 void tile_t::calc_shadows_for_light(unsigned l) {
 
@@ -1006,148 +1278,160 @@ void get_texture_ixs(int &sand_tex_ix, int &dirt_tex_ix, int &grass_tex_ix, int
 }
 
 
-void tile_t::create_texture(mesh_xy_grid_cache_t &height_gen) {
+void tile_t::calc_mesh_weights(mesh_xy_grid_cache_t &height_gen, bool in_worker) { // no GL calls; may be called from tile_gen_queue_t worker threads
 
-	//timer_t timer("Create Tile Weights Texture");
+	//timer_t timer("Calc Tile Mesh Weights");
 	assert(zvals.size() == zvsize*zvsize);
 	unsigned const tsize(stride), num_texels(tsize*tsize);
 	int sand_tex_ix(-1), dirt_tex_ix(-1), grass_tex_ix(-1), rock_tex_ix(-1), snow_tex_ix(-1);
 	get_texture_ixs(sand_tex_ix, dirt_tex_ix, grass_tex_ix, rock_tex_ix, snow_tex_ix);
-
-	if (weight_tid == 0) { // create weights
-		has_any_grass = has_tunnel = 0;
-		grass_blocks.clear();
-		mesh_weight_data.resize(4*num_texels); // RGBA
-		unsigned const grass_block_dim(get_grass_block_dim());
-		float const xy_mult(1.0/float(size)), water_level(get_water_z_height());
-		float const MESH_NOISE_SCALE = 0.003;
-		float const MESH_NOISE_FREQ  = 80.0;
-		float const dz_inv(1.0f/(zmax - zmin));
-		float const noise_scale(((mesh_gen_shape == 2) ? 2.0 : 1.0)*MESH_NOISE_SCALE*mesh_scale_z); // add more noise for ridged
-		float const steep_mult_grass(1.0f/(sthresh[0][1] - sthresh[0][0]));
-		float const steep_mult_snow (1.0f/(sthresh[1][1] - sthresh[1][0]));
-		float const steep_mult_rock (1.0f/(0.8f*sthresh[0][0] - 0.5f*sthresh[0][0]));
-		float const vnz_scale((mesh_gen_mode == MGEN_DWARP_GPU) ? SQRT2 : 1.0); // allow for steeper slopes when domain warping is used
-		int const llc_x(x1 - xoff2), llc_y(y1 - yoff2);
-		point const query_pos(get_xval(tsize/2 + llc_x), get_yval(tsize/2 + llc_y), 0.0);
-		bool const check_mesh_mask(check_mesh_disable(query_pos, radius)), check_buildings(no_grass_under_buildings());
-		int k1, k2, k3, k4;
-		height_gen.build_arrays(MESH_NOISE_FREQ*get_xval(x1), MESH_NOISE_FREQ*get_yval(y1), MESH_NOISE_FREQ*deltax,
-			MESH_NOISE_FREQ*deltay, tsize, tsize, 0, 1); // force_sine_mode=1
-		vector<float> rand_vals(tsize*tsize);
-		//bool const same_dirt(params[0][1].dirt == params[0][0].dirt && params[1][0].dirt == params[0][0].dirt && params[1][1].dirt == params[0][0].dirt);
-		vector<cube_t> exclude_cubes, allow_cubes;
-		get_city_sphere_coll_cubes(query_pos, radius, 1, 1, exclude_cubes, &allow_cubes);
-		has_tunnel |= tile_contains_tunnel(get_mesh_bcube());
-
-#pragma omp parallel for schedule(static,1) num_threads(2)
-		for (int y = 0; y < (int)tsize-DEBUG_TILE_BOUNDS; ++y) {
-			for (unsigned x = 0; x < tsize-DEBUG_TILE_BOUNDS; ++x) {
-				rand_vals[y*tsize + x] = noise_scale*height_gen.eval_index(x, y, 50);
-			}
+	has_any_grass = has_tunnel = 0;
+	grass_blocks.clear();
+	mesh_weight_data.resize(4*num_texels); // RGBA
+	unsigned const grass_block_dim(get_grass_block_dim());
+	float const xy_mult(1.0/float(size)), water_level(get_water_z_height());
+	float const MESH_NOISE_SCALE = 0.003;
+	float const MESH_NOISE_FREQ  = 80.0;
+	float const dz_inv(1.0f/(zmax - zmin));
+	float const noise_scale(((mesh_gen_shape == 2) ? 2.0 : 1.0)*MESH_NOISE_SCALE*mesh_scale_z); // add more noise for ridged
+	float const steep_mult_grass(1.0f/(sthresh[0][1] - sthresh[0][0]));
+	float const steep_mult_snow (1.0f/(sthresh[1][1] - sthresh[1][0]));
+	float const steep_mult_rock (1.0f/(0.8f*sthresh[0][0] - 0.5f*sthresh[0][0]));
+	float const vnz_scale((mesh_gen_mode == MGEN_DWARP_GPU) ? SQRT2 : 1.0); // allow for steeper slopes when domain warping is used
+	int const llc_x(x1 - xoff2), llc_y(y1 - yoff2);
+	point const query_pos(get_xval(tsize/2 + llc_x), get_yval(tsize/2 + llc_y), 0.0);
+	bool const check_mesh_mask(check_mesh_disable(query_pos, radius)), check_buildings(no_grass_under_buildings());
+	int k1, k2, k3, k4;
+	height_gen.build_arrays(MESH_NOISE_FREQ*get_xval(x1), MESH_NOISE_FREQ*get_yval(y1), MESH_NOISE_FREQ*deltax,
+		MESH_NOISE_FREQ*deltay, tsize, tsize, 0, 1); // force_sine_mode=1
+	vector<float> rand_vals(tsize*tsize);
+	//bool const same_dirt(params[0][1].dirt == params[0][0].dirt && params[1][0].dirt == params[0][0].dirt && params[1][1].dirt == params[0][0].dirt);
+	vector<cube_t> exclude_cubes, allow_cubes;
+	get_city_sphere_coll_cubes(query_pos, radius, 1, 1, exclude_cubes, &allow_cubes);
+	has_tunnel |= tile_contains_tunnel(get_mesh_bcube());
+
+#pragma omp parallel for schedule(static,1) num_threads(2) if (!in_worker)
+	for (int y = 0; y < (int)tsize-DEBUG_TILE_BOUNDS; ++y) {
+		for (unsigned x = 0; x < tsize-DEBUG_TILE_BOUNDS; ++x) {
+			rand_vals[y*tsize + x] = noise_scale*height_gen.eval_index(x, y, 50);
 		}
-		for (unsigned y = 0; y < tsize-DEBUG_TILE_BOUNDS; ++y) { // not threadsafe
-			float const yv(float(y)*xy_mult);
+	}
+	for (unsigned y = 0; y < tsize-DEBUG_TILE_BOUNDS; ++y) { // not threadsafe
+		float const yv(float(y)*xy_mult);
 
-			for (unsigned x = 0; x < tsize-DEBUG_TILE_BOUNDS; ++x) {
-				unsigned const ix_val(y*tsize + x), off(4*ix_val);
+		for (unsigned x = 0; x < tsize-DEBUG_TILE_BOUNDS; ++x) {
+			unsigned const ix_val(y*tsize + x), off(4*ix_val);
 
-				if (check_mesh_mask && check_mesh_disable(point(get_xval(x + llc_x)+0.5*DX_VAL, get_yval(y + llc_y)+0.5*DY_VAL, 0.0), HALF_DXY)) {
-					mesh_weight_data[off+0] = mesh_weight_data[off+1] = 255; // set invalid values to flag as transparent
-					mesh_weight_data[off+2] = mesh_weight_data[off+3] = 0;   // make sure grass is disabled
-					has_tunnel = 1; // Note: should be covered by the tile_contains_tunnel(), but we include this case for safety
-					continue;
-				}
-				float weights[NTEX_DIRT] = {0};
-				unsigned const ix(y*zvsize + x);
-				float const mh00(zvals[ix]), mh01(zvals[ix+1]), mh10(zvals[ix+zvsize]), mh11(zvals[ix+zvsize+1]);
-				float const mhmin(min(min(mh00, mh01), min(mh10, mh11))), mhmax(max(max(mh00, mh01), max(mh10, mh11)));
-				float const rand_offset(rand_vals[y*tsize + x]);
-				float const relh1(relh_adj_tex + (mhmin - zmin)*dz_inv + rand_offset);
-				float const relh2(relh_adj_tex + (mhmax - zmin)*dz_inv + rand_offset);
-				get_tids(relh1, k1, k2);
-				get_tids(relh2, k3, k4);
-				bool const same_tid(k1 == k4);
-				float t(0.0);
-				k2 = k4;
-			
-				if (!same_tid) {
-					float const relh(relh_adj_tex + (mh00 - zmin)*dz_inv);
-					get_tids(relh, k1, k2, &t);
-				}
-				float weight_scale(1.0);
-				bool const grass(lttex_dirt[k1].id == GROUND_TEX || lttex_dirt[k2].id == GROUND_TEX), snow(lttex_dirt[k2].id == SNOW_TEX);
-				has_any_grass |= grass;
-
-				if (grass || snow) {
-					float const *const sti(sthresh[snow]);
-					vector3d const normal(get_norm_not_normalized(ix));
-					float vnz(vnz_scale*normal.z/normal.mag());
-					// add random noise here as well to produce dry patches of dirt and sand in the grass
-					if (grass && vnz > sti[1]) {vnz = CLIP_TO_01(1.0f + 20.0f*rand_offset);}
-
-					if (vnz < sti[1]) { // handle steep slopes (dirt/rock texture replaces grass texture)
-						if (grass) { // ground/grass
-							float rock_weight((lttex_dirt[k1].id == GROUND_TEX || lttex_dirt[k2].id == ROCK_TEX) ? t : 0.0);
-							float const steepness(1.0 - CLIP_TO_01((vnz - 0.5f*sti[0])*steep_mult_rock));
-							rock_weight  = rock_weight*(1.0 - steepness) + steepness;
-							weight_scale = CLIP_TO_01((vnz - sti[0])*steep_mult_grass);
-							weights[rock_tex_ix] += (1.0 - weight_scale)*rock_weight;
-							weights[dirt_tex_ix] += (1.0 - weight_scale)*(1.0 - rock_weight);
-						}
-						else { // snow
-							weight_scale = CLIP_TO_01(2.0f*(vnz - sti[0])*steep_mult_snow);
-							weights[rock_tex_ix] += 1.0 - weight_scale;
-						}
+			if (check_mesh_mask && check_mesh_disable(point(get_xval(x + llc_x)+0.5*DX_VAL, get_yval(y + llc_y)+0.5*DY_VAL, 0.0), HALF_DXY)) {
+				mesh_weight_data[off+0] = mesh_weight_data[off+1] = 255; // set invalid values to flag as transparent
+				mesh_weight_data[off+2] = mesh_weight_data[off+3] = 0;   // make sure grass is disabled
+				has_tunnel = 1; // Note: should be covered by the tile_contains_tunnel(), but we include this case for safety
+				continue;
+			}
+			float weights[NTEX_DIRT] = {0};
+			unsigned const ix(y*zvsize + x);
+			float const mh00(zvals[ix]), mh01(zvals[ix+1]), mh10(zvals[ix+zvsize]), mh11(zvals[ix+zvsize+1]);
+			float const mhmin(min(min(mh00, mh01), min(mh10, mh11))), mhmax(max(max(mh00, mh01), max(mh10, mh11)));
+			float const rand_offset(rand_vals[y*tsize + x]);
+			float const relh1(relh_adj_tex + (mhmin - zmin)*dz_inv + rand_offset);
+			float const relh2(relh_adj_tex + (mhmax - zmin)*dz_inv + rand_offset);
+			get_tids(relh1, k1, k2);
+			get_tids(relh2, k3, k4);
+			bool const same_tid(k1 == k4);
+			float t(0.0);
+			k2 = k4;
+		
+			if (!same_tid) {
+				float const relh(relh_adj_tex + (mh00 - zmin)*dz_inv);
+				get_tids(relh, k1, k2, &t);
+			}
+			float weight_scale(1.0);
+			bool const grass(lttex_dirt[k1].id == GROUND_TEX || lttex_dirt[k2].id == GROUND_TEX), snow(lttex_dirt[k2].id == SNOW_TEX);
+			has_any_grass |= grass;
+
+			if (grass || snow) {
+				float const *const sti(sthresh[snow]);
+				vector3d const normal(get_norm_not_normalized(ix));
+				float vnz(vnz_scale*normal.z/normal.mag());
+				// add random noise here as well to produce dry patches of dirt and sand in the grass
+				if (grass && vnz > sti[1]) {vnz = CLIP_TO_01(1.0f + 20.0f*rand_offset);}
+
+				if (vnz < sti[1]) { // handle steep slopes (dirt/rock texture replaces grass texture)
+					if (grass) { // ground/grass
+						float rock_weight((lttex_dirt[k1].id == GROUND_TEX || lttex_dirt[k2].id == ROCK_TEX) ? t : 0.0);
+						float const steepness(1.0 - CLIP_TO_01((vnz - 0.5f*sti[0])*steep_mult_rock));
+						rock_weight  = rock_weight*(1.0 - steepness) + steepness;
+						weight_scale = CLIP_TO_01((vnz - sti[0])*steep_mult_grass);
+						weights[rock_tex_ix] += (1.0 - weight_scale)*rock_weight;
+						weights[dirt_tex_ix] += (1.0 - weight_scale)*(1.0 - rock_weight);
+					}
+					else { // snow
+						weight_scale = CLIP_TO_01(2.0f*(vnz - sti[0])*steep_mult_snow);
+						weights[rock_tex_ix] += 1.0 - weight_scale;
 					}
 				}
-				weights[k2] += weight_scale*t;
-				weights[k1] += weight_scale*(1.0 - t);
-				float const xv(float(x)*xy_mult);
+			}
+			weights[k2] += weight_scale*t;
+			weights[k1] += weight_scale*(1.0 - t);
+			float const xv(float(x)*xy_mult);
 
-				// convert dirt to sand only when there is vegetation; even though it doesn't make sense to have dirt when there's no vegetation, it adds more texture variety
-				if (vegetation > 0.0) {
-					float const dirt_scale(BILINEAR_INTERP(params, dirt, xv, yv)); // slow
+			// convert dirt to sand only when there is vegetation; even though it doesn't make sense to have dirt when there's no vegetation, it adds more texture variety
+			if (vegetation > 0.0) {
+				float const dirt_scale(BILINEAR_INTERP(params, dirt, xv, yv)); // slow
 
-					if (dirt_scale < 1.0) { // apply dirt scale: convert dirt to sand
-						weights[sand_tex_ix] += (1.0 - dirt_scale)*weights[dirt_tex_ix];
-						weights[dirt_tex_ix] *= dirt_scale;
-					}
+				if (dirt_scale < 1.0) { // apply dirt scale: convert dirt to sand
+					weights[sand_tex_ix] += (1.0 - dirt_scale)*weights[dirt_tex_ix];
+					weights[dirt_tex_ix] *= dirt_scale;
 				}
-				if (grass) {
-					float grass_scale((mhmin < water_level) ? 0.0f : BILINEAR_INTERP(params, grass, xv, yv)); // no grass under water
-					bool replace_grass_with_dirt(0);
+			}
+			if (grass) {
+				float grass_scale((mhmin < water_level) ? 0.0f : BILINEAR_INTERP(params, grass, xv, yv)); // no grass under water
+				bool replace_grass_with_dirt(0);
 
-					if (grass_scale > 0.0 && !exclude_cubes.empty()) { // exclude bridges and tunnels here
-						point const test_pt(get_xval(x + llc_x + xoff)+0.5*DX_VAL, get_yval(y + llc_y + yoff)+0.5*DY_VAL, 0.0);
-						replace_grass_with_dirt = (check_bcubes_sphere_coll(exclude_cubes, test_pt, HALF_DXY, 1) && !check_bcubes_sphere_coll(allow_cubes, test_pt, HALF_DXY, 1));
-					}
-					if (!replace_grass_with_dirt && check_buildings && grass_scale > 0.0 && mh01 == mh00 && mh10 == mh00 && mh11 == mh00) { // look for area flattened under a building
-						point const test_pt(get_xval(x + llc_x + xoff)+0.5*DX_VAL, get_yval(y + llc_y + yoff)+0.5*DY_VAL, mh00);
-						replace_grass_with_dirt = check_buildings_no_grass(test_pt); // xy_only 1.61 => 1.76
-					}
-					if (replace_grass_with_dirt) {
-						weights[dirt_tex_ix] += weights[grass_tex_ix]; // replace grass with dirt
-						weights[grass_tex_ix] = 0.0;
-						grass_scale = 0.0;
-					}
-					else if (grass_scale < 1.0) { // apply grass scale: convert grass to sand
-						float const gscale(CLIP_TO_01(2.5f*(grass_scale - 0.5f) + 0.5f));
-						weights[sand_tex_ix ] += (1.0 - gscale)*weights[grass_tex_ix];
-						weights[grass_tex_ix] *= gscale;
-					}
-					if (grass_scale > 0.0) {add_grass_block_at(x, y, mhmin, mhmax, grass_block_dim);}
-				} // end grass
-				for (unsigned i = 0; i < NTEX_DIRT-1; ++i) { // Note: weights should sum to 1.0, so we can calculate w4 as 1.0-w0-w1-w2-w3
-					mesh_weight_data[off+i] = ((weights[i] <= 0.01) ? 0 : ((weights[i] >= 0.99) ? 255 : (unsigned char)(255.0*weights[i])));
+				if (grass_scale > 0.0 && !exclude_cubes.empty()) { // exclude bridges and tunnels here
+					point const test_pt(get_xval(x + llc_x + xoff)+0.5*DX_VAL, get_yval(y + llc_y + yoff)+0.5*DY_VAL, 0.0);
+					replace_grass_with_dirt = (check_bcubes_sphere_coll(exclude_cubes, test_pt, HALF_DXY, 1) && !check_bcubes_sphere_coll(allow_cubes, test_pt, HALF_DXY, 1));
 				}
-			} // for x
-		} // for y
+				if (!replace_grass_with_dirt && check_buildings && grass_scale > 0.0 && mh01 == mh00 && mh10 == mh00 && mh11 == mh00) { // look for area flattened under a building
+					point const test_pt(get_xval(x + llc_x + xoff)+0.5*DX_VAL, get_yval(y + llc_y + yoff)+0.5*DY_VAL, mh00);
+					replace_grass_with_dirt = check_buildings_no_grass(test_pt); // xy_only 1.61 => 1.76
+				}
+				if (replace_grass_with_dirt) {
+					weights[dirt_tex_ix] += weights[grass_tex_ix]; // replace grass with dirt
+					weights[grass_tex_ix] = 0.0;
+					grass_scale = 0.0;
+				}
+				else if (grass_scale < 1.0) { // apply grass scale: convert grass to sand
+					float const gscale(CLIP_TO_01(2.5f*(grass_scale - 0.5f) + 0.5f));
+					weights[sand_tex_ix ] += (1.0 - gscale)*weights[grass_tex_ix];
+					weights[grass_tex_ix] *= gscale;
+				}
+				if (grass_scale > 0.0) {add_grass_block_at(x, y, mhmin, mhmax, grass_block_dim);}
+			} // end grass
+			for (unsigned i = 0; i < NTEX_DIRT-1; ++i) { // Note: weights should sum to 1.0, so we can calculate w4 as 1.0-w0-w1-w2-w3
+				mesh_weight_data[off+i] = ((weights[i] <= 0.01) ? 0 : ((weights[i] >= 0.99) ? 255 : (unsigned char)(255.0*weights[i])));
+			}
+		} // for x
+	} // for y
+	mesh_weights_valid = 1;
+}
+
+void tile_t::create_texture(mesh_xy_grid_cache_t &height_gen) {
+
+	//timer_t timer("Create Tile Weights Texture");
+	assert(zvals.size() == zvsize*zvsize);
+	unsigned const tsize(stride), num_texels(tsize*tsize);
+	int sand_tex_ix(-1), dirt_tex_ix(-1), grass_tex_ix(-1), rock_tex_ix(-1), snow_tex_ix(-1);
+	get_texture_ixs(sand_tex_ix, dirt_tex_ix, grass_tex_ix, rock_tex_ix, snow_tex_ix);
+
+	if (weight_tid == 0) { // create weights, unless they were already calculated by a tile_gen_queue_t worker thread
+		if (!mesh_weights_valid) {calc_mesh_weights(height_gen, 0);}
 	}
 	else { // use existing weights
 		assert(recalc_tree_grass_weights); // can only get here in this case
-		assert(mesh_weight_data.size() == 4*num_texels);
 	}
+	assert(mesh_weight_data.size() == 4*num_texels);
+	mesh_weights_valid = 0; // consumed; recalculate the next time the weight texture is freed, since its inputs may have changed
 	weight_data = mesh_weight_data; // deep copy so that tree_map doesn't alter original weights
 
 	if (!tree_map.empty()) {
@@ -1229,13 +1513,13 @@ bool tile_t::update_range(tile_shadow_map_manager &smap_manager) { // if returns
 	update_animals(); // if any were generated
 	float const dist(get_rel_dist_to_camera());
 	
-	if (dist > CLEAR_DIST_TILES || mesh_height_invalid) {
+	if (dist > CLEAR_DIST_TILES) {
 		if (!just_cleared) {clear_vbo_tid(&smap_manager);} // avoid clearing every frame
 		just_cleared = 1;
 	}
 	else {just_cleared = 0;}
 	if (dist*TILE_RADIUS > SMAP_DEL_THRESH*smap_thresh_scale) {clear_shadow_map(&smap_manager);} // too far, delete old shadow maps
-	return (dist < DELETE_DIST_TILES && !mesh_height_invalid);
+	return (dist < DELETE_DIST_TILES);
 }
 
 
@@ -2068,6 +2352,121 @@ void lightning_strike_t::end_draw() const {
 // *** tile_draw_t ***
 
 
+// *** tile_gen_queue_t ***
+
+void tile_gen_queue_t::worker_loop() {
+
+	omp_set_num_threads(1); // tiles are generated in parallel across workers; don't create nested OpenMP teams within each tile
+	mesh_xy_grid_cache_t height_gen; // per-thread; used for CPU mesh gen and weight noise
+
+	while (1) {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (pending.empty() && !kill_threads) {work_cv.wait(lock);}
+		if (kill_threads) return;
+		tile_t *const tile(pending.back().second);
+		pending.pop_back();
+		bool const calc_weights_(calc_weights);
+		++num_running;
+		lock.unlock();
+		tile->create_zvals_and_ao(height_gen, calc_weights_);
+		lock.lock();
+		finished.push_back(tile);
+		--num_running;
+		lock.unlock();
+		done_cv.notify_all();
+	}
+}
+
+void tile_gen_queue_t::start_threads() {
+
+	if (!workers.empty()) return; // already started
+	unsigned const num_threads(max(1, omp_get_max_threads_3dw()-1)); // leave one core for the main thread
+	kill_threads = 0;
+	for (unsigned i = 0; i < num_threads; ++i) {workers.push_back(std::thread(&tile_gen_queue_t::worker_loop, this));}
+}
+
+void tile_gen_queue_t::stop_threads() {
+
+	if (workers.empty()) return; // not started
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		kill_threads = 1;
+	}
+	work_cv.notify_all();
+	for (auto i = workers.begin(); i != workers.end(); ++i) {i->join();} // waits for running jobs to finish
+	workers.clear();
+}
+
+void tile_gen_queue_t::add(tile_t *tile, bool calc_weights_) { // calc_weights_ should only be set when weights don't depend on state modified by the main thread
+
+	assert(tile);
+	bool const did_ins(queued.insert(tile->get_tile_xy_pair()).second);
+	assert(did_ins);
+	start_threads();
+	pair<float, tile_t *> const job(tile->get_draw_priority(), tile);
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		calc_weights = calc_weights_; // applies to all jobs; constant for a given scene
+		pending.insert(upper_bound(pending.begin(), pending.end(), job, [](pair<float, tile_t *> const &a, pair<float, tile_t *> const &b) {return (a.first > b.first);}), job);
+	}
+	work_cv.notify_one();
+}
+
+void tile_gen_queue_t::update_priorities() { // cancels pending tiles that are now too far away and reorders the rest for the current camera
+
+	std::unique_lock<std::mutex> lock(mutex);
+	unsigned pos(0);
+
+	for (auto i = pending.begin(); i != pending.end(); ++i) {
+		tile_t *const tile(i->second);
+
+		if (tile->get_rel_dist_to_camera() >= CREATE_DIST_TILES) { // cancel this job
+			queued.erase(tile->get_tile_xy_pair());
+			delete tile;
+		}
+		else {pending[pos++] = make_pair(tile->get_draw_priority(), tile);}
+	}
+	pending.resize(pos);
+	sort(pending.begin(), pending.end(), [](pair<float, tile_t *> const &a, pair<float, tile_t *> const &b) {return (a.first > b.first);});
+}
+
+void tile_gen_queue_t::get_finished(vector<tile_t *> &tiles) { // returns finished tiles that are still within the create distance
+
+	tiles.clear();
+	if (queued.empty()) return;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		tiles.swap(finished);
+	}
+	unsigned pos(0);
+
+	for (auto i = tiles.begin(); i != tiles.end(); ++i) {
+		queued.erase((*i)->get_tile_xy_pair());
+		if ((*i)->get_rel_dist_to_camera() >= CREATE_DIST_TILES) {(*i)->clear(); delete *i;} // camera moved away while generating
+		else {tiles[pos++] = *i;}
+	}
+	tiles.resize(pos);
+}
+
+void tile_gen_queue_t::wait_for_all() { // used when switching to synchronous tile generation
+	if (queued.empty()) return;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!pending.empty() || num_running > 0) {done_cv.wait(lock);}
+}
+
+void tile_gen_queue_t::clear() { // cancel pending jobs and delete all tiles
+
+	if (queued.empty()) return;
+	std::unique_lock<std::mutex> lock(mutex);
+	for (auto i = pending.begin(); i != pending.end(); ++i) {delete i->second;}
+	pending.clear();
+	wait_for_running(lock);
+	for (auto i = finished.begin(); i != finished.end(); ++i) {(*i)->clear(); delete *i;}
+	finished.clear();
+	queued.clear();
+}
+
+
 tile_draw_t::tile_draw_t() : buildings_valid(0), tiles_gen_prev_frame(0), terrain_zmin(0.0), lod_renderer(USE_TREE_BILLBOARDS) {
 	assert(MESH_X_SIZE == MESH_Y_SIZE && X_SCENE_SIZE == Y_SCENE_SIZE);
 }
@@ -2075,6 +2474,9 @@ tile_draw_t::tile_draw_t() : buildings_valid(0), tiles_gen_prev_frame(0), terrai
 void tile_draw_t::clear(bool no_regen_buildings) {
 
 	clear_vbos_tids(); // needed to clear vbo, ivbo, and free list
+	gen_queue.clear();
+	tile_cache.flush();
+	tile_cache.print_stats();
 	for (tile_map::iterator i = tiles.begin(); i != tiles.end(); ++i) {i->second->clear();} // may not be necessary
 	to_draw.clear();
 	tiles.clear();
@@ -2091,14 +2493,7 @@ void tile_draw_t::free_compute_shader() {
 	for (auto i = height_gens.begin(); i != height_gens.end(); ++i) {i->clear_context();}
 }
 
-float tile_draw_t::update(float &min_camera_dist) { // view-independent updates; returns terrain zmin
-
-	//timer_t timer("TT Update");
-	unsigned const max_tile_gen_per_frame = 16; // higher = less overall gen time (more parallel), but longer wait for first render
-	unsigned const max_cpu_tiles          = 3; // 0 = GPU only
-	unsigned const max_defer_tiles        = 8; // 0 = disable
-	if (height_gens.empty()) {height_gens.resize(max(max_defer_tiles, 1U));}
-
+void tile_draw_t::init_heightmap_and_buildings() { // CPU only, no GL calls
 	if (terrain_hmap_manager.maybe_load(mh_filename_tt, (invert_mh_image != 0))) {
 		read_default_hmap_modmap();
 		force_onto_surface_mesh(surface_pos); // move camera onto newly loaded terrain so that the first drawn frame is correct
@@ -2108,6 +2503,16 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 		gen_city_details(); // after building generation
 		buildings_valid = 1;
 	}
+}
+
+float tile_draw_t::update(float &min_camera_dist) { // view-independent updates; returns terrain zmin
+
+	//timer_t timer("TT Update");
+	unsigned const max_tile_gen_per_frame = 16; // higher = less overall gen time (more parallel), but longer wait for first render
+	unsigned const max_cpu_tiles          = 3; // 0 = GPU only
+	unsigned const max_defer_tiles        = 8; // 0 = disable
+	if (height_gens.empty()) {height_gens.resize(max(max_defer_tiles, 1U));}
+	init_heightmap_and_buildings();
 	auto_calc_model_zvals(); // must be done after heightmap loading but before any tiles are created
 	to_draw.clear();
 	terrain_zmin = FAR_DISTANCE;
@@ -2120,6 +2525,11 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 	int const x2( tile_radius + toffx), y2( tile_radius + toffy);
 	unsigned const init_tiles((unsigned)tiles.size());
 	bool const create_buildings_first(FLATTEN_BUILDING_TILE && using_tiled_terrain_hmap_tex());
+	bool const gpu_mode(mesh_gen_mode >= MGEN_SIMPLEX_GPU);
+	// background generation is only used for CPU mesh gen modes; GPU modes are already async, and the other cases modify global state during tile generation
+	bool const use_gen_queue(async_tile_gen && !gpu_mode && !enable_terrain_env && !create_buildings_first && inf_terrain_fire_mode == FM_NONE);
+	// weights query cities and buildings, which may be modified by the main thread; in that case they're calculated in pre_draw()
+	bool const gen_queue_weights(!have_cities() && !have_buildings() && !inf_buildings_enabled());
 	unsigned num_erased(0);
 	min_camera_dist = FAR_DISTANCE;
 	// Note: we may want to calculate distant low-res or larger tiles when the camera is high above the mesh
@@ -2135,6 +2545,11 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 		}
 		to_gen_zvals.clear();
 	}
+	if (!use_gen_queue) {gen_queue.wait_for_all();} // finish any background tiles before generating synchronously
+	else {tile_cache.update_key(get_tile_size());}
+	gen_queue.get_finished(gen_finished);
+	for (auto i = gen_finished.begin(); i != gen_finished.end(); ++i) {insert_tile(*i);} // zvals and AO were generated in the background
+
 	for (tile_map::iterator i = tiles.begin(); i != tiles.end(); ) { // update tiles and free old tiles (Note: no ++i)
 		if (!i->second->update_range(smap_manager)) { // delete this tile
 			i->second->clear();
@@ -2146,18 +2561,28 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 		for (int x = x1; x <= x2; ++x ) {
 			tile_xy_pair const txy(x, y);
 			if (tiles.find(txy) != tiles.end()) continue; // already exists
+			if (gen_queue.contains(txy)) continue; // already being generated
 			tile_t tile(get_tile_size(), x, y);
 			if (tile.get_rel_dist_to_camera() >= CREATE_DIST_TILES) continue; // too far away to create
 			tile_t *new_tile(new tile_t(tile));
+			if (use_gen_queue) {gen_queue.add(new_tile, gen_queue_weights); continue;}
 			to_gen_zvals.push_back(make_pair(new_tile->get_draw_priority(), new_tile));
 			// in this mode, we need to place buildings and flatten the heightmap before calculating tile heights
 			if (create_buildings_first) {create_buildings_tile(x, y, 1);}
 		} // for x
 	} // for y
+	if (use_gen_queue) {
+		gen_queue.update_priorities();
+
+		if (init_tiles == 0) { // first frame or after a clear: block so that the camera has terrain to stand on
+			gen_queue.wait_for_all();
+			gen_queue.get_finished(gen_finished);
+			for (auto i = gen_finished.begin(); i != gen_finished.end(); ++i) {insert_tile(*i);}
+		}
+	}
 	//if (to_gen_zvals.size() < max_cpu_tiles) {to_gen_zvals.clear();} // block until at least max_cpu_tiles tiles to generate (lower average gen time, but causes more slow frames/lag)
 	unsigned const num_to_gen(to_gen_zvals.size());
 	unsigned gen_this_frame(min(num_to_gen, max_tile_gen_per_frame));
-	bool const gpu_mode(mesh_gen_mode >= MGEN_SIMPLEX_GPU);
 	
 	// to balance tile gen time across frames, generate a number of tiles equal to the average of this frame and the previous frame
 	if (gen_this_frame > 1 && gen_this_frame < max_tile_gen_per_frame && inf_terrain_fire_mode == FM_NONE) { // disable this mode when editing mesh height to prevent visual artifacts
@@ -2179,9 +2604,9 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 		to_gen_zvals.resize(tgz_pos);
 	}
 	else {
-		// if there are fewer than 4 tiles to generate, use CPU simplex rather than GPU simplex to avoid stalling/flusing the graphics pipeline
-		int const prev_mesh_gen_mode(mesh_gen_mode);
-		if (gpu_mode && gen_this_frame <= max_cpu_tiles) {mesh_gen_mode = MGEN_SIMPLEX;} // GPU simplex => CPU simplex
+		// if there are fewer than 4 tiles to generate, use CPU simplex rather than GPU simplex to avoid stalling/flusing the graphics pipeline;
+		// the CPU version uses the same noise function and domain warping, so tiles match those generated on the GPU
+		if (gpu_mode && gen_this_frame <= max_cpu_tiles) {force_cpu_mesh_gen = 1;} // GPU simplex => CPU simplex
 		if (gen_this_frame < num_to_gen) {sort(to_gen_zvals.begin(), to_gen_zvals.end());} // sort by priority if not all generated
 		//ostringstream oss; oss << "Gen " << gen_this_frame << " tiles"; timer_t timer(oss.str());
 
@@ -2192,7 +2617,7 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 			insert_tile(tile);
 		}
 		to_gen_zvals.clear();
-		mesh_gen_mode = prev_mesh_gen_mode;
+		force_cpu_mesh_gen = 0;
 	}
 	for (tile_map::iterator i = tiles.begin(); i != tiles.end(); ++i) { // calculate terrain_zmin and updated building tiles
 		float const rel_dist(i->second->get_rel_dist_to_camera());
@@ -2655,6 +3080,7 @@ void tile_draw_t::draw(int reflection_pass) { // reflection_pass: 0=none, 1=wate
 			 << ", tree GPU MB: " << in_mb((unsigned long long)dtree_mem + ptree_mem) << ", grass MB: " << in_mb(grass_mem)
 			 << ", smap MB: " << in_mb(smap_mem) << ", smap free list MB: " << in_mb(smap_free_list_mem) << ", frame buf MB: " << in_mb(frame_buf_mem)
 			 << ", texture MB: " << in_mb(texture_mem) << ", building MB: " << in_mb(building_mem) << ", model MB: " << in_mb(models_mem) << endl;
+		tile_cache.print_stats();
 	}
 	if (pine_trees_enabled ()) {draw_pine_trees (reflection_pass);}
 	if (decid_trees_enabled()) {draw_decid_trees(reflection_pass);}
@@ -3342,6 +3768,7 @@ bool tile_smap_data_t::needs_update(point const &lpos) {
 
 tile_t *get_tile_from_xy  (tile_xy_pair const &tp) {return terrain_tile_draw.get_tile_from_xy(tp);}
 float update_tiled_terrain(float &min_camera_dist) {return terrain_tile_draw.update(min_camera_dist);}
+void init_tt_heightmap_and_buildings() {terrain_tile_draw.init_heightmap_and_buildings();}
 void pre_draw_tiled_terrain() {terrain_tile_draw.pre_draw();}
 
 
@@ -3716,6 +4143,7 @@ void inf_terrain_fire_weapon() {
 	float const delta_mag(cur_brush_param.get_delta_mag()*((inf_terrain_fire_mode == FM_INC_MESH) ? 1.0 : -1.0));
 	tex_mod_map_manager_t::hmap_val_t const base_delta(terrain_hmap_manager.scale_delta(delta_mag));
 	tex_mod_map_manager_t::hmap_brush_t const brush(xpos, ypos, base_delta, bradius, shape);
+	terrain_tile_draw.cancel_background_tiles(); // tiles in flight were generated from the old heightmap
 	terrain_hmap_manager.apply_brush(brush, tile, 1); // cache
 	//PRINT_TIME("Hmap Brush");
 }
@@ -3730,6 +4158,7 @@ void inf_terrain_undo_hmap_mod() {
 	if (brush.is_flatten_brush()) return; // can't undo this brush since it's lossy
 	// FIXME: won't work if clamping to min/max height occurred when applying the brush the first time
 	brush.delta = -brush.delta; // invert
+	terrain_tile_draw.cancel_background_tiles();
 	terrain_hmap_manager.apply_brush(brush, get_tile_for_xy(brush.x, brush.y), 0); // don't cache
 }
 
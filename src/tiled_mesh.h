@@ -13,6 +13,9 @@
 #include "tree_3dw.h"
 #include "shadow_map.h"
 #include "animals.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 
 bool const ENABLE_TREE_LOD    = 1; // faster but has popping artifacts
@@ -166,7 +169,7 @@ private:
 	unsigned weight_tid, height_tid, normal_tid, shadow_tid;
 	unsigned size, stride, zvsize, base_tsize, gen_tsize, smap_lod_level;
 	float radius, mzmin, mzmax, mesh_dz, ptzmax, dtzmax, trmax, xstart, ystart, min_normal_z, deltax, deltay;
-	bool sun_shadows_invalid, moon_shadows_invalid, recalc_tree_grass_weights, mesh_height_invalid, in_queue, last_occluded, has_any_grass;
+	bool sun_shadows_invalid, moon_shadows_invalid, recalc_tree_grass_weights, in_queue, last_occluded, has_any_grass, mesh_weights_valid;
 	bool is_distant, no_trees, just_cleared, has_tunnel;
 	colorRGB avg_mesh_tex_color;
 	tile_offset_t mesh_off, ptree_off, dtree_off, scenery_off;
@@ -222,7 +225,6 @@ public:
 	bool has_pine_trees() const {return (pine_trees_generated() && !pine_trees.empty());}
 	bool has_valid_shadow_map() const {return !smap_data.empty();}
 	bool has_grass() const {return !grass_blocks.empty();}
-	void invalidate_mesh_height() {mesh_height_invalid = 1;}
 	float get_avg_veg() const {return 0.25f*(params[0][0].veg + params[0][1].veg + params[1][0].veg + params[1][1].veg);}
 	void set_last_occluded(bool val) {last_occluded = val; last_occluded_frame = frame_counter;}
 	bool was_last_occluded  () const {return (last_occluded_frame == frame_counter &&  last_occluded);}
@@ -263,7 +265,6 @@ public:
 		float const xv1(get_xval(x1)), yv1(get_yval(y1));
 		return cube_t(xv1, xv1+(x2-x1)*deltax, yv1, yv1+(y2-y1)*deltay, mzmin, mzmax);
 	}
-	void fill_adj_mask(bool mask[3][3], int x, int y) const;
 	float get_min_dist_to_pt(point const &pt, bool xy_only=0, bool mesh_only=1) const;
 	float get_max_xy_dist_to_pt(point const &pt) const;
 	bool contains_point(point const &pos) const {return get_bcube().contains_pt_xy(pos);}
@@ -277,11 +278,16 @@ public:
 	}
 	void clear();
 	void clear_flowers() {flowers.clear();}
+	void clear_trees_and_scenery();
 	void clear_shadows(bool clear_sun=1, bool clear_moon=1, bool no_clear_adj=0);
 	void clear_shadow_map(tile_shadow_map_manager *smap_manager);
 	void clear_vbo_tid(tile_shadow_map_manager *smap_manager);
 	void clear_pine_tree_vbos() {pine_trees.clear_vbos();}
 	bool create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait);
+	void create_zvals_and_ao(mesh_xy_grid_cache_t &height_gen, bool calc_weights);
+	void calc_zval_bounds();
+	bool write_cache_file(string const &fn, uint64_t key) const;
+	bool read_cache_file(string const &fn, uint64_t key);
 	void get_z_minmax_for_area(point const &pos, float radius, float &zmin, float &zmax) const;
 	float get_zval_at(float x, float y, bool in_global_space) const;
 
@@ -292,7 +298,9 @@ public:
 	vector3d get_mesh_xlate() const {return mesh_off.get_xlate() + vector3d(xstart, ystart, 0.0);}
 
 	// *** shadows ***
-	void calc_mesh_ao_lighting();
+	void calc_mesh_ao_lighting() {calc_mesh_ao_lighting_region(0, 0, stride, stride);}
+	void calc_mesh_ao_lighting_region(unsigned ax1, unsigned ay1, unsigned ax2, unsigned ay2);
+	bool update_mesh_height_region(int gx1, int gy1, int gx2, int gy2);
 	void calc_shadows_for_light(unsigned l);
 	static void proc_tile_queue(tile_t *init_tile, unsigned l);
 	void calc_shadows(bool calc_sun, bool calc_moon, bool no_push=0);
@@ -323,6 +331,7 @@ public:
 	// *** mesh creation ***
 	void ensure_height_tid();
 	unsigned get_grass_block_dim() const {return (1+(size-1)/GRASS_BLOCK_SZ);} // ceil
+	void calc_mesh_weights(mesh_xy_grid_cache_t &height_gen, bool in_worker);
 	void create_texture(mesh_xy_grid_cache_t &height_gen);
 	void add_grass_block_at(unsigned x, unsigned y, float mhmin, float mhmax, unsigned grass_block_dim);
 	void create_or_update_weight_tex();
@@ -407,6 +416,37 @@ public:
 }; // tile_t
 
 
+// generates tile zvals and AO lighting on background threads, closest visible tiles first; the main thread only inserts finished tiles
+class tile_gen_queue_t {
+
+	typedef vector<pair<float, tile_t *> > job_vect_t;
+
+	std::mutex mutex;
+	std::condition_variable work_cv, done_cv;
+	vector<std::thread> workers;
+	job_vect_t pending; // sorted by decreasing priority value so that the next tile to generate is at the back; guarded by mutex
+	vector<tile_t *> finished; // guarded by mutex
+	set<tile_xy_pair> queued; // pending, running, and finished tiles; main thread only
+	unsigned num_running; // guarded by mutex
+	bool kill_threads, calc_weights; // guarded by mutex
+
+	void worker_loop();
+	void start_threads();
+	void wait_for_running(std::unique_lock<std::mutex> &lock) {while (num_running > 0) {done_cv.wait(lock);}}
+public:
+	tile_gen_queue_t() : num_running(0), kill_threads(0), calc_weights(0) {}
+	~tile_gen_queue_t() {stop_threads();}
+	bool contains(tile_xy_pair const &txy) const {return (queued.find(txy) != queued.end());}
+	bool empty() const {return queued.empty();}
+	void add(tile_t *tile, bool calc_weights_);
+	void update_priorities();
+	void get_finished(vector<tile_t *> &tiles);
+	void wait_for_all();
+	void clear();
+	void stop_threads();
+};
+
+
 class tile_draw_t : public indexed_vbo_manager_t {
 
 	typedef map<tile_xy_pair, std::unique_ptr<tile_t> > tile_map;
@@ -422,6 +462,8 @@ class tile_draw_t : public indexed_vbo_manager_t {
 	vector<tile_t *> occluded_tiles;
 	vector<tile_t *> to_draw_trunk_pts;
 	vector<pair<float, tile_t *>> to_gen_zvals;
+	vector<tile_t *> gen_finished; // reused across update calls
+	tile_gen_queue_t gen_queue;
 	cloud_draw_list_t to_draw_clouds;
 	vector<mesh_xy_grid_cache_t> height_gens;
 	lightning_strike_t lightning_strike;
@@ -443,7 +485,9 @@ public:
 	~tile_draw_t() {/*clear();*/}
 	void clear(bool no_regen_buildings);
 	void free_compute_shader();
+	void init_heightmap_and_buildings();
 	float update(float &min_camera_dist);
+	void cancel_background_tiles() {gen_queue.clear();} // must be called before modifying the heightmap
 private:
 	static void setup_terrain_textures(shader_t &s, unsigned start_tu_id);
 	static void add_texture_colors(shader_t &s, unsigned start_tu_id);
@@ -238,6 +238,7 @@ public:
 	void remove_leaf_ix(unsigned i, bool update_data);
 	bool spraypaint_leaves(point const &pos, float radius, colorRGBA const &color, bool check_only);
 	void bend_leaf(unsigned i, float angle);
+	void bend_leaves(unsigned const *ixs, float const *angles, unsigned num);
 	void draw_leaf_quads_from_vbo(unsigned max_leaves) const;
 	void draw_leaves_shadow_only(float size_scale);
 	void ensure_branch_vbo();
@@ -299,6 +300,18 @@ public:
 };
 
 
+struct leaf_wind_scratch_t { // per-thread temporary data for tree::update_leaf_orients_wind()
+	struct wind_cell_t {
+		int x, y;
+		vector3d wind;
+		wind_cell_t(int x_, int y_, vector3d const &wind_) : x(x_), y(y_), wind(wind_) {}
+	};
+	vector<wind_cell_t> cells; // local wind of each mesh cell containing leaves of the current tree
+	vector<unsigned> ixs; // leaves to bend
+	vector<float> angles;
+};
+
+
 class tree {
 
 	tree_data_t priv_tree_data; // by pointer?
@@ -346,7 +359,7 @@ public:
 	void remove_collision_objects();
 	bool check_sphere_coll(point &center, float radius) const;
 	float calc_size_scale(point const &draw_pos) const;
-	void update_leaf_orients_wind();
+	void update_leaf_orients_wind(leaf_wind_scratch_t &scratch);
 	void draw_branches_top(shader_t &s, tree_lod_render_t &lod_renderer, bool shadow_only, bool reflection_pass, vector3d const &xlate, int wsoff_loc);
 	void draw_leaves_top(shader_t &s, tree_lod_render_t &lod_renderer, bool shadow_only, bool reflection_pass, vector3d const &xlate,
 		int wsoff_loc, int tex0_loc, vector<tree *> &to_update_leaves);
@@ -360,6 +373,8 @@ public:
 	point const &get_center() const {return tree_center;}
 	unsigned get_gpu_mem()    const {return (td_is_private() ? tdata().get_gpu_mem() : 0);}
 	unsigned get_num_leaves() const {return tdata().get_leaves().size();}
+	tree_data_t const *get_tdata_ptr() const {return &tdata();} // for identifying trees that share data
+	void set_leaf_orients_valid() {leaf_orients_valid = 1;} // for trees whose shared leaf data was updated by another tree
 	unsigned get_num_branch_cylins() const {return tdata().get_all_cylins().size();}
 	bool get_no_delete()      const {return no_delete;}
 	void set_no_delete(bool no_delete_) {no_delete = no_delete_;}
@@ -397,9 +412,20 @@ class tree_cont_t : public vector<tree> {
 	tree_data_manager_t &shared_tree_data;
 	vector<pair<float, unsigned>> sorted;
 	vector<tree *> to_update_leaves;
+	vector<leaf_wind_scratch_t> leaf_wind_scratch; // one per thread
+
+	struct leaf_wind_stats_t { // for benchmark_leaf_wind, per container
+		unsigned num_calls;
+		uint64_t num_trees, num_leaves;
+		double time_ms;
+		leaf_wind_stats_t() : num_calls(0), num_trees(0), num_leaves(0), time_ms(0.0) {}
+	};
+	leaf_wind_stats_t leaf_wind_stats;
 	cube_t all_bcube;
 	bool generated;
 
+	void update_leaf_orients_wind();
+
 public:
 	tree_cont_t(tree_data_manager_t &tds) : shared_tree_data(tds), generated(0) {all_bcube.set_to_zeros();}
 	bool was_generated() const {return generated;}
@@ -11,6 +11,7 @@
 #include "file_utils.h"
 #include "openal_wrap.h"
 #include "cobj_bsp_tree.h"
+#include "profiler.h"
 #include <glm/gtc/noise.hpp>
 
 
@@ -29,7 +30,8 @@ voxel_model_ground terrain_voxel_model(GROUND_NUM_LOD);
 voxel_brush_params_t voxel_brush_params;
 bool voxel_ppb_enable_falling(0);
 
-extern bool group_back_face_cull, voxel_shadows_updated;
+extern bool group_back_face_cull, voxel_shadows_updated, benchmark_voxel_brush, sparse_voxel_models;
+extern unsigned voxel_quant_bits;
 extern int dynamic_mesh_scroll, rand_gen_index, scrolling, display_mode, display_framerate, voxel_editing, mesh_gen_mode, mesh_freq_filter;
 extern float FAR_CLIP;
 extern double tfticks;
@@ -78,28 +80,21 @@ float noise_texture_manager_t::eval_at(point const &pos) const {
 }
 
 
-template<typename V> void voxel_grid<V>::init_grid(unsigned nx_, unsigned ny_, unsigned nz_, V default_val, unsigned num_blocks) {
+void voxel_grid_geom_t::init_dims(unsigned nx_, unsigned ny_, unsigned nz_, unsigned num_blocks) {
 	nx = nx_; ny = ny_; nz = nz_;
 	xblocks = 1+(nx-1)/num_blocks; // ceil
 	yblocks = 1+(ny-1)/num_blocks; // ceil
-	unsigned const tot_size(nx * ny * nz);
-	assert(tot_size > 0);
-	clear();
-	resize(tot_size, default_val);
+	assert(get_num_voxels() > 0);
 }
 
-template<typename V> void voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsigned nz_, vector3d const &vsz_,
-	point const &center_, V const &default_val, unsigned num_blocks)
-{
-	init_grid(nx_, ny_, nz_, default_val, num_blocks);
+void voxel_grid_geom_t::init_pos(vector3d const &vsz_, point const &center_) {
 	vsz = vsz_;
 	assert(vsz.x > 0.0 && vsz.y > 0.0 && vsz.z > 0.0);
 	center = center_;
 	lo_pos = center - 0.5*vector3d((nx-1)*vsz.x, (ny-1)*vsz.y, (nz-1)*vsz.z);
 }
 
-template<typename V> void voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsigned nz_, cube_t const &bcube, V const &default_val, unsigned num_blocks) {
-	init_grid(nx_, ny_, nz_, default_val, num_blocks);
+void voxel_grid_geom_t::init_pos(cube_t const &bcube) {
 	assert(!bcube.is_zero_area());
 	vector3d const csz(bcube.get_size());
 	center = bcube.get_cube_center();
@@ -107,6 +102,35 @@ template<typename V> void voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsign
 	vsz    = vector3d(csz.x/(nx-1), csz.y/(ny-1), csz.z/(nz-1));
 }
 
+void voxel_grid_geom_t::get_bcube_ix_bounds(cube_t const &bcube, int llc[3], int urc[3]) const {
+
+	get_xyz(bcube.get_llc(), llc);
+	get_xyz(bcube.get_urc(), urc);
+	UNROLL_3X(assert(llc[i_] <= urc[i_]);)
+	int const num[3] = {(int)nx, (int)ny, (int)nz};
+	UNROLL_3X(llc[i_] = max(0, llc[i_]);)
+	UNROLL_3X(urc[i_] = min(num[i_]-1, urc[i_]);)
+}
+
+
+template<typename V> void voxel_grid<V>::init_grid(unsigned nx_, unsigned ny_, unsigned nz_, V default_val, unsigned num_blocks) {
+	init_dims(nx_, ny_, nz_, num_blocks);
+	clear();
+	resize(get_num_voxels(), default_val);
+}
+
+template<typename V> void voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsigned nz_, vector3d const &vsz_,
+	point const &center_, V const &default_val, unsigned num_blocks)
+{
+	init_grid(nx_, ny_, nz_, default_val, num_blocks);
+	init_pos(vsz_, center_);
+}
+
+template<typename V> void voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsigned nz_, cube_t const &bcube, V const &default_val, unsigned num_blocks) {
+	init_grid(nx_, ny_, nz_, default_val, num_blocks);
+	init_pos(bcube);
+}
+
 
 // Note: assumes mesh is centered around 0,0
 template<> void voxel_grid<float>::init_from_heightmap(float **height, unsigned mesh_nx, unsigned mesh_ny,
@@ -171,17 +195,6 @@ template<> void voxel_grid<float>::downsample_2x() { // modify in place, perserv
 template<> void voxel_grid<cube_t>::downsample_2x() {assert(0);} // not supported
 
 
-template<typename V> void voxel_grid<V>::get_bcube_ix_bounds(cube_t const &bcube, int llc[3], int urc[3]) const {
-
-	get_xyz(bcube.get_llc(), llc);
-	get_xyz(bcube.get_urc(), urc);
-	UNROLL_3X(assert(llc[i_] <= urc[i_]);)
-	int const num[3] = {(int)nx, (int)ny, (int)nz};
-	UNROLL_3X(llc[i_] = max(0, llc[i_]);)
-	UNROLL_3X(urc[i_] = min(num[i_]-1, urc[i_]);)
-}
-
-
 // Note: voxel read/write is unused
 template<typename T> bool read_pod(T &v, FILE *fp, char const *const name) {
 	if (fread(&v, sizeof(T), 1, fp) != 1) {
@@ -197,15 +210,51 @@ template<typename T> bool write_pod(T const &v, FILE *fp, char const *const name
 	}
 	return 1;
 }
+template<typename T> bool read_vector(vector<T> &v, FILE *fp, char const *const name) {
+	unsigned sz(0);
+	if (!read_pod(sz, fp, name)) return 0;
+	v.resize(sz);
 
+	if (sz > 0 && fread(&v.front(), sizeof(T), sz, fp) != sz) {
+		cerr << "Error reading " << name << " data" << endl;
+		return 0;
+	}
+	return 1;
+}
+template<typename T> bool write_vector(vector<T> const &v, FILE *fp, char const *const name) {
+	unsigned const sz(v.size());
+	if (!write_pod(sz, fp, name)) return 0;
 
-template<typename V> bool voxel_grid<V>::read(FILE *fp) {
+	if (sz > 0 && fwrite(&v.front(), sizeof(T), sz, fp) != sz) {
+		cerr << "Error writing " << name << " data" << endl;
+		return 0;
+	}
+	return 1;
+}
+
+
+bool voxel_grid_geom_t::read_geom(FILE *fp) {
 
 	assert(fp);
-	unsigned sz(0);
-	if (!read_pod(nx, fp, "voxel nx") || !read_pod(nx, fp, "voxel ny") || !read_pod(nx, fp, "voxel nz")) return 0;
+	if (!read_pod(nx, fp, "voxel nx") || !read_pod(ny, fp, "voxel ny") || !read_pod(nz, fp, "voxel nz")) return 0;
 	if (!read_pod(xblocks, fp, "voxel xblocks") || !read_pod(yblocks, fp, "voxel yblocks")) return 0;
-	if (!read_pod(vsz, fp, "voxel vsz") || !read_pod(center, fp, "voxel center") || !read_pod(lo_pos, fp, "voxel lo_pos")) return 0;
+	return (read_pod(vsz, fp, "voxel vsz") && read_pod(center, fp, "voxel center") && read_pod(lo_pos, fp, "voxel lo_pos"));
+}
+
+
+bool voxel_grid_geom_t::write_geom(FILE *fp) const {
+
+	assert(fp);
+	if (!write_pod(nx, fp, "voxel nx") || !write_pod(ny, fp, "voxel ny") || !write_pod(nz, fp, "voxel nz")) return 0;
+	if (!write_pod(xblocks, fp, "voxel xblocks") || !write_pod(yblocks, fp, "voxel yblocks")) return 0;
+	return (write_pod(vsz, fp, "voxel vsz") && write_pod(center, fp, "voxel center") && write_pod(lo_pos, fp, "voxel lo_pos"));
+}
+
+
+template<typename V> bool voxel_grid<V>::read(FILE *fp) {
+
+	unsigned sz(0);
+	if (!read_geom(fp)) return 0;
 	if (!read_pod(sz, fp, "voxel_grid size")) return 0;
 	
 	if (empty()) {
@@ -225,11 +274,8 @@ template<typename V> bool voxel_grid<V>::read(FILE *fp) {
 
 template<typename V> bool voxel_grid<V>::write(FILE *fp) const {
 
-	assert(fp);
 	unsigned const sz(size());
-	if (!write_pod(nx, fp, "voxel nx") || !write_pod(nx, fp, "voxel ny") || !write_pod(nx, fp, "voxel nz")) return 0;
-	if (!write_pod(xblocks, fp, "voxel xblocks") || !write_pod(yblocks, fp, "voxel yblocks")) return 0;
-	if (!write_pod(vsz, fp, "voxel vsz") || !write_pod(center, fp, "voxel center") || !write_pod(lo_pos, fp, "voxel lo_pos")) return 0;
+	if (!write_geom(fp)) return 0;
 	if (!write_pod(sz, fp, "voxel_grid size")) return 0;
 	
 	if (fwrite(&front(), sizeof(V), size(), fp) != size()) {
@@ -240,6 +286,321 @@ template<typename V> bool voxel_grid<V>::write(FILE *fp) const {
 }
 
 
+template<typename V> void sparse_voxel_grid<V>::clear() {
+
+	vector<brick_t>().swap(bricks); // free the memory
+	vector<V>().swap(data);
+	vector<unsigned char>().swap(qdata);
+	vector<unsigned>().swap(free_data);
+	clear_edits();
+	nbx = nby = nbz = quant_bits = 0;
+	qmin = 0.0; qscale = 1.0;
+}
+
+
+template<typename V> V sparse_voxel_grid<V>::load_val(unsigned pos) const {
+
+	if (quant_bits == 0) {return data[pos];}
+	unsigned const nbytes(quant_bits >> 3);
+	unsigned char const *const q(&qdata[pos*nbytes]);
+	unsigned const code((nbytes == 1) ? q[0] : (q[0] | (unsigned(q[1]) << 8)));
+	return V(code/qscale + qmin);
+}
+
+
+template<typename V> void sparse_voxel_grid<V>::store_val(unsigned pos, V const &val) {
+
+	if (quant_bits == 0) {data[pos] = val; return;}
+	unsigned const nbytes(quant_bits >> 3);
+	float const max_code((1U << quant_bits) - 1);
+	unsigned const code(round_fp(max(0.0f, min(max_code, (float(val) - qmin)*qscale)))); // values outside the original range are clamped
+	unsigned char *const q(&qdata[pos*nbytes]);
+	q[0] = (unsigned char)(code & 0xFF);
+	if (nbytes == 2) {q[1] = (unsigned char)(code >> 8);}
+}
+
+
+template<typename V> void sparse_voxel_grid<V>::alloc_brick_data(brick_t &brick) {
+
+	assert(brick.data_ix == UNIFORM_BRICK);
+
+	if (!free_data.empty()) { // reuse the data of a brick that became uniform
+		brick.data_ix = free_data.back();
+		free_data.pop_back();
+		return;
+	}
+	brick.data_ix = (quant_bits ? qdata.size()/(quant_bits >> 3) : data.size());
+	if (quant_bits) {qdata.resize(qdata.size() + BRICK_VOXELS*(quant_bits >> 3));} else {data.resize(data.size() + BRICK_VOXELS);}
+}
+
+
+template<typename V> void sparse_voxel_grid<V>::clear_edits() {
+
+	vector<unsigned>().swap(edit_ix); // free the memory
+	vector<unsigned>().swap(edited);
+	vector<V>().swap(edit_data);
+}
+
+
+template<typename V> void sparse_voxel_grid<V>::init_bricks() {
+
+	nbx = (nx + VOXEL_BRICK_SZ - 1)/VOXEL_BRICK_SZ; // ceil
+	nby = (ny + VOXEL_BRICK_SZ - 1)/VOXEL_BRICK_SZ;
+	nbz = (nz + VOXEL_BRICK_SZ - 1)/VOXEL_BRICK_SZ;
+	vector<brick_t>(nbx*nby*nbz).swap(bricks);
+	vector<V>().swap(data); // free any excess capacity from end_edits()
+	vector<unsigned char>().swap(qdata);
+	vector<unsigned>().swap(free_data);
+	clear_edits();
+}
+
+
+// fills the bricks from get_val(x, y, z), which must be thread safe; voxels of partial bricks at the grid edges are stored but never read
+template<typename V> template<typename F> void sparse_voxel_grid<V>::build_bricks(F const &get_val, bool calc_quant_range) {
+
+	init_bricks();
+	unsigned const num_bricks(bricks.size());
+	vector<unsigned char> is_uniform(num_bricks, 1);
+	vector<float> brick_min(num_bricks, 0.0), brick_max(num_bricks, 0.0);
+
+	#pragma omp parallel for schedule(dynamic,1)
+	for (int by = 0; by < (int)nby; ++by) {
+		for (unsigned bx = 0; bx < nbx; ++bx) {
+			for (unsigned bz = 0; bz < nbz; ++bz) {
+				unsigned const bix(get_brick_ix(bx, by, bz));
+				unsigned const x1(bx*VOXEL_BRICK_SZ), y1(by*VOXEL_BRICK_SZ), z1(bz*VOXEL_BRICK_SZ);
+				unsigned const x2(min(nx, x1+VOXEL_BRICK_SZ)), y2(min(ny, y1+VOXEL_BRICK_SZ)), z2(min(nz, z1+VOXEL_BRICK_SZ));
+				V const first(get_val(x1, y1, z1));
+				float vmin(first), vmax(first);
+				bool uniform(1);
+
+				for (unsigned y = y1; y < y2; ++y) {
+					for (unsigned x = x1; x < x2; ++x) {
+						for (unsigned z = z1; z < z2; ++z) {
+							V const val(get_val(x, y, z));
+							if (!(val == first)) {uniform = 0;}
+							if (calc_quant_range) {vmin = min(vmin, float(val)); vmax = max(vmax, float(val));}
+						}
+					}
+				}
+				bricks[bix].uniform_val = first;
+				is_uniform[bix] = uniform;
+				brick_min [bix] = vmin;
+				brick_max [bix] = vmax;
+			} // for bz
+		} // for bx
+	} // for by
+	if (calc_quant_range) { // include uniform bricks so that values written into them later are in range
+		assert(quant_bits == 8 || quant_bits == 16);
+		float const qmax(*max_element(brick_max.begin(), brick_max.end()));
+		qmin   = *min_element(brick_min.begin(), brick_min.end());
+		qscale = ((qmax > qmin) ? ((1U << quant_bits) - 1)/(qmax - qmin) : 1.0);
+	}
+	unsigned num_data(0);
+
+	for (unsigned i = 0; i < num_bricks; ++i) { // allocate storage for non-uniform bricks in brick order
+		if (!is_uniform[i]) {bricks[i].data_ix = num_data; num_data += BRICK_VOXELS;}
+	}
+	if (quant_bits) {qdata.resize(num_data*(quant_bits >> 3), 0);} else {data.resize(num_data, V());}
+
+	#pragma omp parallel for schedule(dynamic,1)
+	for (int by = 0; by < (int)nby; ++by) {
+		for (unsigned bx = 0; bx < nbx; ++bx) {
+			for (unsigned bz = 0; bz < nbz; ++bz) {
+				brick_t const &brick(bricks[get_brick_ix(bx, by, bz)]);
+				if (brick.data_ix == UNIFORM_BRICK) continue;
+				unsigned const x1(bx*VOXEL_BRICK_SZ), y1(by*VOXEL_BRICK_SZ), z1(bz*VOXEL_BRICK_SZ);
+				unsigned const x2(min(nx, x1+VOXEL_BRICK_SZ)), y2(min(ny, y1+VOXEL_BRICK_SZ)), z2(min(nz, z1+VOXEL_BRICK_SZ));
+
+				for (unsigned y = y1; y < y2; ++y) {
+					for (unsigned x = x1; x < x2; ++x) {
+						for (unsigned z = z1; z < z2; ++z) {store_val(brick.data_ix + get_brick_offset(x, y, z), get_val(x, y, z));}
+					}
+				}
+			} // for bz
+		} // for bx
+	} // for by
+}
+
+
+template<typename V> unsigned sparse_voxel_grid<V>::count_uniform_bricks() const {
+
+	unsigned num(0);
+	for (auto i = bricks.begin(); i != bricks.end(); ++i) {num += (i->data_ix == UNIFORM_BRICK);}
+	return num;
+}
+
+
+template<typename V> void sparse_voxel_grid<V>::compress_from(voxel_grid<V> const &grid, unsigned quant_bits_) {
+
+	assert(quant_bits_ == 0 || quant_bits_ == 8 || quant_bits_ == 16);
+	clear();
+	static_cast<voxel_grid_geom_t &>(*this) = grid;
+	quant_bits = quant_bits_;
+	if (grid.empty()) return; // nothing else to do
+	assert(grid.size() == get_num_voxels());
+	build_bricks([&grid](unsigned x, unsigned y, unsigned z) {return grid.get(x, y, z);}, (quant_bits > 0));
+}
+
+
+template<typename V> void sparse_voxel_grid<V>::expand_to(voxel_grid<V> &grid) const {
+
+	grid.clear();
+	static_cast<voxel_grid_geom_t &>(grid) = *this;
+	if (empty()) return; // nothing else to do
+	grid.resize(get_num_voxels());
+
+	#pragma omp parallel for schedule(static,1)
+	for (int y = 0; y < (int)ny; ++y) {
+		for (unsigned x = 0; x < nx; ++x) {
+			V *const vals(&grid[grid.get_ix(x, y, 0)]);
+			for (unsigned z = 0; z < nz; ++z) {vals[z] = get(x, y, z);}
+		}
+	}
+}
+
+
+template<typename V> V sparse_voxel_grid<V>::get(unsigned x, unsigned y, unsigned z) const {
+
+	assert(x < nx && y < ny && z < nz);
+	unsigned const bix(get_brick_ix(x/VOXEL_BRICK_SZ, y/VOXEL_BRICK_SZ, z/VOXEL_BRICK_SZ));
+	if (!edit_ix.empty() && edit_ix[bix] != UNIFORM_BRICK) {return edit_data[edit_ix[bix] + get_brick_offset(x, y, z)];} // being edited
+	brick_t const &brick(bricks[bix]);
+	if (brick.data_ix == UNIFORM_BRICK) {return brick.uniform_val;}
+	return load_val(brick.data_ix + get_brick_offset(x, y, z));
+}
+
+
+// Note: the first write to a brick copies it into full precision edit data, which is used in place of the brick until end_edits() is called
+template<typename V> void sparse_voxel_grid<V>::set(unsigned x, unsigned y, unsigned z, V const &val) {
+
+	assert(x < nx && y < ny && z < nz);
+	unsigned const bix(get_brick_ix(x/VOXEL_BRICK_SZ, y/VOXEL_BRICK_SZ, z/VOXEL_BRICK_SZ));
+	if (edit_ix.empty()) {edit_ix.resize(bricks.size(), UNIFORM_BRICK);}
+	unsigned &eix(edit_ix[bix]);
+
+	if (eix == UNIFORM_BRICK) { // not yet edited
+		brick_t const &brick(bricks[bix]);
+		if (brick.data_ix == UNIFORM_BRICK && val == brick.uniform_val) return; // no change
+		eix = edit_data.size();
+		edit_data.resize(eix + BRICK_VOXELS, brick.uniform_val);
+		if (brick.data_ix != UNIFORM_BRICK) {for (unsigned i = 0; i < BRICK_VOXELS; ++i) {edit_data[eix+i] = load_val(brick.data_ix + i);}}
+		edited.push_back(bix);
+	}
+	edit_data[eix + get_brick_offset(x, y, z)] = val;
+}
+
+
+// merges edited bricks that became uniform and re-quantizes the others; values outside the original quantization range are clamped
+template<typename V> void sparse_voxel_grid<V>::end_edits() {
+
+	for (auto i = edited.begin(); i != edited.end(); ++i) {
+		brick_t &brick(bricks[*i]);
+		V const *const vals(&edit_data[edit_ix[*i]]);
+		unsigned const bz(*i%nbz), bx((*i/nbz)%nbx), by(*i/(nbz*nbx));
+		unsigned const x1(bx*VOXEL_BRICK_SZ), y1(by*VOXEL_BRICK_SZ), z1(bz*VOXEL_BRICK_SZ);
+		unsigned const x2(min(nx, x1+VOXEL_BRICK_SZ)), y2(min(ny, y1+VOXEL_BRICK_SZ)), z2(min(nz, z1+VOXEL_BRICK_SZ));
+		V const first(vals[get_brick_offset(x1, y1, z1)]);
+		bool uniform(1);
+
+		for (unsigned y = y1; y < y2 && uniform; ++y) { // only voxels within the grid are compared, as in build_bricks()
+			for (unsigned x = x1; x < x2 && uniform; ++x) {
+				for (unsigned z = z1; z < z2; ++z) {
+					if (!(vals[get_brick_offset(x, y, z)] == first)) {uniform = 0; break;}
+				}
+			}
+		}
+		if (uniform) {
+			if (brick.data_ix != UNIFORM_BRICK) {free_data.push_back(brick.data_ix); brick.data_ix = UNIFORM_BRICK;}
+			brick.uniform_val = first;
+			continue;
+		}
+		if (brick.data_ix == UNIFORM_BRICK) {alloc_brick_data(brick);}
+		for (unsigned v = 0; v < BRICK_VOXELS; ++v) {store_val(brick.data_ix + v, vals[v]);}
+	} // for i
+	clear_edits();
+}
+
+
+template<typename V> void sparse_voxel_grid<V>::downsample_2x() { // modify in place, perserving total size, center, and lo_pos
+
+	assert(nx > 1 && ny > 1 && nz > 1);
+	assert(!(nx&1) && !(ny&1) && !(nz&1));
+	sparse_voxel_grid<V> const src(*this);
+	nx /= 2; ny /= 2; nz /= 2;
+	vsz *= 2.0;
+
+	build_bricks([&src](unsigned x, unsigned y, unsigned z) {
+		float sum(0.0);
+
+		for (unsigned d = 0; d < 8; ++d) { // combine a block of 2x2x2 = 8 voxels
+			sum += float(src.get((2*x + (d&1)), (2*y + ((d>>1)&1)), (2*z + (d>>2))));
+		}
+		return V(sum/8); // average voxel values
+	}, (quant_bits > 0));
+}
+
+
+template<typename V> bool sparse_voxel_grid<V>::read(FILE *fp) {
+
+	clear();
+	if (!read_geom(fp)) return 0;
+	if (!read_pod(nbx, fp, "sparse voxel nbx") || !read_pod(nby, fp, "sparse voxel nby") || !read_pod(nbz, fp, "sparse voxel nbz")) return 0;
+	if (!read_pod(quant_bits, fp, "sparse voxel quant_bits") || !read_pod(qmin, fp, "sparse voxel qmin") || !read_pod(qscale, fp, "sparse voxel qscale")) return 0;
+	if (!read_vector(bricks, fp, "sparse voxel bricks") || !read_vector(data, fp, "sparse voxel data") || !read_vector(qdata, fp, "sparse voxel qdata")) return 0;
+
+	if (bricks.size() != nbx*nby*nbz && !(bricks.empty() && nbx == 0)) {
+		cerr << "Error reading sparse voxel grid: expected " << nbx*nby*nbz << " bricks but got " << bricks.size() << endl;
+		return 0;
+	}
+	return 1;
+}
+
+
+template<typename V> bool sparse_voxel_grid<V>::write(FILE *fp) const {
+
+	assert(!has_edits()); // end_edits() must be called first
+	if (!write_geom(fp)) return 0;
+	if (!write_pod(nbx, fp, "sparse voxel nbx") || !write_pod(nby, fp, "sparse voxel nby") || !write_pod(nbz, fp, "sparse voxel nbz")) return 0;
+	if (!write_pod(quant_bits, fp, "sparse voxel quant_bits") || !write_pod(qmin, fp, "sparse voxel qmin") || !write_pod(qscale, fp, "sparse voxel qscale")) return 0;
+	return (write_vector(bricks, fp, "sparse voxel bricks") && write_vector(data, fp, "sparse voxel data") && write_vector(qdata, fp, "sparse voxel qdata"));
+}
+
+template class sparse_voxel_grid<float>;         // explicit instantiation
+template class sparse_voxel_grid<unsigned char>; // explicit instantiation
+
+
+// replaces the dense voxel values and outside flags with sparse copies; edits are applied to the sparse copies,
+// and voxel_model::proc_pending_updates() calls end_voxel_edits() once the edits have been processed
+void voxel_manager::compress_voxel_data(unsigned quant_bits) {
+
+	sparse_storage    = 1;
+	sparse_quant_bits = quant_bits;
+	if (is_compressed() || empty()) return; // already compressed, or nothing to compress
+	sparse_vals.compress_from(*this, quant_bits);
+	sparse_outside.compress_from(outside);
+	vector<float>().swap(*this); // free the memory, but keep the grid geometry
+	vector<unsigned char>().swap(outside);
+}
+
+
+void voxel_manager::expand_voxel_data() {
+
+	if (!is_compressed()) return; // already expanded
+	sparse_vals.expand_to(*this);
+	sparse_outside.expand_to(outside);
+	sparse_vals.clear();
+	sparse_outside.clear();
+}
+
+
+void voxel_manager::end_voxel_edits() { // merges or re-quantizes only the bricks that were edited
+	sparse_vals.end_edits();
+	sparse_outside.end_edits();
+}
+
+
+// voxel files are stored in sparse form; voxel values are full precision unless the model is stored quantized in memory
 bool voxel_model::from_file(string const &fn) {
 
 	FILE *fp(fopen(fn.c_str(), "rb"));
@@ -248,9 +609,17 @@ bool voxel_model::from_file(string const &fn) {
 		cerr << "Error opening voxel file " << fn << " for read" << endl;
 		return 0;
 	}
-	bool const success(read(fp) && outside.read(fp) && ao_lighting.read(fp)); // should ao_lighting be read or recalculated?
+	sparse_voxel_grid<float> vals;
+	sparse_voxel_grid<unsigned char> outside_flags, ao;
+	bool const success(vals.read(fp) && outside_flags.read(fp) && ao.read(fp)); // should ao_lighting be read or recalculated?
 	checked_fclose(fp);
-	return success;
+	if (!success) return 0;
+	sparse_vals    = vals;
+	sparse_outside = outside_flags;
+	expand_voxel_data();
+	ao.expand_to(ao_lighting);
+	if (sparse_storage) {compress_voxel_data(sparse_quant_bits);} // keep the current storage mode
+	return 1;
 }
 
 
@@ -262,7 +631,15 @@ bool voxel_model::to_file(string const &fn) const {
 		cerr << "Error opening voxel file " << fn << " for write" << endl;
 		return 0;
 	}
-	bool const success(write(fp) && outside.write(fp) && ao_lighting.write(fp)); // should ao_lighting be read or recalculated?
+	sparse_voxel_grid<float> vals;
+	sparse_voxel_grid<unsigned char> outside_flags, ao;
+	bool const use_sparse(is_compressed() && !sparse_vals.has_edits() && !sparse_outside.has_edits());
+	if (!is_compressed()) {vals.compress_from(*this); outside_flags.compress_from(outside);}
+	else if (!use_sparse) {vals = sparse_vals; vals.end_edits(); outside_flags = sparse_outside; outside_flags.end_edits();} // include pending edits
+	ao.compress_from(ao_lighting);
+	sparse_voxel_grid<float>         const &vals_ref   (use_sparse ? sparse_vals    : vals);
+	sparse_voxel_grid<unsigned char> const &outside_ref(use_sparse ? sparse_outside : outside_flags);
+	bool const success(vals_ref.write(fp) && outside_ref.write(fp) && ao.write(fp)); // should ao_lighting be read or recalculated?
 	checked_fclose(fp);
 	return success;
 }
@@ -272,6 +649,9 @@ void voxel_manager::clear() {
 	
 	outside.clear();
 	float_voxel_grid::clear();
+	sparse_vals.clear();
+	sparse_outside.clear();
+	sparse_storage = 0;
 }
 
 
@@ -505,10 +885,10 @@ unsigned voxel_manager::add_triangles_for_voxel(tri_data_t::value_type &tri_vert
 	for (unsigned yhi = 0; yhi < 2; ++yhi) {
 		for (unsigned xhi = 0; xhi < 2; ++xhi) {
 			unsigned const ix(get_ix(xv[xhi], yv[yhi], z));
-			if (all_under_mesh) {all_under_mesh = ((outside[ix] & UNDER_MESH_BIT) != 0);}
+			if (all_under_mesh) {all_under_mesh = ((get_outside(ix) & UNDER_MESH_BIT) != 0);}
 			
 			for (unsigned zhi = 0; zhi < 2; ++zhi) {
-				if (outside[ix + zv[zhi]-z] & 7) {cix |= 1 << ((xhi^yhi) + 2*yhi + 4*zhi);} // outside or on edge
+				if (get_outside(ix + zv[zhi]-z) & 7) {cix |= 1 << ((xhi^yhi) + 2*yhi + 4*zhi);} // outside or on edge
 			}
 		}
 	}
@@ -536,7 +916,7 @@ unsigned voxel_manager::add_triangles_for_voxel(tri_data_t::value_type &tri_vert
 			unsigned const yhi((eix[d] & 2) >> 1), xhi(yhi ^ (eix[d] & 1)), zhi(eix[d] >> 2);
 			unsigned const ix(get_ix(xv[xhi], yv[yhi], zv[zhi]));
 			xhv &= xhi; yhv &= yhi; zhv &= zhi;
-			vals[d] = ((outside[ix] & 7) == ON_EDGE_BIT) ? params.isolevel : operator[](ix);
+			vals[d] = ((get_outside(ix) & 7) == ON_EDGE_BIT) ? params.isolevel : get_val(ix);
 			pts[d].assign(cube.d[0][xhi], cube.d[1][yhi], cube.d[2][zhi]);
 		}
 		vlist[i] = interpolate_pt(params.isolevel, pts[0], pts[1], vals[0], vals[1]);
@@ -573,9 +953,10 @@ bool val_is_outside(float val, voxel_params_t const &params) {
 void voxel_manager::calc_outside_val(unsigned x, unsigned y, unsigned z, bool is_under_mesh) {
 
 	bool const on_edge(params.make_closed_surface && ((x == 0 || x == nx-1) || (y == 0 || y == ny-1) || (z == 0 || z == nz-1)));
-	unsigned char ival(on_edge ? ON_EDGE_BIT : val_is_outside(get(x, y, z), params)); // Note: on_edge is considered outside
+	unsigned const ix(get_ix(x, y, z));
+	unsigned char ival(on_edge ? ON_EDGE_BIT : val_is_outside(get_val(ix), params)); // Note: on_edge is considered outside
 	if (is_under_mesh) {ival |= UNDER_MESH_BIT;}
-	outside.set(x, y, z, ival);
+	set_outside(ix, ival);
 }
 
 
@@ -671,17 +1052,9 @@ void voxel_model::remove_unconnected_outside_modified_blocks(bool postproc_brush
 		for (vector<unsigned>::const_iterator i = xy_updated.begin(); i != xy_updated.end(); ++i) {
 			unsigned const x((*i)%nx), y((*i)/nx);
 			assert(x < nx && y < ny);
-			unsigned const bx1(max(0, (int)x-1)/xblocks), by1(max(0, (int)y-1)/yblocks);
-			unsigned const bx2(min((int)nx-1, (int)x+1)/xblocks), by2(min((int)nx-1, (int)y+1)/yblocks);
-		
-			for (unsigned by = by1; by <= by2; ++by) {
-				for (unsigned bx = bx1; bx <= bx2; ++bx) {
-					unsigned const bix(by*num_blocks + bx);
-					assert(bix < tri_data[0].size());
-					modified_blocks.insert(bix);
-					if (falling_voxels_shift_down) {next_frame_modified_blocks.insert(bix);} // make sure we continue to update these blocks next frame
-				}
-			}
+			mark_column_modified(x, y, modified_blocks, modified_sub_blocks);
+			// make sure we continue to update these blocks next frame
+			if (falling_voxels_shift_down) {mark_column_modified(x, y, next_frame_modified_blocks, next_frame_modified_sub_blocks);}
 		}
 	}
 	//cout << "blocks out " << modified_blocks.size() << " groups " << groups.size() << " group work " << group_work << " updated " << updated_pts.size() << " xy_up " << xy_updated.size() << endl;
@@ -702,11 +1075,11 @@ void voxel_model::remove_unconnected_outside_modified_blocks(bool postproc_brush
 
 		for (vector<pt_ix_t>::const_iterator i = updated_pts.begin(); i != updated_pts.end(); ++i) {
 			unsigned ix(i->ix);
-			float const val(operator[](ix));
+			float const val(get_val(ix));
 			make_voxel_outside(ix);
 			assert(ix > 0); --ix; // move down one z step
-			operator[](ix) = val;
-			outside[ix]    = (is_under_mesh(i->pt - point(0.0, 0.0, vsz.z)) ? UNDER_MESH_BIT : 0); // make inside or under mesh
+			set_val(ix, val);
+			set_outside(ix, (is_under_mesh(i->pt - point(0.0, 0.0, vsz.z)) ? UNDER_MESH_BIT : 0)); // make inside or under mesh
 		}
 		return; // no fragments or sound (of could add sounds when falling begins?)
 	}
@@ -726,11 +1099,11 @@ void voxel_model::remove_unconnected_outside_modified_blocks(bool postproc_brush
 #define FLOOD_FILL_INNER(pos, min_range, max_range, step) \
 	if (pos >= min_range + 1) { \
 		unsigned const ix(cur - step); \
-		if (outside[ix] == fill_val) {work.push_back(ix); outside[ix] |= bit_mask;} \
+		if (get_outside(ix) == fill_val) {work.push_back(ix); set_outside(ix, (fill_val | bit_mask));} \
 	} \
 	if (pos + 1 < max_range) { \
 		unsigned const ix(cur + step); \
-		if (outside[ix] == fill_val) {work.push_back(ix); outside[ix] |= bit_mask;} \
+		if (get_outside(ix) == fill_val) {work.push_back(ix); set_outside(ix, (fill_val | bit_mask));} \
 	}
 
 void voxel_manager::flood_fill_range(unsigned x1, unsigned y1, unsigned x2, unsigned y2, vector<unsigned> &work, unsigned char fill_val, unsigned char bit_mask) {
@@ -740,8 +1113,8 @@ void voxel_manager::flood_fill_range(unsigned x1, unsigned y1, unsigned x2, unsi
 	while (!work.empty()) {
 		unsigned const cur(work.back());
 		work.pop_back();
-		assert(cur < outside.size());
-		assert(outside[cur] & bit_mask);
+		assert(cur < get_num_voxels());
+		assert(get_outside(cur) & bit_mask);
 		assert(nxnz > 0 && nz > 0);
 		unsigned const y(cur/nxnz), cur_xz(cur - y*nxnz), x(cur_xz/nz), z(cur_xz - x*nz);
 		FLOOD_FILL_INNER(x, x1, x2, nz);
@@ -757,7 +1130,7 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 	vector<unsigned> *xy_updated, vector<pt_ix_t> *updated_pts, bool mark_only)
 {
 	//timer_t timer("Remove Unconnected");
-	assert(!outside.empty());
+	assert(has_outside_data());
 	vector<unsigned> &work(temp_work); // stack of voxels to process
 	assert(work.empty());
 
@@ -766,9 +1139,9 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 
 		if (x >= x1 && x <= x2 && y >= y1 && y <= y2) {
 			unsigned const ix(outside.get_ix(x, y, nz/2));
-			assert(outside[ix] != UNDER_MESH_BIT); // outside or above mesh
+			assert(get_outside(ix) != UNDER_MESH_BIT); // outside or above mesh
 			work.push_back(ix); // inside, anchored to the mesh
-			outside[ix] |= ANCHORED_BIT; // mark as anchored
+			set_outside(ix, (get_outside(ix) | ANCHORED_BIT)); // mark as anchored
 		}
 	}
 	else { // add voxels along the mesh surface
@@ -777,9 +1150,9 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 				unsigned ix(outside.get_ix(x, y, 0));
 
 				for (unsigned z = 0; z < nz; ++z, ++ix) {
-					if (outside[ix] != UNDER_MESH_BIT) continue; // outside or above mesh
+					if (get_outside(ix) != UNDER_MESH_BIT) continue; // outside or above mesh
 					work.push_back(ix); // inside, anchored to the mesh
-					outside[ix] |= ANCHORED_BIT; // mark as anchored
+					set_outside(ix, (UNDER_MESH_BIT | ANCHORED_BIT)); // mark as anchored
 				}
 			}
 		}
@@ -793,9 +1166,10 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 
 				for (unsigned z = 0; z < nz; ++z) {
 					unsigned const ix(outside.get_ix(x, y, z));
-					if (outside[ix] == 1) continue; // outside
+					unsigned char const val(get_outside(ix));
+					if (val == 1) continue; // outside
 					work.push_back(ix); // inside, anchored to the mesh
-					outside[ix] |= ANCHORED_BIT; // mark as anchored
+					set_outside(ix, (val | ANCHORED_BIT)); // mark as anchored
 				}
 			}
 		}
@@ -809,11 +1183,12 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 
 			for (unsigned z = 0; z < nz; ++z) {
 				unsigned const ix(outside.get_ix(x, y, z));
+				unsigned char const val(get_outside(ix));
 
-				if (outside[ix] > 1) { // anchored, on edge, or under mesh
-					outside[ix] &= ~ANCHORED_BIT; // remove anchored bit
+				if (val > 1) { // anchored, on edge, or under mesh
+					if (val & ANCHORED_BIT) {set_outside(ix, (val & ~ANCHORED_BIT));} // remove anchored bit
 				}
-				else if (outside[ix] != 1) { // inside and non-anchored
+				else if (val != 1) { // inside and non-anchored
 					if (updated_pts) {updated_pts->push_back(pt_ix_t(get_pt_at(x, y, z), ix));}
 					if (!mark_only ) {make_voxel_outside(ix);}
 					had_update = 1;
@@ -856,20 +1231,20 @@ void voxel_manager::remove_interior_holes() {
 
 
 void voxel_manager::make_voxel_outside(unsigned ix) {
-	outside[ix] = 1; // make outside
-	operator[](ix) = params.isolevel - (params.invert ? -TOLERANCE : TOLERANCE); // change voxel value to be outside
+	set_outside(ix, 1); // make outside
+	set_val(ix, (params.isolevel - (params.invert ? -TOLERANCE : TOLERANCE))); // change voxel value to be outside
 }
 void voxel_manager::make_voxel_inside(unsigned ix) {
-	outside[ix] = 0; // make inside
-	operator[](ix) = params.isolevel + (params.invert ? -TOLERANCE : TOLERANCE); // change voxel value to be inside
+	set_outside(ix, 0); // make inside
+	set_val(ix, (params.isolevel + (params.invert ? -TOLERANCE : TOLERANCE))); // change voxel value to be inside
 }
 
 
 bool voxel_manager::point_inside_volume(point const &pos) const {
 
-	if (outside.empty()) return 0;
+	if (!has_outside_data()) return 0;
 	unsigned ix(0);
-	return (outside.get_ix(pos, ix) && !is_outside(ix));
+	return (get_ix(pos, ix) && !is_outside(ix));
 }
 
 
@@ -884,7 +1259,7 @@ bool voxel_manager::point_intersect(point const &center, point *int_pt) const {
 bool voxel_manager::sphere_intersect(point const &center, float radius, point *int_pt) const {
 
 	if (point_intersect(center, int_pt))  return 1; // optimization
-	if (radius == 0.0 || outside.empty()) return 0;
+	if (radius == 0.0 || !has_outside_data()) return 0;
 	cube_t bcube;
 	bcube.set_from_sphere(center, radius);
 	int llc[3], urc[3];
@@ -909,7 +1284,7 @@ bool voxel_manager::sphere_intersect(point const &center, float radius, point *i
 
 bool voxel_manager::line_intersect(point const &p1, point const &p2, point *int_pt) const {
 
-	if (outside.empty()) return 0;
+	if (!has_outside_data()) return 0;
 	point pa(p1), pb(p2);
 	if (!do_line_clip(pa, pb, get_raw_bbox().d)) return 0; // no bbox intersection
 	if (point_intersect(pa, int_pt))             return 1; // first point intersects
@@ -995,13 +1370,50 @@ bool voxel_model::has_filled_at_edges() const {
 
 unsigned voxel_model::get_block_ix(unsigned voxel_ix) const {
 
-	assert(voxel_ix < size());
+	assert(voxel_ix < get_num_voxels());
 	unsigned const y(voxel_ix/(nz*nx)), vxz(voxel_ix - y*nz*nx), x(vxz/nz), bx(x/xblocks), by(y/yblocks);
 	return by*params.num_blocks + bx;
 }
 
 
-voxel_model::voxel_model(noise_texture_manager_t *ntg, bool use_mesh_, unsigned num_lod_levels) : voxel_manager(use_mesh_), volume_added(0), noise_tex_gen(ntg) {
+// marks the blocks whose triangles depend on the voxels in column {x,y}, along with the sub-blocks whose cobjs depend on them
+void voxel_model::mark_column_modified(unsigned x, unsigned y, std::set<unsigned> &blocks, sub_block_mask_map_t &sub_blocks) const {
+
+	assert(x < nx && y < ny);
+	// check adjacent voxels since we will need to update our neighbors at the boundaries
+	unsigned const bx1(max((int)x-1, 0        )/xblocks), by1(max((int)y-1, 0        )/yblocks);
+	unsigned const bx2(min((int)x+1, (int)nx-1)/xblocks), by2(min((int)y+1, (int)ny-1)/yblocks);
+
+	for (unsigned by = by1; by <= by2; ++by) {
+		for (unsigned bx = bx1; bx <= bx2; ++bx) {
+			unsigned const block_ix(by*params.num_blocks + bx);
+			assert(block_ix < tri_data[0].size());
+			blocks.insert(block_ix);
+			sub_blocks.insert(make_pair(block_ix, 0U)); // tracked, but no sub-blocks modified yet
+		}
+	}
+	// only the marching cubes cells starting at x-1/x and y-1/y use this column
+	for (unsigned cy = max(y, 1U)-1; cy <= y; ++cy) {
+		for (unsigned cx = max(x, 1U)-1; cx <= x; ++cx) {
+			unsigned const bx(cx/xblocks), by(cy/yblocks);
+			unsigned const sx(((cx - bx*xblocks)*VOXEL_SUB_BLOCKS)/xblocks), sy(((cy - by*yblocks)*VOXEL_SUB_BLOCKS)/yblocks);
+			sub_blocks[by*params.num_blocks + bx] |= (1U << (sy*VOXEL_SUB_BLOCKS + sx));
+		}
+	}
+}
+
+
+unsigned voxel_model::get_modified_sub_blocks(unsigned block_ix) const {
+
+	if (full_block_updates) return ALL_SUB_BLOCKS_MASK;
+	sub_block_mask_map_t::const_iterator const it(modified_sub_blocks.find(block_ix));
+	return ((it == modified_sub_blocks.end()) ? ALL_SUB_BLOCKS_MASK : it->second); // untracked blocks are fully modified
+}
+
+
+voxel_model::voxel_model(noise_texture_manager_t *ntg, bool use_mesh_, unsigned num_lod_levels) :
+	voxel_manager(use_mesh_), volume_added(0), noise_tex_gen(ntg), full_block_updates(0)
+{
 
 	assert(num_lod_levels > 0);
 	tri_data.resize(num_lod_levels);
@@ -1026,6 +1438,8 @@ void voxel_model::clear() {
 	}
 	modified_blocks.clear();
 	next_frame_modified_blocks.clear();
+	modified_sub_blocks.clear();
+	next_frame_modified_sub_blocks.clear();
 	ao_lighting.clear();
 	voxel_manager::clear();
 	volume_added = 0;
@@ -1061,11 +1475,16 @@ bool voxel_model_ground::clear_block(unsigned block_ix) {
 
 	if (add_cobjs) {
 		assert(block_ix < data_blocks.size());
+		data_block_t &db(data_blocks[block_ix]);
+		unsigned const sub_block_mask(get_modified_sub_blocks(block_ix));
 
-		for (vector<unsigned>::const_iterator i = data_blocks[block_ix].cids.begin(); i != data_blocks[block_ix].cids.end(); ++i) {
-			remove_coll_object(*i);
+		for (unsigned sb = 0; sb < NUM_VOXEL_SUB_BLOCKS; ++sb) { // only remove cobjs from modified sub-blocks
+			if (!(sub_block_mask & (1U << sb))) continue;
+			for (vector<unsigned>::const_iterator i = db.sub_block_cids[sb].begin(); i != db.sub_block_cids[sb].end(); ++i) {remove_coll_object(*i);}
+			db.sub_block_cids[sb].clear();
 		}
-		data_blocks[block_ix].clear();
+		db.cids.clear(); // rebuilt from sub_block_cids in merge_created_blocks_hook()
+		db.staged.clear();
 	}
 	return ret;
 }
@@ -1081,22 +1500,34 @@ unsigned voxel_model::create_block(voxel_ix_cache &vix_cache, unsigned block_ix,
 	assert(tri_block.empty());
 	vix_cache.init(xblocks+1, yblocks+1, nz, vsz, zero_vector, vert_ix_cache_entry(), 1);
 	unsigned const xbix(block_ix%params.num_blocks), ybix(block_ix/params.num_blocks), step(1 << lod_level);
+	unsigned const num_sub((lod_level == 0) ? VOXEL_SUB_BLOCKS : 1); // only LOD 0 is used for cobjs, so only it needs sub-block ranges
+	unsigned sub_block_ends[NUM_VOXEL_SUB_BLOCKS] = {0}; // end vertex index of each sub-block's triangles
 	unsigned count(0);
 
-	for (unsigned y = ybix*yblocks; y < (ybix+1)*yblocks; y += step) {
-		for (unsigned x = xbix*xblocks; x < (xbix+1)*xblocks; x += step) {
-			for (unsigned z = 0; z < nz; z += step) {
-				count += add_triangles_for_voxel(tri_block, vix_cache, x, y, z, xbix*xblocks, ybix*yblocks, count_only, lod_level);
+	for (unsigned sy = 0; sy < num_sub; ++sy) {
+		// sub-block s contains cells [ceil(s*blocks/num_sub), ceil((s+1)*blocks/num_sub)), matching mark_column_modified()
+		unsigned const y1(ybix*yblocks + (sy*yblocks + num_sub-1)/num_sub), y2(ybix*yblocks + ((sy+1)*yblocks + num_sub-1)/num_sub);
+
+		for (unsigned sx = 0; sx < num_sub; ++sx) {
+			unsigned const x1(xbix*xblocks + (sx*xblocks + num_sub-1)/num_sub), x2(xbix*xblocks + ((sx+1)*xblocks + num_sub-1)/num_sub);
+
+			for (unsigned y = y1; y < y2; y += step) {
+				for (unsigned x = x1; x < x2; x += step) {
+					for (unsigned z = 0; z < nz; z += step) {
+						count += add_triangles_for_voxel(tri_block, vix_cache, x, y, z, xbix*xblocks, ybix*yblocks, count_only, lod_level);
+					}
+				}
 			}
-		}
-	}
+			if (!count_only) {sub_block_ends[sy*num_sub + sx] = tri_block.num_verts();}
+		} // for sx
+	} // for sy
 	if (!count_only) {
 		if (first_create) { // after the first creation pt_to_ix is out of order
 			assert(lod_level < pt_to_ix.size());
 			pt_to_ix[lod_level][block_ix].pt = (point((xbix+0.5)*xblocks, (ybix+0.5)*yblocks, nz/2)*vsz + lo_pos);
 			pt_to_ix[lod_level][block_ix].ix = block_ix;
 		}
-		if (lod_level == 0) {create_block_hook(block_ix);}
+		if (lod_level == 0) {create_block_hook(block_ix, sub_block_ends);}
 		tri_block.finalize(3); // needed to compute bounding sphere and vertex normals
 	}
 	else { // count_only
@@ -1120,7 +1551,59 @@ unsigned voxel_model::create_block_all_lods(unsigned block_ix, bool first_create
 }
 
 
-void voxel_model_ground::create_block_hook(unsigned block_ix) { // lod_level == 0
+// called in parallel across blocks; polygons of modified sub-blocks are staged here and added to coll_objects in merge_created_blocks_hook()
+void voxel_model_ground::create_block_hook(unsigned block_ix, unsigned const sub_block_ends[NUM_VOXEL_SUB_BLOCKS]) { // lod_level == 0
+
+	if (!add_cobjs) return; // nothing to do
+	assert(block_ix < data_blocks.size());
+	data_block_t &db(data_blocks[block_ix]);
+	assert(db.staged.empty());
+	tri_data_t::value_type const &td(tri_data[0][block_ix]);
+	unsigned const num_verts(td.num_verts()), sub_block_mask(get_modified_sub_blocks(block_ix));
+	assert((num_verts % 3) == 0);
+	assert(sub_block_ends[NUM_VOXEL_SUB_BLOCKS-1] == num_verts);
+	unsigned start(0);
+
+	for (unsigned sb = 0; sb < NUM_VOXEL_SUB_BLOCKS; start = sub_block_ends[sb++]) {
+		if (!(sub_block_mask & (1U << sb))) continue; // unmodified sub-block, keep its existing cobjs
+		assert(db.sub_block_cids[sb].empty());
+		unsigned const end(sub_block_ends[sb]);
+
+		for (unsigned v = start; v < end; v += 3) {
+			staged_cobj_t sc;
+			for (unsigned n = 0; n < 3; ++n) {sc.pts[n] = td.get_vert(v+n).v;}
+			sc.normal = get_poly_norm(sc.pts);
+			if (sc.normal == zero_vector) continue; // degenerate polygon, skip it
+			sc.cp_ix     = ((params.top_tex_used && sc.normal.z > 0.5) ? 2 : fabs(eval_noise_texture_at((sc.pts[0] + sc.pts[1] + sc.pts[2])/3.0)) > 0.5);
+			sc.npts      = 3;
+			sc.sub_block = sb;
+
+#if 1 // only gets here ~5% of the time for the large voxel terrain scene
+			if (v+3 < end) { // have a next triangle in this sub-block
+				point const pts2[3] = {td.get_vert(v+3).v, td.get_vert(v+4).v, td.get_vert(v+5).v};
+
+				if ((sc.normal - get_poly_norm(pts2)).mag_sq() < 0.0001) {
+					if (pts2[0] == sc.pts[1] && pts2[2] == sc.pts[2]) { // merge two tris into a quad
+						sc.pts[3] = sc.pts[2]; sc.pts[2] = pts2[1]; // {pts[0], pts[1], pts2[1], pts[2]}
+						sc.npts   = 4;
+						v += 3; // skip the second triangle
+					}
+					else if (pts2[1] == sc.pts[1] && pts2[0] == sc.pts[2]) { // merge two tris into a quad
+						sc.pts[3] = sc.pts[2]; sc.pts[2] = pts2[2]; // {pts[0], pts[1], pts2[2], pts[2]}
+						sc.npts   = 4;
+						v += 3; // skip the second triangle
+					}
+				}
+			}
+#endif
+			db.staged.push_back(sc);
+		} // for v
+	} // for sb
+}
+
+
+// adds the polygons staged by create_block_hook() to coll_objects in block order, then rebuilds the per-block query trees in parallel
+void voxel_model_ground::merge_created_blocks_hook(vector<unsigned> const &blocks) {
 
 	if (!add_cobjs) return; // nothing to do
 	cobj_params cparams[3];
@@ -1130,46 +1613,27 @@ void voxel_model_ground::create_block_hook(unsigned block_ix) { // lod_level ==
 		cparams[d] = cobj_params(params.elasticity, color, 0, 0, NULL, 0, params.tids[d]);
 		cparams[d].cobj_type = COBJ_TYPE_VOX_TERRAIN;
 	}
-	assert(block_ix < data_blocks.size());
-	assert(data_blocks[block_ix].cids.empty());
-	tri_data_t::value_type const &td(tri_data[0][block_ix]);
-	unsigned const num_verts(td.num_verts());
-	assert((num_verts % 3) == 0);
-	data_blocks[block_ix].cids.reserve(num_verts/3);
-
-	#pragma omp critical(add_coll_polygon)
-	for (unsigned v = 0; v < num_verts; v += 3) {
-		point const pts[3] = {td.get_vert(v+0).v, td.get_vert(v+1).v, td.get_vert(v+2).v};
-		vector3d const normal(get_poly_norm(pts));
-		if (normal == zero_vector) continue; // degenerate polygon, skip it
-		unsigned const cp_ix((params.top_tex_used && normal.z > 0.5) ? 2 : fabs(eval_noise_texture_at((pts[0] + pts[1] + pts[2])/3.0)) > 0.5);
-		int cindex(-1);
+	for (vector<unsigned>::const_iterator i = blocks.begin(); i != blocks.end(); ++i) {
+		assert(*i < data_blocks.size());
+		data_block_t &db(data_blocks[*i]);
 
-#if 1 // only gets here ~5% of the time for the large voxel terrain scene
-		if (v+3 < num_verts) { // have a next triangle
-			point const pts2[3] = {td.get_vert(v+3).v, td.get_vert(v+4).v, td.get_vert(v+5).v};
-
-			if ((normal - get_poly_norm(pts2)).mag_sq() < 0.0001) {
-				if (pts2[0] == pts[1] && pts2[2] == pts[2]) { // merge two tris into a quad
-					point const quad_pts[4] = {pts[0], pts[1], pts2[1], pts[2]};
-					cindex = add_simple_coll_polygon(quad_pts, 4, cparams[cp_ix], normal);
-					v += 3; // skip the second triangle
-				}
-				else if (pts2[1] == pts[1] && pts2[0] == pts[2]) { // merge two tris into a quad
-					point const quad_pts[4] = {pts[0], pts[1], pts2[2], pts[2]};
-					cindex = add_simple_coll_polygon(quad_pts, 4, cparams[cp_ix], normal);
-					v += 3; // skip the second triangle
-				}
-			}
+		for (vector<staged_cobj_t>::const_iterator p = db.staged.begin(); p != db.staged.end(); ++p) {
+			int const cindex(add_simple_coll_polygon(p->pts, p->npts, cparams[p->cp_ix], p->normal));
+			if (add_as_fixed) {coll_objects.get_cobj(cindex).fixed = 1;} // mark as fixed so that lmap cells will be generated and cobjs will be re-added
+			db.sub_block_cids[p->sub_block].push_back(cindex);
 		}
-#endif
-		if (cindex < 0) {cindex = add_simple_coll_polygon(pts, 3, cparams[cp_ix], normal);}
-		if (add_as_fixed) {coll_objects.get_cobj(cindex).fixed = 1;} // mark as fixed so that lmap cells will be generated and cobjs will be re-added
-		data_blocks[block_ix].cids.push_back(cindex);
+		vector<staged_cobj_t>().swap(db.staged); // free the memory
+		db.cids.clear();
+		for (unsigned sb = 0; sb < NUM_VOXEL_SUB_BLOCKS; ++sb) {db.cids.insert(db.cids.end(), db.sub_block_cids[sb].begin(), db.sub_block_cids[sb].end());}
+	}
+	// Note: coll_objects is not modified below, so the trees can be built without a critical section
+	#pragma omp parallel for schedule(dynamic,1)
+	for (int i = 0; i < (int)blocks.size(); ++i) {
+		cobj_tree.build_tree_for_block(data_blocks[blocks[i]].cids, blocks[i]%params.num_blocks, blocks[i]/params.num_blocks);
+	}
+	for (vector<unsigned>::const_iterator i = blocks.begin(); i != blocks.end(); ++i) {
+		cobj_tree.update_bcube_for_block(*i%params.num_blocks, *i/params.num_blocks);
 	}
-	// Note: this call is really only safe to do without trying to the add_coll_polygon critical section because
-	// coll_objects has been reserved ahead of time and won't be resized (meaning the pointers are always valid)
-	cobj_tree.add_cobjs_for_block(data_blocks[block_ix].cids, block_ix%params.num_blocks, block_ix/params.num_blocks);
 }
 
 
@@ -1211,7 +1675,7 @@ void voxel_model::calc_ao_lighting_for_block(unsigned block_ix, bool increase_on
 
 			for (int zi = nz-2; zi >= 0; zi -= zstep) { // skip top zval
 				unsigned const x(min(x_end-1, xi+xstep-1)), y(min(y_end-1, yi+ystep-1)), z(min(nz-1, zi+zstep-1));
-				unsigned char const outside_val(outside.get(x, y, z));
+				unsigned char const outside_val(get_outside(outside.get_ix(x, y, z)));
 				saw_inside |= (outside_val == 0 || (outside_val & end_ray_flags));
 				if (!saw_inside) continue;
 				if (increase_only && ao_lighting.get(x, y, z) == 255) continue;
@@ -1219,7 +1683,7 @@ void voxel_model::calc_ao_lighting_for_block(unsigned block_ix, bool increase_on
 				if (use_mesh && !is_over_mesh(pos)) continue;
 				float val(0.0);
 				
-				if (z+1 == nz || !(outside.get(x, y, z+1) & end_ray_flags)) { // above mesh
+				if (z+1 == nz || !(get_outside(outside.get_ix(x, y, z+1)) & end_ray_flags)) { // above mesh
 					for (vector<step_dir_t>::const_iterator i = ao_dirs.begin(); i != ao_dirs.end(); ++i) {
 						float cur_val(1.0);
 						unsigned cur[3] = {x, y, z};
@@ -1232,7 +1696,9 @@ void voxel_model::calc_ao_lighting_for_block(unsigned block_ix, bool increase_on
 						for (unsigned s = 0; s < max_steps; ++s) { // take steps in this direction
 							ix += i->dist_per_step; // increment first to skip the current voxel
 						
-							if (outside[ix] == 0 || (outside[ix] & end_ray_flags)) {
+							unsigned char const val(get_outside(ix));
+
+							if (val == 0 || (val & end_ray_flags)) {
 								cur_val = s*i->nsteps_inv; // Note: ambient obscurance - uses actual distance to occluder
 								break; // voxel known to be inside the volume or under the mesh
 							}
@@ -1282,12 +1748,13 @@ bool voxel_model::update_voxel_sphere_region(point const &center, float radius,
 	point *damage_pos, int shooter, unsigned num_fragments)
 {
 	assert(radius > 0.0);
-	if (val_at_center == 0.0 || empty()) return 0;
+	if (val_at_center == 0.0 || !has_voxel_data()) return 0;
 	bool const material_removed(val_at_center < 0.0);
 	if (params.invert) val_at_center *= -1.0; // is this correct?
 	unsigned const num[3] = {nx, ny, nz};
 	unsigned bounds[3][2]; // {x,y,z} x {lo,hi}
 	std::set<unsigned> blocks_to_update;
+	sub_block_mask_map_t sub_blocks_to_update;
 	float const dist_adjust(0.5*vsz.mag()); // single voxel diagonal half-width
 	bool saw_inside(0), saw_outside(0);
 
@@ -1305,33 +1772,24 @@ bool voxel_model::update_voxel_sphere_region(point const &center, float radius,
 				float const dist(max(0.0f, (p2p_dist(center, pos) - dist_adjust)));
 				if (spherical && dist >= radius) continue; // too far
 				// update voxel values, linear falloff with distance from center (ending at 0.0 at radius)
-				float &val(get_ref(x, y, z));
-				float const prev_val(val);
-				val += val_at_center*pow(min(1.0f, (1.0f - dist/radius)), (float)falloff_exp);
+				unsigned const ix(get_ix(x, y, z));
+				float const prev_val(get_val(ix));
+				float val(prev_val + val_at_center*pow(min(1.0f, (1.0f - dist/radius)), (float)falloff_exp));
 				if (params.normalize_to_1) val = CLIP_TO_pm1(val);
 				if (val == prev_val) continue; // no change
-				calc_outside_val(x, y, z, ((outside.get(x, y, z) & UNDER_MESH_BIT) != 0));
+				set_val(ix, val); // only the bricks containing modified voxels are expanded when compressed
+				calc_outside_val(x, y, z, ((get_outside(ix) & UNDER_MESH_BIT) != 0));
 				was_updated = 1;
 				(val_is_outside(val,      params) ? saw_outside : saw_inside) = 1;
 				(val_is_outside(prev_val, params) ? saw_outside : saw_inside) = 1;
 				if (damage_pos) {*damage_pos = pos;}
 			}
-			if (!was_updated) continue;
-			// check adjacent voxels since we will need to update our neighbors at the boundaries
-			unsigned const bx1(max((int)x-1, 0        )/xblocks), by1(max((int)y-1, 0        )/yblocks);
-			unsigned const bx2(min((int)x+1, (int)nx-1)/xblocks), by2(min((int)y+1, (int)ny-1)/yblocks);
-
-			for (unsigned by = by1; by <= by2; ++by) {
-				for (unsigned bx = bx1; bx <= bx2; ++bx) {
-					unsigned const block_ix(by*params.num_blocks + bx);
-					assert(block_ix < tri_data[0].size());
-					blocks_to_update.insert(block_ix);
-				}
-			}
+			if (was_updated) {mark_column_modified(x, y, blocks_to_update, sub_blocks_to_update);}
 		}
 	}
 	if (!saw_inside || !saw_outside) return 0; // nothing else to do
 	std::copy(blocks_to_update.begin(), blocks_to_update.end(), inserter(modified_blocks, modified_blocks.begin()));
+	for (auto i = sub_blocks_to_update.begin(); i != sub_blocks_to_update.end(); ++i) {modified_sub_blocks[i->first] |= i->second;}
 
 	if (material_removed) {
 		maybe_create_fragments(center, radius, shooter, num_fragments, 1);
@@ -1370,19 +1828,28 @@ unsigned voxel_model::get_texture_at(point const &pos) const {
 
 void voxel_model::proc_pending_updates(bool postproc_brushes_mode) {
 
-	if (modified_blocks.empty()) return;
+	if (modified_blocks.empty()) { // no more updates
+		end_voxel_edits(); // merge or re-quantize the edited bricks, if compressed
+		return;
+	}
 	//RESET_TIME;
 
 	if (params.remove_unconnected >= 2) {
 		if (postproc_brushes_mode) { // iterate until all blocks stop falling
 			std::set<unsigned> orig_modified_blocks(modified_blocks);
+			sub_block_mask_map_t orig_modified_sub_blocks(modified_sub_blocks);
 
 			while (!modified_blocks.empty()) { // modified_blocks should decrease in size during iteration
 				remove_unconnected_outside_modified_blocks(1);
+				// voxels that fell or were removed may be in sub-blocks of the original blocks that weren't modified by the brushes
+				for (auto i = modified_sub_blocks.begin(); i != modified_sub_blocks.end(); ++i) {orig_modified_sub_blocks[i->first] |= i->second;}
 				modified_blocks = next_frame_modified_blocks;
 				next_frame_modified_blocks.clear();
+				modified_sub_blocks = next_frame_modified_sub_blocks;
+				next_frame_modified_sub_blocks.clear();
 			}
 			modified_blocks.swap(orig_modified_blocks); // restore so we can update all the original blocks that were modified
+			modified_sub_blocks.swap(orig_modified_sub_blocks);
 			//PRINT_TIME("  Process Brush Updates");
 		}
 		else { // only call once (fall one step)
@@ -1392,8 +1859,8 @@ void voxel_model::proc_pending_updates(bool postproc_brushes_mode) {
 	bool something_removed(0);
 	vector<unsigned> blocks_to_update(modified_blocks.begin(), modified_blocks.end());
 	
-	// FIXME: can we only remove/add voxels within the modified region of each block?
-	//        or, create the block first and only remove triangles that don't exist in the new block + add triangles that don't exist in the old block?
+	// Note: cobjs are only removed/added for the modified sub-blocks of each block, but the triangles of the entire block are recreated
+	//       since their vertices and normals are shared across sub-blocks
 	for (unsigned i = 0; i < blocks_to_update.size(); ++i) {
 		something_removed |= clear_block(blocks_to_update[i]);
 	}
@@ -1405,6 +1872,7 @@ void voxel_model::proc_pending_updates(bool postproc_brushes_mode) {
 	for (int i = 0; i < (int)blocks_to_update.size(); ++i) {
 		num_added[i] = (create_block_all_lods(blocks_to_update[i], 0, 0) > 0);
 	}
+	merge_created_blocks_hook(blocks_to_update);
 	for (auto i = num_added.begin(); i != num_added.end(); ++i) {tot_num_added += *i;}
 
 	// Note: this part only needs to be done once per block at the end of the while loop, but in practice is fast anyway
@@ -1422,7 +1890,47 @@ void voxel_model::proc_pending_updates(bool postproc_brushes_mode) {
 	}
 	modified_blocks = next_frame_modified_blocks;
 	next_frame_modified_blocks.clear();
+	modified_sub_blocks = next_frame_modified_sub_blocks;
+	next_frame_modified_sub_blocks.clear();
 	volume_added = 0;
+	if (modified_blocks.empty()) {end_voxel_edits();} // no more updates
+}
+
+
+// applies a sequence of brush strokes that add material at random surface points and reports the latency of each stroke's update
+void voxel_model::benchmark_brush_strokes(unsigned num_strokes, float radius_in_voxels, bool full_updates) {
+
+	if (!has_voxel_data() || tri_data[0].empty()) return; // not built
+	full_block_updates = full_updates;
+	rand_gen_t rgen; // same seed for each call so that the same strokes are applied in both modes
+	float const radius(radius_in_voxels*vsz.x);
+	double tot_time(0.0), max_time(0.0);
+	unsigned num_applied(0), tot_blocks(0), tot_sub_blocks(0);
+
+	for (unsigned n = 0; n < num_strokes; ++n) {
+		unsigned const x(rgen.rand()%nx), y(rgen.rand()%ny);
+		int z(nz-1);
+		while (z >= 0 && is_outside(get_ix(x, y, z))) {--z;} // find the top surface
+		if (z < 0) continue; // no surface in this column
+		high_resolution_clock::time_point const start_time(high_resolution_clock::now());
+		if (!update_voxel_sphere_region(get_pt_at(x, y, z), radius, 1.0, 1, 1)) continue; // no surface change
+		tot_blocks += modified_blocks.size();
+
+		for (auto i = modified_blocks.begin(); i != modified_blocks.end(); ++i) {
+			unsigned const mask(get_modified_sub_blocks(*i));
+			for (unsigned sb = 0; sb < NUM_VOXEL_SUB_BLOCKS; ++sb) {tot_sub_blocks += ((mask >> sb) & 1);}
+		}
+		proc_pending_updates();
+		double const time_ms(duration<double, std::milli>(high_resolution_clock::now() - start_time).count());
+		tot_time += time_ms;
+		max_time  = max(max_time, time_ms);
+		++num_applied;
+	}
+	full_block_updates = 0;
+	cout << "  " << nx << "x" << ny << "x" << nz << (full_updates ? " full blocks: " : " sub-blocks:  ");
+	if (num_applied == 0) {cout << "no strokes applied" << endl; return;}
+	cout << num_applied << " strokes, avg " << tot_time/num_applied << "ms, max " << max_time << "ms, " << float(tot_blocks)/num_applied
+		 << " blocks and " << float(tot_sub_blocks)/num_applied << " of " << NUM_VOXEL_SUB_BLOCKS*float(tot_blocks)/num_applied << " sub-blocks per stroke" << endl;
 }
 
 
@@ -1549,6 +2057,9 @@ void voxel_model::build(bool verbose, bool do_ao_lighting) {
 	for (int block = 0; block < (int)tot_blocks; ++block) {
 		create_block_all_lods(block, 1, 0);
 	}
+	vector<unsigned> all_blocks(tot_blocks);
+	for (unsigned i = 0; i < tot_blocks; ++i) {all_blocks[i] = i;}
+	merge_created_blocks_hook(all_blocks);
 	if (verbose) {PRINT_TIME("  Triangles to Model");}
 
 	if (tot_blocks > 1) { // merge triangle vertices along block seams
@@ -1632,7 +2143,7 @@ void voxel_model_space::calc_shadows(voxel_grid<unsigned char> &shadow_data) con
 			
 			for (unsigned z = 0; z < nz; ++z) {
 				if (z+1 < nz) {shadow_data.set(x, y, z+1, (shadowed ? 0 : 255));} // z offset by 1, before shadowed is updated
-				if ((outside.get(x, y, z) & 3) == 0) {shadowed = 1;} // inside
+				if (!is_outside(get_ix(x, y, z))) {shadowed = 1;} // inside; works for both dense and compressed storage
 			}
 		}
 	}
@@ -1708,7 +2219,7 @@ void voxel_model::core_render(shader_t &s, unsigned lod_level, bool is_shadow_pa
 
 void voxel_model::render(unsigned lod_level, bool is_shadow_pass) { // not const because of vbo caching, etc.
 
-	if (empty()) return; // nothing to do
+	if (!has_voxel_data()) return; // nothing to do
 	pre_render(is_shadow_pass);
 	shader_t s;
 	set_fill_mode();
@@ -1786,6 +2297,13 @@ void voxel_query_tree::bvh_tree_matrix::init(coll_obj_group const *cobjs, unsign
 
 
 void voxel_query_tree::add_cobjs_for_block(vector<unsigned> const &cids, unsigned block_x, unsigned block_y) {
+	build_tree_for_block(cids, block_x, block_y);
+	update_bcube_for_block(block_x, block_y);
+}
+
+
+// may be called in parallel for different blocks
+void voxel_query_tree::build_tree_for_block(vector<unsigned> const &cids, unsigned block_x, unsigned block_y) {
 
 	assert(block_y < tree_matrix.size());
 	assert(block_x < tree_matrix[block_y].size());
@@ -1794,6 +2312,12 @@ void voxel_query_tree::add_cobjs_for_block(vector<unsigned> const &cids, unsigne
 	if (cids.empty()) return; // nothing else to do
 	tree.add_cobj_ids(cids);
 	tree.build_tree_from_cixs(0); // do_mt_build=0
+}
+
+
+void voxel_query_tree::update_bcube_for_block(unsigned block_x, unsigned block_y) {
+
+	assert(block_y < tree_matrix.size());
 	tree_matrix[block_y].update_bcube(block_x); // push the bcube up
 	tree_matrix.update_bcube(block_y); // push the bcube up
 }
@@ -1854,7 +2378,7 @@ void voxel_query_tree::get_coll_sphere_cobjs(point const &center, float radius,
 }
 
 
-void setup_voxel_landscape(voxel_params_t const &params, float default_val) {
+void setup_voxel_model(voxel_model_ground &model, voxel_params_t const &params, float default_val) {
 
 	unsigned const nx((params.xsize > 0) ? params.xsize : MESH_X_SIZE);
 	unsigned const ny((params.ysize > 0) ? params.ysize : MESH_Y_SIZE);
@@ -1866,9 +2390,45 @@ void setup_voxel_landscape(voxel_params_t const &params, float default_val) {
 	float const ysz((2.0*(1.0 - 0.05/MESH_Y_SIZE)*Y_SCENE_SIZE - DY_VAL)/(ny-1));
 	vector3d const vsz(xsz, ysz, (zhi - zlo)/nz);
 	point const center(-0.5f*DX_VAL, -0.5f*DY_VAL, 0.5f*(zlo + zhi));
-	terrain_voxel_model.clear();
-	terrain_voxel_model.set_params(params);
-	terrain_voxel_model.init(nx, ny, nz, vsz, center, default_val, params.num_blocks);
+	model.clear();
+	model.set_params(params);
+	model.init(nx, ny, nz, vsz, center, default_val, params.num_blocks);
+}
+
+void setup_voxel_landscape(voxel_params_t const &params, float default_val) {
+	setup_voxel_model(terrain_voxel_model, params, default_val);
+}
+
+
+void create_procedural_voxel_model(voxel_model_ground &model, voxel_params_t const &params) {
+
+	vector3d const gen_offset(DX_VAL*xoff2, DY_VAL*yoff2, 0.0);
+	model.create_procedural(params.mag, params.freq, gen_offset, params.normalize_to_1, params.geom_rseed, 456+rand_gen_index, mesh_gen_mode);
+}
+
+
+// times voxel brush updates of temporary procedural models of increasing size, with and without sub-block cobj updates
+void benchmark_voxel_brush_latency() {
+
+	unsigned const sizes[3] = {64, 128, 256}, num_strokes = 20;
+	float const brush_radius = 3.0; // in voxels
+	cout << "Voxel brush benchmark for " << num_strokes << " strokes of radius " << brush_radius << " voxels:" << endl;
+
+	for (unsigned s = 0; s < 3; ++s) {
+		voxel_params_t params(global_voxel_params);
+		params.xsize = params.ysize = sizes[s];
+		params.zsize = 0; // auto
+
+		for (unsigned full_updates = 0; full_updates < 2; ++full_updates) {
+			voxel_model_ground model(GROUND_NUM_LOD);
+			setup_voxel_model(model, params, 0.0);
+			create_procedural_voxel_model(model, params);
+			model.build(params.add_cobjs, 0, 0);
+			model.benchmark_brush_strokes(num_strokes, brush_radius, (full_updates != 0));
+			model.clear(); // remove cobjs
+		}
+	}
+	purge_coll_freed(1);
 }
 
 
@@ -1876,9 +2436,7 @@ void gen_voxel_landscape() {
 
 	RESET_TIME;
 	setup_voxel_landscape(global_voxel_params, 0.0);
-	vector3d const gen_offset(DX_VAL*xoff2, DY_VAL*yoff2, 0.0);
-	terrain_voxel_model.create_procedural(global_voxel_params.mag, global_voxel_params.freq, gen_offset,
-		global_voxel_params.normalize_to_1, global_voxel_params.geom_rseed, 456+rand_gen_index, mesh_gen_mode);
+	create_procedural_voxel_model(terrain_voxel_model, global_voxel_params);
 	PRINT_TIME(" Voxel Gen");
 	terrain_voxel_model.build(global_voxel_params.add_cobjs, 0, 1);
 	PRINT_TIME(" Voxels to Triangles/Cobjs");
@@ -1888,6 +2446,8 @@ void gen_voxel_landscape() {
 		terrain_voxel_model.proc_pending_updates(1); // postproc_brushes_mode=1
 		PRINT_TIME(" Apply Voxel Brushes");
 	}
+	if (benchmark_voxel_brush) {benchmark_voxel_brush_latency();}
+	if (sparse_voxel_models) {terrain_voxel_model.compress_voxel_data(voxel_quant_bits);} // edits are applied to the sparse bricks
 }
 
 
@@ -1908,6 +2468,7 @@ bool gen_voxels_from_cobjs(coll_obj_group &cobjs) {
 	PRINT_TIME(" Cobjs Voxel Gen");
 	terrain_voxel_model.build(params.add_cobjs, 1, 1);
 	PRINT_TIME(" Cobjs Voxels to Triangles/Cobjs");
+	if (sparse_voxel_models) {terrain_voxel_model.compress_voxel_data(voxel_quant_bits);}
 	return 1;
 }
 
@@ -1945,7 +2506,9 @@ float gen_voxel_rock(voxel_model &model, point const &center, float radius, unsi
 		model.build(0);
 		if (model.has_filled_at_edges()) continue; // discard and recreate
 		float const gen_radius(model.get_bsphere().radius);
-		if (gen_radius > 0.0) return gen_radius; // nonempty
+		if (gen_radius <= 0.0) continue; // empty
+		if (sparse_voxel_models) {model.compress_voxel_data(voxel_quant_bits);}
+		return gen_radius;
 	}
 	return 0.0; // never gets here
 }
@@ -2127,12 +2690,12 @@ void proc_voxel_updates() {
 }
 
 bool check_voxel_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj, bool exact) {
-	if (terrain_voxel_model.empty()) return 0;
+	if (!terrain_voxel_model.has_voxel_data()) return 0;
 	return terrain_voxel_model.check_coll_line(p1, p2, cpos, cnorm, cindex, ignore_cobj, exact);
 }
 
 void get_voxel_coll_sphere_cobjs(point const &center, float radius, int ignore_cobj, vert_coll_detector &vcd) {
-	if (terrain_voxel_model.empty()) return;
+	if (!terrain_voxel_model.has_voxel_data()) return;
 	terrain_voxel_model.get_coll_sphere_cobjs(center, radius, ignore_cobj, vcd);
 }
 
@@ -10,6 +10,10 @@ struct coll_tquad;
 
 enum {VB_SHAPE_CUBE=0, VB_SHAPE_CONSTANT, VB_SHAPE_LINEAR, VB_SHAPE_QUADRATIC, NUM_VB_SHAPES};
 
+unsigned const VOXEL_SUB_BLOCKS     = 4; // sub-blocks per block in x and y, used for incremental cobj updates
+unsigned const NUM_VOXEL_SUB_BLOCKS = VOXEL_SUB_BLOCKS*VOXEL_SUB_BLOCKS;
+unsigned const ALL_SUB_BLOCKS_MASK  = (1U << NUM_VOXEL_SUB_BLOCKS) - 1;
+
 
 struct voxel_params_t {
 
@@ -108,34 +112,28 @@ public:
 		tree_matrix.init(cobjs, ny, nx);
 	}
 	void add_cobjs_for_block(vector<unsigned> const &cids, unsigned block_x, unsigned block_y);
+	void build_tree_for_block(vector<unsigned> const &cids, unsigned block_x, unsigned block_y);
+	void update_bcube_for_block(unsigned block_x, unsigned block_y);
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj, bool exact) const;
 	void get_coll_sphere_cobjs(point const &center, float radius, int ignore_cobj, vert_coll_detector &vcd) const;
 };
 
 
-// stored internally in yxz order
-template<typename V> class voxel_grid : public vector<V> {
-	void init_grid(unsigned nx_, unsigned ny_, unsigned nz_, V default_val, unsigned num_blocks);
+// voxel grid dimensions and voxel to world space mapping, shared by dense and sparse grids; indexed in yxz order
+class voxel_grid_geom_t {
+protected:
+	void init_dims(unsigned nx_, unsigned ny_, unsigned nz_, unsigned num_blocks);
+	void init_pos(vector3d const &vsz_, point const &center_);
+	void init_pos(cube_t const &bcube);
+	bool read_geom(FILE *fp);
+	bool write_geom(FILE *fp) const;
 public:
 	unsigned nx, ny, nz, xblocks, yblocks;
 	vector3d vsz; // size of a voxel in x,y,z
 	point center, lo_pos;
 
-	using vector<V>::clear;
-	using vector<V>::empty;
-	using vector<V>::size;
-	using vector<V>::at;
-	using vector<V>::operator[];
-	using vector<V>::resize;
-	using vector<V>::begin;
-	using vector<V>::end;
-	using vector<V>::front;
-
-	voxel_grid() : nx(0), ny(0), nz(0), xblocks(0), yblocks(0), vsz(zero_vector) {}
-	void init(unsigned nx_, unsigned ny_, unsigned nz_, vector3d const &vsz_, point const &center_, V const &default_val, unsigned num_blocks=1);
-	void init(unsigned nx_, unsigned ny_, unsigned nz_, cube_t const &bcube, V const &default_val, unsigned num_blocks=1);
-	void init_from_heightmap(float **height, unsigned mesh_nx, unsigned mesh_ny, unsigned zsteps, float mesh_xsize, float mesh_ysize, unsigned num_blocks=1, bool invert=0);
-	void downsample_2x();
+	voxel_grid_geom_t() : nx(0), ny(0), nz(0), xblocks(0), yblocks(0), vsz(zero_vector) {}
+	unsigned get_num_voxels() const {return nx*ny*nz;}
 	bool is_valid_range(int i[3]) const {return (i[0] >= 0 && i[1] >= 0 && i[2] >= 0 && i[0] < (int)nx && i[1] < (int)ny && i[2] < (int)nz);}
 	float get_xv(int x) const {return (x*vsz.x + lo_pos.x);}
 	float get_yv(int y) const {return (y*vsz.y + lo_pos.y);}
@@ -157,10 +155,31 @@ public:
 	}
 	void get_bcube_ix_bounds(cube_t const &bcube, int llc[3], int urc[3]) const;
 	point get_pt_at(unsigned x, unsigned y, unsigned z) const  {return (point(x, y, z)*vsz + lo_pos);}
+	cube_t get_raw_bbox() const {return cube_t(lo_pos, center + (center - lo_pos));}
+};
+
+
+// stored internally in yxz order
+template<typename V> class voxel_grid : public vector<V>, public voxel_grid_geom_t {
+	void init_grid(unsigned nx_, unsigned ny_, unsigned nz_, V default_val, unsigned num_blocks);
+public:
+	using vector<V>::clear;
+	using vector<V>::empty;
+	using vector<V>::size;
+	using vector<V>::at;
+	using vector<V>::operator[];
+	using vector<V>::resize;
+	using vector<V>::begin;
+	using vector<V>::end;
+	using vector<V>::front;
+
+	void init(unsigned nx_, unsigned ny_, unsigned nz_, vector3d const &vsz_, point const &center_, V const &default_val, unsigned num_blocks=1);
+	void init(unsigned nx_, unsigned ny_, unsigned nz_, cube_t const &bcube, V const &default_val, unsigned num_blocks=1);
+	void init_from_heightmap(float **height, unsigned mesh_nx, unsigned mesh_ny, unsigned zsteps, float mesh_xsize, float mesh_ysize, unsigned num_blocks=1, bool invert=0);
+	void downsample_2x();
 	V const &get   (unsigned x, unsigned y, unsigned z) const  {return operator[](get_ix(x, y, z));}
 	V &get_ref     (unsigned x, unsigned y, unsigned z)        {return operator[](get_ix(x, y, z));}
 	void set       (unsigned x, unsigned y, unsigned z, V const &val) {operator[](get_ix(x, y, z)) = val;}
-	cube_t get_raw_bbox() const {return cube_t(lo_pos, center + (center - lo_pos));}
 	bool read(FILE *fp);
 	bool write(FILE *fp) const;
 };
@@ -168,6 +187,65 @@ public:
 typedef voxel_grid<float> float_voxel_grid;
 
 
+// sparse grid of VOXEL_BRICK_SZ^3 bricks; bricks where every voxel has the same value are stored as that single value,
+// and the remaining bricks can optionally be quantized to 8 or 16 bits over the value range of the grid;
+// set() expands only the brick it writes to into full precision edit data, which end_edits() merges or re-quantizes
+unsigned const VOXEL_BRICK_SZ = 8;
+
+template<typename V> class sparse_voxel_grid : public voxel_grid_geom_t {
+
+	static unsigned const UNIFORM_BRICK = ~0U;
+	static unsigned const BRICK_VOXELS  = VOXEL_BRICK_SZ*VOXEL_BRICK_SZ*VOXEL_BRICK_SZ;
+
+	struct brick_t {
+		V uniform_val; // value of every voxel in this brick if data_ix == UNIFORM_BRICK
+		unsigned data_ix; // offset of the first voxel in data (or qdata for quantized grids)
+		brick_t() : uniform_val(), data_ix(UNIFORM_BRICK) {}
+	};
+	unsigned nbx, nby, nbz, quant_bits; // quant_bits: 0 (full precision), 8, or 16
+	float qmin, qscale; // quantized value = (val - qmin)*qscale
+	vector<brick_t> bricks;
+	vector<V> data; // full precision voxel values of non-uniform bricks
+	vector<unsigned char> qdata; // quantized voxel values of non-uniform bricks, quant_bits/8 bytes each
+	vector<unsigned> free_data; // data_ix of bricks that became uniform, reused by alloc_brick_data()
+	vector<unsigned> edit_ix; // per brick offset into edit_data, or UNIFORM_BRICK if not being edited; empty if there are no edits
+	vector<unsigned> edited; // bricks in edit_data
+	vector<V> edit_data; // full precision voxel values of the bricks written by set() since the last end_edits()
+
+	unsigned get_brick_ix(unsigned bx, unsigned by, unsigned bz) const {return (bz + (bx + by*nbx)*nbz);}
+	static unsigned get_brick_offset(unsigned x, unsigned y, unsigned z) {
+		return ((z%VOXEL_BRICK_SZ) + ((x%VOXEL_BRICK_SZ) + (y%VOXEL_BRICK_SZ)*VOXEL_BRICK_SZ)*VOXEL_BRICK_SZ);
+	}
+	V load_val(unsigned pos) const;
+	void store_val(unsigned pos, V const &val);
+	void alloc_brick_data(brick_t &brick);
+	void init_bricks();
+	void clear_edits();
+	template<typename F> void build_bricks(F const &get_val, bool calc_quant_range);
+public:
+	sparse_voxel_grid() : nbx(0), nby(0), nbz(0), quant_bits(0), qmin(0.0), qscale(1.0) {}
+	void clear();
+	bool empty() const {return bricks.empty();}
+	unsigned get_quant_bits() const {return quant_bits;}
+	bool has_edits() const {return !edited.empty();}
+	size_t get_mem_usage() const {
+		return (bricks.capacity()*sizeof(brick_t) + data.capacity()*sizeof(V) + qdata.capacity() +
+			edit_data.capacity()*sizeof(V) + (edit_ix.capacity() + edited.capacity() + free_data.capacity())*sizeof(unsigned));
+	}
+	unsigned count_uniform_bricks() const;
+	void compress_from(voxel_grid<V> const &grid, unsigned quant_bits_=0);
+	void expand_to(voxel_grid<V> &grid) const;
+	V get(unsigned x, unsigned y, unsigned z) const;
+	V get(unsigned ix) const {unsigned const xy(ix/nz), x(xy%nx); return get(x, xy/nx, ix - xy*nz);}
+	void set(unsigned x, unsigned y, unsigned z, V const &val);
+	void set(unsigned ix, V const &val) {unsigned const xy(ix/nz), x(xy%nx); set(x, xy/nx, ix - xy*nz, val);}
+	void end_edits();
+	void downsample_2x();
+	bool read(FILE *fp);
+	bool write(FILE *fp) const;
+};
+
+
 class voxel_manager : public float_voxel_grid {
 
 protected:
@@ -175,6 +253,11 @@ protected:
 	voxel_params_t params;
 	voxel_grid<unsigned char> outside;
 	vector<unsigned> temp_work; // used in remove_unconnected_outside_range()/flood_fill()
+	// compressed voxel values and outside flags, used in place of the dense grids (which are freed) when sparse_storage is set
+	bool sparse_storage;
+	unsigned sparse_quant_bits;
+	sparse_voxel_grid<float> sparse_vals;
+	sparse_voxel_grid<unsigned char> sparse_outside;
 	typedef vert_norm vertex_type_t;
 	typedef vntc_vect_block_t<vertex_type_t> tri_data_t;
 	typedef vertex_map_t<vertex_type_t> vertex_map_type_t;
@@ -204,7 +287,7 @@ protected:
 	void make_voxel_inside(unsigned ix);
 
 public:
-	voxel_manager(bool use_mesh_=0) : use_mesh(use_mesh_) {}
+	voxel_manager(bool use_mesh_=0) : use_mesh(use_mesh_), sparse_storage(0), sparse_quant_bits(0) {}
 	void set_params(voxel_params_t const &p) {params = p;}
 	void clear();
 	void create_procedural(float mag, float freq, vector3d const &offset, bool normalize_to_1, int rseed1, int rseed2, int gen_mode);
@@ -215,7 +298,21 @@ public:
 	void determine_voxels_outside();
 	void remove_unconnected_outside();
 	void remove_interior_holes();
-	bool is_outside(unsigned ix) const {assert(ix < outside.size()); return((outside[ix]&3) != 0);}
+	// voxel value and outside flag accessors that work for both dense and compressed storage
+	float get_val(unsigned ix) const {return (is_compressed() ? sparse_vals.get(ix) : operator[](ix));}
+	void set_val(unsigned ix, float val) {if (is_compressed()) {sparse_vals.set(ix, val);} else {operator[](ix) = val;}}
+	unsigned char get_outside(unsigned ix) const {
+		if (outside.empty()) {return sparse_outside.get(ix);} // compressed
+		assert(ix < outside.size()); return outside[ix];
+	}
+	void set_outside(unsigned ix, unsigned char val) {if (outside.empty()) {sparse_outside.set(ix, val);} else {outside[ix] = val;}}
+	bool is_outside(unsigned ix) const {return ((get_outside(ix)&3) != 0);}
+	bool has_outside_data() const {return (!outside.empty() || !sparse_outside.empty());}
+	bool is_compressed() const {return !sparse_vals.empty();}
+	bool has_voxel_data() const {return (!empty() || is_compressed());} // use in place of empty(), which is true when compressed
+	void compress_voxel_data(unsigned quant_bits);
+	void expand_voxel_data();
+	void end_voxel_edits();
 	bool point_inside_volume(point const &pos) const;
 	bool point_intersect(point const &center, point *int_pt) const;
 	bool sphere_intersect(point const &center, float radius, point *int_pt) const;
@@ -247,7 +344,10 @@ protected:
 	bool volume_added;
 	vector<tri_data_t> tri_data; // one per LOD level
 	noise_texture_manager_t *noise_tex_gen;
+	bool full_block_updates; // ignore sub-block tracking and always rebuild entire blocks; used for benchmarking
 	std::set<unsigned> modified_blocks, next_frame_modified_blocks;
+	typedef map<unsigned, unsigned> sub_block_mask_map_t; // block_ix => mask of modified sub-blocks; modified blocks not in the map are fully modified
+	sub_block_mask_map_t modified_sub_blocks, next_frame_modified_sub_blocks;
 	voxel_grid<unsigned char> ao_lighting;
 
 	struct step_dir_t {
@@ -282,6 +382,8 @@ protected:
 
 	void remove_unconnected_outside_modified_blocks(bool postproc_brushes_mode);
 	unsigned get_block_ix(unsigned voxel_ix) const;
+	void mark_column_modified(unsigned x, unsigned y, std::set<unsigned> &blocks, sub_block_mask_map_t &sub_blocks) const;
+	unsigned get_modified_sub_blocks(unsigned block_ix) const;
 	virtual bool clear_block(unsigned block_ix);
 	unsigned create_block(voxel_ix_cache &vix_cache, unsigned block_ix, bool first_create, bool count_only, unsigned lod_level);
 	unsigned create_block_all_lods(unsigned block_ix, bool first_create, bool count_only);
@@ -292,7 +394,8 @@ protected:
 	void calc_ao_lighting();
 
 	virtual void maybe_create_fragments(point const &center, float radius, int shooter, unsigned num_fragments, bool directly_from_update) const {} // do nothing
-	virtual void create_block_hook(unsigned block_ix) {}
+	virtual void create_block_hook(unsigned block_ix, unsigned const sub_block_ends[NUM_VOXEL_SUB_BLOCKS]) {}
+	virtual void merge_created_blocks_hook(vector<unsigned> const &blocks) {}
 	virtual void update_blocks_hook(vector<unsigned> const &blocks_to_update, unsigned num_added) {}
 	virtual void pre_build_hook() {}
 	virtual void pre_render(bool is_shadow_pass) {}
@@ -319,6 +422,7 @@ public:
 	bool from_file(string const &fn);
 	bool to_file(string const &fn) const;
 	bool has_modified_blocks() const {return !modified_blocks.empty();}
+	void benchmark_brush_strokes(unsigned num_strokes, float radius, bool full_updates);
 };
 
 
@@ -328,16 +432,25 @@ class voxel_model_ground : public voxel_model {
 	noise_texture_manager_t private_ntg;
 	voxel_query_tree cobj_tree;
 
+	struct staged_cobj_t { // polygon created in parallel and added to coll_objects later
+		point pts[4];
+		vector3d normal;
+		unsigned char npts, sub_block, cp_ix;
+	};
+
 	struct data_block_t {
 		vector<unsigned> cids; // references into coll_objects
+		vector<unsigned> sub_block_cids[NUM_VOXEL_SUB_BLOCKS];
+		vector<staged_cobj_t> staged; // written by the thread creating this block, consumed in merge_created_blocks_hook()
 		//unsigned tri_data_ix;
-		void clear() {cids.clear();}
+		void clear() {cids.clear(); staged.clear(); for (unsigned i = 0; i < NUM_VOXEL_SUB_BLOCKS; ++i) {sub_block_cids[i].clear();}}
 	};
 	vector<data_block_t> data_blocks;
 
 	virtual bool clear_block(unsigned block_ix);
 	virtual void maybe_create_fragments(point const &center, float radius, int shooter, unsigned num_fragments, bool directly_from_update) const;
-	virtual void create_block_hook(unsigned block_ix);
+	virtual void create_block_hook(unsigned block_ix, unsigned const sub_block_ends[NUM_VOXEL_SUB_BLOCKS]);
+	virtual void merge_created_blocks_hook(vector<unsigned> const &blocks);
 	virtual void update_blocks_hook(vector<unsigned> const &blocks_to_update, unsigned num_added);
 	virtual void pre_build_hook();
 